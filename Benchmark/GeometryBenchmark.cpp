@@ -1,5 +1,12 @@
 #include "PCH.h"
 #include "../Core/Math/Geometry.h"
+#include "../Core/Math/Simd8Geometry.h"
+#include "../Core/Mesh/Mesh.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Rendering/ShadingData.h"
+#include "../Core/Traversal/TraversalContext.h"
+#include "../Core/Traversal/Traversal_Single.h"
 #include "../Core/Math/Random.h"
 #include "../Core/Math/SamplingHelpers.h"
 
@@ -8,6 +15,65 @@
 using namespace rt;
 using namespace math;
 
+namespace {
+
+// set-associative cache with LRU replacement policy, counts misses of simulated memory accesses
+class SimulatedCache
+{
+public:
+    SimulatedCache(Uint32 size, Uint32 numWays)
+        : mNumWays(numWays)
+        , mNumSets(size / (RT_CACHE_LINE_SIZE * numWays))
+        , mLines(mNumSets * numWays, UINT64_MAX)
+        , mLastUse(mNumSets * numWays, 0)
+        , mTime(0)
+        , mNumAccesses(0)
+        , mNumMisses(0)
+    { }
+
+    void Access(size_t address)
+    {
+        const Uint64 line = address / RT_CACHE_LINE_SIZE;
+        const size_t firstWay = (line % mNumSets) * mNumWays;
+
+        mNumAccesses++;
+        mTime++;
+
+        size_t leastRecentlyUsed = firstWay;
+        for (size_t i = firstWay; i < firstWay + mNumWays; ++i)
+        {
+            if (mLines[i] == line)
+            {
+                mLastUse[i] = mTime;
+                return;
+            }
+
+            if (mLastUse[i] < mLastUse[leastRecentlyUsed])
+            {
+                leastRecentlyUsed = i;
+            }
+        }
+
+        mNumMisses++;
+        mLines[leastRecentlyUsed] = line;
+        mLastUse[leastRecentlyUsed] = mTime;
+    }
+
+    Uint64 GetNumAccesses() const { return mNumAccesses; }
+    Uint64 GetNumMisses() const { return mNumMisses; }
+
+private:
+    size_t mNumWays;
+    size_t mNumSets;
+    std::vector<Uint64> mLines;
+    std::vector<Uint64> mLastUse;
+    Uint64 mTime;
+    Uint64 mNumAccesses;
+    Uint64 mNumMisses;
+};
+
+} // namespace
+
 static void Benchmark_Geometry_BuildOrthonormalBasis(benchmark::State& state)
 {
     Random random;
@@ -71,3 +137,310 @@ static void Benchmark_Geometry_RayTriIntersection(benchmark::State& state)
     printf("%f", tmin);
 }
 BENCHMARK(Benchmark_Geometry_RayTriIntersection);
+
+// single ray vs. 8 triangles (watertight, triangles in SoA layout)
+static void Benchmark_Geometry_RayTriIntersection_Watertight_Simd8(benchmark::State& state)
+{
+    Random random;
+
+    const Uint32 numRays = 1024;
+    std::vector<Ray> rays;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        rays.push_back(Ray(random.GetVector4(), random.GetVector4()));
+    }
+
+    const Uint32 numTriangles = 1024;
+    std::vector<TriangleVertices_Simd8> triangles(numTriangles / 8);
+    for (TriangleVertices_Simd8& tri : triangles)
+    {
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            const Vector4 v0 = random.GetVector4();
+            const Vector4 v1 = random.GetVector4();
+            const Vector4 v2 = random.GetVector4();
+            tri.v0.x[i] = v0.x; tri.v0.y[i] = v0.y; tri.v0.z[i] = v0.z;
+            tri.v1.x[i] = v1.x; tri.v1.y[i] = v1.y; tri.v1.z[i] = v1.z;
+            tri.v2.x[i] = v2.x; tri.v2.y[i] = v2.y; tri.v2.z[i] = v2.z;
+        }
+    }
+
+    Uint32 i = 0;
+    Vector8 tmin = VECTOR8_MAX;
+    for (auto _ : state)
+    {
+        const Uint32 rayIndex = i % numRays;
+        const Uint32 triIndex = (i / numRays) % triangles.size();
+
+        Vector8 u, v, t;
+        const VectorBool8 mask = Intersect_TriangleRay_Watertight_Simd8(WatertightRay_Simd8(rays[rayIndex]), triangles[triIndex], tmin, u, v, t);
+        tmin = Vector8::Select(tmin, t, mask);
+
+        i++;
+    }
+    benchmark::DoNotOptimize(tmin);
+
+    state.SetItemsProcessed(state.iterations() * 8);
+}
+BENCHMARK(Benchmark_Geometry_RayTriIntersection_Watertight_Simd8);
+
+// single ray traversal of a mesh (random triangle soup)
+// argument: max number of triangles in a BVH leaf (see MeshDesc::bvhMaxLeafSize)
+static void Benchmark_Geometry_MeshTraversal_LeafSize(benchmark::State& state)
+{
+    const Uint32 numTriangles = 100000;
+    const Uint32 numRays = 16 * 1024;
+
+    Random random;
+
+    std::vector<Float3> positions;
+    std::vector<Float3> normals;
+    std::vector<Float3> tangents;
+    std::vector<Uint32> indices;
+    std::vector<Uint32> materialIndices;
+    for (Uint32 i = 0; i < numTriangles; ++i)
+    {
+        const Vector4 center = random.GetVector4() * 100.0f;
+        for (Uint32 j = 0; j < 3; ++j)
+        {
+            indices.push_back(static_cast<Uint32>(positions.size()));
+            positions.push_back((center + random.GetVector4() * 2.0f).ToFloat3());
+            normals.push_back(Float3(0.0f, 0.0f, 1.0f));
+            tangents.push_back(Float3(1.0f, 0.0f, 0.0f));
+        }
+        materialIndices.push_back(UINT32_MAX);
+    }
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = numTriangles;
+    desc.vertexBufferDesc.numVertices = static_cast<Uint32>(positions.size());
+    desc.vertexBufferDesc.positions = positions.data();
+    desc.vertexBufferDesc.normals = normals.data();
+    desc.vertexBufferDesc.tangents = tangents.data();
+    desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+    desc.bvhMaxLeafSize = static_cast<Uint32>(state.range(0));
+
+    Mesh mesh;
+    mesh.Initialize(desc);
+
+    std::vector<Ray> rays;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        const Vector4 origin = random.GetVector4() * 100.0f;
+        rays.push_back(Ray(origin, SamplingHelpers::GetSphere(random.GetFloat2())));
+    }
+
+    auto context = std::make_unique<RenderingContext>();
+
+    for (auto _ : state)
+    {
+        for (const Ray& ray : rays)
+        {
+            HitPoint hitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, *context }, 0, &mesh);
+            benchmark::DoNotOptimize(hitPoint);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * rays.size());
+}
+BENCHMARK(Benchmark_Geometry_MeshTraversal_LeafSize)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond);
+
+// shading data evaluation at random hit points of a big mesh (vertices are shared and stored in random order)
+// argument: use flat shading data (see MeshDesc::flatShadingData)
+static void Benchmark_Geometry_MeshShadingData(benchmark::State& state)
+{
+    const Uint32 numVertices = 1024 * 1024;
+    const Uint32 numTriangles = 2 * numVertices;
+    const Uint32 numHitPoints = 64 * 1024;
+
+    Random random;
+
+    std::vector<Float3> positions;
+    std::vector<Float3> normals;
+    std::vector<Float3> tangents;
+    std::vector<Float2> texCoords;
+    for (Uint32 i = 0; i < numVertices; ++i)
+    {
+        const Vector4 normal = SamplingHelpers::GetSphere(random.GetFloat2());
+        positions.push_back((random.GetVector4() * 100.0f).ToFloat3());
+        normals.push_back(normal.ToFloat3());
+        tangents.push_back(Vector4::Cross3(normal, SamplingHelpers::GetSphere(random.GetFloat2())).Normalized3().ToFloat3());
+        texCoords.push_back(random.GetFloat2());
+    }
+
+    std::vector<Uint32> indices;
+    std::vector<Uint32> materialIndices;
+    for (Uint32 i = 0; i < numTriangles; ++i)
+    {
+        for (Uint32 j = 0; j < 3; ++j)
+        {
+            indices.push_back(random.GetInt() % numVertices);
+        }
+        materialIndices.push_back(UINT32_MAX);
+    }
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = numTriangles;
+    desc.vertexBufferDesc.numVertices = numVertices;
+    desc.vertexBufferDesc.positions = positions.data();
+    desc.vertexBufferDesc.normals = normals.data();
+    desc.vertexBufferDesc.tangents = tangents.data();
+    desc.vertexBufferDesc.texCoords = texCoords.data();
+    desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+    desc.flatShadingData = state.range(0) != 0;
+
+    Mesh mesh;
+    mesh.Initialize(desc);
+
+    std::vector<HitPoint> hitPoints;
+    for (Uint32 i = 0; i < numHitPoints; ++i)
+    {
+        const Float2 uv = random.GetFloat2();
+
+        HitPoint hitPoint;
+        hitPoint.distance = 1.0f;
+        hitPoint.objectId = 0;
+        hitPoint.subObjectId = random.GetInt() % numTriangles;
+        hitPoint.u = uv.x * 0.5f;
+        hitPoint.v = uv.y * 0.5f;
+        hitPoints.push_back(hitPoint);
+    }
+
+    for (auto _ : state)
+    {
+        for (const HitPoint& hitPoint : hitPoints)
+        {
+            ShadingData shadingData;
+            mesh.EvaluateShadingData_Single(hitPoint, shadingData, nullptr);
+            benchmark::DoNotOptimize(shadingData);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * hitPoints.size());
+}
+BENCHMARK(Benchmark_Geometry_MeshShadingData)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// shading data fetches of coherent hits on a mesh with vertices stored in random order
+// Misses of simulated 32 KB L1 and 1 MB L2 caches are reported per hit point.
+// argument: renumber vertices in order of first use (see MeshDesc::reorderVertices)
+static void Benchmark_Geometry_MeshVertexLocality(benchmark::State& state)
+{
+    const Uint32 gridSize = 1024;
+    const Uint32 numVertices = gridSize * gridSize;
+    const Uint32 regionSize = 256;
+    const Uint32 tileSize = 16;
+
+    Random random;
+
+    std::vector<Uint32> shuffledIndices(numVertices);
+    for (Uint32 i = 0; i < numVertices; ++i)
+    {
+        shuffledIndices[i] = i;
+    }
+    for (Uint32 i = numVertices - 1; i > 0; --i)
+    {
+        std::swap(shuffledIndices[i], shuffledIndices[random.GetInt() % (i + 1)]);
+    }
+
+    std::vector<Float3> positions(numVertices);
+    std::vector<Float3> normals(numVertices, Float3(0.0f, 0.0f, 1.0f));
+    std::vector<Float3> tangents(numVertices, Float3(1.0f, 0.0f, 0.0f));
+    std::vector<Float2> texCoords(numVertices);
+    for (Uint32 y = 0; y < gridSize; ++y)
+    {
+        for (Uint32 x = 0; x < gridSize; ++x)
+        {
+            const Uint32 index = shuffledIndices[y * gridSize + x];
+            positions[index] = Float3(static_cast<float>(x), static_cast<float>(y), random.GetFloat());
+            texCoords[index] = Float2(static_cast<float>(x), static_cast<float>(y)) / static_cast<float>(gridSize);
+        }
+    }
+
+    std::vector<Uint32> indices;
+    std::vector<Uint32> materialIndices;
+    for (Uint32 y = 0; y + 1 < gridSize; ++y)
+    {
+        for (Uint32 x = 0; x + 1 < gridSize; ++x)
+        {
+            const Uint32 i00 = shuffledIndices[y * gridSize + x];
+            const Uint32 i10 = shuffledIndices[y * gridSize + x + 1];
+            const Uint32 i01 = shuffledIndices[(y + 1) * gridSize + x];
+            const Uint32 i11 = shuffledIndices[(y + 1) * gridSize + x + 1];
+            indices.insert(indices.end(), { i00, i10, i11, i00, i11, i01 });
+            materialIndices.insert(materialIndices.end(), { UINT32_MAX, UINT32_MAX });
+        }
+    }
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = static_cast<Uint32>(materialIndices.size());
+    desc.vertexBufferDesc.numVertices = numVertices;
+    desc.vertexBufferDesc.positions = positions.data();
+    desc.vertexBufferDesc.normals = normals.data();
+    desc.vertexBufferDesc.tangents = tangents.data();
+    desc.vertexBufferDesc.texCoords = texCoords.data();
+    desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+    desc.reorderVertices = state.range(0) != 0;
+
+    Mesh mesh;
+    mesh.Initialize(desc);
+
+    // one ray per grid cell of a region, in the same order as the renderer (scanline order within tiles)
+    std::vector<HitPoint> hitPoints;
+    {
+        auto context = std::make_unique<RenderingContext>();
+        const Vector4 rayDir = Vector4(0.01f, 0.02f, -1.0f, 0.0f).Normalized3();
+        for (Uint32 tileY = 0; tileY < regionSize; tileY += tileSize)
+        {
+            for (Uint32 tileX = 0; tileX < regionSize; tileX += tileSize)
+            {
+                for (Uint32 y = tileY; y < tileY + tileSize; ++y)
+                {
+                    for (Uint32 x = tileX; x < tileX + tileSize; ++x)
+                    {
+                        const Vector4 origin(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, 10.0f, 0.0f);
+
+                        HitPoint hitPoint;
+                        GenericTraverse_Single(SingleTraversalContext{ Ray(origin, rayDir), hitPoint, *context }, 0, &mesh);
+                        if (hitPoint.distance < FLT_MAX)
+                        {
+                            hitPoints.push_back(hitPoint);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // count cache misses of vertex shading data fetches
+    SimulatedCache l1Cache(32 * 1024, 8);
+    SimulatedCache l2Cache(1024 * 1024, 16);
+    for (const HitPoint& hitPoint : hitPoints)
+    {
+        VertexIndices vertexIndices;
+        mesh.GetVertexBuffer().GetVertexIndices(hitPoint.subObjectId, vertexIndices);
+        for (const Uint32 index : { vertexIndices.i0, vertexIndices.i1, vertexIndices.i2 })
+        {
+            l1Cache.Access(sizeof(VertexShadingData) * index);
+            l2Cache.Access(sizeof(VertexShadingData) * index);
+        }
+    }
+
+    for (auto _ : state)
+    {
+        for (const HitPoint& hitPoint : hitPoints)
+        {
+            ShadingData shadingData;
+            mesh.EvaluateShadingData_Single(hitPoint, shadingData, nullptr);
+            benchmark::DoNotOptimize(shadingData);
+        }
+    }
+
+    state.counters["L1 misses/hit"] = static_cast<double>(l1Cache.GetNumMisses()) / static_cast<double>(hitPoints.size());
+    state.counters["L2 misses/hit"] = static_cast<double>(l2Cache.GetNumMisses()) / static_cast<double>(hitPoints.size());
+    state.SetItemsProcessed(state.iterations() * hitPoints.size());
+}
+BENCHMARK(Benchmark_Geometry_MeshVertexLocality)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
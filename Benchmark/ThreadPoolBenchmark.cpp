@@ -0,0 +1,74 @@
+#include "PCH.h"
+#include "../Core/Utils/ThreadPool.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace rt;
+
+namespace {
+
+const Uint32 NumDispatchesPerIteration = 100;
+
+} // namespace
+
+// measures scheduling overhead: tasks are (almost) empty, so the time is spent on dispatching them
+static void Benchmark_ThreadPool_Dispatch(benchmark::State& state)
+{
+    ThreadPool threadPool;
+    const Uint32 numTasks = static_cast<Uint32>(state.range(0));
+
+    std::atomic<Uint32> dummy(0);
+    const auto task = [&dummy](Uint32 taskID, Uint32)
+    {
+        if (taskID == 0)
+        {
+            dummy++;
+        }
+    };
+
+    for (auto _ : state)
+    {
+        for (Uint32 i = 0; i < NumDispatchesPerIteration; ++i)
+        {
+            threadPool.RunParallelTask(task, numTasks);
+        }
+    }
+
+    benchmark::DoNotOptimize(dummy.load());
+    state.SetItemsProcessed(state.iterations() * NumDispatchesPerIteration * numTasks);
+}
+BENCHMARK(Benchmark_ThreadPool_Dispatch)->Arg(1)->Arg(64)->Arg(1024)->Arg(64 * 1024)->Unit(benchmark::kMicrosecond);
+
+// each task of the outer job spawns a nested job (like recursive subtree building)
+static void Benchmark_ThreadPool_Nested(benchmark::State& state)
+{
+    ThreadPool threadPool;
+    const Uint32 numOuterTasks = threadPool.GetNumThreads();
+    const Uint32 numInnerTasks = static_cast<Uint32>(state.range(0));
+
+    std::atomic<Uint32> dummy(0);
+    const auto innerTask = [&dummy](Uint32 taskID, Uint32)
+    {
+        if (taskID == 0)
+        {
+            dummy++;
+        }
+    };
+
+    const auto outerTask = [&](Uint32, Uint32)
+    {
+        threadPool.RunParallelTask(innerTask, numInnerTasks);
+    };
+
+    for (auto _ : state)
+    {
+        for (Uint32 i = 0; i < NumDispatchesPerIteration; ++i)
+        {
+            threadPool.RunParallelTask(outerTask, numOuterTasks);
+        }
+    }
+
+    benchmark::DoNotOptimize(dummy.load());
+    state.SetItemsProcessed(state.iterations() * NumDispatchesPerIteration * numOuterTasks * numInnerTasks);
+}
+BENCHMARK(Benchmark_ThreadPool_Nested)->Arg(64)->Arg(1024)->Unit(benchmark::kMicrosecond);
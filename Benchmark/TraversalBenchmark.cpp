@@ -0,0 +1,349 @@
+#include "PCH.h"
+#include "../Core/Mesh/Mesh.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Object/SceneObject_Mesh.h"
+#include "../Core/Scene/Object/SceneObject_Sphere.h"
+#include "../Core/Scene/Object/SceneObject_SphereCloud.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Traversal/TraversalContext.h"
+#include "../Core/Math/Random.h"
+#include "../Core/Math/SamplingHelpers.h"
+#include "../Core/Utils/ThreadPool.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace rt;
+using namespace math;
+
+namespace {
+
+// scene made of random triangles and a set of incoherent secondary rays (diffuse bounces of camera rays)
+class SecondaryRaysScene
+{
+public:
+    static const SecondaryRaysScene& Get()
+    {
+        static SecondaryRaysScene instance;
+        return instance;
+    }
+
+    Scene scene;
+    std::vector<Ray> rays;
+
+private:
+    SecondaryRaysScene()
+    {
+        const Uint32 numTriangles = 100000;
+        const Uint32 numRays = 64 * 1024;
+
+        Random random;
+
+        std::vector<Float3> positions;
+        std::vector<Float3> normals;
+        std::vector<Float3> tangents;
+        std::vector<Uint32> indices;
+        std::vector<Uint32> materialIndices;
+        for (Uint32 i = 0; i < numTriangles; ++i)
+        {
+            const Vector4 center = random.GetVector4() * 100.0f;
+            for (Uint32 j = 0; j < 3; ++j)
+            {
+                indices.push_back(static_cast<Uint32>(positions.size()));
+                positions.push_back((center + random.GetVector4() * 2.0f).ToFloat3());
+                normals.push_back(Float3(0.0f, 0.0f, 1.0f));
+                tangents.push_back(Float3(1.0f, 0.0f, 0.0f));
+            }
+            materialIndices.push_back(UINT32_MAX);
+        }
+
+        MeshDesc desc;
+        desc.vertexBufferDesc.numTriangles = numTriangles;
+        desc.vertexBufferDesc.numVertices = static_cast<Uint32>(positions.size());
+        desc.vertexBufferDesc.positions = positions.data();
+        desc.vertexBufferDesc.normals = normals.data();
+        desc.vertexBufferDesc.tangents = tangents.data();
+        desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+        desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+
+        auto mesh = std::make_shared<Mesh>();
+        mesh->Initialize(desc);
+        scene.AddObject(std::make_unique<MeshSceneObject>(mesh));
+        scene.BuildBVH();
+
+        // shoot camera rays and spawn random bounces at hit points
+        auto context = std::make_unique<RenderingContext>();
+        const Vector4 cameraPosition(50.0f, 50.0f, -100.0f, 0.0f);
+        while (rays.size() < numRays)
+        {
+            const Vector4 target = random.GetVector4() * 100.0f;
+            const Ray cameraRay(cameraPosition, (target - cameraPosition).Normalized3());
+
+            HitPoint hitPoint;
+            scene.Traverse_Single({ cameraRay, hitPoint, *context });
+            if (hitPoint.distance < FLT_MAX)
+            {
+                const Vector4 origin = cameraRay.GetAtDistance(hitPoint.distance * 0.9999f);
+                rays.push_back(Ray(origin, SamplingHelpers::GetSphere(random.GetFloat2())));
+            }
+        }
+    }
+};
+
+} // namespace
+
+static void Benchmark_Traversal_Secondary_Single(benchmark::State& state)
+{
+    const SecondaryRaysScene& data = SecondaryRaysScene::Get();
+    auto context = std::make_unique<RenderingContext>();
+
+    for (auto _ : state)
+    {
+        for (const Ray& ray : data.rays)
+        {
+            HitPoint hitPoint;
+            data.scene.Traverse_Single({ ray, hitPoint, *context });
+            benchmark::DoNotOptimize(hitPoint);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * data.rays.size());
+}
+BENCHMARK(Benchmark_Traversal_Secondary_Single)->Unit(benchmark::kMillisecond);
+
+// argument: sort rays by direction octant
+static void Benchmark_Traversal_Secondary_Packet(benchmark::State& state)
+{
+    const SecondaryRaysScene& data = SecondaryRaysScene::Get();
+    auto context = std::make_unique<RenderingContext>();
+    RayPacket& packet = context->rayPacket;
+
+    const bool sortByOctant = state.range(0) != 0;
+
+    for (auto _ : state)
+    {
+        for (size_t firstRay = 0; firstRay < data.rays.size(); firstRay += MaxRayPacketSize)
+        {
+            const size_t numRays = std::min<size_t>(MaxRayPacketSize, data.rays.size() - firstRay);
+
+            packet.Clear();
+            for (size_t i = 0; i < numRays; ++i)
+            {
+                packet.PushRay(data.rays[firstRay + i], Vector4(1.0f), ImageLocationInfo());
+            }
+
+            if (sortByOctant)
+            {
+                packet.SortByOctant();
+            }
+
+            data.scene.Traverse_Packet({ packet, *context });
+            benchmark::DoNotOptimize(context->hitPoints[0]);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * data.rays.size());
+}
+BENCHMARK(Benchmark_Traversal_Secondary_Packet)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+static void Benchmark_Traversal_Shadow_Single(benchmark::State& state)
+{
+    const SecondaryRaysScene& data = SecondaryRaysScene::Get();
+    auto context = std::make_unique<RenderingContext>();
+
+    const float shadowRayDistance = 20.0f;
+
+    for (auto _ : state)
+    {
+        for (const Ray& ray : data.rays)
+        {
+            HitPoint hitPoint;
+            hitPoint.distance = shadowRayDistance;
+            benchmark::DoNotOptimize(data.scene.Traverse_Shadow_Single({ ray, hitPoint, *context }));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * data.rays.size());
+}
+BENCHMARK(Benchmark_Traversal_Shadow_Single)->Unit(benchmark::kMillisecond);
+
+// argument: number of shadow rays in a packet
+static void Benchmark_Traversal_Shadow_Packet(benchmark::State& state)
+{
+    const SecondaryRaysScene& data = SecondaryRaysScene::Get();
+    auto context = std::make_unique<RenderingContext>();
+    RayPacket& packet = context->shadowRayPacket;
+
+    const float shadowRayDistance = 20.0f;
+    const size_t packetSize = static_cast<size_t>(state.range(0));
+
+    for (auto _ : state)
+    {
+        for (size_t firstRay = 0; firstRay < data.rays.size(); firstRay += packetSize)
+        {
+            const size_t numRays = std::min<size_t>(packetSize, data.rays.size() - firstRay);
+
+            packet.Clear();
+            for (size_t i = 0; i < numRays; ++i)
+            {
+                packet.PushRay(data.rays[firstRay + i], Vector4(1.0f), ImageLocationInfo(), shadowRayDistance);
+            }
+
+            benchmark::DoNotOptimize(data.scene.Traverse_Shadow_Packet({ packet, *context }));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * data.rays.size());
+}
+BENCHMARK(Benchmark_Traversal_Shadow_Packet)->Arg(64)->Arg(MaxRayPacketSize)->Unit(benchmark::kMillisecond);
+
+// top-level traversal overhead: many small primitive objects
+// argument: number of objects
+static void Benchmark_Traversal_ManyObjects_Single(benchmark::State& state)
+{
+    const Uint32 numObjects = static_cast<Uint32>(state.range(0));
+    const Uint32 numRays = 64 * 1024;
+
+    Random random;
+
+    Scene scene;
+    for (Uint32 i = 0; i < numObjects; ++i)
+    {
+        auto object = std::make_unique<SphereSceneObject>(0.5f);
+        object->SetTransform(Matrix4::MakeTranslation(random.GetVector4() * 100.0f));
+        object->SetDefaultMaterial(nullptr);
+        scene.AddObject(std::move(object));
+    }
+    scene.BuildBVH();
+
+    std::vector<Ray> rays;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        rays.push_back(Ray(random.GetVector4() * 100.0f, SamplingHelpers::GetSphere(random.GetFloat2())));
+    }
+
+    auto context = std::make_unique<RenderingContext>();
+
+    for (auto _ : state)
+    {
+        for (const Ray& ray : rays)
+        {
+            HitPoint hitPoint;
+            scene.Traverse_Single({ ray, hitPoint, *context });
+            benchmark::DoNotOptimize(hitPoint);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * rays.size());
+}
+BENCHMARK(Benchmark_Traversal_ManyObjects_Single)->Arg(1 << 10)->Arg(1 << 14)->Unit(benchmark::kMillisecond);
+
+// particles: the same spheres placed as separate objects or as a single sphere cloud
+// arguments: number of spheres, use sphere cloud
+static void Benchmark_Traversal_SphereCloud_Single(benchmark::State& state)
+{
+    const Uint32 numSpheres = static_cast<Uint32>(state.range(0));
+    const bool useSphereCloud = state.range(1) != 0;
+    const Uint32 numRays = 64 * 1024;
+
+    Random random;
+
+    std::vector<Float3> centers;
+    std::vector<float> radii;
+    for (Uint32 i = 0; i < numSpheres; ++i)
+    {
+        centers.push_back((random.GetVector4() * 100.0f).ToFloat3());
+        radii.push_back(0.1f + 0.4f * random.GetFloat());
+    }
+
+    Scene scene;
+    if (useSphereCloud)
+    {
+        auto object = std::make_unique<SphereCloudSceneObject>();
+        object->Initialize(centers.data(), radii.data(), numSpheres);
+        object->SetDefaultMaterial(nullptr);
+        scene.AddObject(std::move(object));
+    }
+    else
+    {
+        for (Uint32 i = 0; i < numSpheres; ++i)
+        {
+            auto object = std::make_unique<SphereSceneObject>(radii[i]);
+            object->SetTransform(Matrix4::MakeTranslation(Vector4(centers[i])));
+            object->SetDefaultMaterial(nullptr);
+            scene.AddObject(std::move(object));
+        }
+    }
+    scene.BuildBVH();
+
+    std::vector<Ray> rays;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        rays.push_back(Ray(random.GetVector4() * 100.0f, SamplingHelpers::GetSphere(random.GetFloat2())));
+    }
+
+    auto context = std::make_unique<RenderingContext>();
+
+    for (auto _ : state)
+    {
+        for (const Ray& ray : rays)
+        {
+            HitPoint hitPoint;
+            scene.Traverse_Single({ ray, hitPoint, *context });
+            benchmark::DoNotOptimize(hitPoint);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * rays.size());
+}
+BENCHMARK(Benchmark_Traversal_SphereCloud_Single)->Args({ 1 << 14, 0 })->Args({ 1 << 14, 1 })->Args({ 1 << 17, 0 })->Args({ 1 << 17, 1 })->Unit(benchmark::kMillisecond);
+
+// argument: number of mesh instances
+static void Benchmark_Instancing_BuildBVH(benchmark::State& state)
+{
+    const Uint32 numInstances = static_cast<Uint32>(state.range(0));
+
+    // single triangle is enough - only the top-level BVH is built
+    const Float3 positions[] = { Float3(0.0f, 0.0f, 0.0f), Float3(1.0f, 0.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f) };
+    const Float3 normals[] = { Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 0.0f, 1.0f) };
+    const Float3 tangents[] = { Float3(1.0f, 0.0f, 0.0f), Float3(1.0f, 0.0f, 0.0f), Float3(1.0f, 0.0f, 0.0f) };
+    const Uint32 indices[] = { 0, 1, 2 };
+    const Uint32 materialIndices[] = { UINT32_MAX };
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = 1;
+    desc.vertexBufferDesc.numVertices = 3;
+    desc.vertexBufferDesc.positions = positions;
+    desc.vertexBufferDesc.normals = normals;
+    desc.vertexBufferDesc.tangents = tangents;
+    desc.vertexBufferDesc.vertexIndexBuffer = indices;
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices;
+
+    auto mesh = std::make_shared<Mesh>();
+    mesh->Initialize(desc);
+
+    Random random;
+    std::vector<Matrix4> transforms;
+    for (Uint32 i = 0; i < numInstances; ++i)
+    {
+        transforms.push_back(Matrix4::MakeTranslation(random.GetVector4() * 1000.0f));
+    }
+
+    ThreadPool threadPool;
+
+    for (auto _ : state)
+    {
+        Scene scene;
+        const Uint32 meshIndex = scene.AddInstancedMesh(mesh);
+        for (const Matrix4& transform : transforms)
+        {
+            scene.AddMeshInstance(transform, meshIndex);
+        }
+
+        scene.BuildBVH(&threadPool);
+        benchmark::DoNotOptimize(scene.GetInstances().GetBVH().GetNumNodes());
+    }
+
+    state.SetItemsProcessed(state.iterations() * numInstances);
+}
+BENCHMARK(Benchmark_Instancing_BuildBVH)->Arg(1 << 16)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
@@ -1,11 +1,12 @@
 #include "PCH.h"
 #include "BVH.h"
 #include "Utils/Logger.h"
+#include "Utils/ThreadPool.h"
 
 
 namespace rt {
 
-static const Uint32 BvhFileVersion = 0;
+static const Uint32 BvhFileVersion = 1;
 static const Uint32 BvhMagic = 'bvhc';
 
 struct BVHFileHeader
@@ -13,22 +14,228 @@ struct BVHFileHeader
     Uint32 magic;
     Uint32 version;
     Uint32 numNodes;
+    Uint32 nodeFormat; // quantized nodes are stored after full precision nodes
     // TODO checksum, mesh/scene name, etc.
 };
 
 static_assert(sizeof(BVH::Node) == 32, "Invalid node size");
+static_assert(sizeof(BVH::QuantizedNode) == 16, "Invalid quantized node size");
+
+// relative costs of node traversal step and leaf object intersection used in SAH cost calculation
+static const float SahTraversalCost = 1.0f;
+static const float SahIntersectionCost = 1.0f;
+
+// minimum number of nodes per refit task to be worth processing in parallel
+static const Uint32 MinNodesPerRefitTask = 4096;
 
 BVH::BVH()
     : mNumNodes(0)
+    , mRootBox(math::Box::Empty())
+    , mExternalNodes(nullptr)
+    , mExternalQuantizedNodes(nullptr)
+    , mNodeFormat(NodeFormat::Full)
 { }
 
 bool BVH::AllocateNodes(Uint32 numNodes)
 {
+    ClearReplicas();
+
     mNodes.Resize(numNodes);
     mNumNodes = numNodes;
+    mExternalNodes = nullptr;
+    mExternalQuantizedNodes = nullptr;
+
+    // quantized nodes are no longer valid
+    mQuantizedNodes.Clear();
+    mNodeFormat = NodeFormat::Full;
+
+    return true;
+}
+
+void BVH::ClearReplicas()
+{
+    mNodeReplicas.Clear();
+    mQuantizedNodeReplicas.Clear();
+}
+
+bool BVH::ReplicateNodes(ThreadPool& threadPool) const
+{
+    if (!mNodeReplicas.Build(GetNodes(), mNumNodes, threadPool))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for BVH nodes replicas");
+        return false;
+    }
+
+    if (mNodeFormat == NodeFormat::Quantized && !mQuantizedNodeReplicas.Build(GetQuantizedNodes(), mNumNodes, threadPool))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for quantized BVH nodes replicas");
+        return false;
+    }
+
+    return true;
+}
+
+bool BVH::SetNodeFormat(NodeFormat format)
+{
+    if (format == mNodeFormat)
+    {
+        return true;
+    }
+
+    if (!DetachExternalNodes())
+    {
+        return false;
+    }
+
+    if (format == NodeFormat::Quantized)
+    {
+        if (!GenerateQuantizedNodes())
+        {
+            return false;
+        }
+
+        RT_LOG_INFO("Quantized BVH nodes: %u nodes, %.2f KB (full precision nodes: %.2f KB)",
+                    mNumNodes,
+                    (float)(mNumNodes * sizeof(QuantizedNode)) / 1024.0f,
+                    (float)(mNumNodes * sizeof(Node)) / 1024.0f);
+    }
+    else
+    {
+        mQuantizedNodes.Clear();
+    }
+
+    mNodeFormat = format;
+    return true;
+}
+
+void BVH::AttachExternalNodes(const Node* nodes, Uint32 numNodes, NodeFormat format, const QuantizedNode* quantizedNodes)
+{
+    RT_ASSERT(nodes || numNodes == 0);
+    RT_ASSERT(format == NodeFormat::Full || quantizedNodes);
+
+    ClearReplicas();
+    mNodes.Clear(true);
+    mQuantizedNodes.Clear(true);
+
+    mExternalNodes = nodes;
+    mExternalQuantizedNodes = format == NodeFormat::Quantized ? quantizedNodes : nullptr;
+    mNumNodes = numNodes;
+    mNodeFormat = format;
+    mRootBox = numNodes > 0 ? nodes[0].GetBox() : math::Box::Empty();
+}
+
+bool BVH::DetachExternalNodes()
+{
+    // Note: called before any modification of the nodes, so the copies would become stale
+    ClearReplicas();
+
+    if (!mExternalNodes)
+    {
+        return true;
+    }
+
+    if (!mNodes.Resize(mNumNodes))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for BVH nodes");
+        return false;
+    }
+    memcpy(mNodes.Data(), mExternalNodes, sizeof(Node) * mNumNodes);
+
+    if (mExternalQuantizedNodes)
+    {
+        if (!mQuantizedNodes.Resize(mNumNodes))
+        {
+            RT_LOG_ERROR("Failed to allocate memory for quantized BVH nodes");
+            return false;
+        }
+        memcpy(mQuantizedNodes.Data(), mExternalQuantizedNodes, sizeof(QuantizedNode) * mNumNodes);
+    }
+
+    mExternalNodes = nullptr;
+    mExternalQuantizedNodes = nullptr;
     return true;
 }
 
+bool BVH::GenerateQuantizedNodes()
+{
+    mQuantizedNodes.Clear();
+
+    if (mNumNodes == 0)
+    {
+        return true;
+    }
+
+    if (!mQuantizedNodes.Resize(mNumNodes))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for quantized BVH nodes");
+        return false;
+    }
+
+    memset(mQuantizedNodes.Data(), 0, sizeof(QuantizedNode) * mNumNodes);
+
+    mRootBox = mNodes[0].GetBox();
+    QuantizeNode(0, mRootBox);
+
+    return true;
+}
+
+void BVH::QuantizeNode(Uint32 nodeIndex, const math::Box& parentBox)
+{
+    const Node& node = mNodes[nodeIndex];
+    const math::Box box = node.GetBox();
+    const math::Vector4 extent = parentBox.max - parentBox.min;
+
+    QuantizedNode& quantizedNode = mQuantizedNodes[nodeIndex];
+    quantizedNode.childIndex = node.childIndex;
+    quantizedNode.numLeaves = node.numLeaves;
+    quantizedNode.splitAxis = node.splitAxis;
+
+    // initial guess
+    for (Uint32 i = 0; i < 3; ++i)
+    {
+        const float invExtent = extent[i] > 0.0f ? 255.0f / extent[i] : 0.0f;
+        const float offsetMin = (box.min[i] - parentBox.min[i]) * invExtent;
+        const float offsetMax = (parentBox.max[i] - box.max[i]) * invExtent;
+
+        quantizedNode.min[i] = static_cast<Uint8>(math::Clamp(floorf(offsetMin), 0.0f, 255.0f));
+        quantizedNode.max[i] = static_cast<Uint8>(255.0f - math::Clamp(floorf(offsetMax), 0.0f, 255.0f));
+    }
+
+    // make sure the decoded box is conservative (decoding may introduce rounding errors)
+    math::Box decodedBox;
+    for (;;)
+    {
+        decodedBox = quantizedNode.DecodeBox(parentBox);
+
+        bool isConservative = true;
+        for (Uint32 i = 0; i < 3; ++i)
+        {
+            if (decodedBox.min[i] > box.min[i] && quantizedNode.min[i] > 0)
+            {
+                quantizedNode.min[i]--;
+                isConservative = false;
+            }
+
+            if (decodedBox.max[i] < box.max[i] && quantizedNode.max[i] < 255)
+            {
+                quantizedNode.max[i]++;
+                isConservative = false;
+            }
+        }
+
+        if (isConservative)
+        {
+            break;
+        }
+    }
+
+    if (!node.IsLeaf())
+    {
+        QuantizeNode(node.childIndex, decodedBox);
+        QuantizeNode(node.childIndex + 1, decodedBox);
+    }
+}
+
 bool BVH::SaveToFile(const std::string& filePath) const
 {
     FILE* file = fopen(filePath.c_str(), "wb");
@@ -42,6 +249,7 @@ bool BVH::SaveToFile(const std::string& filePath) const
     header.magic = BvhMagic;
     header.version = BvhFileVersion;
     header.numNodes = mNumNodes;
+    header.nodeFormat = static_cast<Uint32>(mNodeFormat);
 
     if (fwrite(&header, sizeof(BVHFileHeader), 1, file) != 1)
     {
@@ -50,13 +258,23 @@ bool BVH::SaveToFile(const std::string& filePath) const
         return false;
     }
 
-    if (fwrite(mNodes.Data(), sizeof(Node), mNumNodes, file) != mNumNodes)
+    if (fwrite(GetNodes(), sizeof(Node), mNumNodes, file) != mNumNodes)
     {
         fclose(file);
         RT_LOG_ERROR("Failed to write BVH nodes");
         return false;
     }
 
+    if (mNodeFormat == NodeFormat::Quantized)
+    {
+        if (fwrite(GetQuantizedNodes(), sizeof(QuantizedNode), mNumNodes, file) != mNumNodes)
+        {
+            fclose(file);
+            RT_LOG_ERROR("Failed to write quantized BVH nodes");
+            return false;
+        }
+    }
+
     fclose(file);
     return true;
 }
@@ -105,6 +323,32 @@ bool BVH::LoadFromFile(const std::string& filePath)
         return false;
     }
 
+    if (header.nodeFormat == static_cast<Uint32>(NodeFormat::Quantized))
+    {
+        if (!mQuantizedNodes.Resize(header.numNodes))
+        {
+            fclose(file);
+            RT_LOG_ERROR("Failed to allocate memory for quantized BVH nodes");
+            return false;
+        }
+
+        if (fread(mQuantizedNodes.Data(), sizeof(QuantizedNode), header.numNodes, file) != header.numNodes)
+        {
+            fclose(file);
+            RT_LOG_ERROR("Failed to read quantized BVH nodes");
+            return false;
+        }
+
+        mRootBox = header.numNodes > 0 ? mNodes[0].GetBox() : math::Box::Empty();
+        mNodeFormat = NodeFormat::Quantized;
+    }
+    else if (header.nodeFormat != static_cast<Uint32>(NodeFormat::Full))
+    {
+        fclose(file);
+        RT_LOG_ERROR("Unsupported BVH node format %u", header.nodeFormat);
+        return false;
+    }
+
     fclose(file);
     return true;
 }
@@ -118,11 +362,156 @@ void BVH::CalculateStats(Stats& outStats) const
     }
 
     CalculateStatsForNode(0, outStats, 1);
+    outStats.sahCost = CalculateSAHCost();
 }
 
-void BVH::CalculateStatsForNode(Uint32 nodeIndex, Stats& outStats, Uint32 depth) const
+float BVH::CalculateSAHCost() const
+{
+    if (mNumNodes == 0)
+    {
+        return 0.0f;
+    }
+
+    const Node* nodes = GetNodes();
+    const float rootArea = nodes[0].GetBox().SurfaceArea();
+    if (rootArea <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    double totalCost = 0.0;
+
+    Uint32 stackSize = 1;
+    Uint32 nodesStack[MaxDepth];
+    nodesStack[0] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node& node = nodes[nodesStack[--stackSize]];
+        const double area = node.GetBox().SurfaceArea();
+
+        if (node.IsLeaf())
+        {
+            totalCost += area * SahIntersectionCost * node.numLeaves;
+        }
+        else
+        {
+            totalCost += area * SahTraversalCost;
+
+            RT_ASSERT(stackSize + 2 <= MaxDepth);
+            nodesStack[stackSize++] = node.childIndex;
+            nodesStack[stackSize++] = node.childIndex + 1;
+        }
+    }
+
+    return static_cast<float>(totalCost / rootArea);
+}
+
+bool BVH::Refit(const math::Box* leafBoxes, ThreadPool* threadPool)
+{
+    if (mNumNodes == 0)
+    {
+        return true;
+    }
+
+    if (!DetachExternalNodes())
+    {
+        return false;
+    }
+
+    // subtrees below tasks level are disjoint, so they can be refitted in parallel
+    Uint32 tasksDepth = 0;
+    if (threadPool && threadPool->GetNumThreads() > 1 && mNumNodes >= 2 * MinNodesPerRefitTask)
+    {
+        const Uint32 numTasks = std::min(4 * threadPool->GetNumThreads(), mNumNodes / MinNodesPerRefitTask);
+        while ((1u << tasksDepth) < numTasks)
+        {
+            tasksDepth++;
+        }
+    }
+
+    DynArray<Uint32> tasks;
+    CollectRefitTasks(0, 0, tasksDepth, tasks);
+
+    const auto refitSubtreeCallback = [this, &tasks, leafBoxes](Uint32 taskID, Uint32)
+    {
+        RefitNode(tasks[taskID], leafBoxes, 0, UINT32_MAX);
+    };
+
+    if (threadPool && tasks.Size() > 1)
+    {
+        threadPool->RunParallelTask(refitSubtreeCallback, tasks.Size());
+    }
+    else
+    {
+        for (Uint32 i = 0; i < tasks.Size(); ++i)
+        {
+            refitSubtreeCallback(i, 0);
+        }
+    }
+
+    // top levels of the tree
+    RefitNode(0, leafBoxes, 0, tasksDepth);
+
+    if (mNodeFormat == NodeFormat::Quantized)
+    {
+        return GenerateQuantizedNodes();
+    }
+
+    return true;
+}
+
+void BVH::CollectRefitTasks(Uint32 nodeIndex, Uint32 depth, Uint32 tasksDepth, DynArray<Uint32>& outTasks) const
 {
     const Node& node = mNodes[nodeIndex];
+    if (node.IsLeaf())
+    {
+        return;
+    }
+
+    if (depth == tasksDepth)
+    {
+        outTasks.PushBack(nodeIndex);
+        return;
+    }
+
+    CollectRefitTasks(node.childIndex, depth + 1, tasksDepth, outTasks);
+    CollectRefitTasks(node.childIndex + 1, depth + 1, tasksDepth, outTasks);
+}
+
+const math::Box BVH::RefitNode(Uint32 nodeIndex, const math::Box* leafBoxes, Uint32 depth, Uint32 stopDepth)
+{
+    Node& node = mNodes[nodeIndex];
+
+    math::Box box;
+    if (node.IsLeaf())
+    {
+        box = math::Box::Empty();
+        for (Uint32 i = 0; i < node.numLeaves; ++i)
+        {
+            box = math::Box(box, leafBoxes[node.childIndex + i]);
+        }
+    }
+    else if (depth == stopDepth)
+    {
+        // already refitted by a parallel task
+        return node.GetBox();
+    }
+    else
+    {
+        const math::Box boxA = RefitNode(node.childIndex, leafBoxes, depth + 1, stopDepth);
+        const math::Box boxB = RefitNode(node.childIndex + 1, leafBoxes, depth + 1, stopDepth);
+        box = math::Box(boxA, boxB);
+    }
+
+    node.min = box.min.ToFloat3();
+    node.max = box.max.ToFloat3();
+    return box;
+}
+
+void BVH::CalculateStatsForNode(Uint32 nodeIndex, Stats& outStats, Uint32 depth) const
+{
+    const Node& node = GetNodes()[nodeIndex];
     const math::Box box = node.GetBox();
 
     outStats.totalNodesArea += box.SurfaceArea();
@@ -131,7 +520,7 @@ void BVH::CalculateStatsForNode(Uint32 nodeIndex, Stats& outStats, Uint32 depth)
 
     if (node.numLeaves + 1u > outStats.leavesCountHistogram.Size())
     {
-        outStats.leavesCountHistogram.Resize(node.numLeaves + 1);
+        outStats.leavesCountHistogram.Resize(node.numLeaves + 1, 0u);
     }
     outStats.leavesCountHistogram[node.numLeaves]++;
 
@@ -8,13 +8,16 @@
 #include "../Math/Simd8Box.h"
 #include "../Utils/AlignmentAllocator.h"
 #include "../Containers/DynArray.h"
+#include "../Utils/NumaReplicas.h"
 
 #include <string>
 
 namespace rt {
 
+class ThreadPool;
+
 // binary Bounding Volume Hierarchy
-class BVH
+class RAYLIB_API BVH
 {
 public:
     static constexpr Uint32 MaxDepth = 128;
@@ -61,11 +64,55 @@ public:
         }
     };
 
+    // compressed node - bounding box is stored as 8-bit offsets relative to the parent's (decoded) box
+    // Note: offsets are rounded conservatively, so decoded box always contains the original one
+    struct RT_ALIGN(16) QuantizedNode
+    {
+        Uint8 min[3];
+        Uint8 max[3];
+        Uint8 padding[2];
+        Uint32 childIndex; // first child node / leaf index
+        Uint32 numLeaves : 30;
+        Uint32 splitAxis : 2;
+
+        RT_FORCE_INLINE bool IsLeaf() const
+        {
+            return numLeaves != 0;
+        }
+
+        // reconstruct node's box from the parent's box
+        RT_FORCE_INLINE const math::Box DecodeBox(const math::Box& parentBox) const
+        {
+            const math::Vector4 mask = math::Vector4::MakeMask<1,1,1,0>();
+
+            // load 4 bytes at once and convert to floats (4th byte is masked out)
+            const __m128i packedMin = _mm_cvtsi32_si128(*reinterpret_cast<const Int32*>(min));
+            const __m128i packedMax = _mm_cvtsi32_si128(*reinterpret_cast<const Int32*>(max));
+            const math::Vector4 quantizedMin = math::Vector4(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(packedMin))) & mask;
+            const math::Vector4 quantizedMax = math::Vector4(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(packedMax))) & mask;
+
+            // Note: min is decoded relative to the parent's min and max relative to the parent's max,
+            // so offsets of 0 and 255 always reproduce the parent's box exactly
+            const math::Vector4 scale = (parentBox.max - parentBox.min) * (1.0f / 255.0f);
+            const math::Vector4 decodedMin = math::Vector4::MulAndAdd(quantizedMin, scale, parentBox.min);
+            const math::Vector4 decodedMax = math::Vector4::NegMulAndAdd(math::Vector4(255.0f) - quantizedMax, scale, parentBox.max);
+
+            return { decodedMin, decodedMax };
+        }
+    };
+
+    enum class NodeFormat : Uint8
+    {
+        Full = 0,
+        Quantized,
+    };
+
     struct Stats
     {
         Uint32 maxDepth;    // max leaf depth
         double totalNodesArea;
         double totalNodesVolume;
+        float sahCost;      // see CalculateSAHCost()
         DynArray<Uint32> leavesCountHistogram;
 
         // TODO overlap factor, etc.
@@ -74,6 +121,7 @@ public:
             : maxDepth(0)
             , totalNodesArea(0.0)
             , totalNodesVolume(0.0)
+            , sahCost(0.0f)
         { }
     };
 
@@ -84,21 +132,71 @@ public:
     // calculate whole BVH stats
     void CalculateStats(Stats& outStats) const;
 
+    // calculate Surface Area Heuristic cost of the tree (relative to the root node's surface area)
+    float CalculateSAHCost() const;
+
+    // recalculate nodes bounding boxes bottom-up, keeping the tree topology
+    // 'leafBoxes' must be provided in the leaves order (as returned by BVHBuilder)
+    // Note: tree quality degrades when the leaves move a lot, compare SAH cost to decide when to rebuild
+    bool Refit(const math::Box* leafBoxes, ThreadPool* threadPool = nullptr);
+
     bool SaveToFile(const std::string& filePath) const;
     bool LoadFromFile(const std::string& filePath);
 
-    RT_FORCE_INLINE const Node* GetNodes() const { return mNodes.Data(); }
+    // select nodes format used by single ray traversal
+    // Note: full precision nodes are always kept (they are required by other traversal modes)
+    bool SetNodeFormat(NodeFormat format);
+
+    // use nodes stored in external memory (e.g. memory mapped file) without copying
+    // Note: the memory must outlive the BVH, any modification of the tree makes a private copy first
+    void AttachExternalNodes(const Node* nodes, Uint32 numNodes, NodeFormat format, const QuantizedNode* quantizedNodes);
+
+    // make a copy of the nodes in local memory of every NUMA node of the thread pool (see NumaReplicas)
+    // Note: the copies are dropped when the tree is modified
+    bool ReplicateNodes(ThreadPool& threadPool) const;
+
+    RT_FORCE_INLINE const Node* GetNodes() const { return mExternalNodes ? mExternalNodes : mNodes.Data(); }
     RT_FORCE_INLINE Uint32 GetNumNodes() const { return mNumNodes; }
 
+    RT_FORCE_INLINE NodeFormat GetNodeFormat() const { return mNodeFormat; }
+    RT_FORCE_INLINE const QuantizedNode* GetQuantizedNodes() const { return mExternalQuantizedNodes ? mExternalQuantizedNodes : mQuantizedNodes.Data(); }
+
+    // get nodes placed on a given NUMA node (see RenderingContext::numaNode), falls back to the original nodes
+    RT_FORCE_INLINE const Node* GetNodes(Uint32 numaNode) const { return mNodeReplicas.Get(numaNode, GetNodes()); }
+    RT_FORCE_INLINE const QuantizedNode* GetQuantizedNodes(Uint32 numaNode) const { return mQuantizedNodeReplicas.Get(numaNode, GetQuantizedNodes()); }
+
+    // bounding box of the root node, used as a base for decoding quantized nodes
+    RT_FORCE_INLINE const math::Box& GetRootBox() const { return mRootBox; }
+
 private:
     void CalculateStatsForNode(Uint32 node, Stats& outStats, Uint32 depth) const;
+    void CollectRefitTasks(Uint32 nodeIndex, Uint32 depth, Uint32 tasksDepth, DynArray<Uint32>& outTasks) const;
+    const math::Box RefitNode(Uint32 nodeIndex, const math::Box* leafBoxes, Uint32 depth, Uint32 stopDepth);
     bool AllocateNodes(Uint32 numNodes);
+    void ClearReplicas();
+    bool DetachExternalNodes();
+    bool GenerateQuantizedNodes();
+    void QuantizeNode(Uint32 nodeIndex, const math::Box& parentBox);
 
     // TODO align to cache line size
     DynArray<Node> mNodes;
     Uint32 mNumNodes;
 
+    DynArray<QuantizedNode> mQuantizedNodes;
+    math::Box mRootBox;
+
+    // nodes stored in external memory (if not null, take precedence over the arrays above)
+    const Node* mExternalNodes;
+    const QuantizedNode* mExternalQuantizedNodes;
+    NodeFormat mNodeFormat;
+
+    // per NUMA node copies of the nodes (see ReplicateNodes)
+    // Note: the copies don't change the tree, so they can be made for a const BVH
+    mutable NumaReplicas<Node> mNodeReplicas;
+    mutable NumaReplicas<QuantizedNode> mQuantizedNodeReplicas;
+
     friend class BVHBuilder;
+    friend class BVHOptimizer;
 };
 
 
@@ -1,21 +1,172 @@
 #include "PCH.h"
 #include "BVHBuilder.h"
+#include "Math/Triangle.h"
 #include "Utils/Logger.h"
 #include "Utils/Timer.h"
+#include "Utils/ThreadPool.h"
 
 
 namespace rt {
 
 using namespace math;
 
-BVHBuilder::Context::Context(Uint32 numLeaves)
+namespace {
+
+// result of binned SAH object split search
+struct BinnedSplit
+{
+    Box centersBox;
+    float binScale[3];
+    Uint32 numBins;
+    Uint32 axis;
+    Uint32 splitBin;
+    Uint32 leftCount;
+    float cost;
+    Box leftBox;
+    Box rightBox;
+
+    // Note: center is doubled (min + max)
+    RT_FORCE_INLINE Uint32 GetBinIndex(const Vector4& center, Uint32 binAxis) const
+    {
+        const float pos = (center[binAxis] - centersBox.min[binAxis]) * binScale[binAxis];
+        return Min(static_cast<Uint32>(pos), numBins - 1u);
+    }
+
+    RT_FORCE_INLINE bool IsOnLeftSide(const Vector4& center) const
+    {
+        return GetBinIndex(center, axis) < splitBin;
+    }
+};
+
+// find best object split position by evaluating SAH on bins boundaries
+template<typename BoxGetter>
+bool FindBinnedSplit(const Uint32 numItems, const Uint32 requestedNumBins, const BoxGetter& getBox, BinnedSplit& outSplit)
 {
-    mLeftBoxesCache.Resize(numLeaves);
-    mRightBoxesCache.Resize(numLeaves);
+    constexpr Uint32 NumAxes = 3;
+    constexpr Uint32 MaxNumBins = 64;
+
+    struct Bin
+    {
+        Box box;
+        Uint32 count;
+    };
+
+    const Uint32 numBins = Clamp(requestedNumBins, 2u, MaxNumBins);
+    outSplit.numBins = numBins;
+
+    // calculate bounding box of leaves centers
+    outSplit.centersBox = Box::Empty();
+    for (Uint32 i = 0; i < numItems; ++i)
+    {
+        const Box& box = getBox(i);
+        outSplit.centersBox.AddPoint(box.min + box.max);
+    }
+
+    const Vector4 extent = outSplit.centersBox.max - outSplit.centersBox.min;
+
+    // skip axes where all the centers are in the same place
+    for (Uint32 axis = 0; axis < NumAxes; ++axis)
+    {
+        outSplit.binScale[axis] = extent[axis] > 0.0f ? (0.9999f * static_cast<float>(numBins) / extent[axis]) : 0.0f;
+    }
+
+    // assign leaves to bins
+    Bin bins[NumAxes][MaxNumBins];
+    for (Uint32 axis = 0; axis < NumAxes; ++axis)
+    {
+        for (Uint32 i = 0; i < numBins; ++i)
+        {
+            bins[axis][i].box = Box::Empty();
+            bins[axis][i].count = 0;
+        }
+    }
+
+    for (Uint32 i = 0; i < numItems; ++i)
+    {
+        const Box& box = getBox(i);
+        const Vector4 center = box.min + box.max;
+
+        for (Uint32 axis = 0; axis < NumAxes; ++axis)
+        {
+            Bin& bin = bins[axis][outSplit.GetBinIndex(center, axis)];
+            bin.box = Box(bin.box, box);
+            bin.count++;
+        }
+    }
+
+    outSplit.cost = FLT_MAX;
+
+    for (Uint32 axis = 0; axis < NumAxes; ++axis)
+    {
+        if (outSplit.binScale[axis] == 0.0f)
+        {
+            continue;
+        }
+
+        // calculate right child node AABB for each possible split position
+        Box rightBoxes[MaxNumBins];
+        Uint32 rightCounts[MaxNumBins];
+        {
+            Box accumulatedBox = Box::Empty();
+            Uint32 accumulatedCount = 0;
+            for (Uint32 i = numBins; i-- > 1; )
+            {
+                accumulatedBox = Box(accumulatedBox, bins[axis][i].box);
+                accumulatedCount += bins[axis][i].count;
+                rightBoxes[i] = accumulatedBox;
+                rightCounts[i] = accumulatedCount;
+            }
+        }
+
+        // find optimal split position (surface area heuristics)
+        Box leftBox = Box::Empty();
+        Uint32 leftCount = 0;
+        for (Uint32 splitBin = 1; splitBin < numBins; ++splitBin)
+        {
+            leftBox = Box(leftBox, bins[axis][splitBin - 1].box);
+            leftCount += bins[axis][splitBin - 1].count;
+
+            const Uint32 rightCount = rightCounts[splitBin];
+            if (leftCount == 0 || rightCount == 0)
+            {
+                continue;
+            }
+
+            const float totalCost =
+                leftBox.SurfaceArea() * static_cast<float>(leftCount) +
+                rightBoxes[splitBin].SurfaceArea() * static_cast<float>(rightCount);
+
+            if (totalCost < outSplit.cost)
+            {
+                outSplit.cost = totalCost;
+                outSplit.axis = axis;
+                outSplit.splitBin = splitBin;
+                outSplit.leftCount = leftCount;
+                outSplit.leftBox = leftBox;
+                outSplit.rightBox = rightBoxes[splitBin];
+            }
+        }
+    }
+
+    return outSplit.cost < FLT_MAX;
+}
+
+} // namespace
 
-    for (Uint32 i = 0; i < NumAxes; ++i)
+BVHBuilder::Context::Context(Uint32 numLeaves, SplitMode splitMode)
+    : mNumNodes(0)
+    , mNumLeaves(0)
+{
+    // caches are required only by sweep algorithm
+    if (splitMode == SplitMode::Sweep)
     {
-        mSortedLeavesIndicesCache[i].Resize(numLeaves);
+        mLeftBoxesCache.Resize(numLeaves);
+        mRightBoxesCache.Resize(numLeaves);
+
+        for (Uint32 i = 0; i < NumAxes; ++i)
+        {
+            mSortedLeavesIndicesCache[i].Resize(numLeaves);
+        }
     }
 }
 
@@ -46,7 +197,7 @@ bool BVHBuilder::Build(const Box* data, const Uint32 numLeaves,
     mNumGeneratedNodes = 0;
     mNumGeneratedLeaves = 0;
     mLeavesOrder.Clear();
-    mLeavesOrder.Reserve(mNumLeaves);
+    mLeafCenters.Clear();
 
     if (mNumLeaves == 0)
     {
@@ -54,11 +205,15 @@ bool BVHBuilder::Build(const Box* data, const Uint32 numLeaves,
         return true;
     }
 
-    // calculate overall bounding box
+    // calculate overall bounding box and leaves centers
     Box overallBox = Box::Empty();
+    mLeafCenters.Resize(mNumLeaves);
+    mLeavesOrder.Resize(mNumLeaves);
     for (Uint32 i = 0; i < mNumLeaves; ++i)
     {
         overallBox = Box(overallBox, mLeafBoxes[i]);
+        mLeafCenters[i] = mLeafBoxes[i].max + mLeafBoxes[i].min;
+        mLeavesOrder[i] = i;
     }
 
     RT_LOG_INFO("BVH statistics: num leaves = %u, overall box = [%f, %f, %f], [%f, %f, %f]",
@@ -66,24 +221,88 @@ bool BVHBuilder::Build(const Box* data, const Uint32 numLeaves,
                 overallBox.min.f[0], overallBox.min.f[1], overallBox.min.f[2],
                 overallBox.max.f[0], overallBox.max.f[1], overallBox.max.f[2]);
 
+    if (mParams.splitMode == SplitMode::Spatial)
+    {
+        if (mParams.triangles)
+        {
+            BuildSpatial(overallBox);
+            outLeavesOrder = mLeavesOrder;
+            return true;
+        }
+
+        RT_LOG_WARNING("Spatial splits require triangles geometry, falling back to binned SAH");
+        mParams.splitMode = SplitMode::Binned;
+    }
+
     WorkSet rootWorkSet;
     rootWorkSet.box = overallBox;
+    rootWorkSet.firstLeaf = 0;
     rootWorkSet.numLeaves = mNumLeaves;
-    rootWorkSet.leafIndices.Reserve(mNumLeaves);
-    for (Uint32 i = 0; i < mNumLeaves; ++i)
-    {
-        rootWorkSet.leafIndices.PushBack(i);
-    }
 
     Timer timer;
     timer.Start();
 
+    // spawn worker threads only if the input is big enough
+    std::unique_ptr<ThreadPool> localThreadPool;
+    ThreadPool* threadPool = mParams.threadPool;
+    if (!threadPool && mNumLeaves >= 2 * MinLeavesPerTask && std::thread::hardware_concurrency() > 1)
+    {
+        localThreadPool = std::make_unique<ThreadPool>();
+        threadPool = localThreadPool.get();
+    }
+
+    Uint32 maxLeavesPerTask = mNumLeaves;
+    if (threadPool && threadPool->GetNumThreads() > 1)
+    {
+        // generate more tasks than threads for better load balancing
+        maxLeavesPerTask = Max<Uint32>(MinLeavesPerTask, mNumLeaves / (4u * threadPool->GetNumThreads()));
+    }
+
+    DynArray<SubtreeTask> tasks;
+
+    // build top levels of the tree
     {
-        Context context(mNumLeaves);
+        // Note: sweep caches are not needed if the whole tree is built as a single task
+        Context context(maxLeavesPerTask < mNumLeaves ? mNumLeaves : 0, mParams.splitMode);
 
-        BVH::Node& rootNode = mTarget.mNodes.Front();
         mNumGeneratedNodes += 2;
-        BuildNode(rootWorkSet, context, rootNode);
+        BuildTopLevelNode(rootWorkSet, context, 0, maxLeavesPerTask, tasks);
+    }
+
+    // build subtrees
+    {
+        DynArray<std::unique_ptr<Context>> contexts;
+        contexts.Resize(tasks.Size());
+
+        const auto buildSubtreeCallback = [this, &tasks, &contexts](Uint32 taskID, Uint32)
+        {
+            const SubtreeTask& task = tasks[taskID];
+
+            contexts[taskID] = std::make_unique<Context>(task.workSet.numLeaves, mParams.splitMode);
+            Context& context = *contexts[taskID];
+            context.mNodes.Resize(2 * task.workSet.numLeaves);
+            context.mNumNodes = 1;
+
+            BuildNode(task.workSet, context, 0);
+        };
+
+        if (threadPool && tasks.Size() > 1)
+        {
+            threadPool->RunParallelTask(buildSubtreeCallback, tasks.Size());
+        }
+        else
+        {
+            for (Uint32 i = 0; i < tasks.Size(); ++i)
+            {
+                buildSubtreeCallback(i, 0);
+            }
+        }
+
+        // merge in deterministic order, so the output does not depend on threads scheduling
+        for (Uint32 i = 0; i < tasks.Size(); ++i)
+        {
+            MergeSubtree(tasks[i], *contexts[i]);
+        }
     }
 
     RT_ASSERT(mNumGeneratedLeaves == mNumLeaves); // Number of generated leaves is invalid
@@ -95,41 +314,127 @@ bool BVHBuilder::Build(const Box* data, const Uint32 numLeaves,
     // mTarget.mNodes.shrink_to_fit(); // TODO
 
     const float millisecondsElapsed = (float)(1000.0 * timer.Stop());
-    RT_LOG_INFO("Finished BVH generation in %.9g ms (num nodes = %u)", millisecondsElapsed, mNumGeneratedNodes);
+    RT_LOG_INFO("Finished BVH generation in %.9g ms (num nodes = %u, SAH cost = %.4f, tasks = %u, %s)",
+                millisecondsElapsed, mNumGeneratedNodes, mTarget.CalculateSAHCost(), tasks.Size(),
+                mParams.splitMode == SplitMode::Sweep ? "sweep" : "binned");
 
     outLeavesOrder = mLeavesOrder;
     return true;
 }
 
-void BVHBuilder::GenerateLeaf(const WorkSet& workSet, BVH::Node& targetNode)
+void BVHBuilder::GenerateLeaf(const WorkSet& workSet, BVH::Node& targetNode) const
 {
     targetNode.numLeaves = workSet.numLeaves;
-    targetNode.childIndex = mNumGeneratedLeaves;
+    targetNode.childIndex = workSet.firstLeaf;
+}
 
-    for (Uint32 i = 0; i < workSet.numLeaves; ++i)
+void BVHBuilder::BuildTopLevelNode(const WorkSet& workSet, Context& context, Uint32 nodeIndex, Uint32 maxLeavesPerTask, DynArray<SubtreeTask>& outTasks)
+{
+    if (workSet.numLeaves <= Max(maxLeavesPerTask, mParams.maxLeafNodeSize))
     {
-        mLeavesOrder.PushBack(workSet.leafIndices[i]);
+        outTasks.PushBack({ workSet, nodeIndex });
+        return;
     }
 
-    mNumGeneratedLeaves += workSet.numLeaves;
+    BVH::Node& targetNode = mTarget.mNodes[nodeIndex];
+    targetNode.min = workSet.box.min.ToFloat3();
+    targetNode.max = workSet.box.max.ToFloat3();
+
+    WorkSet leftWorkSet, rightWorkSet;
+    Uint32 splitAxis = 0;
+    SplitWorkSet(workSet, context, leftWorkSet, rightWorkSet, splitAxis);
+
+    const Uint32 leftNodeIndex = mNumGeneratedNodes;
+    mNumGeneratedNodes += 2;
+
+    targetNode.childIndex = leftNodeIndex;
+    targetNode.numLeaves = 0;
+    targetNode.splitAxis = splitAxis;
+
+    BuildTopLevelNode(leftWorkSet, context, leftNodeIndex, maxLeavesPerTask, outTasks);
+    BuildTopLevelNode(rightWorkSet, context, leftNodeIndex + 1, maxLeavesPerTask, outTasks);
 }
 
-void BVHBuilder::BuildNode(const WorkSet& workSet, Context& context, BVH::Node& targetNode)
+void BVHBuilder::BuildNode(const WorkSet& workSet, Context& context, Uint32 nodeIndex)
 {
     RT_ASSERT(workSet.numLeaves <= mNumLeaves);
     RT_ASSERT(workSet.numLeaves > 0);
     RT_ASSERT(workSet.depth < mNumLeaves);
     RT_ASSERT(workSet.depth <= BVH::MaxDepth);
 
+    BVH::Node& targetNode = context.mNodes[nodeIndex];
     targetNode.min = workSet.box.min.ToFloat3();
     targetNode.max = workSet.box.max.ToFloat3();
 
     if (workSet.numLeaves <= mParams.maxLeafNodeSize)
     {
         GenerateLeaf(workSet, targetNode);
+        context.mNumLeaves += workSet.numLeaves;
         return;
     }
 
+    WorkSet leftWorkSet, rightWorkSet;
+    Uint32 splitAxis = 0;
+    SplitWorkSet(workSet, context, leftWorkSet, rightWorkSet, splitAxis);
+
+    const Uint32 leftNodeIndex = context.mNumNodes;
+    context.mNumNodes += 2;
+
+    targetNode.childIndex = leftNodeIndex;
+    targetNode.numLeaves = 0;
+    targetNode.splitAxis = splitAxis;
+
+    BuildNode(leftWorkSet, context, leftNodeIndex);
+    BuildNode(rightWorkSet, context, leftNodeIndex + 1);
+}
+
+void BVHBuilder::MergeSubtree(const SubtreeTask& task, const Context& context)
+{
+    // subtree root goes to the preallocated node, the rest is appended at the end
+    // Note: local nodes pairs start at odd indices, so siblings stay aligned to even indices in the target BVH
+    const Uint32 baseIndex = mNumGeneratedNodes;
+
+    for (Uint32 i = 0; i < context.mNumNodes; ++i)
+    {
+        BVH::Node node = context.mNodes[i];
+        if (!node.IsLeaf())
+        {
+            node.childIndex = baseIndex + node.childIndex - 1;
+        }
+
+        const Uint32 targetIndex = i == 0 ? task.targetNodeIndex : baseIndex + i - 1;
+        mTarget.mNodes[targetIndex] = node;
+    }
+
+    mNumGeneratedNodes += context.mNumNodes - 1;
+    mNumGeneratedLeaves += context.mNumLeaves;
+}
+
+void BVHBuilder::SplitWorkSet(const WorkSet& workSet, Context& context, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis)
+{
+    bool success = false;
+
+    if (mParams.splitMode == SplitMode::Sweep)
+    {
+        success = SplitWorkSet_Sweep(workSet, context, outLeft, outRight, outAxis);
+    }
+    else
+    {
+        success = SplitWorkSet_Binned(workSet, outLeft, outRight, outAxis);
+    }
+
+    if (!success)
+    {
+        SplitWorkSet_Median(workSet, outLeft, outRight);
+        outAxis = 0;
+    }
+
+    outLeft.depth = workSet.depth + 1;
+    outRight.depth = workSet.depth + 1;
+}
+
+bool BVHBuilder::SplitWorkSet_Sweep(const WorkSet& workSet, Context& context, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis)
+{
     Uint32 bestAxis = 0;
     Uint32 bestSplitPos = 0;
     float bestCost = FLT_MAX;
@@ -188,81 +493,462 @@ void BVHBuilder::BuildNode(const WorkSet& workSet, Context& context, BVH::Node&
         }
     }
 
+    if (bestCost == FLT_MAX)
+    {
+        return false;
+    }
+
     const Uint32 leftCount = bestSplitPos + 1;
     const Uint32 rightCount = workSet.numLeaves - leftCount;
 
+    // store leaves in order of the best axis, so the children are already sorted
+    memcpy(mLeavesOrder.Data() + workSet.firstLeaf, context.mSortedLeavesIndicesCache[bestAxis].Data(), sizeof(Uint32) * workSet.numLeaves);
+
+    outLeft.box = bestLeftBox;
+    outLeft.firstLeaf = workSet.firstLeaf;
+    outLeft.numLeaves = leftCount;
+    outLeft.sortedBy = bestAxis;
+
+    outRight.box = bestRightBox;
+    outRight.firstLeaf = workSet.firstLeaf + leftCount;
+    outRight.numLeaves = rightCount;
+    outRight.sortedBy = bestAxis;
+
+    outAxis = bestAxis;
+    return true;
+}
+
+bool BVHBuilder::SplitWorkSet_Binned(const WorkSet& workSet, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis)
+{
+    Uint32* leafIndices = mLeavesOrder.Data() + workSet.firstLeaf;
+
+    const auto getLeafBox = [this, leafIndices](Uint32 i) -> const Box&
+    {
+        return mLeafBoxes[leafIndices[i]];
+    };
+
+    BinnedSplit split;
+    if (!FindBinnedSplit(workSet.numLeaves, mParams.numBins, getLeafBox, split))
+    {
+        return false;
+    }
+
+    // partition leaves in-place
+    const Uint32* splitPoint = std::partition(leafIndices, leafIndices + workSet.numLeaves, [&](const Uint32 leafIndex)
+    {
+        return split.IsOnLeftSide(mLeafCenters[leafIndex]);
+    });
+
+    RT_ASSERT(static_cast<Uint32>(splitPoint - leafIndices) == split.leftCount);
+    RT_UNUSED(splitPoint);
+
+    outLeft.box = split.leftBox;
+    outLeft.firstLeaf = workSet.firstLeaf;
+    outLeft.numLeaves = split.leftCount;
+
+    outRight.box = split.rightBox;
+    outRight.firstLeaf = workSet.firstLeaf + split.leftCount;
+    outRight.numLeaves = workSet.numLeaves - split.leftCount;
+
+    outAxis = split.axis;
+    return true;
+}
+
+void BVHBuilder::SplitWorkSet_Median(const WorkSet& workSet, WorkSet& outLeft, WorkSet& outRight) const
+{
+    const Uint32 leftCount = workSet.numLeaves / 2;
+
+    outLeft.box = Box::Empty();
+    outLeft.firstLeaf = workSet.firstLeaf;
+    outLeft.numLeaves = leftCount;
+    outLeft.sortedBy = workSet.sortedBy;
+
+    outRight.box = Box::Empty();
+    outRight.firstLeaf = workSet.firstLeaf + leftCount;
+    outRight.numLeaves = workSet.numLeaves - leftCount;
+    outRight.sortedBy = workSet.sortedBy;
+
+    for (Uint32 i = 0; i < outLeft.numLeaves; ++i)
+    {
+        outLeft.box = Box(outLeft.box, mLeafBoxes[mLeavesOrder[outLeft.firstLeaf + i]]);
+    }
+
+    for (Uint32 i = 0; i < outRight.numLeaves; ++i)
+    {
+        outRight.box = Box(outRight.box, mLeafBoxes[mLeavesOrder[outRight.firstLeaf + i]]);
+    }
+}
+
+void BVHBuilder::BuildSpatial(const Box& rootBox)
+{
+    Timer timer;
+    timer.Start();
+
+    mNumReferences = mNumLeaves;
+    mMaxReferences = mNumLeaves + static_cast<Uint32>(static_cast<float>(mNumLeaves) * Max(0.0f, mParams.maxDuplicationRatio));
+
+    // spatial splits are considered only if children overlap is significant (relative to the whole scene)
+    mMinSpatialSplitOverlap = 1.0e-5f * rootBox.SurfaceArea();
+
+    // each leaf node holds at least one reference, so the nodes count is bounded by the references budget
+    mTarget.AllocateNodes(2 * mMaxReferences);
+    mLeavesOrder.Clear();
+    mLeavesOrder.Reserve(mMaxReferences);
+
+    DynArray<Reference> references;
+    references.Resize(mNumLeaves);
+    for (Uint32 i = 0; i < mNumLeaves; ++i)
+    {
+        references[i].box = mLeafBoxes[i];
+        references[i].leafIndex = i;
+    }
+
+    mNumGeneratedNodes = 2;
+    BuildNode_Spatial(references, rootBox, 0, 0);
+
+    RT_ASSERT(mNumGeneratedLeaves == mLeavesOrder.Size()); // Number of generated leaves is invalid
+    RT_ASSERT(mNumGeneratedNodes <= 2 * mMaxReferences); // Number of generated nodes is invalid
+
+    // shrink BVH nodes array
+    mTarget.mNumNodes = mNumGeneratedNodes;
+    mTarget.mNodes.Resize(mNumGeneratedNodes);
+
+    const float millisecondsElapsed = (float)(1000.0 * timer.Stop());
+    RT_LOG_INFO("Finished BVH generation in %.9g ms (num nodes = %u, SAH cost = %.4f, num references = %u (+%.2f%%), spatial)",
+                millisecondsElapsed, mNumGeneratedNodes, mTarget.CalculateSAHCost(), mLeavesOrder.Size(),
+                100.0f * static_cast<float>(mLeavesOrder.Size() - mNumLeaves) / static_cast<float>(mNumLeaves));
+}
+
+void BVHBuilder::BuildNode_Spatial(DynArray<Reference>& references, const Box& box, Uint32 nodeIndex, Uint32 depth)
+{
+    RT_ASSERT(references.Size() > 0);
+    RT_ASSERT(depth < BVH::MaxDepth);
+
+    // Note: nodes array is preallocated, so the reference stays valid during recursion
+    BVH::Node& targetNode = mTarget.mNodes[nodeIndex];
+    targetNode.min = box.min.ToFloat3();
+    targetNode.max = box.max.ToFloat3();
+
+    const Uint32 numReferences = references.Size();
+    if (numReferences <= mParams.maxLeafNodeSize || depth + 1 >= BVH::MaxDepth)
+    {
+        targetNode.numLeaves = numReferences;
+        targetNode.childIndex = mLeavesOrder.Size();
+        for (Uint32 i = 0; i < numReferences; ++i)
+        {
+            mLeavesOrder.PushBack(references[i].leafIndex);
+        }
+        mNumGeneratedLeaves += numReferences;
+        return;
+    }
+
+    const auto getReferenceBox = [&references](Uint32 i) -> const Box&
+    {
+        return references[i].box;
+    };
+
+    DynArray<Reference> leftReferences, rightReferences;
+    Box leftBox = Box::Empty();
+    Box rightBox = Box::Empty();
+    Uint32 splitAxis = 0;
+
+    BinnedSplit objectSplit;
+    const bool objectSplitFound = FindBinnedSplit(numReferences, mParams.numBins, getReferenceBox, objectSplit);
+
+    // try spatial split only if object split children overlap (or there is no valid object split at all)
+    bool trySpatialSplit = mNumReferences < mMaxReferences;
+    if (trySpatialSplit && objectSplitFound)
+    {
+        const Box overlap = Box::Intersection(objectSplit.leftBox, objectSplit.rightBox);
+        trySpatialSplit = overlap.IsValid() && overlap.SurfaceArea() > mMinSpatialSplitOverlap;
+    }
+
+    SpatialSplit spatialSplit;
+    bool useSpatialSplit = false;
+    if (trySpatialSplit && FindSpatialSplit(references, box, spatialSplit))
+    {
+        const Uint32 numNewReferences = spatialSplit.leftCount + spatialSplit.rightCount - numReferences;
+        useSpatialSplit =
+            (!objectSplitFound || spatialSplit.cost < objectSplit.cost) &&
+            mNumReferences + numNewReferences <= mMaxReferences;
+    }
+
+    if (useSpatialSplit)
+    {
+        PerformSpatialSplit(references, spatialSplit, leftReferences, rightReferences);
+        splitAxis = spatialSplit.axis;
+
+        // clipping may reject some references, make sure both children are not empty
+        if (leftReferences.Size() == 0 || rightReferences.Size() == 0)
+        {
+            leftReferences.Clear();
+            rightReferences.Clear();
+            useSpatialSplit = false;
+        }
+    }
+
+    if (!useSpatialSplit && objectSplitFound)
+    {
+        for (Uint32 i = 0; i < numReferences; ++i)
+        {
+            const Reference& reference = references[i];
+            if (objectSplit.IsOnLeftSide(reference.box.min + reference.box.max))
+            {
+                leftReferences.PushBack(reference);
+            }
+            else
+            {
+                rightReferences.PushBack(reference);
+            }
+        }
+        splitAxis = objectSplit.axis;
+    }
+
+    if (leftReferences.Size() == 0 || rightReferences.Size() == 0)
+    {
+        // fallback: split references list in half
+        leftReferences.Clear();
+        rightReferences.Clear();
+        for (Uint32 i = 0; i < numReferences; ++i)
+        {
+            (i < numReferences / 2 ? leftReferences : rightReferences).PushBack(references[i]);
+        }
+        splitAxis = 0;
+    }
+
+    for (const Reference& reference : leftReferences)
+    {
+        leftBox = Box(leftBox, reference.box);
+    }
+    for (const Reference& reference : rightReferences)
+    {
+        rightBox = Box(rightBox, reference.box);
+    }
+
+    mNumReferences += leftReferences.Size() + rightReferences.Size();
+    mNumReferences -= numReferences;
+
+    // release parent's references before going deeper
+    references.Clear(true);
+
     const Uint32 leftNodeIndex = mNumGeneratedNodes;
     mNumGeneratedNodes += 2;
 
     targetNode.childIndex = leftNodeIndex;
     targetNode.numLeaves = 0;
-    targetNode.splitAxis = bestAxis;
+    targetNode.splitAxis = splitAxis;
+
+    BuildNode_Spatial(leftReferences, leftBox, leftNodeIndex, depth + 1);
+    BuildNode_Spatial(rightReferences, rightBox, leftNodeIndex + 1, depth + 1);
+}
 
-    WorkSet childWorkSet;
-    childWorkSet.sortedBy = bestAxis;
-    childWorkSet.depth = workSet.depth + 1;
+bool BVHBuilder::FindSpatialSplit(const DynArray<Reference>& references, const Box& box, SpatialSplit& outSplit) const
+{
+    struct Bin
+    {
+        Box box;
+        Uint32 entryCount;
+        Uint32 exitCount;
+    };
 
-    const Indices& sortedIndices = context.mSortedLeavesIndicesCache[bestAxis];
+    const Uint32 numBins = Clamp(mParams.numBins, 2u, MaxNumBins);
 
-    Indices leftIndices, rightIndices;
-    leftIndices.Resize(leftCount);
-    rightIndices.Resize(rightCount);
-    memcpy(leftIndices.Data(), sortedIndices.Data(), sizeof(Uint32) * leftCount);
-    memcpy(rightIndices.Data(), sortedIndices.Data() + leftCount, sizeof(Uint32) * rightCount);
+    outSplit.cost = FLT_MAX;
 
-    // generate left node
+    for (Uint32 axis = 0; axis < NumAxes; ++axis)
     {
-        BVH::Node& childNode = mTarget.mNodes[leftNodeIndex];
+        const float origin = box.min[axis];
+        const float extent = box.max[axis] - origin;
+        if (extent <= 0.0f)
+        {
+            continue;
+        }
+
+        const float binSize = extent / static_cast<float>(numBins);
+        const float invBinSize = 1.0f / binSize;
+
+        Bin bins[MaxNumBins];
+        for (Uint32 i = 0; i < numBins; ++i)
+        {
+            bins[i].box = Box::Empty();
+            bins[i].entryCount = 0;
+            bins[i].exitCount = 0;
+        }
+
+        // chop references into bins
+        for (const Reference& reference : references)
+        {
+            const Uint32 firstBin = Min(static_cast<Uint32>(Max(0.0f, (reference.box.min[axis] - origin) * invBinSize)), numBins - 1u);
+            const Uint32 lastBin = Clamp(static_cast<Uint32>(Max(0.0f, (reference.box.max[axis] - origin) * invBinSize)), firstBin, numBins - 1u);
+
+            if (firstBin == lastBin)
+            {
+                bins[firstBin].box = Box(bins[firstBin].box, reference.box);
+            }
+            else
+            {
+                for (Uint32 i = firstBin; i <= lastBin; ++i)
+                {
+                    const float slabMin = origin + static_cast<float>(i) * binSize;
+                    const float slabMax = i + 1 == numBins ? box.max[axis] : (origin + static_cast<float>(i + 1) * binSize);
+                    const Box clippedBox = ClipReference(reference, axis, slabMin, slabMax);
+                    if (clippedBox.IsValid())
+                    {
+                        bins[i].box = Box(bins[i].box, clippedBox);
+                    }
+                }
+            }
+
+            bins[firstBin].entryCount++;
+            bins[lastBin].exitCount++;
+        }
+
+        // calculate right child node AABB for each possible split plane
+        Box rightBoxes[MaxNumBins];
+        Uint32 rightCounts[MaxNumBins];
+        {
+            Box accumulatedBox = Box::Empty();
+            Uint32 accumulatedCount = 0;
+            for (Uint32 i = numBins; i-- > 1; )
+            {
+                accumulatedBox = Box(accumulatedBox, bins[i].box);
+                accumulatedCount += bins[i].exitCount;
+                rightBoxes[i] = accumulatedBox;
+                rightCounts[i] = accumulatedCount;
+            }
+        }
+
+        // find optimal split plane (surface area heuristics)
+        Box leftBox = Box::Empty();
+        Uint32 leftCount = 0;
+        for (Uint32 splitBin = 1; splitBin < numBins; ++splitBin)
+        {
+            leftBox = Box(leftBox, bins[splitBin - 1].box);
+            leftCount += bins[splitBin - 1].entryCount;
+
+            const Uint32 rightCount = rightCounts[splitBin];
+            if (leftCount == 0 || rightCount == 0)
+            {
+                continue;
+            }
+
+            const float totalCost =
+                leftBox.SurfaceArea() * static_cast<float>(leftCount) +
+                rightBoxes[splitBin].SurfaceArea() * static_cast<float>(rightCount);
 
-        childWorkSet.box = bestLeftBox;
-        childWorkSet.numLeaves = leftCount;
-        childWorkSet.leafIndices = std::move(leftIndices);
-        BuildNode(childWorkSet, context, childNode);
+            if (totalCost < outSplit.cost)
+            {
+                outSplit.cost = totalCost;
+                outSplit.axis = axis;
+                outSplit.position = origin + static_cast<float>(splitBin) * binSize;
+                outSplit.leftCount = leftCount;
+                outSplit.rightCount = rightCount;
+            }
+        }
     }
 
-    // generate right node
+    return outSplit.cost < FLT_MAX;
+}
+
+void BVHBuilder::PerformSpatialSplit(const DynArray<Reference>& references, const SpatialSplit& split,
+                                     DynArray<Reference>& outLeft, DynArray<Reference>& outRight) const
+{
+    outLeft.Reserve(split.leftCount);
+    outRight.Reserve(split.rightCount);
+
+    for (const Reference& reference : references)
     {
-        BVH::Node& childNode = mTarget.mNodes[leftNodeIndex + 1];
+        const float refMin = reference.box.min[split.axis];
+        const float refMax = reference.box.max[split.axis];
+
+        if (refMax <= split.position)
+        {
+            outLeft.PushBack(reference);
+        }
+        else if (refMin >= split.position)
+        {
+            outRight.PushBack(reference);
+        }
+        else
+        {
+            // straddling reference - clip the triangle and put it on both sides
+            const Box leftBox = ClipReference(reference, split.axis, refMin, split.position);
+            const Box rightBox = ClipReference(reference, split.axis, split.position, refMax);
+
+            if (leftBox.IsValid())
+            {
+                outLeft.PushBack({ leftBox, reference.leafIndex });
+            }
 
-        childWorkSet.box = bestRightBox;
-        childWorkSet.numLeaves = rightCount;
-        childWorkSet.leafIndices = std::move(rightIndices);
-        BuildNode(childWorkSet, context, childNode);
+            if (rightBox.IsValid())
+            {
+                outRight.PushBack({ rightBox, reference.leafIndex });
+            }
+        }
     }
 }
 
+const Box BVHBuilder::ClipReference(const Reference& reference, Uint32 axis, float slabMin, float slabMax) const
+{
+    const Triangle& triangle = mParams.triangles[reference.leafIndex];
+    const Vector4 vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+
+    Box clippedBox = Box::Empty();
+
+    for (Uint32 i = 0; i < 3; ++i)
+    {
+        const Vector4& a = vertices[i];
+        const Vector4& b = vertices[(i + 1) % 3];
+        const float posA = a[axis];
+        const float posB = b[axis];
+
+        if (posA >= slabMin && posA <= slabMax)
+        {
+            clippedBox.AddPoint(a);
+        }
+
+        // add edge intersection points with both slab planes
+        if ((posA < slabMin && posB > slabMin) || (posA > slabMin && posB < slabMin))
+        {
+            clippedBox.AddPoint(Vector4::Lerp(a, b, (slabMin - posA) / (posB - posA)));
+        }
+
+        if ((posA < slabMax && posB > slabMax) || (posA > slabMax && posB < slabMax))
+        {
+            clippedBox.AddPoint(Vector4::Lerp(a, b, (slabMax - posA) / (posB - posA)));
+        }
+    }
+
+    // interpolated points may slightly exceed the slab due to rounding
+    // Note: clipped box must not be bigger than the (possibly already clipped) source reference
+    clippedBox.min[axis] = Max(clippedBox.min[axis], slabMin);
+    clippedBox.max[axis] = Min(clippedBox.max[axis], slabMax);
+
+    return Box::Intersection(clippedBox, reference.box);
+}
+
 void BVHBuilder::SortLeaves(const WorkSet& workSet, Context& context) const
 {
+    const Uint32* leafIndices = mLeavesOrder.Data() + workSet.firstLeaf;
+
     for (Uint32 axis = 0; axis < NumAxes; ++axis)
     {
-        Indices& indicesToSort = context.mSortedLeavesIndicesCache[axis];
+        Uint32* indicesToSort = context.mSortedLeavesIndicesCache[axis].Data();
+        memcpy(indicesToSort, leafIndices, sizeof(Uint32) * workSet.numLeaves);
 
         if (workSet.sortedBy != axis) // sort only what needs to be sorted
         {
-            indicesToSort = workSet.leafIndices;
-
             const auto comparator = [this, axis](const Uint32 a, const Uint32 b)
             {
                 RT_ASSERT(a < mNumLeaves);
                 RT_ASSERT(b < mNumLeaves);
 
-                const Box& leafA = mLeafBoxes[a];
-                const Box& leafB = mLeafBoxes[b];
-
-                // TODO use precalculated triangle center (experiment)
-                const Vector4 centerA = leafA.max + leafA.min;
-                const Vector4 centerB = leafB.max + leafB.min;
-                return centerA[axis] < centerB[axis];
+                return mLeafCenters[a][axis] < mLeafCenters[b][axis];
             };
 
-            std::sort(indicesToSort.begin(), indicesToSort.end(), comparator);
+            std::sort(indicesToSort, indicesToSort + workSet.numLeaves, comparator);
         }
     }
-
-    if (workSet.sortedBy < NumAxes)
-    {
-        context.mSortedLeavesIndicesCache[workSet.sortedBy] = std::move(workSet.leafIndices);
-    }
 }
 
 } // namespace rt
@@ -5,18 +5,55 @@
 
 namespace rt {
 
+namespace math {
+class Triangle;
+} // namespace math
+
+class ThreadPool;
 
 // helper class for constructing BVH using SAH algorithm
-class BVHBuilder
+class RAYLIB_API BVHBuilder
 {
 public:
 
+    // algorithm used for finding optimal split position
+    enum class SplitMode : Uint8
+    {
+        // sweep over leaves sorted in every axis (slowest, highest quality)
+        Sweep = 0,
+
+        // evaluate SAH only on bins boundaries (fast, slightly lower quality)
+        Binned,
+
+        // binned object splits combined with spatial splits (SBVH)
+        // Triangles straddling a split plane are clipped and referenced by both children, so the output
+        // leaves order may contain duplicates. Requires triangles geometry. Always single threaded.
+        Spatial,
+    };
+
     struct BuildingParams
     {
         Uint32 maxLeafNodeSize; // max number of objects in leaf nodes
+        Uint32 numBins;         // number of bins per axis (binned SAH and spatial modes only)
+        SplitMode splitMode;
+
+        // optional thread pool for building subtrees in parallel
+        // if not provided, a temporary one will be created for big inputs
+        ThreadPool* threadPool;
+
+        // leaves geometry (spatial mode only)
+        const math::Triangle* triangles;
+
+        // max number of additional leaf references, relative to the number of leaves (spatial mode only)
+        float maxDuplicationRatio;
 
         BuildingParams()
             : maxLeafNodeSize(2)
+            , numBins(16)
+            , splitMode(SplitMode::Binned)
+            , threadPool(nullptr)
+            , triangles(nullptr)
+            , maxDuplicationRatio(0.3f)
         { }
     };
 
@@ -28,50 +65,119 @@ public:
     void SetLeafData();
 
     // construct the BVH and return new leaves order
+    // Note: in spatial split mode the leaves order may be longer than the input and contain duplicates
     bool Build(const math::Box* data, const Uint32 numLeaves, const BuildingParams& params, Indices& outLeavesOrder);
 
 private:
 
     constexpr static Uint32 NumAxes = 3;
+    constexpr static Uint32 MaxNumBins = 64;
 
-    struct Context
-    {
-        DynArray<math::Box> mLeftBoxesCache;
-        DynArray<math::Box> mRightBoxesCache;
-        Indices mSortedLeavesIndicesCache[3];
-
-        Context(Uint32 numLeaves);
-    };
+    // minimum number of leaves in a subtree to be worth building as a separate task
+    constexpr static Uint32 MinLeavesPerTask = 4096;
 
-    struct RT_ALIGN(16) WorkSet
+    // describes a range of leaves (in mLeavesOrder) to be processed
+    struct WorkSet
     {
         math::Box box;
-        Indices leafIndices;
+        Uint32 firstLeaf;
         Uint32 numLeaves;
         Uint32 sortedBy;
         Uint32 depth;
 
         WorkSet()
-            : numLeaves(0)
+            : firstLeaf(0)
+            , numLeaves(0)
             , sortedBy(std::numeric_limits<Uint32>::max())
             , depth(0)
         { }
     };
 
+    // per-task scratch memory and output
+    struct Context
+    {
+        DynArray<math::Box> mLeftBoxesCache;
+        DynArray<math::Box> mRightBoxesCache;
+        Indices mSortedLeavesIndicesCache[3];
+
+        // nodes generated by the task (the first one is subtree root)
+        DynArray<BVH::Node> mNodes;
+        Uint32 mNumNodes;
+        Uint32 mNumLeaves;
+
+        Context(Uint32 numLeaves, SplitMode splitMode);
+    };
+
+    struct SubtreeTask
+    {
+        WorkSet workSet;
+        Uint32 targetNodeIndex;
+    };
+
+    // (possibly clipped) leaf reference used in spatial split mode
+    struct Reference
+    {
+        math::Box box;
+        Uint32 leafIndex;
+    };
+
+    struct SpatialSplit
+    {
+        Uint32 axis;
+        float position;
+        float cost;
+        Uint32 leftCount;
+        Uint32 rightCount;
+    };
+
     // sort leaf indices in each axis
     void SortLeaves(const WorkSet& workSet, Context& context) const;
-    void BuildNode(const WorkSet& workSet, Context& context, BVH::Node& targetNode);
-    void GenerateLeaf(const WorkSet& workSet, BVH::Node& targetNode);
+
+    // find split position and partition leaves of the work set
+    void SplitWorkSet(const WorkSet& workSet, Context& context, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis);
+
+    // returns false if no valid split position was found
+    bool SplitWorkSet_Sweep(const WorkSet& workSet, Context& context, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis);
+    bool SplitWorkSet_Binned(const WorkSet& workSet, WorkSet& outLeft, WorkSet& outRight, Uint32& outAxis);
+
+    // fallback: split leaves list in half
+    void SplitWorkSet_Median(const WorkSet& workSet, WorkSet& outLeft, WorkSet& outRight) const;
+
+    // generate top levels of the tree (single threaded) and collect subtrees to be built in parallel
+    void BuildTopLevelNode(const WorkSet& workSet, Context& context, Uint32 nodeIndex, Uint32 maxLeavesPerTask, DynArray<SubtreeTask>& outTasks);
+
+    // build a subtree into context-local nodes array
+    void BuildNode(const WorkSet& workSet, Context& context, Uint32 nodeIndex);
+
+    // move subtree nodes from the task's context to the target BVH
+    void MergeSubtree(const SubtreeTask& task, const Context& context);
+
+    void GenerateLeaf(const WorkSet& workSet, BVH::Node& targetNode) const;
+
+    // spatial split mode (SBVH)
+    void BuildSpatial(const math::Box& rootBox);
+    void BuildNode_Spatial(DynArray<Reference>& references, const math::Box& box, Uint32 nodeIndex, Uint32 depth);
+    bool FindSpatialSplit(const DynArray<Reference>& references, const math::Box& box, SpatialSplit& outSplit) const;
+    void PerformSpatialSplit(const DynArray<Reference>& references, const SpatialSplit& split, DynArray<Reference>& outLeft, DynArray<Reference>& outRight) const;
+
+    // calculate bounding box of a triangle clipped to a slab along given axis
+    const math::Box ClipReference(const Reference& reference, Uint32 axis, float slabMin, float slabMax) const;
 
     // input data
     BuildingParams mParams;
     const math::Box* mLeafBoxes;
+    DynArray<math::Vector4> mLeafCenters;
     Uint32 mNumLeaves;
 
     Uint32 mNumGeneratedNodes;
     Uint32 mNumGeneratedLeaves;
     Indices mLeavesOrder;
 
+    // spatial split mode state
+    Uint32 mNumReferences;
+    Uint32 mMaxReferences;
+    float mMinSpatialSplitOverlap;
+
     // target BVH
     BVH& mTarget;
 };
@@ -0,0 +1,382 @@
+#include "PCH.h"
+#include "BVHOptimizer.h"
+#include "Utils/Logger.h"
+#include "Utils/Timer.h"
+#include "Utils/ThreadPool.h"
+
+
+namespace rt {
+
+using namespace math;
+
+BVHOptimizer::BVHOptimizer(BVH& targetBVH)
+    : mTasksDepth(0)
+    , mTimer(nullptr)
+    , mOutOfTime(false)
+    , mTarget(targetBVH)
+    , mNodes(nullptr)
+{ }
+
+bool BVHOptimizer::Optimize(const OptimizationParams& params)
+{
+    mParams = params;
+
+    if (mParams.treeletSize < 3 || mParams.treeletSize > MaxTreeletSize)
+    {
+        RT_LOG_ERROR("Invalid treelet size: %u (must be in range 3..%u)", mParams.treeletSize, MaxTreeletSize);
+        return false;
+    }
+
+    if (mTarget.GetNumNodes() < 3)
+    {
+        return true;
+    }
+
+    // restructuring operates on full precision nodes, quantized ones are regenerated afterwards
+    const BVH::NodeFormat originalFormat = mTarget.GetNodeFormat();
+    if (!mTarget.DetachExternalNodes() || !mTarget.SetNodeFormat(BVH::NodeFormat::Full))
+    {
+        return false;
+    }
+
+    mNodes = mTarget.mNodes.Data();
+
+    Timer timer;
+    timer.Start();
+    mTimer = &timer;
+    mOutOfTime = false;
+
+    mTasksDepth = 0;
+    ThreadPool* threadPool = mParams.threadPool;
+    if (threadPool && threadPool->GetNumThreads() > 1 && mTarget.GetNumNodes() >= 2 * MinNodesPerTask)
+    {
+        // generate more tasks than threads for better load balancing
+        const Uint32 numTasks = Min<Uint32>(4 * threadPool->GetNumThreads(), mTarget.GetNumNodes() / MinNodesPerTask);
+        while ((1u << mTasksDepth) < numTasks)
+        {
+            mTasksDepth++;
+        }
+    }
+
+    const float initialCost = mTarget.CalculateSAHCost();
+    float cost = initialCost;
+
+    Uint32 numPasses = 0;
+    Uint32 numRestructured = 0;
+    DynArray<Uint32> tasks;
+    DynArray<Uint32> tasksResults;
+
+    while (numPasses < mParams.maxIterations && !mOutOfTime)
+    {
+        // subtrees below tasks level are disjoint, so they can be processed in parallel
+        tasks.Clear();
+        CollectTasks(0, 0, tasks);
+        tasksResults.Resize(tasks.Size());
+
+        const auto optimizeSubtreeCallback = [this, &tasks, &tasksResults](Uint32 taskID, Uint32)
+        {
+            Uint32 numVisited = 0;
+            tasksResults[taskID] = OptimizeSubtree(tasks[taskID], numVisited);
+        };
+
+        if (threadPool && tasks.Size() > 1)
+        {
+            threadPool->RunParallelTask(optimizeSubtreeCallback, tasks.Size());
+        }
+        else
+        {
+            for (Uint32 i = 0; i < tasks.Size(); ++i)
+            {
+                optimizeSubtreeCallback(i, 0);
+            }
+        }
+
+        for (Uint32 i = 0; i < tasks.Size(); ++i)
+        {
+            numRestructured += tasksResults[i];
+        }
+
+        numRestructured += OptimizeTopLevel(0, 0);
+        numPasses++;
+
+        // stop if the pass did not give any noticeable improvement
+        const float newCost = mTarget.CalculateSAHCost();
+        const bool converged = newCost > cost * 0.999f;
+        cost = newCost;
+
+        if (converged)
+        {
+            break;
+        }
+    }
+
+    mTimer = nullptr;
+    mNodes = nullptr;
+
+    if (!mTarget.SetNodeFormat(originalFormat))
+    {
+        return false;
+    }
+
+    const float millisecondsElapsed = (float)(1000.0 * timer.Stop());
+    RT_LOG_INFO("Finished BVH optimization in %.9g ms (passes = %u, restructured treelets = %u, SAH cost = %.4f -> %.4f%s)",
+                millisecondsElapsed, numPasses, numRestructured, initialCost, cost,
+                mOutOfTime ? ", time budget exceeded" : "");
+
+    return true;
+}
+
+void BVHOptimizer::CollectTasks(Uint32 nodeIndex, Uint32 depth, DynArray<Uint32>& outTasks) const
+{
+    const BVH::Node& node = mNodes[nodeIndex];
+    if (node.IsLeaf())
+    {
+        return;
+    }
+
+    if (depth == mTasksDepth)
+    {
+        outTasks.PushBack(nodeIndex);
+        return;
+    }
+
+    CollectTasks(node.childIndex, depth + 1, outTasks);
+    CollectTasks(node.childIndex + 1, depth + 1, outTasks);
+}
+
+Uint32 BVHOptimizer::OptimizeTopLevel(Uint32 nodeIndex, Uint32 depth)
+{
+    const BVH::Node& node = mNodes[nodeIndex];
+    if (node.IsLeaf() || depth >= mTasksDepth || mOutOfTime)
+    {
+        return 0;
+    }
+
+    Uint32 numRestructured = 0;
+    numRestructured += OptimizeTopLevel(node.childIndex, depth + 1);
+    numRestructured += OptimizeTopLevel(node.childIndex + 1, depth + 1);
+
+    if (RestructureTreelet(nodeIndex))
+    {
+        numRestructured++;
+    }
+
+    return numRestructured;
+}
+
+Uint32 BVHOptimizer::OptimizeSubtree(Uint32 nodeIndex, Uint32& numVisited)
+{
+    const BVH::Node& node = mNodes[nodeIndex];
+    if (node.IsLeaf())
+    {
+        return 0;
+    }
+
+    // Note: restructuring the subtree modifies only descendants of the node
+    const Uint32 childIndex = node.childIndex;
+
+    Uint32 numRestructured = 0;
+    numRestructured += OptimizeSubtree(childIndex, numVisited);
+    numRestructured += OptimizeSubtree(childIndex + 1, numVisited);
+
+    if ((++numVisited % TimeCheckInterval) == 0)
+    {
+        IsOutOfTime();
+    }
+
+    if (!mOutOfTime && RestructureTreelet(nodeIndex))
+    {
+        numRestructured++;
+    }
+
+    return numRestructured;
+}
+
+bool BVHOptimizer::IsOutOfTime()
+{
+    if (mParams.timeBudget > 0.0f && !mOutOfTime)
+    {
+        if (mTimer->Stop() > static_cast<double>(mParams.timeBudget))
+        {
+            mOutOfTime = true;
+        }
+    }
+
+    return mOutOfTime;
+}
+
+bool BVHOptimizer::FormTreelet(Uint32 rootIndex, Treelet& outTreelet) const
+{
+    const BVH::Node& root = mNodes[rootIndex];
+    if (root.IsLeaf())
+    {
+        return false;
+    }
+
+    outTreelet.numLeaves = 2;
+    outTreelet.leaves[0] = root.childIndex;
+    outTreelet.leaves[1] = root.childIndex + 1;
+    outTreelet.numPairs = 1;
+    outTreelet.pairs[0] = root.childIndex;
+    outTreelet.cost = root.GetBox().SurfaceArea();
+
+    // expand the treelet by turning the largest treelet leaf into inner node
+    while (outTreelet.numLeaves < mParams.treeletSize)
+    {
+        Uint32 largestLeaf = UINT32_MAX;
+        float largestArea = -1.0f;
+
+        for (Uint32 i = 0; i < outTreelet.numLeaves; ++i)
+        {
+            const BVH::Node& node = mNodes[outTreelet.leaves[i]];
+            if (!node.IsLeaf())
+            {
+                const float area = node.GetBox().SurfaceArea();
+                if (area > largestArea)
+                {
+                    largestArea = area;
+                    largestLeaf = i;
+                }
+            }
+        }
+
+        if (largestLeaf == UINT32_MAX)
+        {
+            break;
+        }
+
+        const Uint32 childIndex = mNodes[outTreelet.leaves[largestLeaf]].childIndex;
+        outTreelet.cost += largestArea;
+        outTreelet.pairs[outTreelet.numPairs++] = childIndex;
+        outTreelet.leaves[largestLeaf] = childIndex;
+        outTreelet.leaves[outTreelet.numLeaves++] = childIndex + 1;
+    }
+
+    // there is only one possible topology for two leaves
+    return outTreelet.numLeaves > 2;
+}
+
+bool BVHOptimizer::RestructureTreelet(Uint32 rootIndex) const
+{
+    constexpr Uint32 MaxSubsets = 1u << MaxTreeletSize;
+
+    Treelet treelet;
+    if (!FormTreelet(rootIndex, treelet))
+    {
+        return false;
+    }
+
+    const Uint32 numLeaves = treelet.numLeaves;
+    const Uint32 allLeaves = (1u << numLeaves) - 1;
+
+    // bounding boxes of all subsets of treelet leaves
+    Box boxes[MaxSubsets];
+    float costs[MaxSubsets];
+    Uint8 partitions[MaxSubsets];
+
+    for (Uint32 i = 0; i < numLeaves; ++i)
+    {
+        boxes[1u << i] = mNodes[treelet.leaves[i]].GetBox();
+        costs[1u << i] = 0.0f;
+    }
+
+    // find optimal topology using dynamic programming
+    // Note: costs of treelet leaves (subtrees) do not depend on the topology, so only inner nodes areas are summed up
+    for (Uint32 subset = 1; subset <= allLeaves; ++subset)
+    {
+        const Uint32 lowestLeaf = subset & (0u - subset);
+        if (subset == lowestLeaf)
+        {
+            continue;
+        }
+
+        boxes[subset] = Box(boxes[subset ^ lowestLeaf], boxes[lowestLeaf]);
+
+        // enumerate partitions, the lowest leaf is always on the left side to skip mirrored ones
+        const Uint32 rest = subset ^ lowestLeaf;
+        float bestCost = std::numeric_limits<float>::max();
+        Uint32 bestPartition = lowestLeaf;
+        Uint32 subsetOfRest = rest;
+        do
+        {
+            subsetOfRest = (subsetOfRest - 1) & rest;
+            const Uint32 left = subsetOfRest | lowestLeaf;
+            const float cost = costs[left] + costs[subset ^ left];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestPartition = left;
+            }
+        } while (subsetOfRest != 0);
+
+        costs[subset] = boxes[subset].SurfaceArea() + bestCost;
+        partitions[subset] = static_cast<Uint8>(bestPartition);
+    }
+
+    // restructure only if it gives noticeable improvement
+    if (costs[allLeaves] >= treelet.cost * 0.9999f)
+    {
+        return false;
+    }
+
+    BVH::Node leafNodes[MaxTreeletSize];
+    for (Uint32 i = 0; i < numLeaves; ++i)
+    {
+        leafNodes[i] = mNodes[treelet.leaves[i]];
+    }
+
+    struct StackEntry
+    {
+        Uint32 subset;
+        Uint32 nodeIndex;
+    };
+
+    // write new topology, reusing sibling pairs owned by the original treelet's inner nodes
+    Uint32 numUsedPairs = 0;
+    Uint32 stackSize = 1;
+    StackEntry stack[2 * MaxTreeletSize];
+    stack[0] = { allLeaves, rootIndex };
+
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        BVH::Node& node = mNodes[entry.nodeIndex];
+
+        if (PopCount(entry.subset) == 1)
+        {
+            node = leafNodes[FirstBitSet(entry.subset)];
+            continue;
+        }
+
+        Uint32 left = partitions[entry.subset];
+        Uint32 right = entry.subset ^ left;
+
+        // the first child must lie on the lower side of the split axis (traversal order depends on it)
+        const Vector4 centersDiff = boxes[right].GetCenter() - boxes[left].GetCenter();
+        const Vector4 absCentersDiff = Vector4::Abs(centersDiff);
+        Uint32 splitAxis = 0;
+        if (absCentersDiff.y > absCentersDiff[splitAxis]) splitAxis = 1;
+        if (absCentersDiff.z > absCentersDiff[splitAxis]) splitAxis = 2;
+        if (centersDiff[splitAxis] < 0.0f)
+        {
+            std::swap(left, right);
+        }
+
+        RT_ASSERT(numUsedPairs < treelet.numPairs);
+        const Uint32 pairIndex = treelet.pairs[numUsedPairs++];
+
+        node.min = boxes[entry.subset].min.ToFloat3();
+        node.max = boxes[entry.subset].max.ToFloat3();
+        node.childIndex = pairIndex;
+        node.numLeaves = 0;
+        node.splitAxis = splitAxis;
+
+        stack[stackSize++] = { left, pairIndex };
+        stack[stackSize++] = { right, pairIndex + 1 };
+    }
+
+    RT_ASSERT(numUsedPairs == treelet.numPairs);
+    return true;
+}
+
+} // namespace rt
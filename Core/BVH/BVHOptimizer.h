@@ -0,0 +1,95 @@
+#pragma once
+
+#include "RayLib.h"
+#include "BVH.h"
+
+#include <atomic>
+
+class Timer;
+
+namespace rt {
+
+class ThreadPool;
+
+// post-build pass improving quality of an existing BVH using treelet restructuring
+// Small treelets (a node and a few of its descendants) are rearranged into the topology that minimizes SAH cost.
+// Leaves and the leaves order are left untouched, so the pass can be applied to any BVH produced by BVHBuilder.
+// See: T. Karras, T. Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies", 2013
+class RAYLIB_API BVHOptimizer
+{
+public:
+
+    // max supported number of treelet leaves (the cost of optimal topology search grows as 3^n)
+    constexpr static Uint32 MaxTreeletSize = 8;
+
+    struct OptimizationParams
+    {
+        Uint32 maxIterations;   // max number of bottom-up restructuring passes over the whole tree
+        float timeBudget;       // in seconds, zero means no limit
+        Uint32 treeletSize;     // number of treelet leaves (3..MaxTreeletSize)
+
+        // optional thread pool for optimizing subtrees in parallel
+        ThreadPool* threadPool;
+
+        OptimizationParams()
+            : maxIterations(3)
+            , timeBudget(0.0f)
+            , treeletSize(7)
+            , threadPool(nullptr)
+        { }
+    };
+
+    BVHOptimizer(BVH& targetBVH);
+
+    // restructure the tree in-place
+    // Stops early when a pass does not improve the SAH cost or the time budget is exceeded.
+    bool Optimize(const OptimizationParams& params);
+
+private:
+
+    // minimum number of treelet roots per task to be worth processing in parallel
+    constexpr static Uint32 MinNodesPerTask = 1024;
+
+    // how often (in number of processed treelets) the time budget is checked
+    constexpr static Uint32 TimeCheckInterval = 64;
+
+    struct Treelet
+    {
+        Uint32 numLeaves;
+        Uint32 leaves[MaxTreeletSize];          // indices of treelet leaf nodes
+        Uint32 numPairs;
+        Uint32 pairs[MaxTreeletSize - 1];       // first indices of sibling pairs owned by the treelet's inner nodes
+        float cost;                             // total surface area of the treelet's inner nodes
+    };
+
+    // restructure treelets in the subtree in bottom-up order
+    // returns number of modified treelets
+    Uint32 OptimizeSubtree(Uint32 nodeIndex, Uint32& numVisited);
+
+    // process nodes above the tasks level (single threaded, after the tasks are done)
+    Uint32 OptimizeTopLevel(Uint32 nodeIndex, Uint32 depth);
+
+    // collect subtree roots to be processed as separate tasks
+    void CollectTasks(Uint32 nodeIndex, Uint32 depth, DynArray<Uint32>& outTasks) const;
+
+    // form a treelet rooted at given node and replace its topology with the optimal one
+    // returns true if the treelet was modified
+    bool RestructureTreelet(Uint32 rootIndex) const;
+
+    bool FormTreelet(Uint32 rootIndex, Treelet& outTreelet) const;
+
+    bool IsOutOfTime();
+
+    OptimizationParams mParams;
+    Uint32 mTasksDepth;
+
+    Timer* mTimer;
+    std::atomic<bool> mOutOfTime;
+
+    // target BVH
+    BVH& mTarget;
+    BVH::Node* mNodes;
+};
+
+
+} // namespace rt
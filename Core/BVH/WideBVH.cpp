@@ -0,0 +1,186 @@
+#include "PCH.h"
+#include "WideBVH.h"
+#include "Utils/Logger.h"
+
+
+namespace rt {
+
+using namespace math;
+
+template<Uint32 Width>
+WideBVH<Width>::WideBVH()
+    : mExternalNodes(nullptr)
+    , mNumExternalNodes(0)
+{ }
+
+template<Uint32 Width>
+void WideBVH<Width>::Clear()
+{
+    mNodeReplicas.Clear();
+    mNodes.Clear();
+    mExternalNodes = nullptr;
+    mNumExternalNodes = 0;
+}
+
+template<Uint32 Width>
+void WideBVH<Width>::AttachExternalNodes(const Node* nodes, Uint32 numNodes)
+{
+    RT_ASSERT(nodes || numNodes == 0);
+    RT_ASSERT((reinterpret_cast<size_t>(nodes) % alignof(Node)) == 0, "Wide BVH nodes are not aligned");
+
+    mNodeReplicas.Clear();
+    mNodes.Clear(true);
+    mExternalNodes = nodes;
+    mNumExternalNodes = numNodes;
+}
+
+template<Uint32 Width>
+bool WideBVH<Width>::ReplicateNodes(ThreadPool& threadPool) const
+{
+    if (!mNodeReplicas.Build(GetNodes(), GetNumNodes(), threadPool))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for wide BVH nodes replicas");
+        return false;
+    }
+
+    return true;
+}
+
+template<Uint32 Width>
+bool WideBVH<Width>::Build(const BVH& source)
+{
+    Clear();
+
+    if (source.GetNumNodes() == 0)
+    {
+        return true;
+    }
+
+    // upper bound for number of nodes (each wide node consumes at least one binary inner node)
+    if (!mNodes.Reserve(source.GetNumNodes() / 2 + 1))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for wide BVH");
+        return false;
+    }
+
+    mNodes.Resize(1);
+
+    const BVH::Node& sourceRoot = source.GetNodes()[0];
+    if (sourceRoot.IsLeaf())
+    {
+        // binary tree is a single leaf - generate root with one child
+        Node& root = mNodes[0];
+        for (Uint32 i = 0; i < Width; ++i)
+        {
+            root.minX[i] = root.minY[i] = root.minZ[i] = std::numeric_limits<float>::infinity();
+            root.maxX[i] = root.maxY[i] = root.maxZ[i] = std::numeric_limits<float>::infinity();
+            root.childIndex[i] = 0;
+            root.numLeaves[i] = 0;
+        }
+
+        root.minX[0] = sourceRoot.min.x;
+        root.minY[0] = sourceRoot.min.y;
+        root.minZ[0] = sourceRoot.min.z;
+        root.maxX[0] = sourceRoot.max.x;
+        root.maxY[0] = sourceRoot.max.y;
+        root.maxZ[0] = sourceRoot.max.z;
+        root.childIndex[0] = sourceRoot.childIndex;
+        root.numLeaves[0] = sourceRoot.numLeaves;
+    }
+    else
+    {
+        CollapseNode(source, 0, 0);
+    }
+
+    RT_LOG_INFO("Collapsed BVH to %u-wide tree (num nodes = %u)", Width, mNodes.Size());
+    return true;
+}
+
+template<Uint32 Width>
+void WideBVH<Width>::CollapseNode(const BVH& source, Uint32 sourceNodeIndex, Uint32 targetNodeIndex)
+{
+    const BVH::Node* sourceNodes = source.GetNodes();
+    const BVH::Node& sourceNode = sourceNodes[sourceNodeIndex];
+    RT_ASSERT(!sourceNode.IsLeaf());
+
+    // start with the binary node's children and keep opening the biggest inner child
+    Uint32 children[Width];
+    Uint32 numChildren = 2;
+    children[0] = sourceNode.childIndex;
+    children[1] = sourceNode.childIndex + 1;
+
+    while (numChildren < Width)
+    {
+        Uint32 bestChild = UINT32_MAX;
+        float bestArea = -1.0f;
+
+        for (Uint32 i = 0; i < numChildren; ++i)
+        {
+            const BVH::Node& child = sourceNodes[children[i]];
+            if (!child.IsLeaf())
+            {
+                const float area = child.GetBox().SurfaceArea();
+                if (area > bestArea)
+                {
+                    bestArea = area;
+                    bestChild = i;
+                }
+            }
+        }
+
+        if (bestChild == UINT32_MAX)
+        {
+            // only leaves left
+            break;
+        }
+
+        // replace the child with its own children
+        const Uint32 openedNodeIndex = children[bestChild];
+        children[bestChild] = sourceNodes[openedNodeIndex].childIndex;
+        children[numChildren++] = sourceNodes[openedNodeIndex].childIndex + 1;
+    }
+
+    // Note: target node must be accessed by index, because recursive calls may reallocate nodes array
+    for (Uint32 i = 0; i < Width; ++i)
+    {
+        Node& targetNode = mNodes[targetNodeIndex];
+
+        if (i >= numChildren)
+        {
+            targetNode.minX[i] = targetNode.minY[i] = targetNode.minZ[i] = std::numeric_limits<float>::infinity();
+            targetNode.maxX[i] = targetNode.maxY[i] = targetNode.maxZ[i] = std::numeric_limits<float>::infinity();
+            targetNode.childIndex[i] = 0;
+            targetNode.numLeaves[i] = 0;
+            continue;
+        }
+
+        const BVH::Node& child = sourceNodes[children[i]];
+        targetNode.minX[i] = child.min.x;
+        targetNode.minY[i] = child.min.y;
+        targetNode.minZ[i] = child.min.z;
+        targetNode.maxX[i] = child.max.x;
+        targetNode.maxY[i] = child.max.y;
+        targetNode.maxZ[i] = child.max.z;
+
+        if (child.IsLeaf())
+        {
+            targetNode.childIndex[i] = child.childIndex;
+            targetNode.numLeaves[i] = child.numLeaves;
+        }
+        else
+        {
+            const Uint32 newNodeIndex = mNodes.Size();
+            mNodes.Resize(newNodeIndex + 1);
+
+            mNodes[targetNodeIndex].childIndex[i] = newNodeIndex;
+            mNodes[targetNodeIndex].numLeaves[i] = 0;
+
+            CollapseNode(source, children[i], newNodeIndex);
+        }
+    }
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+} // namespace rt
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "BVH.h"
+
+#include "../Config.h"
+
+#include "../Math/Vector4.h"
+#include "../Math/Vector8.h"
+
+namespace rt {
+
+template<Uint32 Width>
+struct WideBVHTraits;
+
+template<>
+struct WideBVHTraits<4>
+{
+    using VectorType = math::Vector4;
+};
+
+template<>
+struct WideBVHTraits<8>
+{
+    using VectorType = math::Vector8;
+};
+
+// Multi-way (4 or 8 children per node) Bounding Volume Hierarchy
+// Built by collapsing a binary BVH, allows for testing all node's children at once with SIMD instructions.
+template<Uint32 Width>
+class RAYLIB_API WideBVH
+{
+public:
+    static_assert(Width == 4 || Width == 8, "Unsupported BVH width");
+
+    static constexpr Uint32 NumChildren = Width;
+    static constexpr Uint32 MaxDepth = BVH::MaxDepth;
+
+    // stack must hold all the siblings of nodes on the current path
+    static constexpr Uint32 StackSize = MaxDepth * (Width - 1);
+
+    using VectorType = typename WideBVHTraits<Width>::VectorType;
+
+    struct RT_ALIGN(64) Node
+    {
+        // children bounding boxes in SoA layout
+        // Note: unused child slots have boxes placed at infinity, so they never pass the intersection test
+        float minX[Width];
+        float minY[Width];
+        float minZ[Width];
+        float maxX[Width];
+        float maxY[Width];
+        float maxZ[Width];
+
+        // index of child node (for inner nodes) or index of the first leaf (for leaf nodes)
+        Uint32 childIndex[Width];
+
+        // number of leaves (objects) in the child, zero for inner nodes
+        Uint32 numLeaves[Width];
+
+        RT_FORCE_INLINE bool IsChildLeaf(Uint32 slot) const
+        {
+            return numLeaves[slot] != 0;
+        }
+    };
+
+    static_assert(sizeof(Node) == 32 * Width, "Invalid wide BVH node size");
+
+    WideBVH();
+    WideBVH(WideBVH&& rhs) = default;
+    WideBVH& operator = (WideBVH&& rhs) = default;
+
+    // collapse binary BVH
+    // Children of the wide node are chosen greedily by opening the binary node with largest surface area.
+    bool Build(const BVH& source);
+
+    void Clear();
+
+    // use nodes stored in external memory (e.g. memory mapped file) without copying
+    // Note: the memory must be 64-byte aligned and outlive the BVH
+    void AttachExternalNodes(const Node* nodes, Uint32 numNodes);
+
+    // make a copy of the nodes in local memory of every NUMA node of the thread pool (see NumaReplicas)
+    // Note: the copies are dropped when the tree is rebuilt
+    bool ReplicateNodes(ThreadPool& threadPool) const;
+
+    RT_FORCE_INLINE const Node* GetNodes() const { return mExternalNodes ? mExternalNodes : mNodes.Data(); }
+    RT_FORCE_INLINE Uint32 GetNumNodes() const { return mExternalNodes ? mNumExternalNodes : mNodes.Size(); }
+
+    // get nodes placed on a given NUMA node (see RenderingContext::numaNode), falls back to the original nodes
+    RT_FORCE_INLINE const Node* GetNodes(Uint32 numaNode) const { return mNodeReplicas.Get(numaNode, GetNodes()); }
+
+private:
+    WideBVH(const WideBVH&) = delete;
+    WideBVH& operator = (const WideBVH&) = delete;
+
+    void CollapseNode(const BVH& source, Uint32 sourceNodeIndex, Uint32 targetNodeIndex);
+
+    DynArray<Node> mNodes;
+
+    const Node* mExternalNodes;
+    Uint32 mNumExternalNodes;
+
+    // per NUMA node copies of the nodes (see ReplicateNodes)
+    mutable NumaReplicas<Node> mNodeReplicas;
+};
+
+extern template class WideBVH<4>;
+extern template class WideBVH<8>;
+
+// wide BVH variant used by meshes and scene
+using DefaultWideBVH = WideBVH<RT_WIDE_BVH_WIDTH>;
+
+} // namespace rt
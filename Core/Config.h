@@ -8,4 +8,10 @@
 
 // enables spectral rendering via Monte Carlo wavelength sampling
 // NOTE: this slows down everything significantly
-//#define RT_ENABLE_SPECTRAL_RENDERING
\ No newline at end of file
+//#define RT_ENABLE_SPECTRAL_RENDERING
+
+// use collapsed multi-way BVH (see WideBVH) for single ray traversal of meshes and scene
+#define RT_ENABLE_WIDE_BVH
+
+// number of children in wide BVH nodes (4 or 8)
+#define RT_WIDE_BVH_WIDTH 4
@@ -481,8 +481,8 @@ bool DynArray<ElementType>::Resize(Uint32 size, const ElementType& defaultElemen
 template<typename ElementType>
 void DynArray<ElementType>::Swap(DynArray& other)
 {
-    std::swap(this->mElements, other->mElements);
-    std::swap(this->mSize, other->mSize);
+    std::swap(this->mElements, other.mElements);
+    std::swap(this->mSize, other.mSize);
     std::swap(mAllocSize, other.mAllocSize);
 }
 
@@ -115,6 +115,9 @@ public:
     const math::Vector4 GetNormalVector(const math::Vector4& uv) const;
     bool GetMaskValue(const math::Vector4& uv) const;
 
+    // alpha masked (cut-out) materials are tested during traversal, so hits on transparent parts are skipped
+    RT_FORCE_INLINE bool HasAlphaMask() const { return maskMap != nullptr; }
+
     void EvaluateShadingData(const Wavelength& wavelength, ShadingData& shadingData) const;
 
     // sample material's BSDFs
@@ -54,6 +54,18 @@ public:
         , max(Vector4::Max(a.max, b.max))
     {}
 
+    // common part of two boxes (may be empty)
+    RT_FORCE_INLINE static const Box Intersection(const Box& a, const Box& b)
+    {
+        return { Vector4::Max(a.min, b.min), Vector4::Min(a.max, b.max) };
+    }
+
+    // check if the box is not empty (XYZ components only)
+    RT_FORCE_INLINE bool IsValid() const
+    {
+        return ((min <= max).GetMask() & 0x7) == 0x7;
+    }
+
     RT_FORCE_INLINE const Box operator + (const Vector4& offset) const
     {
         return Box{ min + offset, max + offset };
@@ -46,6 +46,44 @@ RT_INLINE float ConvertHalfToFloat(const Half value)
 #endif // RT_USE_FP16C
 }
 
+RT_INLINE Half ConvertFloatToHalf(const float value)
+{
+#ifdef RT_USE_FP16C
+    const __m128i v = _mm_cvtps_ph(_mm_set_ss(value), _MM_FROUND_TO_NEAREST_INT);
+    return static_cast<Half>(_mm_cvtsi128_si32(v));
+#else // RT_USE_FP16C
+    math::Bits32 bits;
+    bits.f = value;
+
+    const Uint32 sign = (bits.ui >> 16) & 0x8000;
+    const Uint32 absValue = bits.ui & 0x7FFFFFFF;
+
+    if (absValue >= 0x7F800000) // INF/NAN
+    {
+        return static_cast<Half>(sign | 0x7C00 | (absValue > 0x7F800000 ? 0x0200 : 0));
+    }
+    if (absValue >= 0x477FF000) // overflow
+    {
+        return static_cast<Half>(sign | 0x7C00);
+    }
+    if (absValue < 0x38800000) // denormalized half (or zero)
+    {
+        const Uint32 mantissa = (absValue & 0x007FFFFF) | 0x00800000;
+        const Uint32 shift = 126 - (absValue >> 23);
+        if (shift > 24)
+        {
+            return static_cast<Half>(sign);
+        }
+        const Uint32 rounded = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+        return static_cast<Half>(sign | rounded);
+    }
+
+    // rebias exponent and round mantissa to nearest even
+    const Uint32 rounded = absValue + 0xC8000FFF + ((absValue >> 13) & 1);
+    return static_cast<Half>(sign | (rounded >> 13));
+#endif // RT_USE_FP16C
+}
+
 
 } // namespace math
 } // namespace rt
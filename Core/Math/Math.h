@@ -239,5 +239,60 @@ RT_FORCE_INLINE Uint32 PopCount(Uint32 x)
 #endif // defined(WIN32)
 }
 
+// index of the lowest set bit
+// Note: result is undefined if x is zero
+RT_FORCE_INLINE Uint32 FirstBitSet(Uint32 x)
+{
+#if defined(WIN32)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<Uint32>(index);
+#elif defined(__LINUX__) | defined(__linux__)
+    return static_cast<Uint32>(__builtin_ctz(x));
+#endif // defined(WIN32)
+}
+
+// index of the highest set bit (floor of base-2 logarithm)
+// Note: result is undefined if x is zero
+RT_FORCE_INLINE Uint32 LastBitSet(Uint32 x)
+{
+#if defined(WIN32)
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return static_cast<Uint32>(index);
+#elif defined(__LINUX__) | defined(__linux__)
+    return 31u - static_cast<Uint32>(__builtin_clz(x));
+#endif // defined(WIN32)
+}
+
+// index of a point on the Hilbert curve filling 2^order x 2^order grid
+// Subsequent indices map to neighbouring grid cells, so traversing the grid in this order preserves 2D locality.
+RT_FORCE_INLINE Uint32 HilbertCurveIndex(Uint32 x, Uint32 y, Uint32 order)
+{
+    RT_ASSERT(order <= 16u);
+    RT_ASSERT(order == 16u || (x < (1u << order) && y < (1u << order)));
+
+    Uint32 index = 0;
+    for (Uint32 s = (1u << order) >> 1; s > 0; s >>= 1)
+    {
+        const Uint32 rx = (x & s) ? 1u : 0u;
+        const Uint32 ry = (y & s) ? 1u : 0u;
+        index += s * s * ((3u * rx) ^ ry);
+
+        // rotate the quadrant, so the curve in it starts and ends at the right corners
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1u - (x & (s - 1u));
+                y = s - 1u - (y & (s - 1u));
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return index;
+}
+
 } // namespace math
 } // namespace rt
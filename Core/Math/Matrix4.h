@@ -7,6 +7,7 @@
 #include "Vector3x8.h"
 #include "Box.h"
 #include "Ray.h"
+#include "Simd8Ray.h"
 
 
 namespace rt {
@@ -215,6 +216,16 @@ public:
         const Vector4 dir = TransformVector(ray.dir);
         return Ray::BuildUnsafe(origin, dir);
     }
+
+    // Transform 8 rays (direction is not normalized, reciprocal is approximated)
+    RT_FORCE_INLINE const Ray_Simd8 TransformRay_Unsafe(const Ray_Simd8& ray) const
+    {
+        Ray_Simd8 result;
+        result.origin = TransformPoint(ray.origin);
+        result.dir = TransformVector(ray.dir);
+        result.invDir = Vector3x8::FastReciprocal(result.dir);
+        return result;
+    }
 };
 
 
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Math.h"
+#include "Half.h"
+#include "Vector4.h"
+
+namespace rt {
+namespace math {
+
+// Unit vectors packed using octahedral mapping
+// The sphere is projected onto octahedron, which is unfolded to [-1, 1] square and quantized to signed normalized integers.
+// Quantization error is below 0.005 degree for 16-bit and below 1 degree for 8-bit components.
+
+// map unit vector onto [-1, 1] square
+RT_FORCE_INLINE void EncodeOctahedral(const Vector4& v, float& outX, float& outY)
+{
+    const float sum = Abs(v.x) + Abs(v.y) + Abs(v.z);
+    if (sum == 0.0f)
+    {
+        // degenerate vector, decoded as +Z axis
+        outX = outY = 0.0f;
+        return;
+    }
+
+    const float invSum = 1.0f / sum;
+    float x = v.x * invSum;
+    float y = v.y * invSum;
+
+    // fold the lower hemisphere
+    if (v.z < 0.0f)
+    {
+        const float foldedX = (1.0f - Abs(y)) * CopySign(1.0f, x);
+        const float foldedY = (1.0f - Abs(x)) * CopySign(1.0f, y);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    outX = x;
+    outY = y;
+}
+
+// map point of [-1, 1] square back onto unit sphere
+RT_FORCE_INLINE const Vector4 DecodeOctahedral(const float x, const float y)
+{
+    const float z = 1.0f - Abs(x) - Abs(y);
+
+    // unfold the lower hemisphere
+    const float t = Max(-z, 0.0f);
+    const Vector4 v(x - CopySign(t, x), y - CopySign(t, y), z, 0.0f);
+
+    return v.Normalized3();
+}
+
+RT_FORCE_INLINE Int32 QuantizeSignedNorm(const float x, const float scale)
+{
+    return static_cast<Int32>(floorf(Clamp(x, -1.0f, 1.0f) * scale + 0.5f));
+}
+
+// pack unit vector to 2x16-bit signed normalized integers
+RT_FORCE_INLINE Uint32 PackUnitVector_32(const Vector4& v)
+{
+    float x, y;
+    EncodeOctahedral(v, x, y);
+
+    const Uint32 packedX = static_cast<Uint16>(static_cast<Int16>(QuantizeSignedNorm(x, 32767.0f)));
+    const Uint32 packedY = static_cast<Uint16>(static_cast<Int16>(QuantizeSignedNorm(y, 32767.0f)));
+    return packedX | (packedY << 16);
+}
+
+RT_FORCE_INLINE const Vector4 UnpackUnitVector_32(const Uint32 packed)
+{
+    const float x = static_cast<float>(static_cast<Int16>(packed & 0xFFFF)) / 32767.0f;
+    const float y = static_cast<float>(static_cast<Int16>(packed >> 16)) / 32767.0f;
+    return DecodeOctahedral(x, y);
+}
+
+// pack unit vector to 2x8-bit signed normalized integers
+RT_FORCE_INLINE Uint16 PackUnitVector_16(const Vector4& v)
+{
+    float x, y;
+    EncodeOctahedral(v, x, y);
+
+    const Uint32 packedX = static_cast<Uint8>(static_cast<Int8>(QuantizeSignedNorm(x, 127.0f)));
+    const Uint32 packedY = static_cast<Uint8>(static_cast<Int8>(QuantizeSignedNorm(y, 127.0f)));
+    return static_cast<Uint16>(packedX | (packedY << 8));
+}
+
+RT_FORCE_INLINE const Vector4 UnpackUnitVector_16(const Uint16 packed)
+{
+    const float x = static_cast<float>(static_cast<Int8>(packed & 0xFF)) / 127.0f;
+    const float y = static_cast<float>(static_cast<Int8>(packed >> 8)) / 127.0f;
+    return DecodeOctahedral(x, y);
+}
+
+// Unpack three unit vectors and compute their weighted sum
+// 'x' and 'y' hold octahedral coordinates of the vectors in XYZ components (W must be zero),
+// 'weights' hold the weights in XYZ components (W must be zero). All three vectors are decoded at once.
+RT_FORCE_INLINE const Vector4 InterpolateOctahedral(const Vector4& x, const Vector4& y, const Vector4& weights)
+{
+    Vector4 vz = Vector4(VECTOR_ONE) - Vector4::Abs(x) - Vector4::Abs(y);
+
+    // unfold the lower hemisphere
+    const Vector4 t = Vector4::Max(-vz, Vector4::Zero());
+    Vector4 vx = Vector4::Select(x - t, x + t, x < Vector4::Zero());
+    Vector4 vy = Vector4::Select(y - t, y + t, y < Vector4::Zero());
+
+    // normalize all the vectors and apply the weights at once
+    Vector4 lengthSqr = vx * vx;
+    lengthSqr = Vector4::MulAndAdd(vy, vy, lengthSqr);
+    lengthSqr = Vector4::MulAndAdd(vz, vz, lengthSqr);
+    const Vector4 scale = weights / Vector4::Sqrt4(lengthSqr);
+
+    Vector4::Transpose3(vx, vy, vz);
+    Vector4 result = vx * scale.SplatX();
+    result = Vector4::MulAndAdd(vy, scale.SplatY(), result);
+    result = Vector4::MulAndAdd(vz, scale.SplatZ(), result);
+    return result & Vector4::MakeMask<1, 1, 1, 0>();
+}
+
+// interpolate three unit vectors packed with PackUnitVector_32
+RT_FORCE_INLINE const Vector4 InterpolatePackedUnitVectors_32(const Uint32* packed, const Vector4& weights)
+{
+    const Vector4 x = Vector4::FromIntegers(
+        static_cast<Int16>(packed[0] & 0xFFFF), static_cast<Int16>(packed[1] & 0xFFFF), static_cast<Int16>(packed[2] & 0xFFFF), 0);
+    const Vector4 y = Vector4::FromIntegers(
+        static_cast<Int16>(packed[0] >> 16), static_cast<Int16>(packed[1] >> 16), static_cast<Int16>(packed[2] >> 16), 0);
+    return InterpolateOctahedral(x * (1.0f / 32767.0f), y * (1.0f / 32767.0f), weights);
+}
+
+// interpolate three unit vectors packed with PackUnitVector_16
+RT_FORCE_INLINE const Vector4 InterpolatePackedUnitVectors_16(const Uint16* packed, const Vector4& weights)
+{
+    const Vector4 x = Vector4::FromIntegers(
+        static_cast<Int8>(packed[0] & 0xFF), static_cast<Int8>(packed[1] & 0xFF), static_cast<Int8>(packed[2] & 0xFF), 0);
+    const Vector4 y = Vector4::FromIntegers(
+        static_cast<Int8>(packed[0] >> 8), static_cast<Int8>(packed[1] >> 8), static_cast<Int8>(packed[2] >> 8), 0);
+    return InterpolateOctahedral(x * (1.0f / 127.0f), y * (1.0f / 127.0f), weights);
+}
+
+} // namespace math
+} // namespace rt
@@ -34,6 +34,16 @@ public:
         return maxY - minY;
     }
 
+    RT_FORCE_INLINE constexpr bool operator == (const Rectangle& other) const
+    {
+        return minX == other.minX && maxX == other.maxX && minY == other.minY && maxY == other.maxY;
+    }
+
+    RT_FORCE_INLINE constexpr bool operator != (const Rectangle& other) const
+    {
+        return !(*this == other);
+    }
+
     T minX;
     T maxX;
     T minY;
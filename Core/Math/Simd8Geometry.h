@@ -161,5 +161,135 @@ RT_INLINE const VectorBool8 Intersect_TriangleRay_Simd8(
 }
 
 
+// single ray prepared for watertight intersection with 8 triangles at a time
+// Coordinates are permuted so that 'z' is the dominant axis of the ray direction and sheared,
+// so the ray becomes a unit ray along 'z' (see Intersect_TriangleRay_Watertight_Simd8)
+struct RT_ALIGN(32) WatertightRay_Simd8
+{
+    Vector8 originX, originY, originZ;
+    Vector8 shearX, shearY, shearZ;
+    Uint32 kx, ky, kz;
+
+    RT_FORCE_INLINE explicit WatertightRay_Simd8(const Ray& ray)
+    {
+        const Vector4 absDir = Vector4::Abs(ray.dir);
+        kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+
+        // preserve winding
+        if (ray.dir[kz] < 0.0f)
+        {
+            std::swap(kx, ky);
+        }
+
+        const float invDirZ = 1.0f / ray.dir[kz];
+        shearX = Vector8(ray.dir[kx] * invDirZ);
+        shearY = Vector8(ray.dir[ky] * invDirZ);
+        shearZ = Vector8(invDirZ);
+
+        originX = Vector8(ray.origin[kx]);
+        originY = Vector8(ray.origin[ky]);
+        originZ = Vector8(ray.origin[kz]);
+    }
+};
+
+// Intersect single ray with 8 triangles
+// Based on "Watertight Ray/Triangle Intersection" by Sven Woop, Carsten Benthin and Ingo Wald.
+// Edges are tested inclusively and consistently for neighbouring triangles, so hits are not missed on shared edges.
+// Returned barycentric coordinates follow Intersect_TriangleRay convention (weights of v1 and v2).
+// Note: triangles with NaN vertices (e.g. padding) never report a hit.
+RT_FORCE_INLINE const VectorBool8 Intersect_TriangleRay_Watertight_Simd8(
+    const WatertightRay_Simd8& ray,
+    const TriangleVertices_Simd8& tri,
+    const Vector8& maxDistance,
+    Vector8& outU,
+    Vector8& outV,
+    Vector8& outDist)
+{
+    const Vector8* v0 = &tri.v0.x;
+    const Vector8* v1 = &tri.v1.x;
+    const Vector8* v2 = &tri.v2.x;
+
+    // vertices relative to the ray origin
+    const Vector8 az = v0[ray.kz] - ray.originZ;
+    const Vector8 bz = v1[ray.kz] - ray.originZ;
+    const Vector8 cz = v2[ray.kz] - ray.originZ;
+
+    // shear and scale the vertices
+    const Vector8 ax = Vector8::NegMulAndAdd(ray.shearX, az, v0[ray.kx] - ray.originX);
+    const Vector8 ay = Vector8::NegMulAndAdd(ray.shearY, az, v0[ray.ky] - ray.originY);
+    const Vector8 bx = Vector8::NegMulAndAdd(ray.shearX, bz, v1[ray.kx] - ray.originX);
+    const Vector8 by = Vector8::NegMulAndAdd(ray.shearY, bz, v1[ray.ky] - ray.originY);
+    const Vector8 cx = Vector8::NegMulAndAdd(ray.shearX, cz, v2[ray.kx] - ray.originX);
+    const Vector8 cy = Vector8::NegMulAndAdd(ray.shearY, cz, v2[ray.ky] - ray.originY);
+
+    // scaled barycentric coordinates (edge functions)
+    // Note: edge function of a shared edge must be exactly negated in the neighbouring triangle. Plain "a*b - c*d"
+    // does not guarantee that when the compiler contracts it to FMA, so the difference of two explicit FMAs is used
+    // instead (it's antisymmetric in both cases). The result is scaled by 2, which cancels out in the division by det.
+    const Vector8 u = Vector8::MulAndSub(cx, by, cy * bx) - Vector8::MulAndSub(cy, bx, cx * by);
+    const Vector8 v = Vector8::MulAndSub(ax, cy, ay * cx) - Vector8::MulAndSub(ay, cx, ax * cy);
+    const Vector8 w = Vector8::MulAndSub(bx, ay, by * ax) - Vector8::MulAndSub(by, ax, bx * ay);
+
+    // all the edge functions must have the same sign (zero is accepted)
+    const Vector8 zero = Vector8::Zero();
+    const VectorBool8 allNonNegative = (u >= zero) & (v >= zero) & (w >= zero);
+    const VectorBool8 allNonPositive = (u <= zero) & (v <= zero) & (w <= zero);
+
+    const Vector8 det = u + v + w;
+
+    // scaled hit distance
+    const Vector8 t = u * (az * ray.shearZ) + v * (bz * ray.shearZ) + w * (cz * ray.shearZ);
+
+    // compare the distance without division: 0 < t / det < maxDistance
+    const Vector8 detSign = det & Vector8(-0.0f);
+    const Vector8 signedT = t ^ detSign;
+    const Vector8 absDet = det ^ detSign;
+
+    const VectorBool8 mask = (allNonNegative | allNonPositive) & (det != zero) & (signedT > zero) & (signedT < maxDistance * absDet);
+
+    const Vector8 invDet = VECTOR8_ONE / det;
+    outU = v * invDet;
+    outV = w * invDet;
+    outDist = t * invDet;
+
+    return mask;
+}
+
+// Intersect 8 rays with 8 spheres (single ray or single sphere can be splatted across the lanes)
+// Ray directions must be normalized. Returns distance to the nearest intersection in front of the ray origin.
+// The distance is computed from the point of the ray closest to the sphere center, which is much more precise
+// than solving the quadratic equation directly when the sphere is small and far away
+// (see "Precision Improvements for Ray/Sphere Intersection", Ray Tracing Gems, chapter 7).
+// Note: spheres with NaN centers (e.g. padding) never report a hit.
+RT_FORCE_INLINE const VectorBool8 Intersect_SphereRay_Simd8(
+    const Vector3x8& rayDir,
+    const Vector3x8& rayOrigin,
+    const Vector3x8& center,
+    const Vector8& radiusSqr,
+    const Vector8& maxDistance,
+    Vector8& outDist)
+{
+    const Vector3x8 f = rayOrigin - center;
+    const Vector8 b = Vector3x8::Dot(f, rayDir);
+
+    // vector from the sphere center to the closest point of the ray
+    const Vector3x8 h = Vector3x8::NegMulAndAdd(rayDir, b, f);
+    const Vector8 det = radiusSqr - Vector3x8::Dot(h, h);
+
+    // Note: negative determinant results in NaN, which fails all the comparisons below
+    const Vector8 sqrtDet = Vector8::Sqrt(det);
+    const Vector8 nearDist = -b - sqrtDet;
+    const Vector8 farDist = sqrtDet - b;
+
+    // ray origin inside the sphere
+    const Vector8 zero = Vector8::Zero();
+    const Vector8 t = Vector8::Select(nearDist, farDist, nearDist <= zero);
+
+    outDist = t;
+    return (det >= zero) & (t > zero) & (t < maxDistance);
+}
+
 } // namespace math
 } // namespace rt
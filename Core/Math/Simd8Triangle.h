@@ -29,6 +29,23 @@ public:
     { }
 };
 
+/**
+ * 8 triangles stored as vertices (SIMD version).
+ * Used by watertight intersection, which needs exact vertex positions - edges computed separately for
+ * neighbouring triangles would be rounded differently and the shared edge would not be tested consistently.
+ */
+class RT_ALIGN(32) TriangleVertices_Simd8
+{
+public:
+    Vector3x8 v0;
+    Vector3x8 v1;
+    Vector3x8 v2;
+
+    TriangleVertices_Simd8() = default;
+    TriangleVertices_Simd8(const TriangleVertices_Simd8&) = default;
+    TriangleVertices_Simd8& operator = (const TriangleVertices_Simd8&) = default;
+};
+
 
 } // namespace math
 } // namespace rt
@@ -1,16 +1,20 @@
-#include "PCH.h"
+﻿#include "PCH.h"
 
 #include "Mesh.h"
 #include "BVH/BVHBuilder.h"
+#include "BVH/BVHOptimizer.h"
 
+#include "Material/Material.h"
 #include "Rendering/Context.h"
 #include "Rendering/ShadingData.h"
 #include "Traversal/TraversalContext.h"
 
 #include "Math/Geometry.h"
 #include "Math/Simd8Geometry.h"
+#include "Math/PackedUnitVector.h"
 
 #include "Utils/Logger.h"
+#include "Utils/ThreadPool.h"
 
 
 
@@ -18,7 +22,92 @@ namespace rt {
 
 using namespace math;
 
+namespace {
+
+// vertex attributes renumbered in order of first use
+struct ReorderedVertices
+{
+    DynArray<Float3> positions;
+    DynArray<Float3> normals;
+    DynArray<Float3> tangents;
+    DynArray<Float2> texCoords;
+};
+
+// renumber vertices in order of their first use in the index buffer and remap the vertex buffer descriptor
+// Unused vertices are moved to the end. 'outVertexOrder' receives original index of each vertex.
+bool ReorderVerticesByFirstUse(DynArray<Uint32>& indexBuffer, VertexBufferDesc& desc, ReorderedVertices& outVertices, DynArray<Uint32>& outVertexOrder)
+{
+    const Uint32 numVertices = desc.numVertices;
+
+    DynArray<Uint32> newIndices;
+    if (!newIndices.Resize(numVertices, UINT32_MAX) || !outVertexOrder.Resize(numVertices))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    Uint32 numUsedVertices = 0;
+    for (Uint32& index : indexBuffer)
+    {
+        if (newIndices[index] == UINT32_MAX)
+        {
+            outVertexOrder[numUsedVertices] = index;
+            newIndices[index] = numUsedVertices++;
+        }
+        index = newIndices[index];
+    }
+
+    for (Uint32 i = 0; i < numVertices; ++i)
+    {
+        if (newIndices[i] == UINT32_MAX)
+        {
+            outVertexOrder[numUsedVertices++] = i;
+        }
+    }
+    RT_ASSERT(numUsedVertices == numVertices);
+
+    const auto remap = [&outVertexOrder, numVertices](const auto* source, auto& target) -> bool
+    {
+        if (!source)
+        {
+            return true;
+        }
+
+        if (!target.Resize(numVertices))
+        {
+            RT_LOG_ERROR("Memory allocation failed");
+            return false;
+        }
+
+        for (Uint32 i = 0; i < numVertices; ++i)
+        {
+            target[i] = source[outVertexOrder[i]];
+        }
+        return true;
+    };
+
+    if (!remap(desc.positions, outVertices.positions) ||
+        !remap(desc.normals, outVertices.normals) ||
+        !remap(desc.tangents, outVertices.tangents) ||
+        !remap(desc.texCoords, outVertices.texCoords))
+    {
+        return false;
+    }
+
+    desc.positions = outVertices.positions.Data();
+    desc.normals = desc.normals ? outVertices.normals.Data() : nullptr;
+    desc.tangents = desc.tangents ? outVertices.tangents.Data() : nullptr;
+    desc.texCoords = desc.texCoords ? outVertices.texCoords.Data() : nullptr;
+    desc.vertexIndexBuffer = indexBuffer.Data();
+    return true;
+}
+
+} // namespace
+
 Mesh::Mesh()
+    : mBVHBuildCost(0.0f)
+    , mBVHRebuildThreshold(1.5f)
+    , mBVHMaxLeafSize(4)
 {
 }
 
@@ -26,14 +115,22 @@ Mesh::~Mesh()
 {
 }
 
-bool Mesh::Initialize(const MeshDesc& desc)
+bool Mesh::Initialize(const MeshDesc& desc, ThreadPool* threadPool)
 {
     mBoundingBox = Box::Empty();
+    mPath = desc.path;
+
+    if (desc.bvhMaxLeafSize == 0)
+    {
+        RT_LOG_ERROR("Invalid BVH leaf size");
+        return false;
+    }
 
     const Float3* positions = desc.vertexBufferDesc.positions;
     const Uint32* indexBuffer = desc.vertexBufferDesc.vertexIndexBuffer;
 
     DynArray<Box> boxes;
+    DynArray<Triangle> triangles;
     boxes.Reserve(desc.vertexBufferDesc.numTriangles);
     for (Uint32 i = 0; i < desc.vertexBufferDesc.numTriangles; ++i)
     {
@@ -45,11 +142,23 @@ bool Mesh::Initialize(const MeshDesc& desc)
 
         boxes.PushBack(triBox);
 
+        if (desc.bvhSpatialSplits)
+        {
+            triangles.PushBack(Triangle(v0, v1, v2));
+        }
+
         mBoundingBox = Box(mBoundingBox, triBox);
     }
 
     BVHBuilder::BuildingParams params;
-    params.maxLeafNodeSize = 2;
+    params.maxLeafNodeSize = desc.bvhMaxLeafSize;
+    params.threadPool = threadPool;
+
+    if (desc.bvhSpatialSplits)
+    {
+        params.splitMode = BVHBuilder::SplitMode::Spatial;
+        params.triangles = triangles.Data();
+    }
 
     BVHBuilder::Indices newTrianglesOrder;
     BVHBuilder bvhBuilder(mBVH);
@@ -58,6 +167,20 @@ bool Mesh::Initialize(const MeshDesc& desc)
         return false;
     }
 
+    if (desc.bvhOptimizationPasses > 0)
+    {
+        BVHOptimizer::OptimizationParams optimizationParams;
+        optimizationParams.maxIterations = desc.bvhOptimizationPasses;
+        optimizationParams.timeBudget = desc.bvhOptimizationTimeBudget;
+        optimizationParams.threadPool = threadPool;
+
+        BVHOptimizer bvhOptimizer(mBVH);
+        if (!bvhOptimizer.Optimize(optimizationParams))
+        {
+            return false;
+        }
+    }
+
     // calculate & print stats
     {
         BVH::Stats stats;
@@ -66,6 +189,7 @@ bool Mesh::Initialize(const MeshDesc& desc)
         RT_LOG_INFO("    - max depth: %u", stats.maxDepth);
         RT_LOG_INFO("    - total surface area: %f", stats.totalNodesArea);
         RT_LOG_INFO("    - total volume: %f", stats.totalNodesVolume);
+        RT_LOG_INFO("    - SAH cost: %f", stats.sahCost);
 
         std::stringstream str;
         for (Uint32 i = 0; i < stats.leavesCountHistogram.Size(); ++i)
@@ -77,11 +201,28 @@ bool Mesh::Initialize(const MeshDesc& desc)
         RT_LOG_INFO("    - leaf nodes histogram: %s", str.str().c_str());
     }
 
+    mBVHBuildCost = mBVH.CalculateSAHCost();
+    mBVHRebuildThreshold = desc.bvhRebuildThreshold;
+    mBVHMaxLeafSize = desc.bvhMaxLeafSize;
+
+    if (!mWideBVH.Build(mBVH))
+    {
+        return false;
+    }
+
+    if (!mBVH.SetNodeFormat(desc.bvhNodeFormat))
+    {
+        return false;
+    }
+
     // reorder triangles
+    // Note: with spatial splits some triangles are referenced by multiple leaves, so they are duplicated
     {
-        DynArray<Uint32> newIndexBuffer(desc.vertexBufferDesc.numTriangles * 3);
-        DynArray<Uint32> newMaterialIndexBuffer(desc.vertexBufferDesc.numTriangles);
-        for (Uint32 i = 0; i < desc.vertexBufferDesc.numTriangles; ++i)
+        const Uint32 numTriangles = newTrianglesOrder.Size();
+
+        DynArray<Uint32> newIndexBuffer(numTriangles * 3);
+        DynArray<Uint32> newMaterialIndexBuffer(numTriangles);
+        for (Uint32 i = 0; i < numTriangles; ++i)
         {
             const Uint32 newTriangleIndex = newTrianglesOrder[i];
             RT_ASSERT(newTriangleIndex < desc.vertexBufferDesc.numTriangles);
@@ -93,9 +234,18 @@ bool Mesh::Initialize(const MeshDesc& desc)
         }
 
         VertexBufferDesc vertexBufferDesc = desc.vertexBufferDesc;
+        vertexBufferDesc.numTriangles = numTriangles;
         vertexBufferDesc.vertexIndexBuffer = newIndexBuffer.Data();
         vertexBufferDesc.materialIndexBuffer = newMaterialIndexBuffer.Data();
 
+        // follow the triangles order with vertices, so neighbouring triangles share cache lines of vertex data
+        ReorderedVertices reorderedVertices;
+        mVertexOrder.Clear();
+        if (desc.reorderVertices && !ReorderVerticesByFirstUse(newIndexBuffer, vertexBufferDesc, reorderedVertices, mVertexOrder))
+        {
+            return false;
+        }
+
         if (!mVertexBuffer.Initialize(vertexBufferDesc))
         {
             RT_LOG_ERROR("Failed to initialize vertex buffer");
@@ -103,36 +253,382 @@ bool Mesh::Initialize(const MeshDesc& desc)
         }
     }
 
-    // TODO reorder indices
+    if (!BuildLeafTriangles())
+    {
+        return false;
+    }
+
+    mFlatShadingData.Clear();
+    if (desc.flatShadingData && !BuildFlatShadingData())
+    {
+        return false;
+    }
 
     RT_LOG_INFO("Mesh '%s' created successfully", !desc.path.empty() ? desc.path.c_str() : "unnamed");
     return true;
 }
 
+bool Mesh::InitializeFromCache(const MeshCachePtr& cache, const MeshDesc& desc)
+{
+    if (!cache || !cache->mHeader)
+    {
+        RT_LOG_ERROR("Invalid mesh cache");
+        return false;
+    }
+
+    const MeshCacheHeader& header = *cache->mHeader;
+    RT_ASSERT(header.bvhNodeFormat == static_cast<Uint32>(desc.bvhNodeFormat));
+
+    mBoundingBox = Box(Vector4(header.boundingBoxMin), Vector4(header.boundingBoxMax));
+    mPath = desc.path;
+
+    VertexBuffer::RawData vertexData;
+    vertexData.buffer = cache->GetSection(header.vertexBufferOffset);
+    vertexData.bufferSize = header.vertexBufferSize;
+    vertexData.triangles = reinterpret_cast<const ProcessedTriangle*>(cache->GetSection(header.trianglesOffset));
+    vertexData.numVertices = header.numVertices;
+    vertexData.numTriangles = header.numTriangles;
+
+    if (!mVertexBuffer.InitializeFromRawData(vertexData, desc.vertexBufferDesc.materials, desc.vertexBufferDesc.numMaterials))
+    {
+        RT_LOG_ERROR("Failed to initialize vertex buffer");
+        return false;
+    }
+
+    mBVH.AttachExternalNodes(
+        reinterpret_cast<const BVH::Node*>(cache->GetSection(header.bvhNodesOffset)),
+        header.numBVHNodes,
+        desc.bvhNodeFormat,
+        reinterpret_cast<const BVH::QuantizedNode*>(cache->GetSection(header.quantizedBVHNodesOffset)));
+
+    mWideBVH.AttachExternalNodes(
+        reinterpret_cast<const DefaultWideBVH::Node*>(cache->GetSection(header.wideBVHNodesOffset)),
+        header.numWideBVHNodes);
+
+    mCache = cache;
+
+    // Note: vertex order is needed only when updating vertex positions, so it's copied instead of keeping a view of the cache
+    mVertexOrder.Clear();
+    if (header.vertexOrderSize > 0)
+    {
+        const Uint32* vertexOrder = reinterpret_cast<const Uint32*>(cache->GetSection(header.vertexOrderOffset));
+        if (!mVertexOrder.Resize(header.numVertices))
+        {
+            RT_LOG_ERROR("Memory allocation failed");
+            return false;
+        }
+        memcpy(mVertexOrder.Data(), vertexOrder, sizeof(Uint32) * header.numVertices);
+    }
+
+    mBVHBuildCost = mBVH.CalculateSAHCost();
+    mBVHRebuildThreshold = desc.bvhRebuildThreshold;
+    mBVHMaxLeafSize = desc.bvhMaxLeafSize;
+
+    // Note: leaf triangle packs are not stored in the cache, they are cheap to recreate
+    if (!BuildLeafTriangles())
+    {
+        return false;
+    }
+
+    mFlatShadingData.Clear();
+    if (desc.flatShadingData && !BuildFlatShadingData())
+    {
+        return false;
+    }
+
+    RT_LOG_INFO("Mesh '%s' loaded from cache", !desc.path.empty() ? desc.path.c_str() : "unnamed");
+    return true;
+}
+
+bool Mesh::UpdateVertexPositions(const Float3* positions, Uint32 numVertices, ThreadPool* threadPool)
+{
+    // bring positions to the vertex buffer order
+    DynArray<Float3> reorderedPositions;
+    if (!mVertexOrder.Empty() && numVertices == mVertexOrder.Size())
+    {
+        if (!reorderedPositions.Resize(numVertices))
+        {
+            RT_LOG_ERROR("Memory allocation failed");
+            return false;
+        }
+
+        for (Uint32 i = 0; i < numVertices; ++i)
+        {
+            reorderedPositions[i] = positions[mVertexOrder[i]];
+        }
+        positions = reorderedPositions.Data();
+    }
+
+    if (!mVertexBuffer.UpdatePositions(positions, numVertices))
+    {
+        return false;
+    }
+
+    // calculate triangle boxes (in the leaves order)
+    const Uint32 numTriangles = mVertexBuffer.GetNumTriangles();
+    DynArray<Box> boxes;
+    if (!boxes.Resize(numTriangles))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    const Uint32 trianglesPerTask = 16384;
+    const Uint32 numTasks = (numTriangles + trianglesPerTask - 1) / trianglesPerTask;
+
+    const auto calculateBoxesCallback = [this, &boxes, numTriangles, trianglesPerTask](Uint32 taskID, Uint32)
+    {
+        const Uint32 end = Min(numTriangles, (taskID + 1) * trianglesPerTask);
+        for (Uint32 i = taskID * trianglesPerTask; i < end; ++i)
+        {
+            // Note: use exact vertex positions, 'v0 + edge' may round inwards and shrink the box
+            Float3 v0, v1, v2;
+            mVertexBuffer.GetTriangleVertices(i, v0, v1, v2);
+            boxes[i] = Box(Vector4(v0), Vector4(v1), Vector4(v2));
+        }
+    };
+
+    if (threadPool && numTasks > 1)
+    {
+        threadPool->RunParallelTask(calculateBoxesCallback, numTasks);
+    }
+    else
+    {
+        for (Uint32 i = 0; i < numTasks; ++i)
+        {
+            calculateBoxesCallback(i, 0);
+        }
+    }
+
+    if (!mBVH.Refit(boxes.Data(), threadPool))
+    {
+        return false;
+    }
+
+    const float refittedCost = mBVH.CalculateSAHCost();
+    if (refittedCost > mBVHBuildCost * mBVHRebuildThreshold)
+    {
+        RT_LOG_INFO("Refitted BVH SAH cost increased from %.4f to %.4f, rebuilding BVH of mesh '%s'",
+                    mBVHBuildCost, refittedCost, !mPath.empty() ? mPath.c_str() : "unnamed");
+
+        if (!RebuildBVH(boxes, threadPool))
+        {
+            return false;
+        }
+    }
+
+    if (!mWideBVH.Build(mBVH))
+    {
+        return false;
+    }
+
+    if (!BuildLeafTriangles())
+    {
+        return false;
+    }
+
+    mBoundingBox = numTriangles > 0 ? mBVH.GetNodes()[0].GetBox() : Box::Empty();
+    return true;
+}
+
+bool Mesh::RebuildBVH(const DynArray<Box>& triangleBoxes, ThreadPool* threadPool)
+{
+    const BVH::NodeFormat nodeFormat = mBVH.GetNodeFormat();
+
+    // Note: spatial splits are not used here, triangles duplicated by the initial build are treated as separate ones
+    BVHBuilder::BuildingParams params;
+    params.maxLeafNodeSize = mBVHMaxLeafSize;
+    params.threadPool = threadPool;
+
+    BVHBuilder::Indices newTrianglesOrder;
+    BVHBuilder bvhBuilder(mBVH);
+    if (!bvhBuilder.Build(triangleBoxes.Data(), triangleBoxes.Size(), params, newTrianglesOrder))
+    {
+        return false;
+    }
+
+    if (!mVertexBuffer.ReorderTriangles(newTrianglesOrder.Data()))
+    {
+        return false;
+    }
+
+    if (!mFlatShadingData.Empty() && !BuildFlatShadingData())
+    {
+        return false;
+    }
+
+    mBVHBuildCost = mBVH.CalculateSAHCost();
+
+    return mBVH.SetNodeFormat(nodeFormat);
+}
+
+bool Mesh::ReplicateData(ThreadPool& threadPool) const
+{
+    if (!mBVH.ReplicateNodes(threadPool) || !mWideBVH.ReplicateNodes(threadPool) || !mVertexBuffer.ReplicateTriangles(threadPool))
+    {
+        return false;
+    }
+
+    if (!mLeafTrianglesReplicas.Build(mLeafTriangles.Data(), mLeafTriangles.Size(), threadPool) ||
+        !mLeafTrianglesOffsetsReplicas.Build(mLeafTrianglesOffsets.Data(), mLeafTrianglesOffsets.Size(), threadPool) ||
+        !mLeafAlphaMasksReplicas.Build(mLeafAlphaMasks.Data(), mLeafAlphaMasks.Size(), threadPool))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for leaf triangles replicas of mesh '%s'", !mPath.empty() ? mPath.c_str() : "unnamed");
+        return false;
+    }
+
+    return true;
+}
+
+bool Mesh::BuildLeafTriangles()
+{
+    mLeafTrianglesReplicas.Clear();
+    mLeafTrianglesOffsetsReplicas.Clear();
+    mLeafAlphaMasksReplicas.Clear();
+
+    const BVH::Node* nodes = mBVH.GetNodes();
+
+    // collect leaves reachable from the root
+    // Note: the nodes array may contain unused slots, so it can't be simply iterated
+    DynArray<const BVH::Node*> leaves;
+    Uint32 numPacks = 0;
+    if (mBVH.GetNumNodes() > 0 && mVertexBuffer.GetNumTriangles() > 0)
+    {
+        Uint32 stackSize = 0;
+        const BVH::Node* nodesStack[BVH::MaxDepth];
+        nodesStack[stackSize++] = nodes;
+
+        while (stackSize > 0)
+        {
+            const BVH::Node* node = nodesStack[--stackSize];
+            if (node->IsLeaf())
+            {
+                leaves.PushBack(node);
+                numPacks += (node->numLeaves + 7) / 8;
+            }
+            else
+            {
+                nodesStack[stackSize++] = nodes + node->childIndex;
+                nodesStack[stackSize++] = nodes + node->childIndex + 1;
+            }
+        }
+    }
+
+    if (!mLeafTriangles.Resize(numPacks) || !mLeafAlphaMasks.Resize(numPacks, 0u) || !mLeafTrianglesOffsets.Resize(mVertexBuffer.GetNumTriangles()))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    Uint32 packIndex = 0;
+    for (const BVH::Node* node : leaves)
+    {
+        mLeafTrianglesOffsets[node->childIndex] = packIndex;
+
+        for (Uint32 j = 0; j < node->numLeaves; j += 8)
+        {
+            Uint8& alphaMask = mLeafAlphaMasks[packIndex];
+            TriangleVertices_Simd8& pack = mLeafTriangles[packIndex++];
+
+            for (Uint32 lane = 0; lane < 8; ++lane)
+            {
+                // unused lanes are filled with NaNs, so they never pass the intersection test
+                const float nan = std::numeric_limits<float>::quiet_NaN();
+                Float3 v0(nan, nan, nan), v1(nan, nan, nan), v2(nan, nan, nan);
+                if (j + lane < node->numLeaves)
+                {
+                    const Uint32 triangleIndex = node->childIndex + j + lane;
+                    mVertexBuffer.GetTriangleVertices(triangleIndex, v0, v1, v2);
+
+                    // Note: triangles using object's default material are always opaque
+                    VertexIndices indices;
+                    mVertexBuffer.GetVertexIndices(triangleIndex, indices);
+                    if (indices.materialIndex != UINT32_MAX)
+                    {
+                        const Material* material = mVertexBuffer.GetMaterial(indices.materialIndex);
+                        if (material && material->HasAlphaMask())
+                        {
+                            alphaMask |= static_cast<Uint8>(1u << lane);
+                        }
+                    }
+                }
+
+                pack.v0.x[lane] = v0.x;
+                pack.v0.y[lane] = v0.y;
+                pack.v0.z[lane] = v0.z;
+                pack.v1.x[lane] = v1.x;
+                pack.v1.y[lane] = v1.y;
+                pack.v1.z[lane] = v1.z;
+                pack.v2.x[lane] = v2.x;
+                pack.v2.y[lane] = v2.y;
+                pack.v2.z[lane] = v2.z;
+            }
+        }
+    }
+
+    RT_ASSERT(packIndex == numPacks);
+    return true;
+}
+
+bool Mesh::BuildFlatShadingData()
+{
+    if (mVertexBuffer.GetNumMaterials() >= FlatTriangleShadingData::DefaultMaterial)
+    {
+        RT_LOG_WARNING("Mesh '%s' has too many materials (%u) for flat shading data, indexed shading data will be used",
+                       !mPath.empty() ? mPath.c_str() : "unnamed", mVertexBuffer.GetNumMaterials());
+        mFlatShadingData.Clear();
+        return true;
+    }
+
+    const Uint32 numTriangles = mVertexBuffer.GetNumTriangles();
+    if (!mFlatShadingData.Resize(numTriangles))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    for (Uint32 i = 0; i < numTriangles; ++i)
+    {
+        mVertexBuffer.GetFlatShadingData(i, mFlatShadingData[i]);
+    }
+
+    return true;
+}
+
 void Mesh::Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
 {
-    float distance, u, v;
+    const WatertightRay_Simd8 ray(context.ray);
+    const TriangleVertices_Simd8* packs = GetLeafTriangles(node, context.context.numaNode);
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
+    HitPoint& hitPoint = context.hitPoint;
+
+    Vector8 distance, u, v;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     context.context.localCounters.numRayTriangleTests += node.numLeaves;
-#endif // RT_ENABLE_INTERSECTION_COUNTERS
 
-    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    for (Uint32 i = 0; i < node.numLeaves; i += 8)
     {
-        const Uint32 triangleIndex = node.childIndex + i;
-        const ProcessedTriangle& tri = mVertexBuffer.GetTriangle(triangleIndex);
+        Uint32 mask = Intersect_TriangleRay_Watertight_Simd8(ray, *packs++, Vector8(hitPoint.distance), u, v, distance).GetMask();
+        const Uint32 alphaMask = *alphaMasks++;
 
-        if (Intersect_TriangleRay(context.ray, Vector4(&tri.v0.x), Vector4(&tri.edge1.x), Vector4(&tri.edge2.x), u, v, distance))
+        // pick the closest hit
+        while (mask)
         {
-            HitPoint& hitPoint = context.hitPoint;
+            const Uint32 lane = FirstBitSet(mask);
+            mask &= mask - 1;
 
-            if (distance < hitPoint.distance)
+            if (distance[lane] < hitPoint.distance)
             {
-                hitPoint.distance = distance;
-                hitPoint.subObjectId = triangleIndex;
+                if ((alphaMask & (1u << lane)) && !EvaluateAlphaMask(node.childIndex + i + lane, u[lane], v[lane]))
+                {
+                    continue;
+                }
+
+                hitPoint.distance = distance[lane];
+                hitPoint.subObjectId = node.childIndex + i + lane;
                 hitPoint.objectId = objectID;
-                hitPoint.u = u;
-                hitPoint.v = v;
+                hitPoint.u = u[lane];
+                hitPoint.v = v[lane];
 
 #ifdef RT_ENABLE_INTERSECTION_COUNTERS
                 context.context.localCounters.numPassedRayTriangleTests++;
@@ -144,97 +640,126 @@ void Mesh::Traverse_Leaf_Single(const SingleTraversalContext& context, const Uin
 
 bool Mesh::Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const
 {
-    float distance, u, v;
+    const WatertightRay_Simd8 ray(context.ray);
+    const TriangleVertices_Simd8* packs = GetLeafTriangles(node, context.context.numaNode);
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
+    HitPoint& hitPoint = context.hitPoint;
+
+    Vector8 distance, u, v;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     context.context.localCounters.numRayTriangleTests += node.numLeaves;
-#endif // RT_ENABLE_INTERSECTION_COUNTERS
 
-    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    for (Uint32 i = 0; i < node.numLeaves; i += 8)
     {
-        const Uint32 triangleIndex = node.childIndex + i;
-        const ProcessedTriangle& tri = mVertexBuffer.GetTriangle(triangleIndex);
-        if (Intersect_TriangleRay(context.ray, Vector4(&tri.v0.x), Vector4(&tri.edge1.x), Vector4(&tri.edge2.x), u, v, distance))
+        Uint32 mask = Intersect_TriangleRay_Watertight_Simd8(ray, *packs++, Vector8(hitPoint.distance), u, v, distance).GetMask();
+        const Uint32 alphaMask = *alphaMasks++;
+
+        // any opaque hit occludes the ray, alpha masked hits must be tested one by one
+        while (mask)
         {
-            HitPoint& hitPoint = context.hitPoint;
-            if (distance < hitPoint.distance)
+            const Uint32 lane = FirstBitSet(mask);
+            mask &= mask - 1;
+
+            if ((alphaMask & (1u << lane)) && !EvaluateAlphaMask(node.childIndex + i + lane, u[lane], v[lane]))
             {
-                hitPoint.distance = distance;
+                continue;
+            }
+
+            hitPoint.distance = distance[lane];
 
 #ifdef RT_ENABLE_INTERSECTION_COUNTERS
-                context.context.localCounters.numPassedRayTriangleTests++;
+            context.context.localCounters.numPassedRayTriangleTests++;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
-                return true;
-            }
+            return true;
         }
     }
 
     return false;
 }
 
-/*
 void Mesh::Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
 {
-    const VectorInt8 objectIndexVec(objectID);
-
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
     Vector8 distance, u, v;
     Triangle_Simd8 tri;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     context.context.localCounters.numRayTriangleTests += 8 * node.numLeaves;
-#endif // RT_ENABLE_INTERSECTION_COUNTERS
 
     for (Uint32 i = 0; i < node.numLeaves; ++i)
     {
-        HitPoint_Simd8& hitPoint = context.hitPoint;
         const Uint32 triangleIndex = node.childIndex + i;
-        const VectorInt8 triangleIndexVec(triangleIndex);
 
-        mVertexBuffer.GetTriangle(triangleIndex, tri);
+        mVertexBuffer.GetTriangle(triangleIndex, tri, context.context.numaNode);
 
-        const Vector8 mask = Intersect_TriangleRay_Simd8(context.ray.dir, context.ray.origin, tri, hitPoint.distance, u, v, distance);
-        const Uint32 intMask = mask.GetSignMask();
-
-        // TODO triangle & object filtering
-        if (intMask)
+        VectorBool8 mask = Intersect_TriangleRay_Simd8(context.ray.dir, context.ray.origin, tri, context.hitPoint.distance, u, v, distance);
+        if (alphaMasks[i / 8] & (1u << (i % 8)))
         {
-            // combine results according to mask
-            hitPoint.u = Vector8::SelectBySign(hitPoint.u, u, mask);
-            hitPoint.v = Vector8::SelectBySign(hitPoint.v, v, mask);
-            hitPoint.distance = Vector8::SelectBySign(hitPoint.distance, distance, mask);
-            hitPoint.subObjectId = VectorInt8::SelectBySign(hitPoint.subObjectId, triangleIndexVec, VectorInt8::Cast(mask));
-            hitPoint.objectId = VectorInt8::SelectBySign(hitPoint.objectId, objectIndexVec, VectorInt8::Cast(mask));
+            mask = FilterAlphaMask_Simd8(triangleIndex, mask, u, v);
+        }
+
+        context.StoreIntersection(distance, u, v, mask, objectID, triangleIndex);
 
 #ifdef RT_ENABLE_INTERSECTION_COUNTERS
-            context.context.localCounters.numPassedRayTriangleTests += PopCount(intMask);
+        context.context.localCounters.numPassedRayTriangleTests += PopCount(mask.GetMask());
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
+    }
+}
+
+void Mesh::Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const
+{
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
+    Vector8 distance, u, v;
+    Triangle_Simd8 tri;
+
+    context.context.localCounters.numRayTriangleTests += 8 * node.numLeaves;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const Uint32 triangleIndex = node.childIndex + i;
+
+        mVertexBuffer.GetTriangle(triangleIndex, tri, context.context.numaNode);
+
+        VectorBool8 mask = Intersect_TriangleRay_Simd8(context.ray.dir, context.ray.origin, tri, context.hitPoint.distance, u, v, distance);
+        if (alphaMasks[i / 8] & (1u << (i % 8)))
+        {
+            mask = FilterAlphaMask_Simd8(triangleIndex, mask, u, v);
         }
+
+        context.StoreOcclusion(mask);
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        context.context.localCounters.numPassedRayTriangleTests += PopCount(mask.GetMask());
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
     }
 }
-*/
 
 void Mesh::Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, const Uint32 numActiveGroups) const
 {
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
     Vector8 distance, u, v;
     Triangle_Simd8 tri;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     context.context.localCounters.numRayTriangleTests += 8 * node.numLeaves * numActiveGroups;
-#endif // RT_ENABLE_INTERSECTION_COUNTERS
 
     for (Uint32 i = 0; i < node.numLeaves; ++i)
     {
         const Uint32 triangleIndex = node.childIndex + i;
         const Vector8 triangleIndexVec(triangleIndex);
 
-        mVertexBuffer.GetTriangle(triangleIndex, tri);
+        mVertexBuffer.GetTriangle(triangleIndex, tri, context.context.numaNode);
+
+        const bool isAlphaTested = (alphaMasks[i / 8] & (1u << (i % 8))) != 0;
 
         for (Uint32 j = 0; j < numActiveGroups; ++j)
         {
             RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
 
-            const VectorBool8 mask = Intersect_TriangleRay_Simd8(rayGroup.rays[1].dir, rayGroup.rays[1].origin, tri, rayGroup.maxDistances, u, v, distance);
+            VectorBool8 mask = Intersect_TriangleRay_Simd8(rayGroup.rays[1].dir, rayGroup.rays[1].origin, tri, rayGroup.maxDistances, u, v, distance);
+            if (isAlphaTested)
+            {
+                mask = FilterAlphaMask_Simd8(triangleIndex, mask, u, v);
+            }
 
             context.StoreIntersection(rayGroup, distance, u, v, mask, objectID, triangleIndex);
 
@@ -245,10 +770,94 @@ void Mesh::Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uin
     }
 }
 
+Uint32 Mesh::Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, const Uint32 numActiveGroups) const
+{
+    const Uint8* alphaMasks = GetLeafAlphaMasks(node, context.context.numaNode);
+    Vector8 distance, u, v;
+    Triangle_Simd8 tri;
+
+    Uint32 numOccludedRays = 0;
+
+    context.context.localCounters.numRayTriangleTests += 8 * node.numLeaves * numActiveGroups;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const Uint32 triangleIndex = node.childIndex + i;
+
+        mVertexBuffer.GetTriangle(triangleIndex, tri, context.context.numaNode);
+
+        const bool isAlphaTested = (alphaMasks[i / 8] & (1u << (i % 8))) != 0;
+
+        for (Uint32 j = 0; j < numActiveGroups; ++j)
+        {
+            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+
+            // any hit within max distance occludes the ray (occluded rays can't be hit again)
+            VectorBool8 mask = Intersect_TriangleRay_Simd8(rayGroup.rays[1].dir, rayGroup.rays[1].origin, tri, rayGroup.maxDistances, u, v, distance);
+            if (isAlphaTested)
+            {
+                mask = FilterAlphaMask_Simd8(triangleIndex, mask, u, v);
+            }
+
+            numOccludedRays += context.StoreOcclusion(rayGroup, mask);
+        }
+    }
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    context.context.localCounters.numPassedRayTriangleTests += numOccludedRays;
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+    return numOccludedRays;
+}
+
+bool Mesh::EvaluateAlphaMask(const Uint32 triangleIndex, const float u, const float v) const
+{
+    VertexIndices indices;
+    mVertexBuffer.GetVertexIndices(triangleIndex, indices);
+
+    const Material* material = mVertexBuffer.GetMaterial(indices.materialIndex);
+    RT_ASSERT(material && material->HasAlphaMask());
+
+    VertexShadingData vertexShadingData[3];
+    mVertexBuffer.GetShadingData(indices, vertexShadingData[0], vertexShadingData[1], vertexShadingData[2]);
+
+    const Vector4 texCoord0(vertexShadingData[0].texCoord.x, vertexShadingData[0].texCoord.y, 0.0f, 0.0f);
+    const Vector4 texCoord1(vertexShadingData[1].texCoord.x, vertexShadingData[1].texCoord.y, 0.0f, 0.0f);
+    const Vector4 texCoord2(vertexShadingData[2].texCoord.x, vertexShadingData[2].texCoord.y, 0.0f, 0.0f);
+    Vector4 texCoord = Vector4(u) * texCoord1;
+    texCoord = Vector4::MulAndAdd(Vector4(v), texCoord2, texCoord);
+    texCoord = Vector4::MulAndAdd(Vector4(1.0f - u - v), texCoord0, texCoord);
+
+    return material->GetMaskValue(texCoord);
+}
+
+const VectorBool8 Mesh::FilterAlphaMask_Simd8(const Uint32 triangleIndex, const VectorBool8 mask, const Vector8& u, const Vector8& v) const
+{
+    const Uint32 hitMask = mask.GetMask();
+    if (hitMask == 0)
+    {
+        return mask;
+    }
+
+    bool passed[8];
+    for (Uint32 lane = 0; lane < 8; ++lane)
+    {
+        passed[lane] = (hitMask & (1u << lane)) && EvaluateAlphaMask(triangleIndex, u[lane], v[lane]);
+    }
+
+    return VectorBool8(passed[0], passed[1], passed[2], passed[3], passed[4], passed[5], passed[6], passed[7]);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Mesh::EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outData, const Material* defaultMaterial) const
  {
+    if (!mFlatShadingData.Empty())
+    {
+        EvaluateFlatShadingData_Single(hitPoint, outData, defaultMaterial);
+        return;
+    }
+
     VertexIndices indices;
     mVertexBuffer.GetVertexIndices(hitPoint.subObjectId, indices); // TODO cache this in MeshIntersectionData?
 
@@ -298,6 +907,47 @@ void Mesh::EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& out
     outData.frame[2] = normal;
 }
 
+void Mesh::EvaluateFlatShadingData_Single(const HitPoint& hitPoint, ShadingData& outData, const Material* defaultMaterial) const
+{
+    const FlatTriangleShadingData& data = mFlatShadingData[hitPoint.subObjectId];
+
+    if (data.materialIndex == FlatTriangleShadingData::DefaultMaterial)
+    {
+        outData.material = defaultMaterial;
+    }
+    else
+    {
+        outData.material = mVertexBuffer.GetMaterial(data.materialIndex);
+    }
+
+    const Vector4 coeff1 = Vector4(hitPoint.u);
+    const Vector4 coeff2 = Vector4(hitPoint.v);
+    const Vector4 coeff0 = Vector4(VECTOR_ONE) - (coeff1 + coeff2);
+
+    // texture coordinates of all three vertices: (u0, v0, u1, v1) and (u2, v2)
+    const Vector4 texCoord01 = Vector4::FromHalves(data.texCoords[0]);
+    const Vector4 texCoord2(ConvertHalfToFloat(data.texCoords[2][0]), ConvertHalfToFloat(data.texCoords[2][1]), 0.0f, 0.0f);
+    Vector4 texCoord = coeff1 * texCoord01.Swizzle<2, 3, 2, 3>();
+    texCoord = Vector4::MulAndAdd(coeff2, texCoord2, texCoord);
+    texCoord = Vector4::MulAndAdd(coeff0, texCoord01, texCoord);
+    texCoord &= Vector4::MakeMask<1, 1, 0, 0>();
+    RT_ASSERT(texCoord.IsValid());
+    outData.texCoord = texCoord;
+
+    // barycentric weights of the vertices
+    const Vector4 weights(coeff0.x, hitPoint.u, hitPoint.v, 0.0f);
+
+    Vector4 tangent = InterpolatePackedUnitVectors_16(data.tangents, weights);
+    tangent.FastNormalize3();
+    RT_ASSERT(tangent.IsValid());
+    outData.frame[0] = tangent;
+
+    Vector4 normal = InterpolatePackedUnitVectors_32(data.normals, weights);
+    normal.Normalize3();
+    RT_ASSERT(normal.IsValid());
+    outData.frame[2] = normal;
+}
+
 const Vector4 ShadingData::LocalToWorld(const Vector4& localCoords) const
 {
     Vector4 result = frame[0] * localCoords.x;
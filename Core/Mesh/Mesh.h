@@ -1,27 +1,61 @@
-#pragma once
+﻿#pragma once
 
 #include "../RayLib.h"
 
 #include "VertexBuffer.h"
+#include "MeshCache.h"
 
 #include "../Traversal/HitPoint.h"
 #include "../BVH/BVH.h"
+#include "../BVH/WideBVH.h"
 
 #include "../Math/Box.h"
 #include "../Math/Ray.h"
 #include "../Math/Simd8Ray.h"
+#include "../Math/Simd8Triangle.h"
 
 
 namespace rt {
 
+class ThreadPool;
 struct ShadingData;
 struct SingleTraversalContext;
 struct PacketTraversalContext;
+struct SimdTraversalContext;
 
 struct MeshDesc
 {
     VertexBufferDesc vertexBufferDesc;
     std::string path;
+
+    // quantized nodes reduce memory bandwidth during single ray traversal at cost of slightly looser boxes
+    BVH::NodeFormat bvhNodeFormat = BVH::NodeFormat::Full;
+
+    // build BVH with spatial splits (SBVH), big triangles may be referenced by multiple leaves
+    bool bvhSpatialSplits = false;
+
+    // max number of triangles in a BVH leaf (see BVHBuilder::BuildingParams::maxLeafNodeSize)
+    // Single rays intersect all the triangles of a leaf at once, so leaves of up to 8 triangles are cheap
+    Uint32 bvhMaxLeafSize = 4;
+
+    // number of treelet restructuring passes applied after the BVH is built (0 disables the optimization)
+    // Improves traversal performance at cost of longer build time, see BVHOptimizer
+    Uint32 bvhOptimizationPasses = 0;
+
+    // time limit for the BVH optimization (in seconds, 0 means no limit)
+    float bvhOptimizationTimeBudget = 0.0f;
+
+    // when vertices are updated, the BVH is refitted unless its SAH cost grows by this factor
+    // (relative to the last full build) - then it's rebuilt from scratch
+    float bvhRebuildThreshold = 1.5f;
+
+    // store quantized shading data of each triangle's vertices contiguously (see FlatTriangleShadingData)
+    // Speeds up shading data evaluation at cost of 32 extra bytes per triangle and a small precision loss
+    bool flatShadingData = false;
+
+    // renumber vertices in order of their first use by triangles (which are stored in the BVH leaves order)
+    // Improves locality of shading data fetches. Positions passed to Mesh::UpdateVertexPositions stay in the original order.
+    bool reorderVertices = true;
 };
 
 
@@ -35,34 +69,131 @@ public:
     RAYLIB_API ~Mesh();
 
     // Initialize the mesh
-    RAYLIB_API bool Initialize(const MeshDesc& desc);
+    // 'threadPool' is optional, used for parallel BVH building and optimization
+    RAYLIB_API bool Initialize(const MeshDesc& desc, ThreadPool* threadPool = nullptr);
+
+    // Initialize the mesh using data stored in a mesh cache (see MeshCache)
+    // Only materials and path are taken from the descriptor. The mesh keeps the cache file mapped.
+    RAYLIB_API bool InitializeFromCache(const MeshCachePtr& cache, const MeshDesc& desc);
+
+    // Update vertex positions (e.g. animated or deforming mesh), the topology must stay the same
+    // Positions are given in the original vertices order. BVH nodes are refitted (in parallel if a thread pool
+    // is provided) or the BVH is rebuilt if the tree quality degrades too much (see MeshDesc::bvhRebuildThreshold).
+    // Note: shading data is not modified and the scene BVH must be rebuilt afterwards.
+    RAYLIB_API bool UpdateVertexPositions(const math::Float3* positions, Uint32 numVertices, ThreadPool* threadPool = nullptr);
+
+    // Make a copy of the traversal data (BVH nodes and triangles) in local memory of every NUMA node of the thread pool
+    // Does nothing if the copies are up to date. Updating the mesh drops the copies (see RenderingParams::replicateSceneData).
+    RAYLIB_API bool ReplicateData(ThreadPool& threadPool) const;
 
     RT_FORCE_INLINE const math::Box& GetBoundingBox() const { return mBoundingBox; }
     RT_FORCE_INLINE const BVH& GetBVH() const { return mBVH; }
+    RT_FORCE_INLINE const DefaultWideBVH& GetWideBVH() const { return mWideBVH; }
+    RT_FORCE_INLINE const VertexBuffer& GetVertexBuffer() const { return mVertexBuffer; }
 
     // Intersect ray(s) with BVH leaf
     void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
     void Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, const Uint32 numActiveGroups) const;
+    void Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
 
     // Intersect shadow ray(s) with BVH leaf
     // Returns true if any hit was found
     bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const;
 
+    // Returns number of newly occluded rays
+    Uint32 Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, const Uint32 numActiveGroups) const;
+
+    // Occluded lanes are marked in the hit point (see SimdTraversalContext::StoreOcclusion)
+    void Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const;
+
     // Calculate input data for shading routine
     void EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData, const Material* defaultMaterial) const;
 
 private:
 
+    // build BVH over the current triangles and reorder them accordingly
+    bool RebuildBVH(const DynArray<math::Box>& triangleBoxes, ThreadPool* threadPool);
+
+    // gather triangles of each BVH leaf into SIMD-8 packs (see mLeafTriangles)
+    // Must be called whenever the BVH leaves or vertex positions change
+    bool BuildLeafTriangles();
+
+    // pack shading data of all the triangles (in the BVH leaves order, see mFlatShadingData)
+    // Must be called whenever the triangles are reordered
+    bool BuildFlatShadingData();
+
+    void EvaluateFlatShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData, const Material* defaultMaterial) const;
+
+    // get first SIMD-8 pack of triangles of a leaf
+    // 'numaNode' selects node-local copies of the packs (see ReplicateData)
+    RT_FORCE_INLINE const math::TriangleVertices_Simd8* GetLeafTriangles(const BVH::Node& node, const Uint32 numaNode) const
+    {
+        return mLeafTrianglesReplicas.Get(numaNode, mLeafTriangles.Data()) + GetLeafTrianglesOffset(node, numaNode);
+    }
+
+    // get alpha tested lanes of the first SIMD-8 pack of a leaf (see mLeafAlphaMasks)
+    RT_FORCE_INLINE const Uint8* GetLeafAlphaMasks(const BVH::Node& node, const Uint32 numaNode) const
+    {
+        return mLeafAlphaMasksReplicas.Get(numaNode, mLeafAlphaMasks.Data()) + GetLeafTrianglesOffset(node, numaNode);
+    }
+
+    RT_FORCE_INLINE Uint32 GetLeafTrianglesOffset(const BVH::Node& node, const Uint32 numaNode) const
+    {
+        return mLeafTrianglesOffsetsReplicas.Get(numaNode, mLeafTrianglesOffsets.Data())[node.childIndex];
+    }
+
+    // any-hit test of a triangle with alpha masked material
+    // Returns false if the hit point lies in a cut-out part of the triangle
+    bool EvaluateAlphaMask(const Uint32 triangleIndex, const float u, const float v) const;
+
+    // reject lanes hitting cut-out parts of a triangle (used by packet and SIMD-8 traversal)
+    const math::VectorBool8 FilterAlphaMask_Simd8(const Uint32 triangleIndex, const math::VectorBool8 mask, const math::Vector8& u, const math::Vector8& v) const;
+
     // bounding box after scaling
     math::Box mBoundingBox;
 
     // vertex data
     VertexBuffer mVertexBuffer;
 
+    // original index of each vertex of the vertex buffer (empty if the vertices were not reordered)
+    DynArray<Uint32> mVertexOrder;
+
     // bounding volume hierarchy for tracing acceleration
     BVH mBVH;
 
+    // exact vertices of leaves' triangles in structure of arrays layout, used by single ray traversal
+    // Each leaf occupies one pack (or more for oversized leaves), unused lanes hold NaNs
+    DynArray<math::TriangleVertices_Simd8> mLeafTriangles;
+
+    // index of the first pack of a leaf, indexed by the first triangle of the leaf
+    DynArray<Uint32> mLeafTrianglesOffsets;
+
+    // bit mask of alpha tested lanes of each pack (parallel to mLeafTriangles)
+    // Packs of opaque triangles have zero mask, so they don't pay for the any-hit test
+    DynArray<Uint8> mLeafAlphaMasks;
+
+    // per NUMA node copies of the leaf packs (see ReplicateData)
+    mutable NumaReplicas<math::TriangleVertices_Simd8> mLeafTrianglesReplicas;
+    mutable NumaReplicas<Uint32> mLeafTrianglesOffsetsReplicas;
+    mutable NumaReplicas<Uint8> mLeafAlphaMasksReplicas;
+
+    // quantized per-triangle shading data (empty if the mesh uses the indexed shading data only)
+    DynArray<FlatTriangleShadingData> mFlatShadingData;
+
+    // the same hierarchy collapsed to multi-way tree
+    DefaultWideBVH mWideBVH;
+
+    // SAH cost of the BVH after the last full build (used to decide when refitting is not enough)
+    float mBVHBuildCost;
+    float mBVHRebuildThreshold;
+    Uint32 mBVHMaxLeafSize;
+
     std::string mPath;
+
+    // memory mapped cache file (if the mesh was loaded from cache)
+    MeshCachePtr mCache;
+
+    friend class MeshCache;
 };
 
 using MeshPtr = std::shared_ptr<Mesh>;
@@ -0,0 +1,237 @@
+#include "PCH.h"
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "Utils/Logger.h"
+
+
+namespace rt {
+
+using namespace math;
+
+// Note: bump the version whenever layout of any stored structure or mesh building algorithm changes
+static const Uint32 MeshCacheFileVersion = 2;
+static const Uint32 MeshCacheMagic = 'rtmc';
+
+// all the sections are aligned, so they can be used directly from the mapped memory
+static const Uint64 MeshCacheSectionAlignment = RT_CACHE_LINE_SIZE;
+
+namespace {
+
+// append a section to the file (padded to the sections alignment)
+bool WriteSection(FILE* file, const void* data, Uint64 size, Uint64& fileOffset, Uint64& outSectionOffset)
+{
+    static const Uint8 zeros[MeshCacheSectionAlignment] = { 0 };
+
+    const Uint64 paddingSize = RoundUp(fileOffset, MeshCacheSectionAlignment) - fileOffset;
+    if (paddingSize > 0 && fwrite(zeros, 1, paddingSize, file) != paddingSize)
+    {
+        return false;
+    }
+
+    outSectionOffset = fileOffset + paddingSize;
+    fileOffset = outSectionOffset + size;
+
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// check if a section read from the file header lies within the file and is properly aligned
+bool IsSectionValid(Uint64 offset, Uint64 size, Uint64 fileSize)
+{
+    return (offset % MeshCacheSectionAlignment == 0) && offset <= fileSize && size <= fileSize - offset;
+}
+
+} // namespace
+
+MeshCache::MeshCache()
+    : mHeader(nullptr)
+{ }
+
+MeshCache::~MeshCache()
+{
+    Close();
+}
+
+Uint32 MeshCache::CalculateBuildParamsHash(const MeshDesc& desc)
+{
+    Uint32 hash = Hash(MeshCacheFileVersion);
+    hash = Hash(hash ^ static_cast<Uint32>(desc.bvhNodeFormat));
+    hash = Hash(hash ^ static_cast<Uint32>(desc.bvhSpatialSplits));
+    hash = Hash(hash ^ static_cast<Uint32>(desc.reorderVertices));
+    hash = Hash(hash ^ desc.bvhMaxLeafSize);
+    hash = Hash(hash ^ desc.bvhOptimizationPasses);
+    hash = Hash(hash ^ static_cast<Uint32>(desc.bvhOptimizationTimeBudget * 1000.0f));
+    hash = Hash(hash ^ static_cast<Uint32>(DefaultWideBVH::NumChildren));
+    return hash;
+}
+
+bool MeshCache::Save(const std::string& filePath, const Mesh& mesh, const MeshDesc& desc, Uint64 sourceKey, const ArrayView<const Uint8>& userData)
+{
+    const VertexBuffer::RawData vertexData = mesh.mVertexBuffer.GetRawData();
+    const BVH& bvh = mesh.mBVH;
+    const DefaultWideBVH& wideBvh = mesh.mWideBVH;
+
+    if (bvh.GetNodeFormat() != desc.bvhNodeFormat)
+    {
+        RT_LOG_ERROR("Mesh was not initialized with given descriptor");
+        return false;
+    }
+
+    FILE* file = fopen(filePath.c_str(), "wb");
+    if (!file)
+    {
+        RT_LOG_ERROR("Failed to open mesh cache file '%s' for writing. Error code: %i", filePath.c_str(), errno);
+        return false;
+    }
+
+    MeshCacheHeader header = {};
+    header.magic = MeshCacheMagic;
+    header.version = MeshCacheFileVersion;
+    header.sourceKey = sourceKey;
+    header.buildParamsHash = CalculateBuildParamsHash(desc);
+    header.numVertices = vertexData.numVertices;
+    header.numTriangles = vertexData.numTriangles;
+    header.numBVHNodes = bvh.GetNumNodes();
+    header.numWideBVHNodes = wideBvh.GetNumNodes();
+    header.bvhNodeFormat = static_cast<Uint32>(bvh.GetNodeFormat());
+    header.boundingBoxMin = mesh.mBoundingBox.min.ToFloat3();
+    header.boundingBoxMax = mesh.mBoundingBox.max.ToFloat3();
+    header.vertexBufferSize = vertexData.bufferSize;
+    header.vertexOrderSize = sizeof(Uint32) * mesh.mVertexOrder.Size();
+    header.userDataSize = userData.Size();
+
+    // header is written twice: at first as a placeholder, then with all the offsets filled
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    Uint64 fileOffset = sizeof(header);
+    success = success && WriteSection(file, vertexData.buffer, vertexData.bufferSize, fileOffset, header.vertexBufferOffset);
+    success = success && WriteSection(file, vertexData.triangles, sizeof(ProcessedTriangle) * vertexData.numTriangles, fileOffset, header.trianglesOffset);
+    success = success && WriteSection(file, mesh.mVertexOrder.Data(), header.vertexOrderSize, fileOffset, header.vertexOrderOffset);
+    success = success && WriteSection(file, bvh.GetNodes(), sizeof(BVH::Node) * bvh.GetNumNodes(), fileOffset, header.bvhNodesOffset);
+
+    if (bvh.GetNodeFormat() == BVH::NodeFormat::Quantized)
+    {
+        success = success && WriteSection(file, bvh.GetQuantizedNodes(), sizeof(BVH::QuantizedNode) * bvh.GetNumNodes(), fileOffset, header.quantizedBVHNodesOffset);
+    }
+
+    success = success && WriteSection(file, wideBvh.GetNodes(), sizeof(DefaultWideBVH::Node) * wideBvh.GetNumNodes(), fileOffset, header.wideBVHNodesOffset);
+    success = success && WriteSection(file, userData.Data(), userData.Size(), fileOffset, header.userDataOffset);
+
+    header.fileSize = fileOffset;
+
+    success = success && fseek(file, 0, SEEK_SET) == 0;
+    success = success && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    fclose(file);
+
+    if (!success)
+    {
+        RT_LOG_ERROR("Failed to write mesh cache file '%s'", filePath.c_str());
+        std::remove(filePath.c_str());
+        return false;
+    }
+
+    RT_LOG_INFO("Mesh cache file '%s' written (%.2f MB)", filePath.c_str(), (double)header.fileSize / (1024.0 * 1024.0));
+    return true;
+}
+
+bool MeshCache::Open(const std::string& filePath, const MeshDesc& desc, Uint64 sourceKey)
+{
+    Close();
+
+    // missing cache file is not an error
+    if (FILE* file = fopen(filePath.c_str(), "rb"))
+    {
+        fclose(file);
+    }
+    else
+    {
+        RT_LOG_INFO("Mesh cache file '%s' does not exist", filePath.c_str());
+        return false;
+    }
+
+    if (!mFile.Open(filePath))
+    {
+        return false;
+    }
+
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(mFile.GetData());
+
+    if (mFile.GetSize() < sizeof(MeshCacheHeader) || header->magic != MeshCacheMagic)
+    {
+        RT_LOG_ERROR("Corrupted mesh cache file '%s' (invalid magic value)", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    if (header->version != MeshCacheFileVersion)
+    {
+        RT_LOG_INFO("Mesh cache file '%s' is outdated (version %u, expected %u)", filePath.c_str(), header->version, MeshCacheFileVersion);
+        Close();
+        return false;
+    }
+
+    if (header->fileSize != mFile.GetSize())
+    {
+        RT_LOG_ERROR("Corrupted mesh cache file '%s' (invalid size)", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    if (header->vertexOrderSize != 0 && header->vertexOrderSize != sizeof(Uint32) * header->numVertices)
+    {
+        RT_LOG_ERROR("Corrupted mesh cache file '%s' (invalid vertex order section)", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    // Note: sizes are calculated in 64 bits, so they can't overflow for 32-bit element counts
+    const Uint64 fileSize = header->fileSize;
+    bool sectionsValid =
+        IsSectionValid(header->vertexBufferOffset, header->vertexBufferSize, fileSize) &&
+        IsSectionValid(header->trianglesOffset, sizeof(ProcessedTriangle) * static_cast<Uint64>(header->numTriangles), fileSize) &&
+        IsSectionValid(header->vertexOrderOffset, header->vertexOrderSize, fileSize) &&
+        IsSectionValid(header->bvhNodesOffset, sizeof(BVH::Node) * static_cast<Uint64>(header->numBVHNodes), fileSize) &&
+        IsSectionValid(header->wideBVHNodesOffset, sizeof(DefaultWideBVH::Node) * static_cast<Uint64>(header->numWideBVHNodes), fileSize) &&
+        IsSectionValid(header->userDataOffset, header->userDataSize, fileSize);
+
+    if (header->bvhNodeFormat == static_cast<Uint32>(BVH::NodeFormat::Quantized))
+    {
+        sectionsValid = sectionsValid &&
+            IsSectionValid(header->quantizedBVHNodesOffset, sizeof(BVH::QuantizedNode) * static_cast<Uint64>(header->numBVHNodes), fileSize);
+    }
+
+    if (!sectionsValid)
+    {
+        RT_LOG_ERROR("Corrupted mesh cache file '%s' (invalid section)", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    if (header->sourceKey != sourceKey || header->buildParamsHash != CalculateBuildParamsHash(desc))
+    {
+        RT_LOG_INFO("Mesh cache file '%s' is outdated", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    mHeader = header;
+    return true;
+}
+
+void MeshCache::Close()
+{
+    mHeader = nullptr;
+    mFile.Close();
+}
+
+const ArrayView<const Uint8> MeshCache::GetUserData() const
+{
+    if (!mHeader)
+    {
+        return ArrayView<const Uint8>();
+    }
+
+    return ArrayView<const Uint8>(GetSection(mHeader->userDataOffset), static_cast<Uint32>(mHeader->userDataSize));
+}
+
+} // namespace rt
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../RayLib.h"
+#include "../Utils/MemoryMappedFile.h"
+#include "../Containers/ArrayView.h"
+#include "../Math/Float3.h"
+
+#include <string>
+
+namespace rt {
+
+class Mesh;
+struct MeshDesc;
+
+// mesh cache file header, followed by data sections
+struct MeshCacheHeader
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint64 sourceKey;
+    Uint32 buildParamsHash;
+
+    Uint32 numVertices;
+    Uint32 numTriangles;
+    Uint32 numBVHNodes;
+    Uint32 numWideBVHNodes;
+    Uint32 bvhNodeFormat;
+
+    math::Float3 boundingBoxMin;
+    math::Float3 boundingBoxMax;
+
+    // sections (offsets relative to the beginning of the file)
+    Uint64 vertexBufferOffset;
+    Uint64 vertexBufferSize;
+    Uint64 trianglesOffset;
+    Uint64 vertexOrderOffset;
+    Uint64 vertexOrderSize;
+    Uint64 bvhNodesOffset;
+    Uint64 quantizedBVHNodesOffset;
+    Uint64 wideBVHNodesOffset;
+    Uint64 userDataOffset;
+    Uint64 userDataSize;
+
+    Uint64 fileSize;
+};
+
+/**
+ * Binary cache of preprocessed mesh data (vertex buffer, preprocessed triangles and BVH nodes).
+ * The file is memory mapped and the mesh uses its content in place, so loading requires neither parsing nor copying.
+ */
+class RAYLIB_API MeshCache
+{
+public:
+    MeshCache();
+    ~MeshCache();
+
+    // write cache file for an initialized mesh
+    // 'sourceKey' identifies the source data (e.g. hash of the source file path, size and modification time)
+    // 'userData' is stored as-is and can hold any application specific data (e.g. materials description)
+    static bool Save(const std::string& filePath, const Mesh& mesh, const MeshDesc& desc, Uint64 sourceKey, const ArrayView<const Uint8>& userData);
+
+    // map cache file and validate it
+    // Fails if the file does not exist, is corrupted or was created from different source data or with different mesh building parameters.
+    bool Open(const std::string& filePath, const MeshDesc& desc, Uint64 sourceKey);
+
+    void Close();
+
+    const ArrayView<const Uint8> GetUserData() const;
+
+private:
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator = (const MeshCache&) = delete;
+
+    // hash of all the parameters affecting generated mesh data
+    static Uint32 CalculateBuildParamsHash(const MeshDesc& desc);
+
+    RT_FORCE_INLINE const Uint8* GetSection(Uint64 offset) const
+    {
+        return reinterpret_cast<const Uint8*>(mFile.GetData()) + offset;
+    }
+
+    MemoryMappedFile mFile;
+    const MeshCacheHeader* mHeader;
+
+    friend class Mesh;
+};
+
+using MeshCachePtr = std::shared_ptr<MeshCache>;
+
+} // namespace rt
@@ -3,12 +3,14 @@
 #include "Utils/Logger.h"
 #include "Utils/AlignmentAllocator.h"
 #include "Math/Simd8Triangle.h"
+#include "Math/PackedUnitVector.h"
 
 
 namespace rt {
 
 static_assert(sizeof(VertexIndices) == 16, "Invalid size");
 static_assert(sizeof(VertexShadingData) == 32, "Invalid size");
+static_assert(sizeof(FlatTriangleShadingData) == 32, "Invalid size");
 static_assert(alignof(VertexIndices) == 16, "Invalid alignment");
 static_assert(alignof(VertexShadingData) == 32, "Invalid alignment");
 
@@ -17,6 +19,7 @@ using namespace math;
 VertexBuffer::VertexBuffer()
     : mBuffer(nullptr)
     , mPreprocessedTriangles(nullptr)
+    , mOwnsBuffers(false)
 {
     Clear();
 }
@@ -28,23 +31,22 @@ VertexBuffer::~VertexBuffer()
 
 void VertexBuffer::Clear()
 {
-    if (mBuffer)
+    if (mOwnsBuffers)
     {
-        AlignedFree(mBuffer);
-        mBuffer = nullptr;
+        AlignedFree(const_cast<char*>(mBuffer));
+        AlignedFree(const_cast<ProcessedTriangle*>(mPreprocessedTriangles));
     }
 
-    if (mPreprocessedTriangles)
-    {
-        AlignedFree(mPreprocessedTriangles);
-        mPreprocessedTriangles = nullptr;
-    }
+    mBuffer = nullptr;
+    mPreprocessedTriangles = nullptr;
+    mOwnsBuffers = false;
+    mTriangleReplicas.Clear();
 
     mNumVertices = 0;
     mNumTriangles = 0;
     mVertexIndexBufferOffset = 0;
     mShadingDataBufferOffset = 0;
-    mMaterialBufferOffset = 0;
+    mBufferSize = 0;
 
     mMaterials.Clear();
 }
@@ -78,25 +80,19 @@ bool VertexBuffer::Initialize(const VertexBufferDesc& desc)
 
     const size_t preprocessedTrianglesBufferSize = sizeof(ProcessedTriangle) * desc.numTriangles;
     const size_t positionsBufferSize = sizeof(Float3) * desc.numVertices;
-    const size_t indexBufferSize = sizeof(VertexIndices) * desc.numTriangles;
-    const size_t shadingDataBufferSize = sizeof(VertexShadingData) * desc.numVertices;
-    const size_t materialBufferSize = sizeof(Material*) * desc.numMaterials;
-
-    mVertexIndexBufferOffset = RoundUp<size_t>(positionsBufferSize, alignof(VertexIndices));
-    mShadingDataBufferOffset = RoundUp<size_t>(mVertexIndexBufferOffset + indexBufferSize, alignof(VertexShadingData));
-    mMaterialBufferOffset = mShadingDataBufferOffset + shadingDataBufferSize;
+    const size_t bufferSizeRequired = CalculateBufferLayout(desc.numVertices, desc.numTriangles);
 
-    const size_t bufferSizeRequired = mMaterialBufferOffset + materialBufferSize;
-
-
-    RT_LOG_DEBUG("Allocating vertex buffer for mesh, size = %u", bufferSizeRequired);
-    mBuffer = (char*)AlignedMalloc(bufferSizeRequired, RT_CACHE_LINE_SIZE);
-    if (!mBuffer)
+    RT_LOG_DEBUG("Allocating vertex buffer for mesh, size = %zu", bufferSizeRequired);
+    char* buffer = (char*)AlignedMalloc(bufferSizeRequired, RT_CACHE_LINE_SIZE);
+    if (!buffer)
     {
         RT_LOG_ERROR("Memory allocation failed");
         return false;
     }
 
+    mBuffer = buffer;
+    mOwnsBuffers = true;
+
     // validate vertices
     {
         for (Uint32 i = 0; i < desc.numVertices; ++i)
@@ -105,36 +101,12 @@ bool VertexBuffer::Initialize(const VertexBufferDesc& desc)
         }
     }
 
-    // preprocess triangles
-    {
-        mPreprocessedTriangles = (ProcessedTriangle*)AlignedMalloc(preprocessedTrianglesBufferSize, RT_CACHE_LINE_SIZE);
-        if (!mPreprocessedTriangles)
-        {
-            RT_LOG_ERROR("Memory allocation failed");
-            return false;
-        }
-
-        const Float3* positions = desc.positions;
-        const Uint32* indexBuffer = desc.vertexIndexBuffer;
-
-        for (Uint32 i = 0; i < desc.numTriangles; ++i)
-        {
-            const Vector4 v0(positions[indexBuffer[3 * i + 0]]);
-            const Vector4 v1(positions[indexBuffer[3 * i + 1]]);
-            const Vector4 v2(positions[indexBuffer[3 * i + 2]]);
-
-            mPreprocessedTriangles[i].v0 = v0.ToFloat3();
-            mPreprocessedTriangles[i].edge1 = (v1 - v0).ToFloat3();
-            mPreprocessedTriangles[i].edge2 = (v2 - v0).ToFloat3();
-        }
-    }
-
     // fill index buffer
     {
-        VertexIndices* buffer = reinterpret_cast<VertexIndices*>(mBuffer + mVertexIndexBufferOffset);
+        VertexIndices* indexBuffer = reinterpret_cast<VertexIndices*>(buffer + mVertexIndexBufferOffset);
         for (Uint32 i = 0; i < desc.numTriangles; ++i)
         {
-            VertexIndices& indices = buffer[i];
+            VertexIndices& indices = indexBuffer[i];
 
             indices.i0 = desc.vertexIndexBuffer[3 * i];
             indices.i1 = desc.vertexIndexBuffer[3 * i + 1];
@@ -148,44 +120,211 @@ bool VertexBuffer::Initialize(const VertexBufferDesc& desc)
         }
     }
 
-    memcpy(mBuffer, desc.positions, positionsBufferSize);
+    memcpy(buffer, desc.positions, positionsBufferSize);
+
+    mNumVertices = desc.numVertices;
+    mNumTriangles = desc.numTriangles;
+
+    // preprocess triangles
+    {
+        ProcessedTriangle* triangles = (ProcessedTriangle*)AlignedMalloc(preprocessedTrianglesBufferSize, RT_CACHE_LINE_SIZE);
+        if (!triangles)
+        {
+            RT_LOG_ERROR("Memory allocation failed");
+            return false;
+        }
+
+        mPreprocessedTriangles = triangles;
+        PreprocessTriangles(triangles);
+    }
 
     // fill vertex shading data buffer
     {
-        VertexShadingData* buffer = reinterpret_cast<VertexShadingData*>(mBuffer + mShadingDataBufferOffset);
+        VertexShadingData* shadingDataBuffer = reinterpret_cast<VertexShadingData*>(buffer + mShadingDataBufferOffset);
         for (Uint32 i = 0; i < desc.numVertices; ++i)
         {
-            buffer[i].normal = desc.normals ? desc.normals[i] : Float3();
-            buffer[i].tangent = desc.tangents ? desc.tangents[i] : Float3();
-            buffer[i].texCoord = desc.texCoords ? desc.texCoords[i] : Float2();
-
-            RT_ASSERT(buffer[i].normal.IsValid(), "Corrupted normal vector");
-            RT_ASSERT(buffer[i].tangent.IsValid(), "Corrupted tangent vector");
-            RT_ASSERT(buffer[i].texCoord.IsValid(), "Corrupted texture coordinates");
-            RT_ASSERT(Abs(1.0f - buffer[i].normal.Length()) < 0.0001f, "Normal vector is not normalized");
-            RT_ASSERT(Abs(1.0f - buffer[i].tangent.Length()) < 0.0001f, "Tangent vector is not normalized");
-            RT_ASSERT(Abs(Float3::Dot(buffer[i].normal, buffer[i].tangent)) < 0.0001f, "Normal and tangent vectors are not orthogonal");
+            VertexShadingData& data = shadingDataBuffer[i];
+            data.normal = desc.normals ? desc.normals[i] : Float3();
+            data.tangent = desc.tangents ? desc.tangents[i] : Float3();
+            data.texCoord = desc.texCoords ? desc.texCoords[i] : Float2();
+
+            RT_ASSERT(data.normal.IsValid(), "Corrupted normal vector");
+            RT_ASSERT(data.tangent.IsValid(), "Corrupted tangent vector");
+            RT_ASSERT(data.texCoord.IsValid(), "Corrupted texture coordinates");
+            RT_ASSERT(Abs(1.0f - data.normal.Length()) < 0.0001f, "Normal vector is not normalized");
+            RT_ASSERT(Abs(1.0f - data.tangent.Length()) < 0.0001f, "Tangent vector is not normalized");
+            RT_ASSERT(Abs(Float3::Dot(data.normal, data.tangent)) < 0.0001f, "Normal and tangent vectors are not orthogonal");
         }
     }
 
-    if (desc.numMaterials > 0u)
+    mMaterials.Resize(desc.numMaterials);
+    for (Uint32 i = 0; i < desc.numMaterials; ++i)
     {
-        Material** buffer = reinterpret_cast<Material**>(mBuffer + mMaterialBufferOffset);
+        mMaterials[i] = desc.materials[i];
+    }
 
-        mMaterials.Resize(desc.numMaterials);
-        for (Uint32 i = 0; i < desc.numMaterials; ++i)
-        {
-            buffer[i] = desc.materials[i].get();
-            mMaterials[i] = desc.materials[i];
-        }
+    return true;
+}
+
+bool VertexBuffer::InitializeFromRawData(const RawData& data, const MaterialPtr* materials, Uint32 numMaterials)
+{
+    Clear();
+
+    const size_t bufferSizeRequired = CalculateBufferLayout(data.numVertices, data.numTriangles);
+    if (data.bufferSize != bufferSizeRequired)
+    {
+        RT_LOG_ERROR("Invalid vertex buffer size: %zu (expected %zu)", data.bufferSize, bufferSizeRequired);
+        Clear();
+        return false;
     }
 
-    mNumVertices = desc.numVertices;
-    mNumTriangles = desc.numTriangles;
+    if ((reinterpret_cast<size_t>(data.buffer) % alignof(VertexShadingData)) != 0 ||
+        (reinterpret_cast<size_t>(data.triangles) % alignof(ProcessedTriangle)) != 0)
+    {
+        RT_LOG_ERROR("Vertex buffer data is not properly aligned");
+        Clear();
+        return false;
+    }
+
+    mBuffer = reinterpret_cast<const char*>(data.buffer);
+    mPreprocessedTriangles = data.triangles;
+    mNumVertices = data.numVertices;
+    mNumTriangles = data.numTriangles;
+
+    mMaterials.Resize(numMaterials);
+    for (Uint32 i = 0; i < numMaterials; ++i)
+    {
+        mMaterials[i] = materials[i];
+    }
+
+    return true;
+}
+
+const VertexBuffer::RawData VertexBuffer::GetRawData() const
+{
+    RawData data;
+    data.buffer = mBuffer;
+    data.bufferSize = mBufferSize;
+    data.triangles = mPreprocessedTriangles;
+    data.numVertices = mNumVertices;
+    data.numTriangles = mNumTriangles;
+    return data;
+}
+
+bool VertexBuffer::UpdatePositions(const Float3* positions, Uint32 numVertices)
+{
+    if (numVertices != mNumVertices)
+    {
+        RT_LOG_ERROR("Invalid number of vertices: %u (expected %u)", numVertices, mNumVertices);
+        return false;
+    }
+
+    if (!DetachExternalBuffers())
+    {
+        return false;
+    }
+
+    for (Uint32 i = 0; i < numVertices; ++i)
+    {
+        RT_ASSERT(positions[i].IsValid(), "Corrupted vertex position");
+    }
+
+    memcpy(const_cast<char*>(mBuffer), positions, sizeof(Float3) * numVertices);
+    PreprocessTriangles(const_cast<ProcessedTriangle*>(mPreprocessedTriangles));
+
+    return true;
+}
+
+bool VertexBuffer::ReorderTriangles(const Uint32* newOrder)
+{
+    if (!DetachExternalBuffers())
+    {
+        return false;
+    }
+
+    VertexIndices* indexBuffer = reinterpret_cast<VertexIndices*>(const_cast<char*>(mBuffer) + mVertexIndexBufferOffset);
+    ProcessedTriangle* triangles = const_cast<ProcessedTriangle*>(mPreprocessedTriangles);
+
+    DynArray<VertexIndices> oldIndices;
+    DynArray<ProcessedTriangle> oldTriangles;
+    if (!oldIndices.Resize(mNumTriangles) || !oldTriangles.Resize(mNumTriangles))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    memcpy(oldIndices.Data(), indexBuffer, sizeof(VertexIndices) * mNumTriangles);
+    memcpy(oldTriangles.Data(), triangles, sizeof(ProcessedTriangle) * mNumTriangles);
+
+    for (Uint32 i = 0; i < mNumTriangles; ++i)
+    {
+        RT_ASSERT(newOrder[i] < mNumTriangles);
+        indexBuffer[i] = oldIndices[newOrder[i]];
+        triangles[i] = oldTriangles[newOrder[i]];
+    }
+
+    return true;
+}
+
+bool VertexBuffer::DetachExternalBuffers()
+{
+    // Note: called before any modification of the buffers, so the copies would become stale
+    mTriangleReplicas.Clear();
+
+    if (mOwnsBuffers || mNumTriangles == 0)
+    {
+        return true;
+    }
 
+    char* buffer = (char*)AlignedMalloc(mBufferSize, RT_CACHE_LINE_SIZE);
+    ProcessedTriangle* triangles = (ProcessedTriangle*)AlignedMalloc(sizeof(ProcessedTriangle) * mNumTriangles, RT_CACHE_LINE_SIZE);
+    if (!buffer || !triangles)
+    {
+        AlignedFree(buffer);
+        AlignedFree(triangles);
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    memcpy(buffer, mBuffer, mBufferSize);
+    memcpy(triangles, mPreprocessedTriangles, sizeof(ProcessedTriangle) * mNumTriangles);
+
+    mBuffer = buffer;
+    mPreprocessedTriangles = triangles;
+    mOwnsBuffers = true;
     return true;
 }
 
+void VertexBuffer::PreprocessTriangles(ProcessedTriangle* triangles) const
+{
+    const Float3* positions = reinterpret_cast<const Float3*>(mBuffer);
+    const VertexIndices* indexBuffer = reinterpret_cast<const VertexIndices*>(mBuffer + mVertexIndexBufferOffset);
+
+    for (Uint32 i = 0; i < mNumTriangles; ++i)
+    {
+        const Vector4 v0(positions[indexBuffer[i].i0]);
+        const Vector4 v1(positions[indexBuffer[i].i1]);
+        const Vector4 v2(positions[indexBuffer[i].i2]);
+
+        triangles[i].v0 = v0.ToFloat3();
+        triangles[i].edge1 = (v1 - v0).ToFloat3();
+        triangles[i].edge2 = (v2 - v0).ToFloat3();
+    }
+}
+
+size_t VertexBuffer::CalculateBufferLayout(Uint32 numVertices, Uint32 numTriangles)
+{
+    const size_t positionsBufferSize = sizeof(Float3) * numVertices;
+    const size_t indexBufferSize = sizeof(VertexIndices) * numTriangles;
+    const size_t shadingDataBufferSize = sizeof(VertexShadingData) * numVertices;
+
+    mVertexIndexBufferOffset = RoundUp<size_t>(positionsBufferSize, alignof(VertexIndices));
+    mShadingDataBufferOffset = RoundUp<size_t>(mVertexIndexBufferOffset + indexBufferSize, alignof(VertexShadingData));
+    mBufferSize = mShadingDataBufferOffset + shadingDataBufferSize;
+
+    return mBufferSize;
+}
+
 void VertexBuffer::GetVertexIndices(const Uint32 triangleIndex, VertexIndices& indices) const
 {
     RT_ASSERT(triangleIndex < mNumTriangles);
@@ -198,8 +337,7 @@ const Material* VertexBuffer::GetMaterial(const Uint32 materialIndex) const
 {
     RT_ASSERT(materialIndex < mMaterials.Size());
 
-    const Material** materialBufferData = reinterpret_cast<const Material**>(mBuffer + mMaterialBufferOffset);
-    return materialBufferData[materialIndex];
+    return mMaterials[materialIndex].get();
 }
 
 const math::ProcessedTriangle& VertexBuffer::GetTriangle(const Uint32 triangleIndex) const
@@ -207,14 +345,37 @@ const math::ProcessedTriangle& VertexBuffer::GetTriangle(const Uint32 triangleIn
     return mPreprocessedTriangles[triangleIndex];
 }
 
-void VertexBuffer::GetTriangle(const Uint32 triangleIndex, Triangle_Simd8& outTriangle) const
+void VertexBuffer::GetTriangle(const Uint32 triangleIndex, Triangle_Simd8& outTriangle, const Uint32 numaNode) const
 {
-    const ProcessedTriangle& tri = mPreprocessedTriangles[triangleIndex];
+    const ProcessedTriangle& tri = mTriangleReplicas.Get(numaNode, mPreprocessedTriangles)[triangleIndex];
     outTriangle.v0 = Vector3x8(tri.v0);
     outTriangle.edge1 = Vector3x8(tri.edge1);
     outTriangle.edge2 = Vector3x8(tri.edge2);
 }
 
+bool VertexBuffer::ReplicateTriangles(ThreadPool& threadPool) const
+{
+    if (!mTriangleReplicas.Build(mPreprocessedTriangles, mNumTriangles, threadPool))
+    {
+        RT_LOG_ERROR("Failed to allocate memory for triangles replicas");
+        return false;
+    }
+
+    return true;
+}
+
+void VertexBuffer::GetTriangleVertices(const Uint32 triangleIndex, Float3& outV0, Float3& outV1, Float3& outV2) const
+{
+    RT_ASSERT(triangleIndex < mNumTriangles);
+
+    const Float3* positions = reinterpret_cast<const Float3*>(mBuffer);
+    const VertexIndices& indices = reinterpret_cast<const VertexIndices*>(mBuffer + mVertexIndexBufferOffset)[triangleIndex];
+
+    outV0 = positions[indices.i0];
+    outV1 = positions[indices.i1];
+    outV2 = positions[indices.i2];
+}
+
 void VertexBuffer::GetShadingData(const VertexIndices& indices, VertexShadingData& a, VertexShadingData& b, VertexShadingData& c) const
 {
     const VertexShadingData* buffer = reinterpret_cast<const VertexShadingData*>(mBuffer + mShadingDataBufferOffset);
@@ -223,4 +384,26 @@ void VertexBuffer::GetShadingData(const VertexIndices& indices, VertexShadingDat
     c = buffer[indices.i2];
 }
 
+void VertexBuffer::GetFlatShadingData(const Uint32 triangleIndex, FlatTriangleShadingData& outData) const
+{
+    VertexIndices indices;
+    GetVertexIndices(triangleIndex, indices);
+
+    VertexShadingData vertexShadingData[3];
+    GetShadingData(indices, vertexShadingData[0], vertexShadingData[1], vertexShadingData[2]);
+
+    RT_ASSERT(indices.materialIndex == UINT32_MAX || indices.materialIndex < FlatTriangleShadingData::DefaultMaterial);
+    outData.materialIndex = indices.materialIndex == UINT32_MAX ?
+        FlatTriangleShadingData::DefaultMaterial : static_cast<Uint16>(indices.materialIndex);
+
+    for (Uint32 i = 0; i < 3; ++i)
+    {
+        const VertexShadingData& data = vertexShadingData[i];
+        outData.normals[i] = PackUnitVector_32(Vector4(data.normal));
+        outData.tangents[i] = PackUnitVector_16(Vector4(data.tangent));
+        outData.texCoords[i][0] = ConvertFloatToHalf(data.texCoord.x);
+        outData.texCoords[i][1] = ConvertFloatToHalf(data.texCoord.y);
+    }
+}
+
 } // namespace rt
@@ -6,6 +6,7 @@
 #include "../Math/Triangle.h"
 #include "../Math/Float3.h"
 #include "../Containers/DynArray.h"
+#include "../Utils/NumaReplicas.h"
 
 namespace rt {
 
@@ -30,11 +31,33 @@ struct RT_ALIGN(32) VertexShadingData
     math::Float2 texCoord;
 };
 
+// Quantized shading data of triangle's three vertices stored contiguously (see MeshDesc::flatShadingData)
+// Two triangles fit in a cache line, so evaluating shading data of a hit does not follow the vertex indices.
+struct RT_ALIGN(32) FlatTriangleShadingData
+{
+    static constexpr Uint16 DefaultMaterial = UINT16_MAX;
+
+    Uint32 normals[3];          // octahedral mapping, 2x16-bit (see PackUnitVector_32)
+    Uint16 tangents[3];         // octahedral mapping, 2x8-bit (see PackUnitVector_16)
+    Uint16 materialIndex;       // 'DefaultMaterial' if object's default material is used
+    math::Half texCoords[3][2];
+};
+
 
 // Structure containing packed mesh data (vertices, vertex indices and material indices).
 class VertexBuffer
 {
 public:
+    // raw buffers content, used for storing the vertex buffer in a mesh cache
+    struct RawData
+    {
+        const void* buffer; // vertex positions, vertex indices and vertex shading data
+        size_t bufferSize;
+        const math::ProcessedTriangle* triangles;
+        Uint32 numVertices;
+        Uint32 numTriangles;
+    };
+
     VertexBuffer();
     ~VertexBuffer();
 
@@ -44,6 +67,20 @@ public:
     // Initialize the vertex buffer with a new content
     bool Initialize(const VertexBufferDesc& desc);
 
+    // Initialize the vertex buffer with buffers stored in external memory (e.g. memory mapped file)
+    // No copy is made, so the memory must outlive the vertex buffer.
+    bool InitializeFromRawData(const RawData& data, const MaterialPtr* materials, Uint32 numMaterials);
+
+    // get raw buffers content
+    const RawData GetRawData() const;
+
+    // overwrite vertex positions (the topology stays the same) and recalculate preprocessed triangles
+    // Note: buffers stored in external memory are copied first
+    bool UpdatePositions(const math::Float3* positions, Uint32 numVertices);
+
+    // permute triangles, 'newOrder[i]' is the current index of the triangle to be placed at index 'i'
+    bool ReorderTriangles(const Uint32* newOrder);
+
     // get vertex indices for given triangle
     void GetVertexIndices(const Uint32 triangleIndex, VertexIndices& indices) const;
 
@@ -51,26 +88,52 @@ public:
     const Material* GetMaterial(const Uint32 materialIndex) const;
 
     // extract preprocessed triangle data (for one triangle)
+    // 'numaNode' selects a node-local copy of the triangles (see ReplicateTriangles)
     const math::ProcessedTriangle& GetTriangle(const Uint32 triangleIndex) const;
-    void GetTriangle(const Uint32 triangleIndex, math::Triangle_Simd8& outTriangle) const;
+    void GetTriangle(const Uint32 triangleIndex, math::Triangle_Simd8& outTriangle, const Uint32 numaNode) const;
+
+    // make a copy of the preprocessed triangles in local memory of every NUMA node of the thread pool (see NumaReplicas)
+    // Note: the copies are dropped when the triangles are modified
+    bool ReplicateTriangles(ThreadPool& threadPool) const;
+
+    // extract exact vertex positions of a triangle
+    void GetTriangleVertices(const Uint32 triangleIndex, math::Float3& outV0, math::Float3& outV1, math::Float3& outV2) const;
 
     void GetShadingData(const VertexIndices& indices, VertexShadingData& a, VertexShadingData& b, VertexShadingData& c) const;
 
+    // pack shading data of a triangle (see FlatTriangleShadingData)
+    void GetFlatShadingData(const Uint32 triangleIndex, FlatTriangleShadingData& outData) const;
+
     RT_FORCE_INLINE Uint32 GetNumVertices() const { return mNumVertices; }
     RT_FORCE_INLINE Uint32 GetNumTriangles() const { return mNumTriangles; }
+    RT_FORCE_INLINE Uint32 GetNumMaterials() const { return mMaterials.Size(); }
 
 private:
 
-    char* mBuffer;
-    math::ProcessedTriangle* mPreprocessedTriangles;
+    // calculate buffer offsets, returns required buffer size
+    size_t CalculateBufferLayout(Uint32 numVertices, Uint32 numTriangles);
+
+    // make private copy of buffers stored in external memory
+    bool DetachExternalBuffers();
+
+    void PreprocessTriangles(math::ProcessedTriangle* triangles) const;
+
+    const char* mBuffer;
+    const math::ProcessedTriangle* mPreprocessedTriangles;
 
     size_t mVertexIndexBufferOffset;
     size_t mShadingDataBufferOffset;
-    size_t mMaterialBufferOffset;
+    size_t mBufferSize;
 
     Uint32 mNumVertices;
     Uint32 mNumTriangles;
 
+    // buffers are allocated by the vertex buffer (not stored in external memory)
+    bool mOwnsBuffers;
+
+    // per NUMA node copies of the preprocessed triangles (see ReplicateTriangles)
+    mutable NumaReplicas<math::ProcessedTriangle> mTriangleReplicas;
+
     DynArray<MaterialPtr> mMaterials;
 };
 
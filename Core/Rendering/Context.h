@@ -22,6 +22,16 @@ enum class TraversalMode : Uint8
 {
     Single = 0,
     Packet,
+
+    // wavefront path tracing: all paths of a frame are extended one bounce at a time, rays of each bounce
+    // are sorted by origin and direction and traced in large packets, shading is performed in a separate stage
+    // Note: falls back to single ray traversal for renderers not supporting it (see IRenderer::Shade_Stream)
+    Stream,
+
+    // 4x2 pixel groups are traced together through SIMD-8 traversal (including all the bounces),
+    // terminated paths are masked out and shading is performed per lane
+    // Note: falls back to single ray traversal for renderers not supporting it (see IRenderer::Shade_Stream)
+    Simd8,
 };
 
 struct AdaptiveRenderingSettings
@@ -38,6 +48,16 @@ struct RenderingParams
 {
     Uint32 numThreads = 0;
 
+    // pin worker threads to logical CPUs, spread evenly across NUMA nodes
+    // Each node then renders a contiguous part of the tiles list (image rows), which is also the part of the film
+    // its threads initialize (first touch) - so the accumulation buffers end up in the node's local memory.
+    bool pinThreads = false;
+
+    // keep a copy of read-only scene data (BVH nodes and meshes' leaf triangles) in local memory of every NUMA node
+    // the threads are pinned to, so traversal doesn't access remote memory. Costs one extra copy of the data per node.
+    // Note: has no effect unless 'pinThreads' is set and the threads span more than one node
+    bool replicateSceneData = false;
+
     // Number of sample dimensions generated by low-discrepancy sampler
     // Note: If more dimensions is required during integration, random samples will be used
     Uint32 sampleDimensions = 64;
@@ -64,6 +84,10 @@ struct RenderingParams
 
     // adaptive rendering settings
     AdaptiveRenderingSettings adaptiveSettings;
+
+    // collect per-ray statistics: traversal steps histogram, rays per depth and shadow rays (see RayTracingCounters)
+    // Note: total traversal steps and intersection tests counts are always collected
+    bool collectRayStats = true;
 };
 
 struct PixelBreakpoint
@@ -97,12 +121,19 @@ struct RT_ALIGN(64) RenderingContext
     // global rendering parameters
     const RenderingParams* params = nullptr;
 
+    // NUMA node of the owning thread, selects node-local copies of the scene data (see RenderingParams::replicateSceneData)
+    // Out of range value selects the original data
+    Uint32 numaNode = UINT32_MAX;
+
     // per-thread counters
     RayTracingCounters counters;
 
     // counters used in local ray traversal routines
     LocalCounters localCounters;
 
+    // time spent on executing tasks of the current rendering stage (see Viewport)
+    double busyTime = 0.0;
+
     // for motion blur sampling
     float time = 0.0f;
 
@@ -118,6 +149,13 @@ struct RT_ALIGN(64) RenderingContext
     // TODO separate stacks for scene and mesh
     Uint8 activeRaysMask[RayPacket::MaxNumGroups];
     Uint16 activeGroupsIndices[RayPacket::MaxNumGroups];
+
+    // packet for batching shadow rays (e.g. next event estimation for many lights)
+    RayPacket shadowRayPacket;
+
+    // results of shadow rays packet traversal
+    // Bit N of M-th element is set if (8 * M + N)-th ray of the packet is occluded
+    Uint8 occludedRaysMask[RayPacket::MaxNumGroups];
 };
 
 
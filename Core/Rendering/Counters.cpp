@@ -0,0 +1,117 @@
+#include "PCH.h"
+#include "Counters.h"
+
+namespace rt {
+
+namespace {
+
+const char* const RenderingStageNames[NumRenderingStages] =
+{
+    "preRender",
+    "preRenderGlobal",
+    "render",
+    "postProcess",
+};
+
+template<typename T, Uint32 N>
+void WriteJSONArray(std::stringstream& str, const T (&values)[N])
+{
+    str << '[';
+    for (Uint32 i = 0; i < N; ++i)
+    {
+        if (i > 0)
+        {
+            str << ", ";
+        }
+        str << values[i];
+    }
+    str << ']';
+}
+
+void WriteJSON(std::stringstream& str, const TimeDistribution& distribution)
+{
+    str << "{ ";
+    str << "\"numSamples\": " << distribution.numSamples << ", ";
+    str << "\"average\": " << distribution.average << ", ";
+    str << "\"variance\": " << distribution.variance << ", ";
+    str << "\"percentile95\": " << distribution.percentile95 << ", ";
+    str << "\"max\": " << distribution.max << " }";
+}
+
+} // namespace
+
+void TimeDistribution::Compute(double* samples, Uint32 num)
+{
+    *this = TimeDistribution();
+    if (num == 0)
+    {
+        return;
+    }
+
+    numSamples = num;
+
+    double sum = 0.0;
+    for (Uint32 i = 0; i < num; ++i)
+    {
+        sum += samples[i];
+        max = std::max(max, samples[i]);
+    }
+    average = sum / static_cast<double>(num);
+
+    double sumOfSquares = 0.0;
+    for (Uint32 i = 0; i < num; ++i)
+    {
+        sumOfSquares += (samples[i] - average) * (samples[i] - average);
+    }
+    variance = sumOfSquares / static_cast<double>(num);
+
+    // nearest-rank percentile
+    const Uint32 rank = static_cast<Uint32>(std::ceil(0.95 * static_cast<double>(num)));
+    std::nth_element(samples, samples + rank - 1, samples + num);
+    percentile95 = samples[rank - 1];
+}
+
+std::string FrameStats::ToJSON() const
+{
+    std::stringstream str;
+    str << "{\n";
+    str << "    \"frameIndex\": " << frameIndex << ",\n";
+    str << "    \"numPasses\": " << numPasses << ",\n";
+    str << "    \"numThreads\": " << numThreads << ",\n";
+    str << "    \"renderTime\": " << renderTime << ",\n";
+    str << "    \"stages\": {\n";
+    for (Uint32 i = 0; i < NumRenderingStages; ++i)
+    {
+        str << "        \"" << RenderingStageNames[i] << "\": { ";
+        str << "\"wallTime\": " << stages[i].wallTime << ", ";
+        str << "\"idleTime\": " << stages[i].idleTime << " }";
+        str << (i + 1 < NumRenderingStages ? ",\n" : "\n");
+    }
+    str << "    },\n";
+    str << "    \"passTime\": ";
+    WriteJSON(str, passTime);
+    str << ",\n";
+    str << "    \"tileTime\": ";
+    WriteJSON(str, tileTime);
+    str << ",\n";
+    str << "    \"numPrimaryRays\": " << counters.numPrimaryRays << ",\n";
+    str << "    \"numRays\": " << counters.numRays << ",\n";
+    str << "    \"numShadowRays\": " << counters.numShadowRays << ",\n";
+    str << "    \"numTraversalSteps\": " << counters.numTraversalSteps << ",\n";
+    str << "    \"numRayBoxTests\": " << counters.numRayBoxTests << ",\n";
+    str << "    \"numRayTriangleTests\": " << counters.numRayTriangleTests << ",\n";
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    str << "    \"numPassedRayBoxTests\": " << counters.numPassedRayBoxTests << ",\n";
+    str << "    \"numPassedRayTriangleTests\": " << counters.numPassedRayTriangleTests << ",\n";
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+    str << "    \"numRaysPerDepth\": ";
+    WriteJSONArray(str, counters.numRaysPerDepth);
+    str << ",\n";
+    str << "    \"traversalStepsHistogram\": ";
+    WriteJSONArray(str, counters.traversalStepsHistogram);
+    str << "\n";
+    str << "}\n";
+    return str.str();
+}
+
+} // namespace rt
@@ -2,17 +2,31 @@
 
 #include "../Common.h"
 #include "../Config.h"
+#include "../Math/Math.h"
 
 
 namespace rt {
 
+// rays deeper than this are accounted in the last bucket of RayTracingCounters::numRaysPerDepth
+static constexpr Uint32 MaxCountedRayDepth = 16;
 
-struct LocalCounters
+// Number of buckets in traversal steps histogram
+// Bucket 0 holds rays that did not visit any node, bucket N > 0 holds rays that took [2^(N-1), 2^N) steps.
+static constexpr Uint32 NumTraversalStepsBuckets = 16;
+
+
+// Counters incremented in ray traversal routines
+// Traversal steps and intersection tests are always counted (the increments are cheap),
+// the passed tests require RT_ENABLE_INTERSECTION_COUNTERS.
+struct RT_ALIGN(64) LocalCounters
 {
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    // number of BVH nodes visited (per ray)
+    Uint32 numTraversalSteps;
     Uint32 numRayBoxTests;
-    Uint32 numPassedRayBoxTests;
     Uint32 numRayTriangleTests;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    Uint32 numPassedRayBoxTests;
     Uint32 numPassedRayTriangleTests;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
@@ -23,65 +37,248 @@ struct LocalCounters
 
     RT_FORCE_INLINE void Reset()
     {
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numTraversalSteps = 0;
         numRayBoxTests = 0;
-        numPassedRayBoxTests = 0;
         numRayTriangleTests = 0;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numPassedRayBoxTests = 0;
         numPassedRayTriangleTests = 0;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
     }
 };
 
 
-struct RayTracingCounters
+// Per-thread ray tracing statistics
+// Note: aligned to cache line, so threads don't share the lines when updating the counters
+struct RT_ALIGN(64) RayTracingCounters
 {
     Uint64 numPrimaryRays;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    // all the traced rays (excluding shadow rays)
+    Uint64 numRays;
+
+    // counted only if 'collectRayStats' is set (see ShadowRaysCountersScope)
+    Uint64 numShadowRays;
+
+    Uint64 numTraversalSteps;
     Uint64 numRayBoxTests;
-    Uint64 numPassedRayBoxTests;
     Uint64 numRayTriangleTests;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+    Uint64 numPassedRayBoxTests;
     Uint64 numPassedRayTriangleTests;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
+    // per-ray statistics (collected only if 'collectRayStats' is set)
+    Uint64 numRaysPerDepth[MaxCountedRayDepth];
+    Uint64 traversalStepsHistogram[NumTraversalStepsBuckets];
+
+    // runtime toggle of the per-ray statistics (not affected by Reset)
+    bool collectRayStats = true;
+
+    RT_FORCE_INLINE RayTracingCounters()
+    {
+        Reset();
+    }
 
     RT_FORCE_INLINE void Reset()
     {
         numPrimaryRays = 0;
+        numRays = 0;
+        numShadowRays = 0;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numTraversalSteps = 0;
         numRayBoxTests = 0;
-        numPassedRayBoxTests = 0;
         numRayTriangleTests = 0;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numPassedRayBoxTests = 0;
         numPassedRayTriangleTests = 0;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+        for (Uint32 i = 0; i < MaxCountedRayDepth; ++i)
+        {
+            numRaysPerDepth[i] = 0;
+        }
+
+        for (Uint32 i = 0; i < NumTraversalStepsBuckets; ++i)
+        {
+            traversalStepsHistogram[i] = 0;
+        }
     }
 
+    // get histogram bucket for given number of traversal steps
+    static RT_FORCE_INLINE Uint32 GetTraversalStepsBucket(const Uint32 numSteps)
+    {
+        if (numSteps == 0)
+        {
+            return 0;
+        }
+
+        return std::min(math::LastBitSet(numSteps) + 1u, NumTraversalStepsBuckets - 1u);
+    }
 
-    RT_FORCE_INLINE void Append(const LocalCounters& other)
+    // accumulate counters of traversal of 'numRays' rays at given path depth
+    // Note: for multiple rays, the histogram is updated with average number of steps per ray
+    RT_FORCE_INLINE void Append(const LocalCounters& other, const Uint32 depth = 0, const Uint32 count = 1)
     {
-        RT_UNUSED(other);
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
-        numRayBoxTests += other.numRayBoxTests;
-        numPassedRayBoxTests += other.numPassedRayBoxTests;
-        numRayTriangleTests += other.numRayTriangleTests;
-        numPassedRayTriangleTests += other.numPassedRayTriangleTests;
-#endif // RT_ENABLE_INTERSECTION_COUNTERS
+        numRays += count;
+        AppendTests(other);
+
+        if (collectRayStats && count > 0)
+        {
+            numRaysPerDepth[std::min(depth, MaxCountedRayDepth - 1u)] += count;
+            traversalStepsHistogram[GetTraversalStepsBucket(other.numTraversalSteps / count)] += count;
+        }
     }
 
+    // accumulate counters of shadow rays traversal
+    RT_FORCE_INLINE void AppendShadowRays(const LocalCounters& other, const Uint32 count)
+    {
+        if (collectRayStats)
+        {
+            numShadowRays += count;
+        }
+
+        AppendTests(other);
+    }
 
     void Append(const RayTracingCounters& other)
     {
         numPrimaryRays += other.numPrimaryRays;
+        numRays += other.numRays;
+        numShadowRays += other.numShadowRays;
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numTraversalSteps += other.numTraversalSteps;
         numRayBoxTests += other.numRayBoxTests;
+        numRayTriangleTests += other.numRayTriangleTests;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
         numPassedRayBoxTests += other.numPassedRayBoxTests;
+        numPassedRayTriangleTests += other.numPassedRayTriangleTests;
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+        for (Uint32 i = 0; i < MaxCountedRayDepth; ++i)
+        {
+            numRaysPerDepth[i] += other.numRaysPerDepth[i];
+        }
+
+        for (Uint32 i = 0; i < NumTraversalStepsBuckets; ++i)
+        {
+            traversalStepsHistogram[i] += other.traversalStepsHistogram[i];
+        }
+    }
+
+private:
+    RT_FORCE_INLINE void AppendTests(const LocalCounters& other)
+    {
+        numTraversalSteps += other.numTraversalSteps;
+        numRayBoxTests += other.numRayBoxTests;
         numRayTriangleTests += other.numRayTriangleTests;
+
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        numPassedRayBoxTests += other.numPassedRayBoxTests;
         numPassedRayTriangleTests += other.numPassedRayTriangleTests;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
     }
 };
 
 
+// Shadow rays are traced in the middle of shading of other ray, so their traversal
+// is accounted separately and the local counters of the shaded ray are preserved.
+// Note: intersection tests are always accounted, only the shadow rays count depends on 'collectRayStats'
+class ShadowRaysCountersScope
+{
+public:
+    RT_FORCE_INLINE ShadowRaysCountersScope(LocalCounters& localCounters, RayTracingCounters& counters, const Uint32 numRays)
+        : mLocalCounters(localCounters)
+        , mCounters(counters)
+        , mSavedCounters(localCounters)
+        , mNumRays(numRays)
+    {
+        mLocalCounters.Reset();
+    }
+
+    RT_FORCE_INLINE ~ShadowRaysCountersScope()
+    {
+        mCounters.AppendShadowRays(mLocalCounters, mNumRays);
+        mLocalCounters = mSavedCounters;
+    }
+
+private:
+    LocalCounters& mLocalCounters;
+    RayTracingCounters& mCounters;
+    LocalCounters mSavedCounters;
+    Uint32 mNumRays;
+};
+
+
+// Stages of a rendering pass (see Viewport::Render)
+enum class RenderingStage : Uint8
+{
+    PreRender,          // per-pixel pre-pass (e.g. light paths tracing in VCM), run only if the renderer needs it
+    PreRenderGlobal,    // single threaded part of the pre-pass
+    Render,             // tiles rendering (includes tiles post processing if passes are pipelined)
+    PostProcess,        // separate post processing pass
+};
+
+static constexpr Uint32 NumRenderingStages = 4;
+
+struct RenderingStageStats
+{
+    // summed time between the stage start and end
+    double wallTime = 0.0;
+
+    // time the worker threads spent waiting for other threads (summed over all the threads)
+    double idleTime = 0.0;
+};
+
+// Distribution of measured durations (e.g. tile rendering times)
+struct TimeDistribution
+{
+    Uint32 numSamples = 0;
+    double average = 0.0;
+    double variance = 0.0;
+
+    // tail latency
+    double percentile95 = 0.0;
+    double max = 0.0;
+
+    // compute the statistics from a set of samples
+    // Note: the samples array is reordered
+    RAYLIB_API void Compute(double* samples, Uint32 num);
+};
+
+
+// Statistics of a single rendered frame (see Viewport::GetFrameStats)
+struct FrameStats
+{
+    // number of passes rendered so far (including this frame)
+    Uint32 frameIndex = 0;
+
+    // number of passes rendered in this frame
+    Uint32 numPasses = 0;
+
+    Uint32 numThreads = 0;
+
+    // wall time of Viewport::Render
+    double renderTime = 0.0;
+
+    RenderingStageStats stages[NumRenderingStages];
+
+    // wall time of a single pass, collected from all the passes rendered since the viewport reset
+    // Note: pipelined passes are timed together, each of them accounts for an equal share of the time
+    TimeDistribution passTime;
+
+    // rendering time of a single tile in the last pass of the frame (not measured in stream traversal mode)
+    TimeDistribution tileTime;
+
+    RayTracingCounters counters;
+
+    // dump to JSON object
+    RAYLIB_API std::string ToJSON() const;
+};
+
+
 } // namespace rt
@@ -7,10 +7,50 @@ namespace rt {
 
 using namespace math;
 
-Film::Film(Bitmap& sum, Bitmap* secondarySum)
+namespace {
+
+// lock-free floating point addition (compare-and-swap loop on the value bits)
+RT_FORCE_INLINE void AtomicAdd(float& target, float value)
+{
+    if (value == 0.0f)
+    {
+        return;
+    }
+
+    Bits32 oldValue, newValue;
+
+#if defined(WIN32)
+    volatile long* targetBits = reinterpret_cast<volatile long*>(&target);
+    oldValue.ui = static_cast<Uint32>(*targetBits);
+    for (;;)
+    {
+        newValue.f = oldValue.f + value;
+        const long previous = _InterlockedCompareExchange(targetBits, static_cast<long>(newValue.ui), static_cast<long>(oldValue.ui));
+        if (static_cast<Uint32>(previous) == oldValue.ui)
+        {
+            break;
+        }
+        oldValue.ui = static_cast<Uint32>(previous);
+    }
+#elif defined(__LINUX__) | defined(__linux__)
+    Uint32* targetBits = reinterpret_cast<Uint32*>(&target);
+    oldValue.ui = __atomic_load_n(targetBits, __ATOMIC_RELAXED);
+    do
+    {
+        newValue.f = oldValue.f + value;
+    }
+    // Note: 'oldValue' is updated on failure
+    while (!__atomic_compare_exchange_n(targetBits, &oldValue.ui, newValue.ui, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#endif // defined(WIN32)
+}
+
+} // namespace
+
+Film::Film(Bitmap& sum, Bitmap* secondarySum, Bitmap* splatSum)
     : mFilmSize((float)sum.GetWidth(), (float)sum.GetHeight())
     , mSum(sum)
     , mSecondarySum(secondarySum) 
+    , mSplatSum(splatSum)
     , mWidth(mSum.GetWidth())
     , mHeight(mSum.GetHeight())
 {
@@ -19,6 +59,12 @@ Film::Film(Bitmap& sum, Bitmap* secondarySum)
         RT_ASSERT(mSecondarySum->GetWidth() == mWidth);
         RT_ASSERT(mSecondarySum->GetHeight() == mHeight);
     }
+
+    if (mSplatSum)
+    {
+        RT_ASSERT(mSplatSum->GetWidth() == mWidth);
+        RT_ASSERT(mSplatSum->GetHeight() == mHeight);
+    }
 }
 
 void Film::AccumulateColor(const Uint32 x, const Uint32 y, const Vector4& sampleColor)
@@ -65,6 +111,16 @@ void Film::AccumulateColor(const Vector4& pos, const Vector4& sampleColor, Rando
     {
         const size_t pixelIndex = mWidth * y + x;
 
+        if (mSplatSum)
+        {
+            // other threads may splat onto the same pixel
+            Float3& pixel = mSplatSum->GetDataAs<Float3>()[pixelIndex];
+            AtomicAdd(pixel.x, sampleColor.x);
+            AtomicAdd(pixel.y, sampleColor.y);
+            AtomicAdd(pixel.z, sampleColor.z);
+            return;
+        }
+
         mSum.GetDataAs<Float3>()[pixelIndex] += sampleColor.ToFloat3();
 
         if (mSecondarySum)
@@ -14,7 +14,9 @@ class Random;
 class Film
 {
 public:
-    Film(Bitmap& sum, Bitmap* secondarySum = nullptr);
+    // Note: if 'splatSum' is provided, samples splatted at arbitrary film positions are accumulated in it
+    // with atomic adds instead of 'sum' (the splat layer must be merged by the film owner after rendering)
+    Film(Bitmap& sum, Bitmap* secondarySum = nullptr, Bitmap* splatSum = nullptr);
 
     RT_FORCE_INLINE Uint32 GetWidth() const
     {
@@ -26,7 +28,12 @@ public:
         return mHeight;
     }
 
+    // splat a sample at a given film position
+    // Thread safe (lock-free) if the splat layer is present
     void AccumulateColor(const math::Vector4& pos, const math::Vector4& sampleColor, math::Random& randomGenerator);
+
+    // accumulate a sample in a given pixel
+    // Note: not thread safe, a pixel can be written only by the thread which renders it
     void AccumulateColor(const Uint32 x, const Uint32 y, const math::Vector4& sampleColor);
 
 private:
@@ -34,6 +41,7 @@ private:
 
     Bitmap& mSum;
     Bitmap* mSecondarySum;
+    Bitmap* mSplatSum;
 
     const Uint32 mWidth;
     const Uint32 mHeight;
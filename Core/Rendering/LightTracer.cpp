@@ -23,6 +23,11 @@ const char* LightTracer::GetName() const
     return "Light Tracer";
 }
 
+bool LightTracer::SplatsToFilm() const
+{
+    return true;
+}
+
 const RayColor LightTracer::RenderPixel(const Ray&, const RenderParam& param, RenderingContext& ctx) const
 {
     Uint32 depth = 0;
@@ -67,7 +72,7 @@ const RayColor LightTracer::RenderPixel(const Ray&, const RenderParam& param, Re
         HitPoint hitPoint;
         ctx.localCounters.Reset();
         mScene.Traverse_Single({ ray, hitPoint, ctx });
-        ctx.counters.Append(ctx.localCounters);
+        ctx.counters.Append(ctx.localCounters, depth);
 
         if (hitPoint.distance == FLT_MAX)
         {
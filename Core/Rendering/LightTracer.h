@@ -19,6 +19,7 @@ public:
 
     virtual const char* GetName() const override;
     virtual const RayColor RenderPixel(const math::Ray& ray, const RenderParam& param, RenderingContext& ctx) const override;
+    virtual bool SplatsToFilm() const override;
 
 private:
 
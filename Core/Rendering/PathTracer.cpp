@@ -51,8 +51,6 @@ const RayColor PathTracer::RenderPixel(const math::Ray& primaryRay, const Render
     HitPoint hitPoint;
     Ray ray = primaryRay;
 
-    ShadingData shadingData;
-
     RayColor resultColor = RayColor::Zero();
     RayColor throughput = RayColor::One();
 
@@ -63,84 +61,112 @@ const RayColor PathTracer::RenderPixel(const math::Ray& primaryRay, const Render
         hitPoint.distance = FLT_MAX;
         context.localCounters.Reset();
         mScene.Traverse_Single({ ray, hitPoint, context });
-        context.counters.Append(context.localCounters);
+        context.counters.Append(context.localCounters, depth);
 
-        // ray missed - return background light color
-        if (hitPoint.distance == FLT_MAX)
+        if (!ExtendPath(hitPoint, depth, ray, throughput, resultColor, context))
         {
-            resultColor.MulAndAccumulate(throughput, EvaluateGlobalLights(ray, context));
             break;
         }
 
-        // we hit a light directly
-        if (hitPoint.subObjectId == RT_LIGHT_OBJECT)
-        {
-            const ILight& light = mScene.GetLightByObjectId(hitPoint.objectId);
-            resultColor.MulAndAccumulate(throughput, EvaluateLight(light, ray, hitPoint.distance, context));
-            break;
-        }
+        depth++;
+    }
 
-        // fill up structure with shading data
-        {
-            mScene.ExtractShadingData(ray, hitPoint, context.time, shadingData);
+    return resultColor;
+}
 
-            RT_ASSERT(shadingData.material != nullptr);
-            shadingData.material->EvaluateShadingData(context.wavelength, shadingData);
-        }
+bool PathTracer::SupportsStreamRendering() const
+{
+    return true;
+}
 
-        // accumulate emission color
-        const RayColor emissionColor = RayColor::Resolve(context.wavelength, Spectrum(shadingData.material->emission.Evaluate(shadingData.texCoord)));
-        RT_ASSERT(emissionColor.IsValid());
-        resultColor.MulAndAccumulate(throughput, emissionColor);
-        RT_ASSERT(resultColor.IsValid());
+bool PathTracer::Shade_Stream(StreamPathState& path, const HitPoint& hitPoint, RenderingContext& context) const
+{
+    if (!ExtendPath(hitPoint, path.depth, path.ray, path.throughput, path.color, context))
+    {
+        return false;
+    }
 
-        // check if the ray depth won't be exeeded in the next iteration
-        if (depth >= context.params->maxRayDepth)
-        {
-            break;
-        }
+    path.depth++;
+    return true;
+}
 
-        // Russian roulette algorithm
-        if (depth >= context.params->minRussianRouletteDepth)
-        {
-            const float minColorValue = 0.125f;
-            const float threshold = minColorValue + (1.0f - minColorValue) * shadingData.materialParams.baseColor.Max();
-#ifdef RT_ENABLE_SPECTRAL_RENDERING
-            if (context.wavelength.isSingle)
-            {
-                threshold *= 1.0f / static_cast<float>(Wavelength::NumComponents);
-            }
-#endif
-            if (context.sampler->GetFloat() > threshold)
-            {
-                break;
-            }
+bool PathTracer::ExtendPath(const HitPoint& hitPoint, Uint32 depth, Ray& ray, RayColor& throughput, RayColor& resultColor, RenderingContext& context) const
+{
+    ShadingData shadingData;
 
-            throughput *= 1.0f / threshold;
-            RT_ASSERT(throughput.IsValid());
-        }
+    // ray missed - return background light color
+    if (hitPoint.distance == FLT_MAX)
+    {
+        resultColor.MulAndAccumulate(throughput, EvaluateGlobalLights(ray, context));
+        return false;
+    }
 
-        // sample BSDF
-        Vector4 incomingDirWorldSpace;
-        const RayColor bsdfValue = shadingData.material->Sample(context.wavelength, incomingDirWorldSpace, shadingData, context.sampler->GetFloat3());
+    // we hit a light directly
+    if (hitPoint.subObjectId == RT_LIGHT_OBJECT)
+    {
+        const ILight& light = mScene.GetLightByObjectId(hitPoint.objectId);
+        resultColor.MulAndAccumulate(throughput, EvaluateLight(light, ray, hitPoint.distance, context));
+        return false;
+    }
 
-        RT_ASSERT(bsdfValue.IsValid());
-        throughput *= bsdfValue;
+    // fill up structure with shading data
+    {
+        mScene.ExtractShadingData(ray, hitPoint, context.time, shadingData);
 
-        // ray is not visible anymore
-        if (throughput.AlmostZero())
+        RT_ASSERT(shadingData.material != nullptr);
+        shadingData.material->EvaluateShadingData(context.wavelength, shadingData);
+    }
+
+    // accumulate emission color
+    const RayColor emissionColor = RayColor::Resolve(context.wavelength, Spectrum(shadingData.material->emission.Evaluate(shadingData.texCoord)));
+    RT_ASSERT(emissionColor.IsValid());
+    resultColor.MulAndAccumulate(throughput, emissionColor);
+    RT_ASSERT(resultColor.IsValid());
+
+    // check if the ray depth won't be exeeded in the next iteration
+    if (depth >= context.params->maxRayDepth)
+    {
+        return false;
+    }
+
+    // Russian roulette algorithm
+    if (depth >= context.params->minRussianRouletteDepth)
+    {
+        const float minColorValue = 0.125f;
+        const float threshold = minColorValue + (1.0f - minColorValue) * shadingData.materialParams.baseColor.Max();
+#ifdef RT_ENABLE_SPECTRAL_RENDERING
+        if (context.wavelength.isSingle)
         {
-            break;
+            threshold *= 1.0f / static_cast<float>(Wavelength::NumComponents);
+        }
+#endif
+        if (context.sampler->GetFloat() > threshold)
+        {
+            return false;
         }
 
-        // generate secondary ray
-        ray = Ray(shadingData.frame.GetTranslation(), incomingDirWorldSpace);
-        ray.origin += ray.dir * 0.001f;
+        throughput *= 1.0f / threshold;
+        RT_ASSERT(throughput.IsValid());
+    }
+
+    // sample BSDF
+    Vector4 incomingDirWorldSpace;
+    const RayColor bsdfValue = shadingData.material->Sample(context.wavelength, incomingDirWorldSpace, shadingData, context.sampler->GetFloat3());
 
-        depth++;
+    RT_ASSERT(bsdfValue.IsValid());
+    throughput *= bsdfValue;
+
+    // ray is not visible anymore
+    if (throughput.AlmostZero())
+    {
+        return false;
     }
 
-    return resultColor;
+    // generate secondary ray
+    ray = Ray(shadingData.frame.GetTranslation(), incomingDirWorldSpace);
+    ray.origin += ray.dir * 0.001f;
+
+    return true;
 }
 
 } // namespace rt
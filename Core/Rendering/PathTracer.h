@@ -18,8 +18,15 @@ public:
     virtual const char* GetName() const override;
     virtual const RayColor RenderPixel(const math::Ray& ray, const RenderParam& param, RenderingContext& ctx) const override;
 
+    virtual bool SupportsStreamRendering() const override;
+    virtual bool Shade_Stream(StreamPathState& path, const HitPoint& hitPoint, RenderingContext& ctx) const override;
+
 private:
 
+    // accumulate radiance at a path vertex (hit point of the ray) and sample the next path segment
+    // Returns false if the path is terminated
+    bool ExtendPath(const HitPoint& hitPoint, Uint32 depth, math::Ray& ray, RayColor& throughput, RayColor& resultColor, RenderingContext& context) const;
+
     // compute radiance from a hit local lights
     const RayColor EvaluateLight(const ILight& light, const math::Ray& ray, float dist, RenderingContext& context) const;
 
@@ -39,7 +39,16 @@ const char* PathTracerMIS::GetName() const
     return "Path Tracer MIS";
 }
 
-const RayColor PathTracerMIS::SampleLight(const ILight& light, const ShadingData& shadingData, const PathState& pathState, RenderingContext& context) const
+// minimum number of lights in the scene for which shadow rays are traced in packets
+static const Uint32 MinLightsForShadowRayPacket = 4;
+
+// max number of shadow rays traced in a single packet
+static const Uint32 MaxShadowRaysPerPacket = 64;
+
+// minimum number of lights in the scene for which shadow rays are traced in groups of 8 (in SIMD-8 traversal mode)
+static const Uint32 MinLightsForShadowRaySimd8 = 2;
+
+bool PathTracerMIS::SampleLight_Unoccluded(const ILight& light, const ShadingData& shadingData, const PathState& pathState, RenderingContext& context, LightSample& outSample) const
 {
     const ILight::IlluminateParam illuminateParam =
     {
@@ -53,7 +62,7 @@ const RayColor PathTracerMIS::SampleLight(const ILight& light, const ShadingData
     RayColor radiance = light.Illuminate(illuminateParam, illuminateResult);
     if (radiance.AlmostZero())
     {
-        return RayColor::Zero();
+        return false;
     }
 
     RT_ASSERT(radiance.IsValid());
@@ -68,25 +77,15 @@ const RayColor PathTracerMIS::SampleLight(const ILight& light, const ShadingData
 
     if (factor.AlmostZero())
     {
-        return RayColor::Zero();
+        return false;
     }
 
     RT_ASSERT(bsdfPdfW >= 0.0f && IsValid(bsdfPdfW));
 
-    // cast shadow ray
-    {
-        HitPoint hitPoint;
-        hitPoint.distance = illuminateResult.distance * 0.999f;
-
-        Ray shadowRay(shadingData.frame.GetTranslation(), illuminateResult.directionToLight);
-        shadowRay.origin += shadingData.frame[2] * 0.0001f;
-
-        if (mScene.Traverse_Shadow_Single({ shadowRay, hitPoint, context }))
-        {
-            // shadow ray missed the light - light is occluded
-            return RayColor::Zero();
-        }
-    }
+    // prepare shadow ray
+    outSample.shadowRay = Ray(shadingData.frame.GetTranslation(), illuminateResult.directionToLight);
+    outSample.shadowRay.origin += shadingData.frame[2] * 0.0001f;
+    outSample.shadowRayDistance = illuminateResult.distance * 0.999f;
 
     float weight = 1.0f;
 
@@ -103,18 +102,130 @@ const RayColor PathTracerMIS::SampleLight(const ILight& light, const ShadingData
         weight = CombineMis(illuminateResult.directPdfW, bsdfPdfW);
     }
 
-    return (radiance * factor) * (weight / illuminateResult.directPdfW);
+    outSample.contribution = (radiance * factor) * (weight / illuminateResult.directPdfW);
+    return true;
+}
+
+const RayColor PathTracerMIS::SampleLight(const ILight& light, const ShadingData& shadingData, const PathState& pathState, RenderingContext& context) const
+{
+    LightSample sample;
+    if (!SampleLight_Unoccluded(light, shadingData, pathState, context, sample))
+    {
+        return RayColor::Zero();
+    }
+
+    // cast shadow ray
+    HitPoint hitPoint;
+    hitPoint.distance = sample.shadowRayDistance;
+
+    if (mScene.Traverse_Shadow_Single({ sample.shadowRay, hitPoint, context }))
+    {
+        // shadow ray missed the light - light is occluded
+        return RayColor::Zero();
+    }
+
+    return sample.contribution;
 }
 
 const RayColor PathTracerMIS::SampleLights(const ShadingData& shadingData, const PathState& pathState, RenderingContext& context) const
 {
     RayColor accumulatedColor = RayColor::Zero();
 
+    const DynArray<LightPtr>& lights = mScene.GetLights();
+    const Uint32 numLights = lights.Size();
+
     // TODO check only one (or few) lights per sample instead all of them
     // TODO check only nearest lights
-    for (const LightPtr& light : mScene.GetLights())
+    if (context.params->traversalMode == TraversalMode::Simd8 && numLights >= MinLightsForShadowRaySimd8)
+    {
+        LightSample samples[8];
+
+        for (Uint32 lightIndex = 0; lightIndex < numLights; )
+        {
+            // collect shadow rays of contributing lights
+            Uint32 numSamples = 0;
+            for (; lightIndex < numLights && numSamples < 8; ++lightIndex)
+            {
+                if (SampleLight_Unoccluded(*lights[lightIndex], shadingData, pathState, context, samples[numSamples]))
+                {
+                    numSamples++;
+                }
+            }
+
+            if (numSamples == 0)
+            {
+                continue;
+            }
+
+            // unused lanes get negative infinite max distance, so they are inactive and fail every box test
+            HitPoint_Simd8 hitPoints;
+            hitPoints.distance = Vector8(-std::numeric_limits<float>::infinity());
+            Ray rays[8];
+            for (Uint32 i = 0; i < numSamples; ++i)
+            {
+                rays[i] = samples[i].shadowRay;
+                hitPoints.distance[i] = samples[i].shadowRayDistance;
+            }
+            for (Uint32 i = numSamples; i < 8; ++i)
+            {
+                rays[i] = samples[0].shadowRay;
+            }
+
+            const Ray_Simd8 simdRay(rays[0], rays[1], rays[2], rays[3], rays[4], rays[5], rays[6], rays[7]);
+            const Uint32 occludedMask = mScene.Traverse_Shadow_Simd8({ simdRay, hitPoints, context });
+
+            for (Uint32 i = 0; i < numSamples; ++i)
+            {
+                if ((occludedMask & (1u << i)) == 0)
+                {
+                    accumulatedColor += samples[i].contribution;
+                }
+            }
+        }
+    }
+    else if (numLights < MinLightsForShadowRayPacket)
     {
-        accumulatedColor += SampleLight(*light, shadingData, pathState, context);
+        for (const LightPtr& light : lights)
+        {
+            accumulatedColor += SampleLight(*light, shadingData, pathState, context);
+        }
+    }
+    else
+    {
+        LightSample samples[MaxShadowRaysPerPacket];
+        RayPacket& packet = context.shadowRayPacket;
+
+        for (Uint32 lightIndex = 0; lightIndex < numLights; )
+        {
+            // collect shadow rays of contributing lights
+            packet.Clear();
+            Uint32 numSamples = 0;
+            for (; lightIndex < numLights && numSamples < MaxShadowRaysPerPacket; ++lightIndex)
+            {
+                LightSample& sample = samples[numSamples];
+                if (SampleLight_Unoccluded(*lights[lightIndex], shadingData, pathState, context, sample))
+                {
+                    packet.PushRay(sample.shadowRay, VECTOR_ONE, ImageLocationInfo(), sample.shadowRayDistance);
+                    numSamples++;
+                }
+            }
+
+            if (numSamples == 0)
+            {
+                continue;
+            }
+
+            mScene.Traverse_Shadow_Packet({ packet, context });
+
+            for (Uint32 i = 0; i < numSamples; ++i)
+            {
+                const bool occluded = (context.occludedRaysMask[i / RayPacket::RaysPerGroup] & (1u << (i % RayPacket::RaysPerGroup))) != 0;
+                if (!occluded)
+                {
+                    accumulatedColor += samples[i].contribution;
+                }
+            }
+        }
     }
 
     accumulatedColor *= RayColor::Resolve(context.wavelength, Spectrum(mLightSamplingWeight));
@@ -199,7 +310,7 @@ const RayColor PathTracerMIS::RenderPixel(const math::Ray& primaryRay, const Ren
         hitPoint.distance = FLT_MAX;
         context.localCounters.Reset();
         mScene.Traverse_Single({ ray, hitPoint, context });
-        context.counters.Append(context.localCounters);
+        context.counters.Append(context.localCounters, pathState.depth);
 
         // ray missed - return background light color
         if (hitPoint.distance == FLT_MAX)
@@ -33,12 +33,25 @@ private:
         bool lastSpecular = true;
     };
 
+    // light sample with its visibility not tested yet
+    struct LightSample
+    {
+        RayColor contribution;
+        math::Ray shadowRay;
+        float shadowRayDistance;
+    };
+
     // importance sample light sources
+    // Shadow rays are traced in packets if there are many light sources in the scene
     const RayColor SampleLights(const ShadingData& shadingData, const PathState& pathState, RenderingContext& context) const;
 
     // importance sample single light source
     const RayColor SampleLight(const ILight& light, const ShadingData& shadingData, const PathState& pathState, RenderingContext& context) const;
 
+    // importance sample single light source, without casting the shadow ray
+    // Returns false if the light does not contribute at all
+    bool SampleLight_Unoccluded(const ILight& light, const ShadingData& shadingData, const PathState& pathState, RenderingContext& context, LightSample& outSample) const;
+
     // compute radiance from a hit local lights
     const RayColor EvaluateLight(const ILight& light, const math::Ray& ray, float dist, const PathState& pathState, RenderingContext& context) const;
 
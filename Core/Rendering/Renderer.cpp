@@ -40,10 +40,30 @@ void IRenderer::PreRenderGlobal()
 {
 }
 
+bool IRenderer::HasPreRenderPass() const
+{
+    return false;
+}
+
+bool IRenderer::SplatsToFilm() const
+{
+    return false;
+}
+
 void IRenderer::Raytrace_Packet(RayPacket&, const Camera&, Film&, RenderingContext&) const
 {
 }
 
+bool IRenderer::SupportsStreamRendering() const
+{
+    return false;
+}
+
+bool IRenderer::Shade_Stream(StreamPathState&, const HitPoint&, RenderingContext&) const
+{
+    return false;
+}
+
 
 // TODO use reflection
 RendererPtr CreateRenderer(const std::string& name, const Scene& scene)
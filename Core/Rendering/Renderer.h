@@ -4,6 +4,8 @@
 
 #include "../Color/RayColor.h"
 #include "../Math/Ray.h"
+#include "../Sampling/GenericSampler.h"
+#include "../Traversal/RayPacket.h"
 #include "../Utils/AlignmentAllocator.h"
 
 namespace rt {
@@ -12,7 +14,20 @@ class Film;
 class Scene;
 class Camera;
 struct RenderingContext;
-struct RayPacket;
+struct HitPoint;
+
+// state of a path traced in stream mode (see TraversalMode::Stream)
+// Paths are suspended after each bounce, so everything the shading needs must be kept here.
+struct RT_ALIGN(16) StreamPathState
+{
+    math::Ray ray;                          // current path segment
+    RayColor throughput;
+    RayColor color;                         // accumulated radiance
+    Wavelength wavelength;
+    GenericSampler::PixelState samplerState;
+    ImageLocationInfo imageLocation;
+    Uint32 depth;
+};
 
 // abstract scene rendering interface
 class RT_ALIGN(16) IRenderer : public Aligned<16>
@@ -34,6 +49,8 @@ public:
 
     virtual const char* GetName() const = 0;
 
+    RT_FORCE_INLINE const Scene& GetScene() const { return mScene; }
+
     // create per-thread context
     virtual RendererContextPtr CreateContext() const;
 
@@ -54,6 +71,14 @@ public:
     virtual void PreRenderGlobal(RenderingContext& ctx);
     virtual void PreRenderGlobal();
 
+    // returns true if the renderer implements the pre-render passes above
+    // Note: the pre-render passes require all the threads to synchronize, so they are skipped if not needed
+    virtual bool HasPreRenderPass() const;
+
+    // returns true if RenderPixel accumulates samples in other pixels of the film (e.g. light tracing)
+    // Note: in such case a tile can't be post processed before all other tiles are rendered
+    virtual bool SplatsToFilm() const;
+
     // called for every pixel on screen during rendering
     // Note: this will be called from multiple threads, each thread provides own RenderingContext
     virtual const RayColor RenderPixel(const math::Ray& ray, const RenderParam& param, RenderingContext& ctx) const = 0;
@@ -61,6 +86,14 @@ public:
 
     virtual void Raytrace_Packet(RayPacket& packet, const Camera& camera, Film& film, RenderingContext& context) const;
 
+    // returns true if the renderer implements Shade_Stream
+    virtual bool SupportsStreamRendering() const;
+
+    // called for every path vertex found by stream traversal (hit point of 'path.ray', can be a miss)
+    // Should update path color and throughput. Returns true (and the next path segment) if the path continues.
+    // Note: this will be called from multiple threads, each thread provides own RenderingContext
+    virtual bool Shade_Stream(StreamPathState& path, const HitPoint& hitPoint, RenderingContext& ctx) const;
+
 protected:
     const Scene& mScene;
 
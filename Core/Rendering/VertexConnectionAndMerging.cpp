@@ -156,6 +156,17 @@ void VertexConnectionAndMerging::PreRenderGlobal()
     }
 }
 
+bool VertexConnectionAndMerging::HasPreRenderPass() const
+{
+    return true;
+}
+
+bool VertexConnectionAndMerging::SplatsToFilm() const
+{
+    // light paths are connected to camera
+    return true;
+}
+
 const RayColor VertexConnectionAndMerging::RenderPixel(const math::Ray& ray, const RenderParam& param, RenderingContext& ctx) const
 {
     // Stage 4 - trace camera paths
@@ -180,7 +191,7 @@ const RayColor VertexConnectionAndMerging::RenderPixel(const math::Ray& ray, con
         HitPoint hitPoint;
         ctx.localCounters.Reset();
         mScene.Traverse_Single({ pathState.ray, hitPoint, ctx });
-        ctx.counters.Append(ctx.localCounters);
+        ctx.counters.Append(ctx.localCounters, pathState.length - 1u);
 
         // ray missed - return background light color
         if (hitPoint.distance == FLT_MAX)
@@ -326,7 +337,7 @@ void VertexConnectionAndMerging::TraceLightPath(const Camera& camera, Film& film
         HitPoint hitPoint;
         ctx.localCounters.Reset();
         mScene.Traverse_Single({ pathState.ray, hitPoint, ctx });
-        ctx.counters.Append(ctx.localCounters);
+        ctx.counters.Append(ctx.localCounters, pathState.length - 1u);
 
         if (hitPoint.distance == FLT_MAX)
         {
@@ -31,6 +31,8 @@ public:
     virtual void PreRenderPixel(const RenderParam& param, RenderingContext& ctx) const override;
     virtual void PreRenderGlobal(RenderingContext& ctx) override;
     virtual void PreRenderGlobal() override;
+    virtual bool HasPreRenderPass() const override;
+    virtual bool SplatsToFilm() const override;
     virtual const RayColor RenderPixel(const math::Ray& ray, const RenderParam& param, RenderingContext& ctx) const override;
 
     // for debugging
@@ -4,7 +4,10 @@
 #include "Renderer.h"
 #include "RendererContext.h"
 #include "Utils/Logger.h"
+#include "Utils/Timer.h"
 #include "Scene/Camera.h"
+#include "Scene/Scene.h"
+#include "Traversal/TraversalContext.h"
 #include "Color/LdrColor.h"
 #include "Color/ColorHelpers.h"
 #include "Math/SamplingHelpers.h"
@@ -28,20 +31,26 @@ void Viewport::InitThreadData()
 
     mThreadData.Resize(numThreads);
 
-    mSamplers.Clear();
-    mSamplers.Reserve(numThreads);
-
-    for (Uint32 i = 0; i < numThreads; ++i)
+    // Note: renderer contexts are created on the owning threads, so their memory is allocated on the thread's NUMA node
+    const auto initCallback = [this](Uint32, Uint32 threadID)
     {
-        RenderingContext& ctx = mThreadData[i];
+        RenderingContext& ctx = mThreadData[threadID];
         ctx.randomGenerator.Reset();
 
         if (mRenderer)
         {
             ctx.rendererContext = mRenderer->CreateContext();
         }
+    };
+
+    mThreadPool.RunPerThreadTask(initCallback);
 
-        mSamplers.EmplaceBack(ctx.randomGenerator);
+    mSamplers.Clear();
+    mSamplers.Reserve(numThreads);
+
+    for (Uint32 i = 0; i < numThreads; ++i)
+    {
+        mSamplers.EmplaceBack(mThreadData[i].randomGenerator);
     }
 }
 
@@ -92,11 +101,12 @@ void Viewport::Reset()
 
     mHaltonSequence.Initialize(mParams.sampleDimensions);
 
-    mSum.Clear();
-    mSecondarySum.Clear();
+    ClearAccumulationBuffers();
 
     memset(mPassesPerPixel.Data(), 0, sizeof(Uint32) * GetWidth() * GetHeight());
 
+    mPassTimes.Clear();
+
     BuildInitialBlocksList();
 }
 
@@ -115,13 +125,18 @@ bool Viewport::SetRenderingParams(const RenderingParams& params)
     RT_ASSERT(params.antiAliasingSpread >= 0.0f);
     RT_ASSERT(params.motionBlurStrength >= 0.0f && params.motionBlurStrength <= 1.0f);
 
-    if (mParams.numThreads != params.numThreads)
+    const bool threadsChanged = mParams.numThreads != params.numThreads || mParams.pinThreads != params.pinThreads;
+
+    mParams = params;
+
+    if (threadsChanged)
     {
-        mThreadPool.SetNumThreads(params.numThreads);
+        mThreadPool.SetNumThreads(params.numThreads, params.pinThreads);
         InitThreadData();
-    }
 
-    mParams = params;
+        // tiles order depends on the number of NUMA nodes (see GenerateRenderingTiles)
+        mRenderingTiles.Clear();
+    }
 
     return true;
 }
@@ -139,13 +154,79 @@ bool Viewport::SetPostprocessParams(const PostprocessParams& params)
     return true;
 }
 
+void Viewport::ClearAccumulationBuffers()
+{
+    const Uint32 width = GetWidth();
+    const Uint32 height = GetHeight();
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+
+    // clear horizontal bands in parallel - with pinned threads, memory pages of each band are first touched
+    // by the NUMA node which renders the corresponding image rows (see ThreadPool::RunParallelTask and GenerateRenderingTiles)
+    const Uint32 numBands = Min(height, mThreadPool.GetNumThreads());
+    const auto clearCallback = [this, width, height, numBands](Uint32 id, Uint32)
+    {
+        const Uint32 minY = height * id / numBands;
+        const Uint32 maxY = height * (id + 1) / numBands;
+        const size_t rowSize = sizeof(Float3) * width;
+
+        memset(mSum.GetDataAs<Uint8>() + rowSize * minY, 0, rowSize * (maxY - minY));
+        memset(mSecondarySum.GetDataAs<Uint8>() + rowSize * minY, 0, rowSize * (maxY - minY));
+    };
+
+    mThreadPool.RunParallelTask(clearCallback, numBands);
+}
+
+Film Viewport::CreateFilm(Uint32 passNumber)
+{
+    // samples splatted at arbitrary positions go to a separate layer - it's written with atomic adds,
+    // so it doesn't conflict with the (plain) writes of rendered tiles and no samples are lost
+    Bitmap* splatSum = mRenderer->SplatsToFilm() ? &mSplatSum : nullptr;
+
+    return Film(mSum, passNumber % 2 == 0 ? &mSecondarySum : nullptr, splatSum);
+}
+
+void Viewport::MergeSplats(Uint32 passNumber)
+{
+    const Uint32 width = GetWidth();
+    const Uint32 height = GetHeight();
+    const bool accumulateSecondary = passNumber % 2 == 0;
+
+    const Uint32 numBands = Min(height, mThreadPool.GetNumThreads());
+    const auto mergeCallback = [this, width, height, numBands, accumulateSecondary](Uint32 id, Uint32)
+    {
+        const size_t begin = static_cast<size_t>(width) * (height * id / numBands);
+        const size_t end = static_cast<size_t>(width) * (height * (id + 1) / numBands);
+
+        const Float3* __restrict splatPixels = mSplatSum.GetDataAs<Float3>();
+        Float3* __restrict sumPixels = mSum.GetDataAs<Float3>();
+        Float3* __restrict secondarySumPixels = mSecondarySum.GetDataAs<Float3>();
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            sumPixels[i] += splatPixels[i];
+
+            if (accumulateSecondary)
+            {
+                secondarySumPixels[i] += splatPixels[i];
+            }
+        }
+
+        memset(mSplatSum.GetDataAs<Uint8>() + sizeof(Float3) * begin, 0, sizeof(Float3) * (end - begin));
+    };
+
+    RunParallelTasks(mergeCallback, numBands);
+}
+
 void Viewport::ComputeError()
 {
     const Block fullImageBlock(0, GetWidth(), 0, GetHeight());
     mProgress.averageError = ComputeBlockError(fullImageBlock);
 }
 
-bool Viewport::Render(const Camera& camera)
+bool Viewport::Render(const Camera& camera, Uint32 numPasses)
 {
     RT_ASSERT(GetFlushDenormalsToZero(), "Flushing denormal float to zero is disabled");
 
@@ -162,48 +243,170 @@ bool Viewport::Render(const Camera& camera)
         return false;
     }
 
-    mHaltonSequence.NextSample();
-    DynArray<float> seed(mHaltonSequence.GetNumDimensions());
-    for (Uint32 i = 0; i < mHaltonSequence.GetNumDimensions(); ++i)
+    if (numPasses == 0)
     {
-        seed[i] = (float)(mHaltonSequence.GetValue(i));
+        return true;
+    }
+
+    Timer timer;
+
+    // Note: the copies are made only once and kept until the scene changes (see Scene::ReplicateData)
+    bool useSceneReplicas = mParams.replicateSceneData && mThreadPool.GetNumNodes() > 1;
+    if (useSceneReplicas && !mRenderer->GetScene().ReplicateData(mThreadPool))
+    {
+        RT_LOG_WARNING("Viewport: Failed to replicate scene data, all the NUMA nodes will share it");
+        useSceneReplicas = false;
     }
 
     for (Uint32 i = 0; i < mThreadData.Size(); ++i)
     {
         RenderingContext& ctx = mThreadData[i];
+        ctx.numaNode = useSceneReplicas ? mThreadPool.GetThreadNode(i) : UINT32_MAX;
         ctx.counters.Reset();
+        ctx.counters.collectRayStats = mParams.collectRayStats;
         ctx.params = &mParams;
         ctx.camera = &camera;
         ctx.pixelBreakpoint = mPendingPixelBreakpoint;
         ctx.sampler = &mSamplers[i];
-        ctx.sampler->ResetFrame(seed);
-
-        mRenderer->PreRender(ctx);
     }
 
     mPendingPixelBreakpoint.x = UINT32_MAX;
     mPendingPixelBreakpoint.y = UINT32_MAX;
 
+    for (RenderingStageStats& stageStats : mFrameStats.stages)
+    {
+        stageStats = RenderingStageStats();
+    }
+    mFrameStats.tileTime = TimeDistribution();
+
     if (mRenderingTiles.Empty() || mProgress.passesFinished == 0)
     {
         GenerateRenderingTiles();
     }
 
-    // render
+    mPostprocessParams.colorScale = mPostprocessParams.params.colorFilter * exp2f(mPostprocessParams.params.exposure);
+
+    if (mRenderer->SplatsToFilm() && (mSplatSum.GetWidth() != width || mSplatSum.GetHeight() != height))
+    {
+        if (!mSplatSum.Init(width, height, Bitmap::Format::R32G32B32_Float))
+        {
+            return false;
+        }
+        memset(mSplatSum.GetData(), 0, sizeof(Float3) * width * height);
+    }
+
+    for (Uint32 passesLeft = numPasses; passesLeft > 0; )
+    {
+        if (CanPipelinePasses())
+        {
+            // adaptive rendering updates the tiles list after every even pass, so all the tiles must be finished by then
+            Uint32 numPipelinedPasses = passesLeft;
+            if (mParams.adaptiveSettings.enable)
+            {
+                numPipelinedPasses = Min(passesLeft, 2u - mProgress.passesFinished % 2u);
+            }
+
+            Timer passTimer;
+            RenderPipelinedPasses(camera, numPipelinedPasses);
+            const double passTime = passTimer.Stop() / static_cast<double>(numPipelinedPasses);
+
+            for (Uint32 i = 0; i < numPipelinedPasses; ++i)
+            {
+                mPassTimes.PushBack(passTime);
+            }
+            passesLeft -= numPipelinedPasses;
+        }
+        else
+        {
+            Timer passTimer;
+            RenderPass(camera);
+            mPassTimes.PushBack(passTimer.Stop());
+            passesLeft--;
+        }
+    }
+
+    // Note: the order of the pass times doesn't matter
+    mFrameStats.passTime.Compute(mPassTimes.Data(), mPassTimes.Size());
+
+    // accumulate counters
+    mFrameStats.frameIndex = mProgress.passesFinished;
+    mFrameStats.numPasses = numPasses;
+    mFrameStats.numThreads = mThreadData.Size();
+    mFrameStats.renderTime = timer.Stop();
+    mFrameStats.counters.Reset();
+    for (const RenderingContext& ctx : mThreadData)
+    {
+        mFrameStats.counters.Append(ctx.counters);
+    }
+
+    return true;
+}
+
+bool Viewport::CanPipelinePasses() const
+{
+    // tiles (and subsequent passes of a tile) can be rendered independently only if there is no global pre-pass
+    // and the renderer writes only to the rendered pixels
+    if (mRenderer->HasPreRenderPass() || mRenderer->SplatsToFilm())
+    {
+        return false;
+    }
+
+    // stream mode traces paths of all the tiles together
+    if (mParams.traversalMode == TraversalMode::Stream && mRenderer->SupportsStreamRendering())
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void Viewport::InitPasses(Uint32 numPasses)
+{
+    const Uint32 numDimensions = mHaltonSequence.GetNumDimensions();
+
+    mPassSeeds.Resize(numPasses * numDimensions);
+    mPassSampleOffsets.Resize(numPasses);
+
+    for (Uint32 i = 0; i < numPasses; ++i)
     {
+        mHaltonSequence.NextSample();
+        for (Uint32 j = 0; j < numDimensions; ++j)
+        {
+            mPassSeeds[i * numDimensions + j] = (float)(mHaltonSequence.GetValue(j));
+        }
+
         // randomize pixel offset
         const Vector4 u = SamplingHelpers::GetFloatNormal2(mRandomGenerator.GetFloat2());
+        mPassSampleOffsets[i] = u * mParams.antiAliasingSpread;
+    }
+}
 
-        const TileRenderingContext tileContext =
+void Viewport::RenderPass(const Camera& camera)
+{
+    InitPasses(1);
+
+    const TileRenderingContext tileContext =
+    {
+        *mRenderer,
+        camera,
+        mPassSampleOffsets[0],
+        mProgress.passesFinished
+    };
+
+    for (RenderingContext& ctx : mThreadData)
+    {
+        ctx.sampler->ResetFrame(mPassSeeds.Data(), mHaltonSequence.GetNumDimensions());
+    }
+
+    if (mRenderer->HasPreRenderPass())
+    {
+        for (RenderingContext& ctx : mThreadData)
         {
-            *mRenderer,
-            camera,
-            u * mThreadData[0].params->antiAliasingSpread
-        };
+            mRenderer->PreRender(ctx);
+        }
 
         {
-            const Film film(mSum, mProgress.passesFinished % 2 == 0 ? &mSecondarySum : nullptr);
+            const Film film = CreateFilm(mProgress.passesFinished);
             mRenderer->PreRender(mProgress.passesFinished, film);
         }
 
@@ -212,27 +415,118 @@ bool Viewport::Render(const Camera& camera)
             PreRenderTile(tileContext, mThreadData[threadID], mRenderingTiles[id]);
         };
 
+        BeginStage();
+        RunParallelTasks(preRenderCallback, mRenderingTiles.Size());
+        EndStage(RenderingStage::PreRender);
+
+        BeginStage();
+        for (RenderingContext& ctx : mThreadData)
+        {
+            mRenderer->PreRenderGlobal(ctx);
+        }
+        mRenderer->PreRenderGlobal();
+        EndStage(RenderingStage::PreRenderGlobal);
+    }
+
+    BeginStage();
+    if (mParams.traversalMode == TraversalMode::Stream && mRenderer->SupportsStreamRendering())
+    {
+        RenderStream(tileContext);
+    }
+    else
+    {
         const auto renderCallback = [&](Uint32 id, Uint32 threadID)
         {
+            Timer timer;
             RenderTile(tileContext, mThreadData[threadID], mRenderingTiles[id]);
+            mTileTimes[id] = timer.Stop();
         };
 
-        mThreadPool.RunParallelTask(preRenderCallback, mRenderingTiles.Size());
+        RunTileTasks(renderCallback);
 
-        for (RenderingContext& ctx : mThreadData)
+        DynArray<double> tileTimes = mTileTimes;
+        mFrameStats.tileTime.Compute(tileTimes.Data(), tileTimes.Size());
+    }
+
+    if (mRenderer->SplatsToFilm())
+    {
+        MergeSplats(mProgress.passesFinished);
+    }
+    EndStage(RenderingStage::Render);
+
+    BeginStage();
+    PerformPostProcess(mProgress.passesFinished);
+    EndStage(RenderingStage::PostProcess);
+
+    mProgress.passesFinished++;
+    OnPassesFinished();
+}
+
+void Viewport::RenderPipelinedPasses(const Camera& camera, Uint32 numPasses)
+{
+    InitPasses(numPasses);
+
+    const Uint32 numDimensions = mHaltonSequence.GetNumDimensions();
+    const Uint32 firstPass = mProgress.passesFinished;
+    const Uint32 lastPass = firstPass + numPasses - 1u;
+
+    // full image update is done after rendering anyway
+    const bool postProcessTiles = !mPostprocessParams.fullUpdateRequired;
+
+    // Each task renders all the passes of a single tile and post processes it right away, so there are no barriers
+    // between the passes and post processing of finished tiles overlaps rendering of the remaining ones.
+    const auto renderCallback = [&](Uint32 id, Uint32 threadID)
+    {
+        RenderingContext& ctx = mThreadData[threadID];
+        const Block& tile = mRenderingTiles[id];
+
+        Timer timer;
+        for (Uint32 i = 0; i < numPasses; ++i)
         {
-            mRenderer->PreRenderGlobal(ctx);
+            const TileRenderingContext tileContext =
+            {
+                *mRenderer,
+                camera,
+                mPassSampleOffsets[i],
+                firstPass + i
+            };
+
+            ctx.sampler->ResetFrame(mPassSeeds.Data() + i * numDimensions, numDimensions);
+            RenderTile(tileContext, ctx, tile);
         }
+        mTileTimes[id] = timer.Stop() / static_cast<double>(numPasses);
 
-        mRenderer->PreRenderGlobal();
+        if (postProcessTiles)
+        {
+            PostProcessTile(tile, threadID, lastPass);
 
-        mThreadPool.RunParallelTask(renderCallback, mRenderingTiles.Size());
+            // flush non-temporal stores
+            _mm_sfence();
+        }
+    };
+
+    BeginStage();
+    RunTileTasks(renderCallback);
+    EndStage(RenderingStage::Render);
+
+    {
+        DynArray<double> tileTimes = mTileTimes;
+        mFrameStats.tileTime.Compute(tileTimes.Data(), tileTimes.Size());
     }
 
-    PerformPostProcess();
+    if (!postProcessTiles)
+    {
+        BeginStage();
+        PerformPostProcess(lastPass);
+        EndStage(RenderingStage::PostProcess);
+    }
 
-    mProgress.passesFinished++;
+    mProgress.passesFinished += numPasses;
+    OnPassesFinished();
+}
 
+void Viewport::OnPassesFinished()
+{
     if ((mProgress.passesFinished > 0) && (mProgress.passesFinished % 2 == 0))
     {
         if (mParams.adaptiveSettings.enable)
@@ -245,15 +539,88 @@ bool Viewport::Render(const Camera& camera)
             ComputeError();
         }
     }
+}
 
-    // accumulate counters
-    mCounters.Reset();
+template<typename TaskType>
+void Viewport::RunParallelTasks(const TaskType& task, Uint32 num)
+{
+    const auto timedTask = [this, &task](Uint32 id, Uint32 threadID)
+    {
+        Timer timer;
+        task(id, threadID);
+        mThreadData[threadID].busyTime += timer.Stop();
+    };
+
+    mThreadPool.RunParallelTask(timedTask, num);
+}
+
+template<typename TaskType>
+void Viewport::RunTileTasks(const TaskType& task)
+{
+    const Uint32 numTiles = mRenderingTiles.Size();
+
+    // each NUMA node renders its own contiguous part of the tiles list (see RenderingParams::pinThreads)
+    if (mThreadPool.GetNumNodes() > 1)
+    {
+        RunParallelTasks(task, numTiles);
+        return;
+    }
+
+    // Longest expected time first: cheap tiles dispatched at the end fill the gaps, so the threads finish at
+    // similar time. Tiles with equal (or not yet measured) times keep the Hilbert curve order.
+    mTileOrder.Resize(numTiles);
+    for (Uint32 i = 0; i < numTiles; ++i)
+    {
+        mTileOrder[i] = i;
+    }
+    std::stable_sort(mTileOrder.Data(), mTileOrder.Data() + numTiles, [this](Uint32 a, Uint32 b)
+    {
+        return mTileTimes[a] > mTileTimes[b];
+    });
+
+    // the thread pool splits the tasks range between the workers, so the tiles are picked from a shared counter
+    // to dispatch them in the exact order
+    std::atomic<Uint32> nextTile(0);
+    const auto schedulingTask = [&](Uint32, Uint32 threadID)
+    {
+        for (;;)
+        {
+            const Uint32 index = nextTile.fetch_add(1, std::memory_order_relaxed);
+            if (index >= numTiles)
+            {
+                break;
+            }
+
+            task(mTileOrder[index], threadID);
+        }
+    };
+
+    RunParallelTasks(schedulingTask, mThreadPool.GetNumThreads());
+}
+
+void Viewport::BeginStage()
+{
+    for (RenderingContext& ctx : mThreadData)
+    {
+        ctx.busyTime = 0.0;
+    }
+
+    mStageTimer.Start();
+}
+
+void Viewport::EndStage(RenderingStage stage)
+{
+    const double wallTime = mStageTimer.Stop();
+
+    double busyTime = 0.0;
     for (const RenderingContext& ctx : mThreadData)
     {
-        mCounters.Append(ctx.counters);
+        busyTime += ctx.busyTime;
     }
 
-    return true;
+    RenderingStageStats& stats = mFrameStats.stages[static_cast<Uint32>(stage)];
+    stats.wallTime += wallTime;
+    stats.idleTime += Max(0.0, wallTime * mThreadData.Size() - busyTime);
 }
 
 void Viewport::PreRenderTile(const TileRenderingContext& tileCtx, RenderingContext& ctx, const Block& tile)
@@ -263,9 +630,9 @@ void Viewport::PreRenderTile(const TileRenderingContext& tileCtx, RenderingConte
     RT_ASSERT(tile.maxX <= GetWidth());
     RT_ASSERT(tile.maxY <= GetHeight());
 
-    Film film(mSum, mProgress.passesFinished % 2 == 0 ? &mSecondarySum : nullptr);
+    Film film = CreateFilm(tileCtx.passNumber);
 
-    if (ctx.params->traversalMode == TraversalMode::Single)
+    if (ctx.params->traversalMode != TraversalMode::Packet)
     {
         for (Uint32 y = tile.minY; y < tile.maxY; ++y)
         {
@@ -295,9 +662,14 @@ void Viewport::RenderTile(const TileRenderingContext& tileContext, RenderingCont
     const Vector4 invSize = VECTOR_ONE2 / filmSize;
     const Uint32 tileSize = ctx.params->tileSize;
 
-    Film film(mSum, mProgress.passesFinished % 2 == 0 ? &mSecondarySum : nullptr);
+    Film film = CreateFilm(tileContext.passNumber);
 
-    if (ctx.params->traversalMode == TraversalMode::Single)
+    // Note: stream and SIMD-8 modes fall back to single ray traversal if the renderer does not support it
+    if (ctx.params->traversalMode == TraversalMode::Simd8 && tileContext.renderer.SupportsStreamRendering())
+    {
+        RenderTile_Simd8(tileContext, ctx, tile, film);
+    }
+    else if (ctx.params->traversalMode != TraversalMode::Packet)
     {
         for (Uint32 y = tile.minY; y < tile.maxY; ++y)
         {
@@ -399,25 +771,317 @@ void Viewport::RenderTile(const TileRenderingContext& tileContext, RenderingCont
             }
         }
 
+        primaryPacket.SortByOctant();
+
+        const Uint32 numRays = primaryPacket.numRays;
         ctx.localCounters.Reset();
         tileContext.renderer.Raytrace_Packet(primaryPacket, tileContext.camera, film, ctx);
-        ctx.counters.Append(ctx.localCounters);
+        ctx.counters.Append(ctx.localCounters, 0, numRays);
     }
 
     ctx.counters.numPrimaryRays += tileSize * tileSize;
 }
 
-void Viewport::PerformPostProcess()
+void Viewport::RenderTile_Simd8(const TileRenderingContext& tileContext, RenderingContext& ctx, const Block& tile, Film& film)
 {
-    mPostprocessParams.colorScale = mPostprocessParams.params.colorFilter * exp2f(mPostprocessParams.params.exposure);
+    const Vector4 filmSize = Vector4::FromIntegers(GetWidth(), GetHeight(), 1, 1);
+    const Vector4 invSize = VECTOR_ONE2 / filmSize;
+    const Scene& scene = tileContext.renderer.GetScene();
+
+    constexpr Uint32 rayGroupSizeX = 4;
+    constexpr Uint32 rayGroupSizeY = 2;
+
+    // state of paths traced in a group (the group is shaded lane by lane, like in stream mode)
+    StreamPathState paths[8];
+
+    for (Uint32 y = tile.minY; y < tile.maxY; y += rayGroupSizeY)
+    {
+        const Uint32 realY = GetHeight() - 1u - y;
+
+        for (Uint32 x = tile.minX; x < tile.maxX; x += rayGroupSizeX)
+        {
+            // all the rays of a group share the same time (like rays of a packet)
+            ctx.time = ctx.randomGenerator.GetFloat() * ctx.params->motionBlurStrength;
+
+            // generate ray group with following layout:
+            //  0 1 2 3
+            //  4 5 6 7
+            Vector2x8 coords{ Vector8::FromInteger(x), Vector8::FromInteger(realY) };
+            coords.x += Vector8(0.0f, 1.0f, 2.0f, 3.0f, 0.0f, 1.0f, 2.0f, 3.0f);
+            coords.y -= Vector8(0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+            coords.x += Vector8(tileContext.sampleOffset.x);
+            coords.y += Vector8(tileContext.sampleOffset.y);
+            coords.x *= invSize.x;
+            coords.y *= invSize.y;
+
+            const Ray_Simd8 primaryRays = tileContext.camera.GenerateRay_Simd8(coords, ctx);
+
+            // lanes outside of the tile are masked out from the beginning
+            Uint32 activeMask = 0;
+            for (Uint32 i = 0; i < 8; ++i)
+            {
+                const Uint32 pixelX = x + i % rayGroupSizeX;
+                const Uint32 pixelY = y + i / rayGroupSizeX;
+
+                StreamPathState& path = paths[i];
+                path.ray = Ray(Vector4(primaryRays.origin.x[i], primaryRays.origin.y[i], primaryRays.origin.z[i], 0.0f),
+                               Vector4(primaryRays.dir.x[i], primaryRays.dir.y[i], primaryRays.dir.z[i], 0.0f));
+
+                if (pixelX >= tile.maxX || pixelY >= tile.maxY)
+                {
+                    continue;
+                }
+
+                const Uint32 pixelIndex = pixelY * GetHeight() + pixelX;
+                ctx.sampler->ResetPixel(pixelIndex);
+                ctx.wavelength.Randomize(ctx.randomGenerator);
+
+                path.throughput = RayColor::One();
+                path.color = RayColor::Zero();
+                path.wavelength = ctx.wavelength;
+                path.samplerState = ctx.sampler->GetPixelState();
+                path.imageLocation = ImageLocationInfo(pixelX, pixelY);
+                path.depth = 0;
+
+                activeMask |= 1u << i;
+            }
+
+            Ray_Simd8 rays = primaryRays;
+
+            // all the lanes are extended together, so they share the path depth
+            for (Uint32 depth = 0; activeMask; ++depth)
+            {
+                // terminated lanes get negative infinite max distance, so they fail every box test
+                // Note: zero is not enough, a box containing the stale ray origin would still be entered
+                HitPoint_Simd8 hitPoints;
+                for (Uint32 i = 0; i < 8; ++i)
+                {
+                    if (!(activeMask & (1u << i)))
+                    {
+                        hitPoints.distance[i] = -std::numeric_limits<float>::infinity();
+                    }
+                }
+
+                ctx.localCounters.Reset();
+                scene.Traverse_Simd8({ rays, hitPoints, ctx });
+                ctx.counters.Append(ctx.localCounters, depth, PopCount(activeMask));
+
+                for (Uint32 i = 0; i < 8; ++i)
+                {
+                    if (!(activeMask & (1u << i)))
+                    {
+                        continue;
+                    }
+
+                    StreamPathState& path = paths[i];
+                    ctx.wavelength = path.wavelength;
+                    ctx.sampler->SetPixelState(path.samplerState);
+
+                    if (tileContext.renderer.Shade_Stream(path, hitPoints.Get(i), ctx))
+                    {
+                        path.samplerState = ctx.sampler->GetPixelState();
+                        continue;
+                    }
+
+                    RT_ASSERT(path.color.IsValid());
+                    const Vector4 sampleColor = path.color.ConvertToTristimulus(path.wavelength);
+
+#ifndef RT_ENABLE_SPECTRAL_RENDERING
+                    RT_ASSERT((sampleColor >= Vector4::Zero()).All());
+#endif // RT_ENABLE_SPECTRAL_RENDERING
+
+                    film.AccumulateColor(path.imageLocation.x, path.imageLocation.y, sampleColor);
+                    activeMask &= ~(1u << i);
+                }
+
+                // gather next path segments
+                if (activeMask)
+                {
+                    rays = Ray_Simd8(paths[0].ray, paths[1].ray, paths[2].ray, paths[3].ray,
+                                     paths[4].ray, paths[5].ray, paths[6].ray, paths[7].ray);
+                }
+            }
+        }
+    }
+}
+
+void Viewport::RenderStream(const TileRenderingContext& tileContext)
+{
+    // paths of consecutive tiles are traced together, as many as fit into a ray stream
+    Uint32 firstTile = 0;
+    while (firstTile < mRenderingTiles.Size())
+    {
+        Uint32 numTiles = 0;
+        Uint32 numPaths = 0;
+
+        mStreamTileOffsets.Clear();
+        while (firstTile + numTiles < mRenderingTiles.Size())
+        {
+            const Block& tile = mRenderingTiles[firstTile + numTiles];
+            const Uint32 numTilePixels = tile.Width() * tile.Height();
+            RT_ASSERT(numTilePixels <= RayStream::MaxRays);
+
+            if (numPaths + numTilePixels > RayStream::MaxRays)
+            {
+                break;
+            }
+
+            mStreamTileOffsets.PushBack(numPaths);
+            numPaths += numTilePixels;
+            numTiles++;
+        }
 
+        RenderStreamBatch(tileContext, firstTile, numTiles, numPaths);
+
+        firstTile += numTiles;
+    }
+}
+
+void Viewport::RenderStreamBatch(const TileRenderingContext& tileContext, Uint32 firstTile, Uint32 numTiles, Uint32 numPaths)
+{
+    // Note: the allocations are kept between frames
+    if (mStreamPaths.Size() < numPaths)
+    {
+        if (!mStreamPaths.Resize(numPaths) || !mStreamHitPoints.Resize(numPaths) ||
+            !mRayStreams[0].Reserve(numPaths) || !mRayStreams[1].Reserve(numPaths))
+        {
+            RT_LOG_ERROR("Failed to allocate stream rendering data for %u paths", numPaths);
+            return;
+        }
+    }
+
+    const Vector4 filmSize = Vector4::FromIntegers(GetWidth(), GetHeight(), 1, 1);
+    const Vector4 invSize = VECTOR_ONE2 / filmSize;
+
+    Film film = CreateFilm(tileContext.passNumber);
+
+    // all the paths in a batch share the same time (like rays of a packet)
+    const float time = mRandomGenerator.GetFloat() * mParams.motionBlurStrength;
+
+    RayStream* stream = &mRayStreams[0];
+    stream->Clear();
+
+    // generate primary rays
+    const auto generateCallback = [&](Uint32 id, Uint32 threadID)
+    {
+        RenderingContext& ctx = mThreadData[threadID];
+        const Block& tile = mRenderingTiles[firstTile + id];
+
+        Uint32 pathIndex = mStreamTileOffsets[id];
+        for (Uint32 y = tile.minY; y < tile.maxY; ++y)
+        {
+            const Uint32 realY = GetHeight() - 1u - y;
+
+            for (Uint32 x = tile.minX; x < tile.maxX; ++x)
+            {
+                const Uint32 pixelIndex = y * GetHeight() + x;
+                const Vector4 coords = (Vector4::FromIntegers(x, realY, 0, 0) + tileContext.sampleOffset) * invSize;
+
+                ctx.sampler->ResetPixel(pixelIndex);
+                ctx.time = time;
+                ctx.wavelength.Randomize(ctx.randomGenerator);
+
+                StreamPathState& path = mStreamPaths[pathIndex];
+                path.ray = tileContext.camera.GenerateRay(coords, ctx);
+                path.throughput = RayColor::One();
+                path.color = RayColor::Zero();
+                path.wavelength = ctx.wavelength;
+                path.samplerState = ctx.sampler->GetPixelState();
+                path.imageLocation = ImageLocationInfo(x, y);
+                path.depth = 0;
+
+                stream->PushRay(path.ray, path.imageLocation, pathIndex);
+                pathIndex++;
+            }
+        }
+
+        ctx.counters.numPrimaryRays += tile.Width() * tile.Height();
+    };
+
+    RunParallelTasks(generateCallback, numTiles);
+
+    constexpr Uint32 RaysPerShadingTask = 1024;
+
+    for (Uint32 bounce = 0; stream->GetNumRays() > 0; ++bounce)
+    {
+        stream->Sort();
+
+        // traversal stage: each thread pops packets until the stream is drained
+        const auto traverseCallback = [&](Uint32, Uint32 threadID)
+        {
+            RenderingContext& ctx = mThreadData[threadID];
+            ctx.time = time;
+
+            Uint32 pathIndices[MaxRayPacketSize];
+
+            while (stream->PopPacket(ctx.rayPacket, pathIndices))
+            {
+                ctx.localCounters.Reset();
+                tileContext.renderer.GetScene().Traverse_Packet({ ctx.rayPacket, ctx });
+                ctx.counters.Append(ctx.localCounters, bounce, ctx.rayPacket.numRays);
+
+                for (Uint32 i = 0; i < ctx.rayPacket.numRays; ++i)
+                {
+                    mStreamHitPoints[pathIndices[i]] = ctx.hitPoints[i];
+                }
+            }
+        };
+
+        RunParallelTasks(traverseCallback, mThreadPool.GetNumThreads());
+
+        // shading stage: continued paths are pushed to the other stream
+        RayStream* nextStream = &mRayStreams[(bounce + 1) % 2];
+        nextStream->Clear();
+
+        const Uint32 numRays = stream->GetNumRays();
+
+        const auto shadeCallback = [&](Uint32 id, Uint32 threadID)
+        {
+            RenderingContext& ctx = mThreadData[threadID];
+            ctx.time = time;
+
+            const Uint32 lastRay = Min(numRays, (id + 1) * RaysPerShadingTask);
+            for (Uint32 i = id * RaysPerShadingTask; i < lastRay; ++i)
+            {
+                const Uint32 pathIndex = stream->GetUserData(i);
+                StreamPathState& path = mStreamPaths[pathIndex];
+
+                ctx.wavelength = path.wavelength;
+                ctx.sampler->SetPixelState(path.samplerState);
+
+                if (tileContext.renderer.Shade_Stream(path, mStreamHitPoints[pathIndex], ctx))
+                {
+                    path.samplerState = ctx.sampler->GetPixelState();
+                    nextStream->PushRay(path.ray, path.imageLocation, pathIndex);
+                    continue;
+                }
+
+                RT_ASSERT(path.color.IsValid());
+                const Vector4 sampleColor = path.color.ConvertToTristimulus(path.wavelength);
+
+#ifndef RT_ENABLE_SPECTRAL_RENDERING
+                RT_ASSERT((sampleColor >= Vector4::Zero()).All());
+#endif // RT_ENABLE_SPECTRAL_RENDERING
+
+                film.AccumulateColor(path.imageLocation.x, path.imageLocation.y, sampleColor);
+            }
+        };
+
+        RunParallelTasks(shadeCallback, (numRays + RaysPerShadingTask - 1) / RaysPerShadingTask);
+
+        stream = nextStream;
+    }
+}
+
+void Viewport::PerformPostProcess(Uint32 passNumber)
+{
     if (mPostprocessParams.fullUpdateRequired)
     {
         // post processing params has changed, perfrom full image update
 
         const Uint32 numTiles = mThreadPool.GetNumThreads();
 
-        const auto taskCallback = [this, numTiles](Uint32 id, Uint32 threadID)
+        const auto taskCallback = [this, numTiles, passNumber](Uint32 id, Uint32 threadID)
         {
             Block block;
             block.minY = GetHeight() * id / numTiles;
@@ -425,10 +1089,10 @@ void Viewport::PerformPostProcess()
             block.minX = 0;
             block.maxX = GetWidth();
 
-            PostProcessTile(block, threadID);
+            PostProcessTile(block, threadID, passNumber);
         };
 
-        mThreadPool.RunParallelTask(taskCallback, numTiles);
+        RunParallelTasks(taskCallback, numTiles);
 
         mPostprocessParams.fullUpdateRequired = false;
     }
@@ -438,12 +1102,12 @@ void Viewport::PerformPostProcess()
 
         if (!mRenderingTiles.Empty())
         {
-            const auto taskCallback = [this](Uint32 id, Uint32 threadID)
+            const auto taskCallback = [this, passNumber](Uint32 id, Uint32 threadID)
             {
-                PostProcessTile(mRenderingTiles[id], threadID);
+                PostProcessTile(mRenderingTiles[id], threadID, passNumber);
             };
 
-            mThreadPool.RunParallelTask(taskCallback, mRenderingTiles.Size());
+            RunParallelTasks(taskCallback, mRenderingTiles.Size());
         }
     }
 
@@ -451,14 +1115,14 @@ void Viewport::PerformPostProcess()
     _mm_mfence();
 }
 
-void Viewport::PostProcessTile(const Block& block, Uint32 threadID)
+void Viewport::PostProcessTile(const Block& block, Uint32 threadID, Uint32 passNumber)
 {
     Random& randomGenerator = mThreadData[threadID].randomGenerator;
 
     const Float3* __restrict sumPixels = mSum.GetDataAs<Float3>();
     Uint8* __restrict frontBufferPixels = mFrontBuffer.GetDataAs<Uint8>();
 
-    const float pixelScaling = 1.0f / (1u + mProgress.passesFinished);
+    const float pixelScaling = 1.0f / (1u + passNumber);
 
     for (Uint32 y = block.minY; y < block.maxY; ++y)
     {
@@ -521,8 +1185,8 @@ float Viewport::ComputeBlockError(const Block& block) const
 
 void Viewport::GenerateRenderingTiles()
 {
-    mRenderingTiles.Clear();
-    mRenderingTiles.Reserve(mBlocks.Size());
+    DynArray<Block> tiles;
+    tiles.Reserve(mBlocks.Size());
 
     const Uint32 tileSize = mParams.tileSize;
 
@@ -545,10 +1209,50 @@ void Viewport::GenerateRenderingTiles()
                 tile.maxX = Min(block.maxX, block.minX + i * tileSize + tileSize);
                 RT_ASSERT(tile.maxX > tile.minX);
 
-                mRenderingTiles.PushBack(tile);
+                tiles.PushBack(tile);
             }
         }
     }
+
+    // order the tiles along Hilbert curve, so subsequently rendered tiles access similar parts of the scene
+    // Note: with multiple NUMA nodes the tiles are kept in row-major order instead. Each node renders a contiguous
+    // part of the tiles list, which then matches the horizontal band of the film first touched by the node
+    // (see ClearAccumulationBuffers). A part of the Hilbert curve would cover a 2D region spanning multiple bands.
+    {
+        const Uint32 maxTileIndex = (Max(GetWidth(), GetHeight()) - 1) / tileSize;
+        const Uint32 order = maxTileIndex > 0 ? LastBitSet(maxTileIndex) + 1 : 0;
+        const Uint32 numTileColumns = 1 + (GetWidth() - 1) / tileSize;
+        const bool rowMajorOrder = mThreadPool.GetNumNodes() > 1;
+
+        DynArray<std::pair<Uint32, Uint32>> keys;
+        keys.Resize(tiles.Size());
+        for (Uint32 i = 0; i < tiles.Size(); ++i)
+        {
+            const Uint32 tileX = tiles[i].minX / tileSize;
+            const Uint32 tileY = tiles[i].minY / tileSize;
+            keys[i].first = rowMajorOrder ? (tileY * numTileColumns + tileX) : HilbertCurveIndex(tileX, tileY, order);
+            keys[i].second = i;
+        }
+        std::sort(keys.Data(), keys.Data() + keys.Size());
+
+        // tile times measured in the previous pass are still valid if the tiles didn't change
+        bool tilesChanged = mRenderingTiles.Size() != tiles.Size();
+
+        mRenderingTiles.Resize(tiles.Size());
+        for (Uint32 i = 0; i < tiles.Size(); ++i)
+        {
+            const Block& tile = tiles[keys[i].second];
+            tilesChanged |= mRenderingTiles[i] != tile;
+            mRenderingTiles[i] = tile;
+        }
+
+        if (tilesChanged)
+        {
+            mTileTimes.Clear();
+        }
+    }
+
+    mTileTimes.Resize(mRenderingTiles.Size(), 0.0);
 }
 
 void Viewport::BuildInitialBlocksList()
@@ -5,13 +5,16 @@
 #include "Context.h"
 #include "Counters.h"
 #include "PostProcess.h"
+#include "Renderer.h"
 
 #include "../Math/Random.h"
 #include "../Sampling/HaltonSampler.h"
 #include "../Sampling/GenericSampler.h"
+#include "../Traversal/RayStream.h"
 #include "../Math/Rectangle.h"
 #include "../Utils/Bitmap.h"
 #include "../Utils/ThreadPool.h"
+#include "../Utils/Timer.h"
 #include "../Utils/AlignmentAllocator.h"
 
 
@@ -19,6 +22,7 @@ namespace rt {
 
 class IRenderer;
 class Camera;
+class Film;
 
 using RendererPtr = std::shared_ptr<IRenderer>;
 
@@ -41,7 +45,12 @@ public:
     RAYLIB_API bool SetRenderingParams(const RenderingParams& params);
     RAYLIB_API bool SetRenderer(const RendererPtr& renderer);
     RAYLIB_API bool SetPostprocessParams(const PostprocessParams& params);
-    RAYLIB_API bool Render(const Camera& camera);
+
+    // render 'numPasses' passes (samples per pixel)
+    // Note: if the renderer allows it, the passes are pipelined: a tile of the next pass can be rendered
+    // while other tiles of the previous pass are still in progress (see FrameStats::stages for the idle time)
+    RAYLIB_API bool Render(const Camera& camera, Uint32 numPasses = 1);
+
     RAYLIB_API void Reset();
 
     RAYLIB_API void SetPixelBreakpoint(Uint32 x, Uint32 y);
@@ -53,7 +62,10 @@ public:
     RT_FORCE_INLINE Uint32 GetHeight() const { return mSum.GetHeight(); }
 
     RT_FORCE_INLINE const RenderingProgress& GetProgress() const { return mProgress; }
-    RT_FORCE_INLINE const RayTracingCounters& GetCounters() const { return mCounters; }
+    RT_FORCE_INLINE const RayTracingCounters& GetCounters() const { return mFrameStats.counters; }
+
+    // statistics of the last rendered frame (counters are aggregated from all the threads)
+    RT_FORCE_INLINE const FrameStats& GetFrameStats() const { return mFrameStats; }
 
     RAYLIB_API void VisualizeActiveBlocks(Bitmap& bitmap) const;
 
@@ -68,6 +80,7 @@ private:
         const IRenderer& renderer;
         const Camera& camera;
         const math::Vector4 sampleOffset;
+        const Uint32 passNumber;
     };
 
     struct RT_ALIGN(16) PostprocessParamsInternal
@@ -80,25 +93,70 @@ private:
 
     void BuildInitialBlocksList();
 
+    // zero the accumulation buffers (in parallel, see RenderingParams::pinThreads)
+    void ClearAccumulationBuffers();
+
+    // film accumulating samples of a given pass
+    Film CreateFilm(Uint32 passNumber);
+
+    // add samples splatted in a given pass to the accumulation buffers and clear the splat layer
+    void MergeSplats(Uint32 passNumber);
+
     // compute average error (variance) in the image
     void ComputeError();
 
     // calculate estimated error (variance) of a given block
     float ComputeBlockError(const Block& block) const;
 
-    // generate list of tiles to be rendered (updates mRenderingTiles)
+    // generate list of tiles to be rendered, ordered along Hilbert curve (updates mRenderingTiles)
     void GenerateRenderingTiles();
 
     void UpdateBlocksList();
 
+    // returns true if tiles of subsequent passes can be rendered without synchronization of all the threads
+    bool CanPipelinePasses() const;
+
+    // generate per-pass sampler seeds and pixel offsets (updates mPassSeeds and mPassSampleOffsets)
+    void InitPasses(Uint32 numPasses);
+
+    // render single pass, all the stages are separated with barriers
+    void RenderPass(const Camera& camera);
+
+    // render multiple passes at once, each tile is post processed as soon as all its passes are finished
+    void RenderPipelinedPasses(const Camera& camera, Uint32 numPasses);
+
+    // update adaptive rendering blocks and error estimate
+    void OnPassesFinished();
+
+    // run tasks in the thread pool measuring time spent by each thread
+    template<typename TaskType>
+    void RunParallelTasks(const TaskType& task, Uint32 num);
+
+    // run a task for every rendering tile, the tiles that were the most expensive in the previous pass go first
+    template<typename TaskType>
+    void RunTileTasks(const TaskType& task);
+
+    // measure wall time and idle time of the worker threads (updates mFrameStats.stages)
+    void BeginStage();
+    void EndStage(RenderingStage stage);
+
     // raytrace single image tile (will be called from multiple threads)
     void PreRenderTile(const TileRenderingContext& tileContext, RenderingContext& renderingContext, const Block& tile);
     void RenderTile(const TileRenderingContext& tileContext, RenderingContext& renderingContext, const Block& tile);
 
-    void PerformPostProcess();
+    // raytrace single image tile in 4x2 pixel groups using SIMD-8 traversal (see TraversalMode::Simd8)
+    void RenderTile_Simd8(const TileRenderingContext& tileContext, RenderingContext& renderingContext, const Block& tile, Film& film);
+
+    // render all the tiles in stream mode (see TraversalMode::Stream)
+    void RenderStream(const TileRenderingContext& tileContext);
+
+    // trace paths of a range of rendering tiles in stream mode
+    void RenderStreamBatch(const TileRenderingContext& tileContext, Uint32 firstTile, Uint32 numTiles, Uint32 numPaths);
+
+    void PerformPostProcess(Uint32 passNumber);
 
     // generate "front buffer" image from "sum" image
-    void PostProcessTile(const Block& tile, Uint32 threadID);
+    void PostProcessTile(const Block& tile, Uint32 threadID, Uint32 passNumber);
 
     ThreadPool mThreadPool;
 
@@ -112,6 +170,7 @@ private:
 
     Bitmap mSum;            // image with accumulated samples (floating point, high dynamic range)
     Bitmap mSecondarySum;   // contains image with every second sample - required for adaptive rendering
+    Bitmap mSplatSum;       // samples splatted in the current pass (allocated only if the renderer splats to film)
     Bitmap mFrontBuffer;    // postprocesses image (low dynamic range)
     DynArray<Uint32> mPassesPerPixel;
     DynArray<math::Float2> mPixelSalt; // salt value for each pixel
@@ -119,12 +178,26 @@ private:
     RenderingParams mParams;
     PostprocessParamsInternal mPostprocessParams;
 
-    RayTracingCounters mCounters;
+    FrameStats mFrameStats;
+    Timer mStageTimer;
 
     RenderingProgress mProgress;
 
     DynArray<Block> mBlocks;
     DynArray<Block> mRenderingTiles;
+    DynArray<double> mTileTimes;    // rendering time of each tile in the last pass (zero if not measured yet)
+    DynArray<Uint32> mTileOrder;    // dispatch order of the tiles (see RunTileTasks)
+    DynArray<double> mPassTimes;    // wall time of each pass rendered since the reset
+
+    // per-pass data of currently rendered passes
+    DynArray<float> mPassSeeds;
+    DynArray<math::Vector4> mPassSampleOffsets;
+
+    // stream mode data
+    RayStream mRayStreams[2];
+    DynArray<StreamPathState> mStreamPaths;
+    DynArray<HitPoint> mStreamHitPoints;
+    DynArray<Uint32> mStreamTileOffsets;    // index of the first path of each tile in a batch
 
     PixelBreakpoint mPendingPixelBreakpoint;
 };
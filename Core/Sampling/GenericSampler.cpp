@@ -20,9 +20,10 @@ GenericSampler::GenericSampler(Random& fallbackGenerator)
 
 GenericSampler::~GenericSampler() = default;
 
-void GenericSampler::ResetFrame(const DynArray<float>& seed)
+void GenericSampler::ResetFrame(const float* seed, Uint32 numDimensions)
 {
     mSeed = seed;
+    mNumSeedDimensions = numDimensions;
 }
 
 void GenericSampler::ResetPixel(const Uint32 salt)
@@ -34,7 +35,7 @@ void GenericSampler::ResetPixel(const Uint32 salt)
 float GenericSampler::GetFloat()
 {
     Uint32 currentSample = mSamplesGenerated++;
-    if (currentSample < mSeed.Size())
+    if (currentSample < mNumSeedDimensions)
     {
         Uint32 salt = mSalt;
         mSalt = XorShift(mSalt);
@@ -63,7 +64,7 @@ const Float3 GenericSampler::GetFloat3()
     const Uint32 currentSample = mSamplesGenerated;
     mSamplesGenerated += 3;
 
-    if (currentSample < mSeed.Size())
+    if (currentSample < mNumSeedDimensions)
     {
         const Uint32 salt0 = mSalt & INT32_MAX;
         mSalt = XorShift(mSalt);
@@ -72,7 +73,7 @@ const Float3 GenericSampler::GetFloat3()
         const Uint32 salt2 = mSalt & INT32_MAX;
         mSalt = XorShift(mSalt);
 
-        v = Vector4(Float3(mSeed.Data() + currentSample));
+        v = Vector4(Float3(mSeed + currentSample));
         v += Vector4::FromIntegers(salt0, salt1, salt2, 0) * (1.0f / float(INT32_MAX));
 
         // wrap
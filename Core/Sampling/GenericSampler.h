@@ -16,10 +16,30 @@ public:
     GenericSampler(math::Random& fallbackGenerator);
     ~GenericSampler();
 
-    void ResetFrame(const DynArray<float>& seed);
+    // set low-discrepancy sample of the current frame (pass)
+    // Note: the seed is not copied, it must be kept alive until next ResetFrame call
+    void ResetFrame(const float* seed, Uint32 numDimensions);
 
     void ResetPixel(const Uint32 salt);
 
+    // state of the current pixel sample, allows suspending and resuming a path (e.g. in stream rendering)
+    struct PixelState
+    {
+        Uint32 salt;
+        Uint32 samplesGenerated;
+    };
+
+    RT_FORCE_INLINE const PixelState GetPixelState() const
+    {
+        return PixelState{ mSalt, mSamplesGenerated };
+    }
+
+    RT_FORCE_INLINE void SetPixelState(const PixelState& state)
+    {
+        mSalt = state.salt;
+        mSamplesGenerated = state.samplesGenerated;
+    }
+
     // get next sample
     float GetFloat();
     const math::Float2 GetFloat2();
@@ -30,7 +50,8 @@ private:
     Uint32 mSalt;
     Uint32 mSamplesGenerated;
 
-    DynArray<float> mSeed;
+    const float* mSeed = nullptr;
+    Uint32 mNumSeedDimensions = 0;
 
     math::Random& mFallbackGenerator;
 };
@@ -0,0 +1,422 @@
+#include "PCH.h"
+#include "MeshInstanceSet.h"
+#include "Mesh/Mesh.h"
+#include "Material/Material.h"
+#include "BVH/BVHBuilder.h"
+#include "Rendering/ShadingData.h"
+#include "Utils/ThreadPool.h"
+#include "Utils/Logger.h"
+
+#include "Traversal/Traversal_Single.h"
+#include "Traversal/Traversal_Packet.h"
+#include "Traversal/Traversal_Wide.h"
+#include "Traversal/Traversal_Simd.h"
+
+namespace rt {
+
+using namespace math;
+
+MeshInstanceSet::MeshInstanceSet() = default;
+
+MeshInstanceSet::~MeshInstanceSet() = default;
+
+MeshInstanceSet::MeshInstanceSet(MeshInstanceSet&&) = default;
+
+MeshInstanceSet& MeshInstanceSet::operator = (MeshInstanceSet&&) = default;
+
+Uint32 MeshInstanceSet::AddMesh(const MeshPtr& mesh)
+{
+    RT_ASSERT(mesh);
+
+    mMeshes.PushBack(mesh);
+    return mMeshes.Size() - 1;
+}
+
+Uint32 MeshInstanceSet::AddMaterial(const MaterialPtr& material)
+{
+    RT_ASSERT(material);
+
+    mMaterials.PushBack(material);
+    return mMaterials.Size() - 1;
+}
+
+bool MeshInstanceSet::AddInstance(const Matrix4& transform, Uint32 meshIndex, Uint32 materialIndex)
+{
+    if (meshIndex >= mMeshes.Size())
+    {
+        RT_LOG_ERROR("Invalid mesh index: %u (num meshes = %u)", meshIndex, mMeshes.Size());
+        return false;
+    }
+
+    if (materialIndex != MeshInstance::NoMaterialOverride && materialIndex >= mMaterials.Size())
+    {
+        RT_LOG_ERROR("Invalid material index: %u (num materials = %u)", materialIndex, mMaterials.Size());
+        return false;
+    }
+
+    if (mInstances.Size() >= RT_INSTANCE_OBJECT_FLAG)
+    {
+        RT_LOG_ERROR("Too many mesh instances");
+        return false;
+    }
+
+    if (!transform.IsValid())
+    {
+        RT_LOG_ERROR("Invalid mesh instance transform");
+        return false;
+    }
+
+    // traversal inverts the transform with Matrix4::FastInverseNoScale, so scaling and shearing are not supported
+    const float tolerance = 1.0e-3f;
+    for (Uint32 i = 0; i < 3; ++i)
+    {
+        for (Uint32 j = i; j < 3; ++j)
+        {
+            const float expected = (i == j) ? 1.0f : 0.0f;
+            if (Abs(Vector4::Dot3(transform[i], transform[j]) - expected) > tolerance)
+            {
+                RT_LOG_ERROR("Mesh instance transform must consist of rotation and translation only");
+                return false;
+            }
+        }
+    }
+
+    if (!mInstances.Reserve(mInstances.Size() + 1))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    MeshInstance instance;
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        instance.transform[i] = transform[i].ToFloat3();
+    }
+    instance.meshIndex = meshIndex;
+    instance.materialIndex = materialIndex;
+
+    mInstances.PushBack(instance);
+    return true;
+}
+
+bool MeshInstanceSet::ReplicateData(ThreadPool& threadPool) const
+{
+    if (!mBVH.ReplicateNodes(threadPool) || !mWideBVH.ReplicateNodes(threadPool))
+    {
+        return false;
+    }
+
+    for (const MeshPtr& mesh : mMeshes)
+    {
+        if (!mesh->ReplicateData(threadPool))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MeshInstanceSet::BuildBVH(ThreadPool* threadPool)
+{
+    const Uint32 numInstances = mInstances.Size();
+
+    DynArray<Box> boxes;
+    if (!boxes.Resize(numInstances))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    // calculate world-space bounds of the instances
+    const Uint32 instancesPerTask = 16384;
+    const Uint32 numTasks = (numInstances + instancesPerTask - 1) / instancesPerTask;
+
+    const auto calculateBoxesCallback = [this, &boxes, numInstances, instancesPerTask](Uint32 taskID, Uint32)
+    {
+        const Uint32 end = Min(numInstances, (taskID + 1) * instancesPerTask);
+        for (Uint32 i = taskID * instancesPerTask; i < end; ++i)
+        {
+            const MeshInstance& instance = mInstances[i];
+            boxes[i] = instance.GetTransform().TransformBox(mMeshes[instance.meshIndex]->GetBoundingBox());
+        }
+    };
+
+    if (threadPool && numTasks > 1)
+    {
+        threadPool->RunParallelTask(calculateBoxesCallback, numTasks);
+    }
+    else
+    {
+        for (Uint32 i = 0; i < numTasks; ++i)
+        {
+            calculateBoxesCallback(i, 0);
+        }
+    }
+
+    BVHBuilder::BuildingParams params;
+    params.maxLeafNodeSize = 2;
+    params.threadPool = threadPool;
+
+    BVHBuilder::Indices newOrder;
+    BVHBuilder bvhBuilder(mBVH);
+    if (!bvhBuilder.Build(boxes.Data(), numInstances, params, newOrder))
+    {
+        return false;
+    }
+
+    DynArray<MeshInstance> newInstances;
+    if (!newInstances.Resize(numInstances))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    for (Uint32 i = 0; i < numInstances; ++i)
+    {
+        newInstances[i] = mInstances[newOrder[i]];
+    }
+
+    mInstances = std::move(newInstances);
+
+    if (!mWideBVH.Build(mBVH))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void MeshInstanceSet::Traverse_Single(const SingleTraversalContext& context) const
+{
+    if (mInstances.Empty())
+    {
+        return;
+    }
+
+#ifdef RT_ENABLE_WIDE_BVH
+    GenericTraverse_Wide_Single(context, 0, this);
+#else
+    GenericTraverse_Single(context, 0, this);
+#endif // RT_ENABLE_WIDE_BVH
+}
+
+bool MeshInstanceSet::Traverse_Shadow_Single(const SingleTraversalContext& context) const
+{
+    if (mInstances.Empty())
+    {
+        return false;
+    }
+
+#ifdef RT_ENABLE_WIDE_BVH
+    return GenericTraverse_Wide_Shadow_Single(context, this);
+#else
+    return GenericTraverse_Shadow_Single(context, this);
+#endif // RT_ENABLE_WIDE_BVH
+}
+
+void MeshInstanceSet::Traverse_Simd8(const SimdTraversalContext& context) const
+{
+    if (mInstances.Empty())
+    {
+        return;
+    }
+
+    GenericTraverse_Simd8(context, 0, this);
+}
+
+void MeshInstanceSet::Traverse_Shadow_Simd8(const SimdTraversalContext& context) const
+{
+    if (mInstances.Empty())
+    {
+        return;
+    }
+
+    GenericTraverse_Shadow_Simd8(context, this);
+}
+
+void MeshInstanceSet::Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+{
+    RT_UNUSED(objectID);
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const Uint32 instanceIndex = node.childIndex + i;
+        const MeshInstance& instance = mInstances[instanceIndex];
+        const Mesh* mesh = mMeshes[instance.meshIndex].get();
+
+        // transform ray to local-space
+        const Ray transformedRay = instance.GetTransform().FastInverseNoScale().TransformRay_Unsafe(context.ray);
+
+        const SingleTraversalContext instanceContext =
+        {
+            transformedRay,
+            context.hitPoint,
+            context.context
+        };
+
+        const Uint32 instanceObjectID = RT_INSTANCE_OBJECT_FLAG | instanceIndex;
+
+#ifdef RT_ENABLE_WIDE_BVH
+        // quantized nodes are only supported by binary BVH traversal
+        if (mesh->GetBVH().GetNodeFormat() == BVH::NodeFormat::Full)
+        {
+            GenericTraverse_Wide_Single<Mesh>(instanceContext, instanceObjectID, mesh);
+            continue;
+        }
+#endif // RT_ENABLE_WIDE_BVH
+
+        GenericTraverse_Single<Mesh>(instanceContext, instanceObjectID, mesh);
+    }
+}
+
+bool MeshInstanceSet::Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const
+{
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const MeshInstance& instance = mInstances[node.childIndex + i];
+        const Mesh* mesh = mMeshes[instance.meshIndex].get();
+
+        // transform ray to local-space
+        Ray transformedRay = instance.GetTransform().FastInverseNoScale().TransformRay_Unsafe(context.ray);
+        transformedRay.originDivDir = transformedRay.origin * transformedRay.invDir;
+
+        const SingleTraversalContext instanceContext =
+        {
+            transformedRay,
+            context.hitPoint,
+            context.context
+        };
+
+        bool occluded;
+
+#ifdef RT_ENABLE_WIDE_BVH
+        // quantized nodes are only supported by binary BVH traversal
+        if (mesh->GetBVH().GetNodeFormat() == BVH::NodeFormat::Full)
+        {
+            occluded = GenericTraverse_Wide_Shadow_Single<Mesh>(instanceContext, mesh);
+        }
+        else
+#endif // RT_ENABLE_WIDE_BVH
+        {
+            occluded = GenericTraverse_Shadow_Single<Mesh>(instanceContext, mesh);
+        }
+
+        if (occluded)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MeshInstanceSet::TransformRays(const PacketTraversalContext& context, const Matrix4& invTransform, Uint32 numActiveGroups)
+{
+    for (Uint32 j = 0; j < numActiveGroups; ++j)
+    {
+        RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+        rayGroup.rays[1].origin = invTransform.TransformPoint(rayGroup.rays[0].origin);
+        rayGroup.rays[1].dir = invTransform.TransformVector(rayGroup.rays[0].dir);
+        rayGroup.rays[1].invDir = Vector3x8::FastReciprocal(rayGroup.rays[1].dir);
+    }
+}
+
+void MeshInstanceSet::Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, Uint32 numActiveGroups) const
+{
+    RT_UNUSED(objectID);
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const Uint32 instanceIndex = node.childIndex + i;
+        const MeshInstance& instance = mInstances[instanceIndex];
+
+        TransformRays(context, instance.GetTransform().FastInverseNoScale(), numActiveGroups);
+
+        GenericTraverse_Packet<Mesh, 1>(context, RT_INSTANCE_OBJECT_FLAG | instanceIndex, mMeshes[instance.meshIndex].get(), numActiveGroups);
+    }
+}
+
+Uint32 MeshInstanceSet::Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, Uint32 numActiveGroups) const
+{
+    Uint32 numOccludedRays = 0;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const MeshInstance& instance = mInstances[node.childIndex + i];
+
+        TransformRays(context, instance.GetTransform().FastInverseNoScale(), numActiveGroups);
+
+        numOccludedRays += GenericTraverse_Shadow_Packet<Mesh, 1>(context, mMeshes[instance.meshIndex].get(), numActiveGroups);
+    }
+
+    return numOccludedRays;
+}
+
+void MeshInstanceSet::Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+{
+    RT_UNUSED(objectID);
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const Uint32 instanceIndex = node.childIndex + i;
+        const MeshInstance& instance = mInstances[instanceIndex];
+
+        // transform rays to local-space
+        const Ray_Simd8 transformedRay = instance.GetTransform().FastInverseNoScale().TransformRay_Unsafe(context.ray);
+
+        const SimdTraversalContext instanceContext =
+        {
+            transformedRay,
+            context.hitPoint,
+            context.context
+        };
+
+        GenericTraverse_Simd8<Mesh>(instanceContext, RT_INSTANCE_OBJECT_FLAG | instanceIndex, mMeshes[instance.meshIndex].get());
+    }
+}
+
+void MeshInstanceSet::Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const
+{
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const MeshInstance& instance = mInstances[node.childIndex + i];
+
+        // transform rays to local-space
+        const Ray_Simd8 transformedRay = instance.GetTransform().FastInverseNoScale().TransformRay_Unsafe(context.ray);
+
+        const SimdTraversalContext instanceContext =
+        {
+            transformedRay,
+            context.hitPoint,
+            context.context
+        };
+
+        if (GenericTraverse_Shadow_Simd8<Mesh>(instanceContext, mMeshes[instance.meshIndex].get()))
+        {
+            return;
+        }
+    }
+}
+
+const Matrix4 MeshInstanceSet::GetTransform(const HitPoint& hitPoint) const
+{
+    RT_ASSERT(hitPoint.objectId & RT_INSTANCE_OBJECT_FLAG);
+
+    return mInstances[hitPoint.objectId & ~RT_INSTANCE_OBJECT_FLAG].GetTransform();
+}
+
+void MeshInstanceSet::EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const
+{
+    RT_ASSERT(hitPoint.objectId & RT_INSTANCE_OBJECT_FLAG);
+
+    const MeshInstance& instance = mInstances[hitPoint.objectId & ~RT_INSTANCE_OBJECT_FLAG];
+    mMeshes[instance.meshIndex]->EvaluateShadingData_Single(hitPoint, outShadingData, Material::GetDefaultMaterial().get());
+
+    if (instance.materialIndex != MeshInstance::NoMaterialOverride)
+    {
+        outShadingData.material = mMaterials[instance.materialIndex].get();
+    }
+}
+
+} // namespace rt
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "../RayLib.h"
+
+#include "../Traversal/HitPoint.h"
+#include "../BVH/BVH.h"
+#include "../BVH/WideBVH.h"
+#include "../Containers/DynArray.h"
+#include "../Math/Float3.h"
+#include "../Math/Matrix4.h"
+
+#include <memory>
+
+namespace rt {
+
+class Mesh;
+class Material;
+class ThreadPool;
+struct HitPoint;
+struct ShadingData;
+struct SingleTraversalContext;
+struct PacketTraversalContext;
+struct SimdTraversalContext;
+
+using MeshPtr = std::shared_ptr<Mesh>;
+using MaterialPtr = std::shared_ptr<rt::Material>;
+
+// Placement of a shared mesh on the scene
+// Note: the record is kept compact (56 bytes), so the scene can hold millions of instances
+struct MeshInstance
+{
+    static constexpr Uint32 NoMaterialOverride = UINT32_MAX;
+
+    // local->world transform (rows of 4x4 matrix, the last column is implicit)
+    // NOTE: only rigid transforms are supported (rotation and translation)
+    math::Float3 transform[4];
+
+    // index of the mesh in the instance set
+    Uint32 meshIndex;
+
+    // index of material replacing all the mesh materials (or NoMaterialOverride)
+    Uint32 materialIndex;
+
+    RT_FORCE_INLINE const math::Matrix4 GetTransform() const
+    {
+        return math::Matrix4(math::Vector4(transform[0]),
+                             math::Vector4(transform[1]),
+                             math::Vector4(transform[2]),
+                             math::Vector4(transform[3]) + math::VECTOR_W);
+    }
+};
+
+static_assert(sizeof(MeshInstance) == 56, "Invalid MeshInstance size");
+
+/**
+ * Set of mesh instances with a top-level BVH built over the instances world-space bounds.
+ * Meshes (and their BVHs) are shared between the instances.
+ */
+class RT_ALIGN(16) MeshInstanceSet : public Aligned<16>
+{
+public:
+    MeshInstanceSet();
+    ~MeshInstanceSet();
+    MeshInstanceSet(MeshInstanceSet&&);
+    MeshInstanceSet& operator = (MeshInstanceSet&&);
+
+    // register mesh shared by instances, returns the mesh index
+    Uint32 AddMesh(const MeshPtr& mesh);
+
+    // register material overriding instance's mesh materials, returns the material index
+    Uint32 AddMaterial(const MaterialPtr& material);
+
+    // place instance of a registered mesh
+    // Note: the transform must be rigid (rotation and translation only), scaled or sheared instances are rejected
+    bool AddInstance(const math::Matrix4& transform, Uint32 meshIndex, Uint32 materialIndex = MeshInstance::NoMaterialOverride);
+
+    // build top-level BVH over the instances
+    // NOTE: this reorders the instances (instance index stored in hit points refers to the new order)
+    bool BuildBVH(ThreadPool* threadPool = nullptr);
+
+    // copy the top-level BVH and the meshes' traversal data to every NUMA node of the thread pool (see Mesh::ReplicateData)
+    bool ReplicateData(ThreadPool& threadPool) const;
+
+    RT_FORCE_INLINE bool IsEmpty() const { return mInstances.Empty(); }
+    RT_FORCE_INLINE const DynArray<MeshInstance>& GetInstances() const { return mInstances; }
+    RT_FORCE_INLINE const DynArray<MeshPtr>& GetMeshes() const { return mMeshes; }
+
+    RT_FORCE_INLINE const BVH& GetBVH() const { return mBVH; }
+    RT_FORCE_INLINE const DefaultWideBVH& GetWideBVH() const { return mWideBVH; }
+
+    // traverse the instances (ray is expected in world space)
+    void Traverse_Single(const SingleTraversalContext& context) const;
+    bool Traverse_Shadow_Single(const SingleTraversalContext& context) const;
+    void Traverse_Simd8(const SimdTraversalContext& context) const;
+    void Traverse_Shadow_Simd8(const SimdTraversalContext& context) const;
+
+    // get local->world transform of an instance hit
+    const math::Matrix4 GetTransform(const HitPoint& hitPoint) const;
+
+    // Calculate input data for shading routine
+    // NOTE: all calculations are performed in instance's local space
+    void EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const;
+
+    void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
+    void Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, Uint32 numActiveGroups) const;
+
+    bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const;
+    Uint32 Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, Uint32 numActiveGroups) const;
+
+    void Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
+    void Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const;
+
+private:
+    MeshInstanceSet(const MeshInstanceSet&) = delete;
+    MeshInstanceSet& operator = (const MeshInstanceSet&) = delete;
+
+    // transform world-space rays of active groups to instance's local space
+    static void TransformRays(const PacketTraversalContext& context, const math::Matrix4& invTransform, Uint32 numActiveGroups);
+
+    DynArray<MeshPtr> mMeshes;
+    DynArray<MaterialPtr> mMaterials;
+    DynArray<MeshInstance> mInstances;
+
+    // top-level BVH
+    BVH mBVH;
+
+    // the same hierarchy collapsed to multi-way tree
+    DefaultWideBVH mWideBVH;
+};
+
+} // namespace rt
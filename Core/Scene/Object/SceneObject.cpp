@@ -1,12 +1,23 @@
 #include "PCH.h"
 #include "SceneObject.h"
 #include "Material/Material.h"
+#include "Traversal/TraversalContext.h"
+#include "Rendering/Context.h"
+#include "Math/Transcendental.h"
 
 namespace rt {
 
 using namespace math;
 
+// max rotation angle between two consecutive samples when computing motion bounds
+static const float MotionBoundsAngleStep = RT_PI / 16.0f;
+static const Uint32 MaxMotionBoundsSamples = 64;
+
 ISceneObject::ISceneObject()
+    : mLinearVelocity(Vector4::Zero())
+    , mAngularVelocityAxis(VECTOR_X)
+    , mAngularVelocityAngle(0.0f)
+    , mIsMoving(false)
 {
     mTransform = Matrix4::Identity();
     mInverseTranform = Matrix4::Identity();
@@ -34,4 +45,195 @@ void ISceneObject::SetTransform(const math::Matrix4& matrix)
     mInverseTranform = matrix.FastInverseNoScale();
 }
 
+void ISceneObject::SetLinearVelocity(const Vector4& velocity)
+{
+    RT_ASSERT(velocity.IsValid());
+
+    mLinearVelocity = velocity * VECTOR_ONE3;
+    mIsMoving = !mLinearVelocity.IsZero().All() || mAngularVelocityAngle > 0.0f;
+}
+
+void ISceneObject::SetAngularVelocity(const Quaternion& quat)
+{
+    RT_ASSERT(quat.IsValid());
+
+    quat.Normalized().ToAxis(mAngularVelocityAxis, mAngularVelocityAngle);
+
+    // use the shortest arc
+    if (mAngularVelocityAngle > RT_PI)
+    {
+        mAngularVelocityAngle = 2.0f * RT_PI - mAngularVelocityAngle;
+        mAngularVelocityAxis = -mAngularVelocityAxis;
+    }
+
+    if (!(mAngularVelocityAngle > RT_EPSILON) || !(mAngularVelocityAxis.SqrLength3() > 0.5f))
+    {
+        mAngularVelocityAngle = 0.0f;
+        mAngularVelocityAxis = VECTOR_X;
+    }
+
+    mIsMoving = !mLinearVelocity.IsZero().All() || mAngularVelocityAngle > 0.0f;
+}
+
+const Matrix4 ISceneObject::ComputeTransform_Motion(const float t) const
+{
+    Matrix4 result = mTransform;
+
+    if (mAngularVelocityAngle > 0.0f)
+    {
+        // rotate in local space first
+        const Matrix4 rotation = Quaternion::FromAxisAndAngle(mAngularVelocityAxis, mAngularVelocityAngle * t).ToMatrix4();
+        result = rotation * mTransform;
+    }
+
+    result[3] = Vector4::MulAndAdd(mLinearVelocity, t, mTransform[3]);
+
+    return result;
+}
+
+Box ISceneObject::GetBoundingBox(const float timeBegin, const float timeEnd) const
+{
+    RT_ASSERT(timeBegin <= timeEnd);
+
+    const Box localBox = GetLocalBoundingBox();
+
+    if (!mIsMoving)
+    {
+        return mTransform.TransformBox(localBox);
+    }
+
+    const Box boxBegin = ComputeTransform(timeBegin).TransformBox(localBox);
+    const Box boxEnd = ComputeTransform(timeEnd).TransformBox(localBox);
+    Box result(boxBegin, boxEnd);
+
+    // linear motion is fully enclosed by the boxes at the range ends
+    if (mAngularVelocityAngle == 0.0f || timeBegin == timeEnd)
+    {
+        return result;
+    }
+
+    // rotating object - sample the motion
+    const float totalAngle = mAngularVelocityAngle * (timeEnd - timeBegin);
+    const Uint32 numSteps = Clamp(static_cast<Uint32>(ceilf(totalAngle / MotionBoundsAngleStep)), 1u, MaxMotionBoundsSamples);
+    const float timeStep = (timeEnd - timeBegin) / static_cast<float>(numSteps);
+
+    for (Uint32 i = 1; i < numSteps; ++i)
+    {
+        const float t = timeBegin + timeStep * static_cast<float>(i);
+        result = Box(result, ComputeTransform(t).TransformBox(localBox));
+    }
+
+    // between the samples points travel along arcs, which may stick out of the boxes
+    // Expand the box by the max arc's distance from its chord: r * (1 - cos(angle / 2)) = 2 * r * sin^2(angle / 4)
+    const float radius = Vector4::Max(Vector4::Abs(localBox.min), Vector4::Abs(localBox.max)).Length3();
+    const float sinQuarterAngle = Sin(0.25f * totalAngle / static_cast<float>(numSteps));
+    const float margin = 2.0f * radius * sinQuarterAngle * sinQuarterAngle;
+    result.min -= Vector4(margin, margin, margin, 0.0f);
+    result.max += Vector4(margin, margin, margin, 0.0f);
+
+    return result;
+}
+
+Uint32 ISceneObject::Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const
+{
+    Uint32 numOccludedRays = 0;
+
+    for (Uint32 i = 0; i < numActiveGroups; ++i)
+    {
+        RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[i]];
+        const Ray_Simd8& rays = rayGroup.rays[1];
+
+        bool occluded[RayPacket::RaysPerGroup] = { false };
+        for (Uint32 j = 0; j < RayPacket::RaysPerGroup; ++j)
+        {
+            // skip already occluded (or disabled) rays
+            if (!(rayGroup.maxDistances[j] > 0.0f))
+            {
+                continue;
+            }
+
+            Ray ray;
+            ray.origin = Vector4(rays.origin.x[j], rays.origin.y[j], rays.origin.z[j], 0.0f);
+            ray.dir = Vector4(rays.dir.x[j], rays.dir.y[j], rays.dir.z[j], 0.0f);
+            ray.invDir = Vector4(rays.invDir.x[j], rays.invDir.y[j], rays.invDir.z[j], 0.0f);
+            ray.originDivDir = ray.origin * ray.invDir;
+
+            HitPoint hitPoint;
+            hitPoint.distance = rayGroup.maxDistances[j];
+
+            if (Traverse_Shadow_Single({ ray, hitPoint, context.context }))
+            {
+                occluded[j] = true;
+            }
+        }
+
+        const VectorBool8 mask(occluded[0], occluded[1], occluded[2], occluded[3], occluded[4], occluded[5], occluded[6], occluded[7]);
+        numOccludedRays += context.StoreOcclusion(rayGroup, mask);
+    }
+
+    return numOccludedRays;
+}
+
+void ISceneObject::Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const
+{
+    HitPoint_Simd8& hitPoints = context.hitPoint;
+
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        // skip inactive rays
+        if (!(hitPoints.distance[i] > 0.0f))
+        {
+            continue;
+        }
+
+        Ray ray;
+        ray.origin = Vector4(context.ray.origin.x[i], context.ray.origin.y[i], context.ray.origin.z[i], 0.0f);
+        ray.dir = Vector4(context.ray.dir.x[i], context.ray.dir.y[i], context.ray.dir.z[i], 0.0f);
+        ray.invDir = Vector4(context.ray.invDir.x[i], context.ray.invDir.y[i], context.ray.invDir.z[i], 0.0f);
+        ray.originDivDir = ray.origin * ray.invDir;
+
+        HitPoint hitPoint;
+        hitPoint.distance = hitPoints.distance[i];
+
+        Traverse_Single({ ray, hitPoint, context.context }, objectID);
+
+        if (hitPoint.objectId != RT_INVALID_OBJECT)
+        {
+            hitPoints.distance[i] = hitPoint.distance;
+            hitPoints.u[i] = hitPoint.u;
+            hitPoints.v[i] = hitPoint.v;
+            hitPoints.objectId[i] = hitPoint.objectId;
+            hitPoints.subObjectId[i] = hitPoint.subObjectId;
+        }
+    }
+}
+
+void ISceneObject::Traverse_Shadow_Simd8(const SimdTraversalContext& context) const
+{
+    HitPoint_Simd8& hitPoints = context.hitPoint;
+
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        // skip already occluded (or disabled) rays
+        if (!(hitPoints.distance[i] > 0.0f))
+        {
+            continue;
+        }
+
+        Ray ray;
+        ray.origin = Vector4(context.ray.origin.x[i], context.ray.origin.y[i], context.ray.origin.z[i], 0.0f);
+        ray.dir = Vector4(context.ray.dir.x[i], context.ray.dir.y[i], context.ray.dir.z[i], 0.0f);
+        ray.invDir = Vector4(context.ray.invDir.x[i], context.ray.invDir.y[i], context.ray.invDir.z[i], 0.0f);
+        ray.originDivDir = ray.origin * ray.invDir;
+
+        HitPoint hitPoint;
+        hitPoint.distance = hitPoints.distance[i];
+
+        if (Traverse_Shadow_Single({ ray, hitPoint, context.context }))
+        {
+            hitPoints.distance[i] = -std::numeric_limits<float>::infinity();
+        }
+    }
+}
+
 } // namespace rt
@@ -3,6 +3,7 @@
 #include "../../RayLib.h"
 #include "../../Math/Box.h"
 #include "../../Math/Matrix4.h"
+#include "../../Math/Quaternion.h"
 #include "../../Utils/AlignmentAllocator.h"
 #include "../../Traversal/HitPoint.h"
 
@@ -14,6 +15,7 @@ struct HitPoint;
 struct ShadingData;
 struct SingleTraversalContext;
 struct PacketTraversalContext;
+struct SimdTraversalContext;
 
 class Material;
 using MaterialPtr = std::shared_ptr<rt::Material>;
@@ -22,12 +24,31 @@ using MaterialPtr = std::shared_ptr<rt::Material>;
 class ISceneObject : public Aligned<16>
 {
 public:
+    // type tag used for devirtualized dispatch in the scene traversal
+    enum class Type : Uint8
+    {
+        Mesh,
+        Sphere,
+        SphereCloud,
+        Box,
+        Plane,
+        Light,
+    };
+
     RAYLIB_API ISceneObject();
     RAYLIB_API virtual ~ISceneObject();
 
+    virtual Type GetType() const = 0;
+
     RAYLIB_API void SetDefaultMaterial(const MaterialPtr& material);
     RAYLIB_API void SetTransform(const math::Matrix4& matrix);
 
+    // set object's motion (used for motion blur)
+    // Linear velocity is a world-space translation over time range 0.0...1.0
+    // Angular velocity is a rotation (around object's local origin) over time range 0.0...1.0
+    RAYLIB_API void SetLinearVelocity(const math::Vector4& velocity);
+    RAYLIB_API void SetAngularVelocity(const math::Quaternion& quat);
+
     // traverse the object and return hit points
     virtual void Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const = 0;
     virtual void Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const = 0;
@@ -35,38 +56,70 @@ public:
     // check shadow ray occlusion
     virtual bool Traverse_Shadow_Single(const SingleTraversalContext& context) const = 0;
 
+    // check occlusion of shadow rays packet (rays are expected in local space, see PacketTraversalContext::StoreOcclusion)
+    // Returns number of newly occluded rays
+    // Note: default implementation tests the rays one by one using Traverse_Shadow_Single
+    virtual Uint32 Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const;
+
+    // traverse the object with 8 rays at a time (rays are expected in local space)
+    // Note: default implementation traverses the rays one by one using Traverse_Single
+    virtual void Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const;
+
+    // check occlusion of 8 shadow rays (rays are expected in local space, see SimdTraversalContext::StoreOcclusion)
+    // Note: default implementation tests the rays one by one using Traverse_Shadow_Single
+    virtual void Traverse_Shadow_Simd8(const SimdTraversalContext& context) const;
+
     // Calculate input data for shading routine
     // NOTE: all calculations are performed in local space
     virtual void EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const = 0;
 
-    // Get world-space bounding box
-    virtual math::Box GetBoundingBox() const = 0;
+    // Get local-space bounding box
+    virtual math::Box GetLocalBoundingBox() const = 0;
+
+    // Get world-space bounding box enclosing the object's motion within given time range
+    RAYLIB_API math::Box GetBoundingBox(const float timeBegin = 0.0f, const float timeEnd = 1.0f) const;
 
     RT_FORCE_INLINE const math::Matrix4& GetTransform() const { return mTransform; }
 
+    RT_FORCE_INLINE bool IsMoving() const { return mIsMoving; }
+
     RT_FORCE_INLINE const Material* GetDefaultMaterial() const { return mDefaultMaterial.get(); }
 
+    // compute local->world transform at given time point
     RT_FORCE_INLINE const math::Matrix4 ComputeTransform(const float t) const
     {
-        // TODO motion blur
-        RT_UNUSED(t);
+        if (!mIsMoving)
+        {
+            return mTransform;
+        }
 
-        return mTransform;
+        return ComputeTransform_Motion(t);
     }
 
+    // compute world->local transform at given time point
     RT_FORCE_INLINE const math::Matrix4 ComputeInverseTransform(const float t) const
     {
-        // TODO motion blur
-        RT_UNUSED(t);
+        if (!mIsMoving)
+        {
+            return mInverseTranform;
+        }
 
-        return mInverseTranform;
+        return ComputeTransform_Motion(t).FastInverseNoScale();
     }
 
 private:
+    const math::Matrix4 ComputeTransform_Motion(const float t) const;
+
     math::Matrix4 mTransform; // local->world transform at time=0.0
     math::Matrix4 mInverseTranform;
 
-    // TODO velocity
+    math::Vector4 mLinearVelocity;
+
+    // angular velocity decomposed to axis-angle, so the rotation at given time is cheap to evaluate
+    math::Vector4 mAngularVelocityAxis;
+    float mAngularVelocityAngle;
+
+    bool mIsMoving;
 
     MaterialPtr mDefaultMaterial;
 };
@@ -83,12 +83,9 @@ BoxSceneObject::BoxSceneObject(const Vector4& size)
     , mInvSize(VECTOR_ONE / mSize)
 { }
 
-Box BoxSceneObject::GetBoundingBox() const
+Box BoxSceneObject::GetLocalBoundingBox() const
 {
-    const Box localBox(-mSize, mSize);
-    const Box box0 = ComputeTransform(0.0f).TransformBox(localBox);
-    const Box box1 = ComputeTransform(1.0f).TransformBox(localBox);
-    return Box(box0, box1);
+    return Box(-mSize, mSize);
 }
 
 void BoxSceneObject::Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const
@@ -12,8 +12,13 @@ class BoxSceneObject : public ISceneObject
 public:
     RAYLIB_API BoxSceneObject(const math::Vector4& size);
 
+    virtual Type GetType() const override { return Type::Box; }
+
 private:
-    virtual math::Box GetBoundingBox() const override;
+    // allow devirtualized calls from the scene traversal
+    friend class Scene;
+
+    virtual math::Box GetLocalBoundingBox() const override;
 
     virtual void Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const override;
     virtual void Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const override;
@@ -11,7 +11,7 @@ LightSceneObject::LightSceneObject(const ILight& light)
     : mLight(light)
 { }
 
-Box LightSceneObject::GetBoundingBox() const
+Box LightSceneObject::GetLocalBoundingBox() const
 {
     return mLight.GetBoundingBox();
 }
@@ -12,10 +12,15 @@ class LightSceneObject : public ISceneObject
 public:
     RAYLIB_API explicit LightSceneObject(const ILight& light);
 
+    virtual Type GetType() const override { return Type::Light; }
+
     RT_FORCE_INLINE const ILight& GetLight() const { return mLight; }
 
 private:
-    virtual math::Box GetBoundingBox() const override;
+    // allow devirtualized calls from the scene traversal
+    friend class Scene;
+
+    virtual math::Box GetLocalBoundingBox() const override;
 
     virtual void Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const override;
     virtual void Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const override;
@@ -3,6 +3,8 @@
 #include "Mesh/Mesh.h"
 #include "Traversal/Traversal_Single.h"
 #include "Traversal/Traversal_Packet.h"
+#include "Traversal/Traversal_Wide.h"
+#include "Traversal/Traversal_Simd.h"
 
 namespace rt {
 
@@ -12,24 +14,35 @@ MeshSceneObject::MeshSceneObject(const MeshPtr mesh)
     : mMesh(mesh)
 { }
 
-Box MeshSceneObject::GetBoundingBox() const
+Box MeshSceneObject::GetLocalBoundingBox() const
 {
-    const Box localBox = mMesh->GetBoundingBox();
-
-    // TODO just transformed box may be bigger that bounding box of rotated triangles
-    const Box box0 = ComputeTransform(0.0f).TransformBox(localBox);
-    const Box box1 = ComputeTransform(1.0f).TransformBox(localBox);
-
-    return Box(box0, box1);
+    return mMesh->GetBoundingBox();
 }
 
 void MeshSceneObject::Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const
 {
+#ifdef RT_ENABLE_WIDE_BVH
+    // quantized nodes are only supported by binary BVH traversal
+    if (mMesh->GetBVH().GetNodeFormat() == BVH::NodeFormat::Full)
+    {
+        GenericTraverse_Wide_Single<Mesh>(context, objectID, mMesh.get());
+        return;
+    }
+#endif // RT_ENABLE_WIDE_BVH
+
     GenericTraverse_Single<Mesh>(context, objectID, mMesh.get());
 }
 
 bool MeshSceneObject::Traverse_Shadow_Single(const SingleTraversalContext& context) const
 {
+#ifdef RT_ENABLE_WIDE_BVH
+    // quantized nodes are only supported by binary BVH traversal
+    if (mMesh->GetBVH().GetNodeFormat() == BVH::NodeFormat::Full)
+    {
+        return GenericTraverse_Wide_Shadow_Single<Mesh>(context, mMesh.get());
+    }
+#endif // RT_ENABLE_WIDE_BVH
+
     return GenericTraverse_Shadow_Single<Mesh>(context, mMesh.get());
 }
 
@@ -38,6 +51,21 @@ void MeshSceneObject::Traverse_Packet(const PacketTraversalContext& context, con
     GenericTraverse_Packet<Mesh, 1>(context, objectID, mMesh.get(), numActiveGroups);
 }
 
+Uint32 MeshSceneObject::Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const
+{
+    return GenericTraverse_Shadow_Packet<Mesh, 1>(context, mMesh.get(), numActiveGroups);
+}
+
+void MeshSceneObject::Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const
+{
+    GenericTraverse_Simd8<Mesh>(context, objectID, mMesh.get());
+}
+
+void MeshSceneObject::Traverse_Shadow_Simd8(const SimdTraversalContext& context) const
+{
+    GenericTraverse_Shadow_Simd8<Mesh>(context, mMesh.get());
+}
+
 void MeshSceneObject::EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const
 {
     mMesh->EvaluateShadingData_Single(hitPoint, outShadingData, GetDefaultMaterial());
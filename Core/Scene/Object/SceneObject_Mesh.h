@@ -23,6 +23,8 @@ class MeshSceneObject : public ISceneObject
 public:
     RAYLIB_API explicit MeshSceneObject(const MeshPtr mesh);
 
+    virtual Type GetType() const override { return Type::Mesh; }
+
     const MeshPtr mMesh;
 
     // TODO:
@@ -30,12 +32,19 @@ public:
     // material mapping
 
 private:
-    virtual math::Box GetBoundingBox() const override;
+    // allow devirtualized calls from the scene traversal
+    friend class Scene;
+
+    virtual math::Box GetLocalBoundingBox() const override;
 
     virtual void Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const override;
     virtual void Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const override;
 
     virtual bool Traverse_Shadow_Single(const SingleTraversalContext& context) const override;
+    virtual Uint32 Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const override;
+
+    virtual void Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const override;
+    virtual void Traverse_Shadow_Simd8(const SimdTraversalContext& context) const override;
 
     virtual void EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const override;
 };
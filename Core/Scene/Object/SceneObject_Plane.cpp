@@ -13,10 +13,9 @@ PlaneSceneObject::PlaneSceneObject(const Float2 size, const Float2 texScale)
     , mTextureScale(texScale)
 { }
 
-Box PlaneSceneObject::GetBoundingBox() const
+Box PlaneSceneObject::GetLocalBoundingBox() const
 {
-    const Box localBox(Vector4(-mSize.x, 0.0f, -mSize.y, 0.0f), Vector4(mSize.x, 0.0f, mSize.y, 0.0f));
-    return ComputeTransform(0.0f).TransformBox(localBox); // TODO motion blur
+    return Box(Vector4(-mSize.x, 0.0f, -mSize.y, 0.0f), Vector4(mSize.x, 0.0f, mSize.y, 0.0f));
 }
 
 bool PlaneSceneObject::Traverse_Single_Internal(const SingleTraversalContext& context, float& outDist) const
@@ -13,8 +13,13 @@ class PlaneSceneObject : public ISceneObject
 public:
     RAYLIB_API PlaneSceneObject(const math::Float2 size = math::Float2(FLT_MAX), const math::Float2 texScale = math::Float2(1.0f));
 
+    virtual Type GetType() const override { return Type::Plane; }
+
 private:
-    virtual math::Box GetBoundingBox() const override;
+    // allow devirtualized calls from the scene traversal
+    friend class Scene;
+
+    virtual math::Box GetLocalBoundingBox() const override;
 
     bool Traverse_Single_Internal(const SingleTraversalContext& context, float& outDist) const;
 
@@ -15,15 +15,10 @@ SphereSceneObject::SphereSceneObject(const float radius)
     , mInvRadius(1.0f / radius)
 { }
 
-Box SphereSceneObject::GetBoundingBox() const
+Box SphereSceneObject::GetLocalBoundingBox() const
 {
     const Vector4 radius = Vector4(mRadius, mRadius, mRadius, 0.0f);
-
-    const Box localBox(ComputeTransform(0.0f).GetTranslation() - radius, ComputeTransform(0.0f).GetTranslation() + radius);
-
-    // TODO motion blur
-
-    return localBox;
+    return Box(-radius, radius);
 }
 
 void SphereSceneObject::Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const
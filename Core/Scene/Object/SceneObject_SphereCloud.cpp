@@ -0,0 +1,351 @@
+#include "PCH.h"
+#include "SceneObject_SphereCloud.h"
+#include "BVH/BVHBuilder.h"
+#include "Utils/Logger.h"
+#include "Rendering/ShadingData.h"
+#include "Rendering/Context.h"
+#include "Traversal/TraversalContext.h"
+#include "Traversal/Traversal_Single.h"
+#include "Traversal/Traversal_Packet.h"
+#include "Traversal/Traversal_Simd.h"
+#include "Traversal/Traversal_Wide.h"
+#include "Math/Geometry.h"
+#include "Math/Simd8Geometry.h"
+
+namespace rt {
+
+using namespace math;
+
+SphereCloudSceneObject::SphereCloudSceneObject()
+    : mBoundingBox(Box::Empty())
+    , mNumSpheres(0)
+{ }
+
+SphereCloudSceneObject::~SphereCloudSceneObject() = default;
+
+bool SphereCloudSceneObject::Initialize(const Float3* centers, const float* radii, Uint32 numSpheres, ThreadPool* threadPool)
+{
+    mPacks.Clear();
+    mLeafPacksOffsets.Clear();
+    mSphereIndices.Clear();
+    mBoundingBox = Box::Empty();
+    mNumSpheres = 0;
+
+    if (numSpheres == 0)
+    {
+        RT_LOG_ERROR("Sphere cloud can't be empty");
+        return false;
+    }
+
+    DynArray<Box> boxes;
+    if (!boxes.Resize(numSpheres))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    for (Uint32 i = 0; i < numSpheres; ++i)
+    {
+        if (!(radii[i] > 0.0f))
+        {
+            RT_LOG_ERROR("Invalid radius of sphere %u: %f", i, radii[i]);
+            return false;
+        }
+
+        const Vector4 center(centers[i]);
+        const Vector4 radius(radii[i], radii[i], radii[i], 0.0f);
+        boxes[i] = Box(center - radius, center + radius);
+        mBoundingBox = Box(mBoundingBox, boxes[i]);
+    }
+
+    // leaves of 8 spheres fill exactly one pack
+    BVHBuilder::BuildingParams params;
+    params.maxLeafNodeSize = 8;
+    params.threadPool = threadPool;
+
+    BVHBuilder::Indices newSpheresOrder;
+    BVHBuilder bvhBuilder(mBVH);
+    if (!bvhBuilder.Build(boxes.Data(), numSpheres, params, newSpheresOrder))
+    {
+        return false;
+    }
+
+    if (!mWideBVH.Build(mBVH))
+    {
+        return false;
+    }
+
+    // collect leaves reachable from the root
+    // Note: the nodes array may contain unused slots, so it can't be simply iterated
+    const BVH::Node* nodes = mBVH.GetNodes();
+    DynArray<const BVH::Node*> leaves;
+    Uint32 numPacks = 0;
+    if (mBVH.GetNumNodes() > 0)
+    {
+        Uint32 stackSize = 0;
+        const BVH::Node* nodesStack[BVH::MaxDepth];
+        nodesStack[stackSize++] = nodes;
+
+        while (stackSize > 0)
+        {
+            const BVH::Node* node = nodesStack[--stackSize];
+            if (node->IsLeaf())
+            {
+                leaves.PushBack(node);
+                numPacks += (node->numLeaves + 7) / 8;
+            }
+            else
+            {
+                nodesStack[stackSize++] = nodes + node->childIndex;
+                nodesStack[stackSize++] = nodes + node->childIndex + 1;
+            }
+        }
+    }
+
+    if (!mPacks.Resize(numPacks) || !mSphereIndices.Resize(8 * numPacks, UINT32_MAX) || !mLeafPacksOffsets.Resize(numSpheres))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    Uint32 packIndex = 0;
+    for (const BVH::Node* node : leaves)
+    {
+        mLeafPacksOffsets[node->childIndex] = packIndex;
+
+        for (Uint32 j = 0; j < node->numLeaves; j += 8)
+        {
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            SpherePack& pack = mPacks[packIndex];
+            pack.center = Vector3x8(nan);
+            pack.radius = Vector8::Zero();
+            pack.radiusSqr = Vector8::Zero();
+
+            for (Uint32 lane = 0; lane < 8 && j + lane < node->numLeaves; ++lane)
+            {
+                const Uint32 sphereIndex = newSpheresOrder[node->childIndex + j + lane];
+                pack.center.x[lane] = centers[sphereIndex].x;
+                pack.center.y[lane] = centers[sphereIndex].y;
+                pack.center.z[lane] = centers[sphereIndex].z;
+                pack.radius[lane] = radii[sphereIndex];
+                pack.radiusSqr[lane] = radii[sphereIndex] * radii[sphereIndex];
+                mSphereIndices[8 * packIndex + lane] = sphereIndex;
+            }
+
+            packIndex++;
+        }
+    }
+
+    mNumSpheres = numSpheres;
+    return true;
+}
+
+Box SphereCloudSceneObject::GetLocalBoundingBox() const
+{
+    return mBoundingBox;
+}
+
+void SphereCloudSceneObject::Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const
+{
+#ifdef RT_ENABLE_WIDE_BVH
+    GenericTraverse_Wide_Single(context, objectID, this);
+#else
+    GenericTraverse_Single(context, objectID, this);
+#endif // RT_ENABLE_WIDE_BVH
+}
+
+bool SphereCloudSceneObject::Traverse_Shadow_Single(const SingleTraversalContext& context) const
+{
+#ifdef RT_ENABLE_WIDE_BVH
+    return GenericTraverse_Wide_Shadow_Single(context, this);
+#else
+    return GenericTraverse_Shadow_Single(context, this);
+#endif // RT_ENABLE_WIDE_BVH
+}
+
+void SphereCloudSceneObject::Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const
+{
+    GenericTraverse_Packet<SphereCloudSceneObject, 1>(context, objectID, this, numActiveGroups);
+}
+
+Uint32 SphereCloudSceneObject::Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const
+{
+    return GenericTraverse_Shadow_Packet<SphereCloudSceneObject, 1>(context, this, numActiveGroups);
+}
+
+void SphereCloudSceneObject::Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const
+{
+    GenericTraverse_Simd8(context, objectID, this);
+}
+
+void SphereCloudSceneObject::Traverse_Shadow_Simd8(const SimdTraversalContext& context) const
+{
+    GenericTraverse_Shadow_Simd8(context, this);
+}
+
+void SphereCloudSceneObject::Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+{
+    const Vector3x8 rayDir(context.ray.dir);
+    const Vector3x8 rayOrigin(context.ray.origin);
+    HitPoint& hitPoint = context.hitPoint;
+
+    Uint32 packIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    for (Uint32 i = 0; i < node.numLeaves; i += 8, ++packIndex)
+    {
+        const SpherePack& pack = mPacks[packIndex];
+        Uint32 mask = Intersect_SphereRay_Simd8(rayDir, rayOrigin, pack.center, pack.radiusSqr, Vector8(hitPoint.distance), distance).GetMask();
+
+        // pick the closest hit
+        while (mask)
+        {
+            const Uint32 lane = FirstBitSet(mask);
+            mask &= mask - 1;
+
+            if (distance[lane] < hitPoint.distance)
+            {
+                hitPoint.distance = distance[lane];
+                hitPoint.subObjectId = 8 * packIndex + lane;
+                hitPoint.objectId = objectID;
+                hitPoint.u = 0.0f;
+                hitPoint.v = 0.0f;
+            }
+        }
+    }
+}
+
+bool SphereCloudSceneObject::Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const
+{
+    const Vector3x8 rayDir(context.ray.dir);
+    const Vector3x8 rayOrigin(context.ray.origin);
+    HitPoint& hitPoint = context.hitPoint;
+
+    Uint32 packIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    for (Uint32 i = 0; i < node.numLeaves; i += 8, ++packIndex)
+    {
+        const SpherePack& pack = mPacks[packIndex];
+        const Uint32 mask = Intersect_SphereRay_Simd8(rayDir, rayOrigin, pack.center, pack.radiusSqr, Vector8(hitPoint.distance), distance).GetMask();
+        if (mask)
+        {
+            hitPoint.distance = distance[FirstBitSet(mask)];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SphereCloudSceneObject::Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+{
+    const Uint32 firstPackIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const SpherePack& pack = mPacks[firstPackIndex + i / 8];
+        const Uint32 lane = i % 8;
+
+        const Vector3x8 center(Float3(pack.center.x[lane], pack.center.y[lane], pack.center.z[lane]));
+        const VectorBool8 mask = Intersect_SphereRay_Simd8(context.ray.dir, context.ray.origin, center, Vector8(pack.radiusSqr[lane]), context.hitPoint.distance, distance);
+
+        context.StoreIntersection(distance, Vector8::Zero(), Vector8::Zero(), mask, objectID, 8 * firstPackIndex + i);
+    }
+}
+
+void SphereCloudSceneObject::Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const
+{
+    const Uint32 firstPackIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const SpherePack& pack = mPacks[firstPackIndex + i / 8];
+        const Uint32 lane = i % 8;
+
+        const Vector3x8 center(Float3(pack.center.x[lane], pack.center.y[lane], pack.center.z[lane]));
+        const VectorBool8 mask = Intersect_SphereRay_Simd8(context.ray.dir, context.ray.origin, center, Vector8(pack.radiusSqr[lane]), context.hitPoint.distance, distance);
+
+        context.StoreOcclusion(mask);
+    }
+}
+
+void SphereCloudSceneObject::Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, const Uint32 numActiveGroups) const
+{
+    const Uint32 firstPackIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const SpherePack& pack = mPacks[firstPackIndex + i / 8];
+        const Uint32 lane = i % 8;
+
+        const Vector3x8 center(Float3(pack.center.x[lane], pack.center.y[lane], pack.center.z[lane]));
+        const Vector8 radiusSqr(pack.radiusSqr[lane]);
+
+        for (Uint32 j = 0; j < numActiveGroups; ++j)
+        {
+            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+
+            const VectorBool8 mask = Intersect_SphereRay_Simd8(rayGroup.rays[1].dir, rayGroup.rays[1].origin, center, radiusSqr, rayGroup.maxDistances, distance);
+
+            context.StoreIntersection(rayGroup, distance, Vector8::Zero(), Vector8::Zero(), mask, objectID, 8 * firstPackIndex + i);
+        }
+    }
+}
+
+Uint32 SphereCloudSceneObject::Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, const Uint32 numActiveGroups) const
+{
+    const Uint32 firstPackIndex = GetLeafPackIndex(node);
+    Vector8 distance;
+
+    Uint32 numOccludedRays = 0;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const SpherePack& pack = mPacks[firstPackIndex + i / 8];
+        const Uint32 lane = i % 8;
+
+        const Vector3x8 center(Float3(pack.center.x[lane], pack.center.y[lane], pack.center.z[lane]));
+        const Vector8 radiusSqr(pack.radiusSqr[lane]);
+
+        for (Uint32 j = 0; j < numActiveGroups; ++j)
+        {
+            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+
+            // any hit within max distance occludes the ray (occluded rays can't be hit again)
+            const VectorBool8 mask = Intersect_SphereRay_Simd8(rayGroup.rays[1].dir, rayGroup.rays[1].origin, center, radiusSqr, rayGroup.maxDistances, distance);
+
+            numOccludedRays += context.StoreOcclusion(rayGroup, mask);
+        }
+    }
+
+    return numOccludedRays;
+}
+
+void SphereCloudSceneObject::EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const
+{
+    const SpherePack& pack = mPacks[hitPoint.subObjectId / 8];
+    const Uint32 lane = hitPoint.subObjectId % 8;
+
+    const Vector4 center(pack.center.x[lane], pack.center.y[lane], pack.center.z[lane], 0.0f);
+    const Vector4 normal = (outShadingData.frame.GetTranslation() - center) / pack.radius[lane];
+
+    outShadingData.material = GetDefaultMaterial();
+    outShadingData.texCoord = CartesianToSphericalCoordinates(-normal);
+    outShadingData.frame[2] = normal;
+
+    // equivalent of: Vector4::Cross3(outShadingData.normal, VECTOR_Y);
+    outShadingData.frame[0] = (outShadingData.frame[2].Swizzle<2,0,0,0>() & Vector4::MakeMask<1,0,1,0>()).ChangeSign<1,0,0,0>();
+
+    outShadingData.frame[1] = Vector4::Cross3(outShadingData.frame[0], outShadingData.frame[2]);
+
+    outShadingData.frame[0].FastNormalize3();
+    outShadingData.frame[1].FastNormalize3();
+    outShadingData.frame[2].FastNormalize3();
+}
+
+
+} // namespace rt
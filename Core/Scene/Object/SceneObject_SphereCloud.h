@@ -0,0 +1,94 @@
+#pragma once
+
+#include "SceneObject.h"
+#include "../../BVH/BVH.h"
+#include "../../BVH/WideBVH.h"
+#include "../../Containers/DynArray.h"
+#include "../../Math/Float3.h"
+#include "../../Math/Vector3x8.h"
+
+namespace rt {
+
+class ThreadPool;
+
+// Set of spheres traversed as a single scene object (e.g. particles)
+// The spheres are stored in SIMD-8 packs (structure of arrays) in the BVH leaves order,
+// so a single ray is intersected with all the spheres of a leaf at once.
+// Hit point's sub-object ID is the sphere position in the packs (see GetSphereIndex).
+class SphereCloudSceneObject : public ISceneObject
+{
+public:
+    RAYLIB_API SphereCloudSceneObject();
+    RAYLIB_API ~SphereCloudSceneObject();
+
+    virtual Type GetType() const override { return Type::SphereCloud; }
+
+    // build the spheres packs and BVH over them
+    // Note: the optional thread pool is used to build the BVH in parallel
+    RAYLIB_API bool Initialize(const math::Float3* centers, const float* radii, Uint32 numSpheres, ThreadPool* threadPool = nullptr);
+
+    RT_FORCE_INLINE Uint32 GetNumSpheres() const { return mNumSpheres; }
+    RT_FORCE_INLINE const BVH& GetBVH() const { return mBVH; }
+    RT_FORCE_INLINE const DefaultWideBVH& GetWideBVH() const { return mWideBVH; }
+
+    // get index of a sphere (in order passed to Initialize) from hit point's sub-object ID
+    RT_FORCE_INLINE Uint32 GetSphereIndex(const Uint32 subObjectId) const { return mSphereIndices[subObjectId]; }
+
+    // Intersect ray(s) with BVH leaf
+    void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
+    void Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, const Uint32 numActiveGroups) const;
+    void Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
+
+    bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const;
+    Uint32 Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, const Uint32 numActiveGroups) const;
+    void Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const;
+
+private:
+    // allow devirtualized calls from the scene traversal
+    friend class Scene;
+
+    // eight spheres of a BVH leaf
+    // Note: unused lanes have NaN centers, so they never pass the intersection test
+    struct RT_ALIGN(32) SpherePack
+    {
+        math::Vector3x8 center;
+        math::Vector8 radius;
+        math::Vector8 radiusSqr;
+    };
+
+    virtual math::Box GetLocalBoundingBox() const override;
+
+    virtual void Traverse_Single(const SingleTraversalContext& context, const Uint32 objectID) const override;
+    virtual void Traverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const Uint32 numActiveGroups) const override;
+
+    virtual bool Traverse_Shadow_Single(const SingleTraversalContext& context) const override;
+    virtual Uint32 Traverse_Shadow_Packet(const PacketTraversalContext& context, const Uint32 numActiveGroups) const override;
+
+    virtual void Traverse_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const override;
+    virtual void Traverse_Shadow_Simd8(const SimdTraversalContext& context) const override;
+
+    virtual void EvaluateShadingData_Single(const HitPoint& hitPoint, ShadingData& outShadingData) const override;
+
+    RT_FORCE_INLINE Uint32 GetLeafPackIndex(const BVH::Node& node) const
+    {
+        return mLeafPacksOffsets[node.childIndex];
+    }
+
+    DynArray<SpherePack> mPacks;
+
+    // index of the first pack of a BVH leaf (indexed by leaf's first sphere)
+    DynArray<Uint32> mLeafPacksOffsets;
+
+    // original index of each sphere (parallel to the packs lanes)
+    DynArray<Uint32> mSphereIndices;
+
+    BVH mBVH;
+
+    // the same hierarchy collapsed to multi-way tree
+    DefaultWideBVH mWideBVH;
+
+    math::Box mBoundingBox;
+    Uint32 mNumSpheres;
+};
+
+} // namespace rt
@@ -2,18 +2,32 @@
 #include "Scene.h"
 #include "Light/BackgroundLight.h"
 #include "Object/SceneObject_Light.h"
+#include "Object/SceneObject_Mesh.h"
+#include "Object/SceneObject_Sphere.h"
+#include "Object/SceneObject_SphereCloud.h"
+#include "Object/SceneObject_Box.h"
+#include "Object/SceneObject_Plane.h"
+#include "Mesh/Mesh.h"
 #include "Rendering/ShadingData.h"
 #include "BVH/BVHBuilder.h"
 #include "Material/Material.h"
+#include "Utils/Logger.h"
 
 #include "Traversal/Traversal_Single.h"
 #include "Traversal/Traversal_Packet.h"
+#include "Traversal/Traversal_Wide.h"
+#include "Traversal/Traversal_Simd.h"
 
 namespace rt {
 
 using namespace math;
 
-Scene::Scene() = default;
+// moving object is split in time if its motion bounds are that many times bigger (in terms of surface area) than the static bounds
+static const float TimeSplitAreaThreshold = 2.0f;
+
+Scene::Scene()
+    : mMaxTimeSegments(4)
+{ }
 
 Scene::~Scene() = default;
 
@@ -31,7 +45,27 @@ void Scene::AddObject(SceneObjectPtr object)
     mObjects.PushBack(std::move(object));
 }
 
-bool Scene::BuildBVH()
+Uint32 Scene::AddInstancedMesh(const MeshPtr& mesh)
+{
+    return mInstances.AddMesh(mesh);
+}
+
+Uint32 Scene::AddInstanceMaterial(const MaterialPtr& material)
+{
+    return mInstances.AddMaterial(material);
+}
+
+bool Scene::AddMeshInstance(const math::Matrix4& transform, Uint32 meshIndex, Uint32 materialIndex)
+{
+    return mInstances.AddInstance(transform, meshIndex, materialIndex);
+}
+
+void Scene::SetMaxTimeSegments(Uint32 maxTimeSegments)
+{
+    mMaxTimeSegments = Max(1u, maxTimeSegments);
+}
+
+bool Scene::BuildBVH(ThreadPool* threadPool)
 {
     for (const LightPtr& light : mLights)
     {
@@ -46,9 +80,51 @@ bool Scene::BuildBVH()
     }
 
     DynArray<Box> boxes;
-    for (const auto& obj : mObjects)
+    DynArray<ObjectReference> references;
+    for (Uint32 i = 0; i < mObjects.Size(); ++i)
     {
-        boxes.PushBack(obj->GetBoundingBox());
+        const ISceneObject* object = mObjects[i].get();
+        const Box motionBox = object->GetBoundingBox();
+
+        // split fast moving objects in time, so they don't inflate the whole tree
+        Uint32 numTimeSegments = 1;
+        if (object->IsMoving() && mMaxTimeSegments > 1)
+        {
+            const float staticArea = object->GetBoundingBox(0.0f, 0.0f).SurfaceArea();
+            const float motionArea = motionBox.SurfaceArea();
+            if (motionArea > TimeSplitAreaThreshold * staticArea)
+            {
+                const float ratio = motionArea / Max(staticArea, FLT_MIN);
+                numTimeSegments = static_cast<Uint32>(Min(static_cast<float>(mMaxTimeSegments), ceilf(ratio)));
+            }
+        }
+
+        if (numTimeSegments == 1)
+        {
+            boxes.PushBack(motionBox);
+            references.PushBack({ i, -FLT_MAX, FLT_MAX });
+            continue;
+        }
+
+        const float segmentLength = 1.0f / static_cast<float>(numTimeSegments);
+        for (Uint32 j = 0; j < numTimeSegments; ++j)
+        {
+            const float timeBegin = segmentLength * static_cast<float>(j);
+            const float timeEnd = j + 1 < numTimeSegments ? segmentLength * static_cast<float>(j + 1) : 1.0f;
+            boxes.PushBack(object->GetBoundingBox(timeBegin, timeEnd));
+
+            // the first and the last segments cover the time outside 0.0...1.0 range
+            ObjectReference reference = { i, timeBegin, timeEnd };
+            if (j == 0)
+            {
+                reference.timeBegin = -FLT_MAX;
+            }
+            if (j + 1 == numTimeSegments)
+            {
+                reference.timeEnd = FLT_MAX;
+            }
+            references.PushBack(reference);
+        }
     }
 
     BVHBuilder::BuildingParams params;
@@ -56,35 +132,194 @@ bool Scene::BuildBVH()
 
     BVHBuilder::Indices newOrder;
     BVHBuilder bvhBuilder(mBVH);
-    if (!bvhBuilder.Build(boxes.Data(), (Uint32)mObjects.Size(), params, newOrder))
+    if (!bvhBuilder.Build(boxes.Data(), references.Size(), params, newOrder))
     {
         return false;
     }
 
-    DynArray<SceneObjectPtr> newObjectsArray;
-    newObjectsArray.Reserve(mObjects.Size());
-    for (Uint32 i = 0; i < mObjects.Size(); ++i)
+    mObjectReferences.Clear();
+    if (!mObjectReferences.Reserve(references.Size()))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    for (Uint32 i = 0; i < references.Size(); ++i)
     {
-        Uint32 sourceIndex = newOrder[i];
-        newObjectsArray.PushBack(std::move(mObjects[sourceIndex]));
+        mObjectReferences.PushBack(references[newOrder[i]]);
+    }
+
+    if (!mWideBVH.Build(mBVH))
+    {
+        return false;
+    }
+
+    if (!BuildObjectTraversalData())
+    {
+        return false;
     }
 
-    mObjects = std::move(newObjectsArray);
+    if (!mInstances.IsEmpty())
+    {
+        if (!mInstances.BuildBVH(threadPool))
+        {
+            return false;
+        }
+    }
 
     return true;
 }
 
+bool Scene::ReplicateData(ThreadPool& threadPool) const
+{
+    if (!mBVH.ReplicateNodes(threadPool) || !mWideBVH.ReplicateNodes(threadPool))
+    {
+        return false;
+    }
+
+    for (const SceneObjectPtr& object : mObjects)
+    {
+        if (object->GetType() == ISceneObject::Type::Mesh)
+        {
+            // Note: meshes shared by multiple objects are replicated only once
+            const MeshSceneObject* meshObject = static_cast<const MeshSceneObject*>(object.get());
+            if (!meshObject->mMesh->ReplicateData(threadPool))
+            {
+                return false;
+            }
+        }
+        else if (object->GetType() == ISceneObject::Type::SphereCloud)
+        {
+            const SphereCloudSceneObject* sphereCloud = static_cast<const SphereCloudSceneObject*>(object.get());
+            if (!sphereCloud->GetBVH().ReplicateNodes(threadPool) || !sphereCloud->GetWideBVH().ReplicateNodes(threadPool))
+            {
+                return false;
+            }
+        }
+    }
+
+    return mInstances.ReplicateData(threadPool);
+}
+
 const ILight& Scene::GetLightByObjectId(Uint32 id) const
 {
     const LightSceneObject* lightSceneObj = static_cast<const LightSceneObject*>(mObjects[id].get());
     return lightSceneObj->GetLight();
 }
 
-void Scene::Traverse_Object_Single(const SingleTraversalContext& context, const Uint32 objectID) const
+bool Scene::BuildObjectTraversalData()
+{
+    const Uint32 numObjects = mObjects.Size();
+
+    ObjectTraversalData& data = mObjectTraversalData;
+    if (!data.inverseTransforms.Resize(4 * numObjects) || !data.flags.Resize(numObjects) || !data.types.Resize(numObjects))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    const Matrix4 identity = Matrix4::Identity();
+
+    for (Uint32 i = 0; i < numObjects; ++i)
+    {
+        const ISceneObject* object = mObjects[i].get();
+
+        const Matrix4 invTransform = object->ComputeInverseTransform(0.0f);
+        for (Uint32 j = 0; j < 4; ++j)
+        {
+            data.inverseTransforms[4 * i + j] = invTransform[j].ToFloat3();
+        }
+
+        Uint8 flags = 0;
+        if (object->IsMoving())
+        {
+            flags |= ObjectTraversalFlag_Moving;
+        }
+        else if (object->GetTransform() == identity)
+        {
+            flags |= ObjectTraversalFlag_Identity;
+        }
+
+        data.flags[i] = flags;
+        data.types[i] = object->GetType();
+    }
+
+    return true;
+}
+
+const Matrix4 Scene::GetObjectInverseTransform(const Uint32 objectID, const float time) const
+{
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Moving)
+    {
+        return mObjects[objectID]->ComputeInverseTransform(time);
+    }
+
+    const Float3* rows = mObjectTraversalData.inverseTransforms.Data() + 4 * objectID;
+    return Matrix4(Vector4(rows[0]), Vector4(rows[1]), Vector4(rows[2]), Vector4(rows[3]) + VECTOR_W);
+}
+
+void Scene::Dispatch_Single(const SingleTraversalContext& context, const Uint32 objectID) const
+{
+    const ISceneObject* object = mObjects[objectID].get();
+
+    switch (mObjectTraversalData.types[objectID])
+    {
+    case ISceneObject::Type::Mesh:
+        static_cast<const MeshSceneObject*>(object)->MeshSceneObject::Traverse_Single(context, objectID);
+        break;
+    case ISceneObject::Type::Sphere:
+        static_cast<const SphereSceneObject*>(object)->SphereSceneObject::Traverse_Single(context, objectID);
+        break;
+    case ISceneObject::Type::SphereCloud:
+        static_cast<const SphereCloudSceneObject*>(object)->SphereCloudSceneObject::Traverse_Single(context, objectID);
+        break;
+    case ISceneObject::Type::Box:
+        static_cast<const BoxSceneObject*>(object)->BoxSceneObject::Traverse_Single(context, objectID);
+        break;
+    case ISceneObject::Type::Plane:
+        static_cast<const PlaneSceneObject*>(object)->PlaneSceneObject::Traverse_Single(context, objectID);
+        break;
+    case ISceneObject::Type::Light:
+        static_cast<const LightSceneObject*>(object)->LightSceneObject::Traverse_Single(context, objectID);
+        break;
+    default:
+        object->Traverse_Single(context, objectID);
+    }
+}
+
+bool Scene::Dispatch_Shadow_Single(const SingleTraversalContext& context, const Uint32 objectID) const
 {
     const ISceneObject* object = mObjects[objectID].get();
 
-    const Matrix4 invTransform = object->ComputeInverseTransform(context.context.time);
+    switch (mObjectTraversalData.types[objectID])
+    {
+    case ISceneObject::Type::Mesh:
+        return static_cast<const MeshSceneObject*>(object)->MeshSceneObject::Traverse_Shadow_Single(context);
+    case ISceneObject::Type::Sphere:
+        return static_cast<const SphereSceneObject*>(object)->SphereSceneObject::Traverse_Shadow_Single(context);
+    case ISceneObject::Type::SphereCloud:
+        return static_cast<const SphereCloudSceneObject*>(object)->SphereCloudSceneObject::Traverse_Shadow_Single(context);
+    case ISceneObject::Type::Box:
+        return static_cast<const BoxSceneObject*>(object)->BoxSceneObject::Traverse_Shadow_Single(context);
+    case ISceneObject::Type::Plane:
+        return static_cast<const PlaneSceneObject*>(object)->PlaneSceneObject::Traverse_Shadow_Single(context);
+    case ISceneObject::Type::Light:
+        return static_cast<const LightSceneObject*>(object)->LightSceneObject::Traverse_Shadow_Single(context);
+    default:
+        return object->Traverse_Shadow_Single(context);
+    }
+}
+
+void Scene::Traverse_Object_Single(const SingleTraversalContext& context, const Uint32 objectID) const
+{
+    // fast path: object placed in world space
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Identity)
+    {
+        Dispatch_Single(context, objectID);
+        return;
+    }
+
+    const Matrix4 invTransform = GetObjectInverseTransform(objectID, context.context.time);
 
     // transform ray to local-space
     const Ray transformedRay = invTransform.TransformRay_Unsafe(context.ray);
@@ -96,14 +331,18 @@ void Scene::Traverse_Object_Single(const SingleTraversalContext& context, const
         context.context
     };
 
-    object->Traverse_Single(objectContext, objectID);
+    Dispatch_Single(objectContext, objectID);
 }
 
 bool Scene::Traverse_Object_Shadow_Single(const SingleTraversalContext& context, const Uint32 objectID) const
 {
-    const ISceneObject* object = mObjects[objectID].get();
+    // fast path: object placed in world space
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Identity)
+    {
+        return Dispatch_Shadow_Single(context, objectID);
+    }
 
-    const Matrix4 invTransform = object->ComputeInverseTransform(context.context.time);
+    const Matrix4 invTransform = GetObjectInverseTransform(objectID, context.context.time);
 
     // transform ray to local-space
     Ray transformedRay = invTransform.TransformRay_Unsafe(context.ray);
@@ -116,7 +355,78 @@ bool Scene::Traverse_Object_Shadow_Single(const SingleTraversalContext& context,
         context.context
     };
 
-    return object->Traverse_Shadow_Single(objectContext);
+    return Dispatch_Shadow_Single(objectContext, objectID);
+}
+
+void Scene::Traverse_Object_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const
+{
+    const ISceneObject* object = mObjects[objectID].get();
+
+    // fast path: object placed in world space
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Identity)
+    {
+        object->Traverse_Simd8(context, objectID);
+        return;
+    }
+
+    // transform rays to local-space
+    const Ray_Simd8 transformedRay = GetObjectInverseTransform(objectID, context.context.time).TransformRay_Unsafe(context.ray);
+
+    const SimdTraversalContext objectContext =
+    {
+        transformedRay,
+        context.hitPoint,
+        context.context
+    };
+
+    object->Traverse_Simd8(objectContext, objectID);
+}
+
+void Scene::Traverse_Object_Shadow_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const
+{
+    const ISceneObject* object = mObjects[objectID].get();
+
+    // fast path: object placed in world space
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Identity)
+    {
+        object->Traverse_Shadow_Simd8(context);
+        return;
+    }
+
+    // transform rays to local-space
+    const Ray_Simd8 transformedRay = GetObjectInverseTransform(objectID, context.context.time).TransformRay_Unsafe(context.ray);
+
+    const SimdTraversalContext objectContext =
+    {
+        transformedRay,
+        context.hitPoint,
+        context.context
+    };
+
+    object->Traverse_Shadow_Simd8(objectContext);
+}
+
+void Scene::TransformRays(const PacketTraversalContext& context, const Uint32 objectID, Uint32 numActiveGroups) const
+{
+    if (mObjectTraversalData.flags[objectID] & ObjectTraversalFlag_Identity)
+    {
+        for (Uint32 j = 0; j < numActiveGroups; ++j)
+        {
+            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+            rayGroup.rays[1] = rayGroup.rays[0];
+        }
+        return;
+    }
+
+    const Matrix4 invTransform = GetObjectInverseTransform(objectID, context.context.time);
+
+    for (Uint32 j = 0; j < numActiveGroups; ++j)
+    {
+        RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
+        rayGroup.rays[1].origin = invTransform.TransformPoint(rayGroup.rays[0].origin);
+        rayGroup.rays[1].dir = invTransform.TransformVector(rayGroup.rays[0].dir);
+        rayGroup.rays[1].invDir = Vector3x8::FastReciprocal(rayGroup.rays[1].dir);
+    }
 }
 
 void Scene::Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
@@ -125,8 +435,11 @@ void Scene::Traverse_Leaf_Single(const SingleTraversalContext& context, const Ui
 
     for (Uint32 i = 0; i < node.numLeaves; ++i)
     {
-        const Uint32 objectIndex = node.childIndex + i;
-        Traverse_Object_Single(context, objectIndex);
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (reference.ContainsTime(context.context.time))
+        {
+            Traverse_Object_Single(context, reference.objectIndex);
+        }
     }
 }
 
@@ -134,131 +447,382 @@ bool Scene::Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, c
 {
     for (Uint32 i = 0; i < node.numLeaves; ++i)
     {
-        const Uint32 objectIndex = node.childIndex + i;
-        if (Traverse_Object_Shadow_Single(context, objectIndex))
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (reference.ContainsTime(context.context.time))
         {
-            return true;
+            if (Traverse_Object_Shadow_Single(context, reference.objectIndex))
+            {
+                return true;
+            }
         }
     }
 
     return false;
 }
 
+void Scene::Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+{
+    RT_UNUSED(objectID);
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (reference.ContainsTime(context.context.time))
+        {
+            Traverse_Object_Simd8(context, reference.objectIndex);
+        }
+    }
+}
+
+void Scene::Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const
+{
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (reference.ContainsTime(context.context.time))
+        {
+            Traverse_Object_Shadow_Simd8(context, reference.objectIndex);
+
+            if ((context.hitPoint.distance > Vector8::Zero()).None())
+            {
+                return;
+            }
+        }
+    }
+}
+
 void Scene::Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, Uint32 numActiveGroups) const
 {
     RT_UNUSED(objectID);
 
     for (Uint32 i = 0; i < node.numLeaves; ++i)
     {
-        const Uint32 objectIndex = node.childIndex + i;
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (!reference.ContainsTime(context.context.time))
+        {
+            continue;
+        }
+
+        const Uint32 objectIndex = reference.objectIndex;
         const ISceneObject* object = mObjects[objectIndex].get();
-        const Matrix4 invTransform = object->ComputeInverseTransform(context.context.time);
 
         // transform ray to local-space
-        for (Uint32 j = 0; j < numActiveGroups; ++j)
+        TransformRays(context, objectIndex, numActiveGroups);
+
+        object->Traverse_Packet(context, objectIndex, numActiveGroups);
+    }
+}
+
+Uint32 Scene::Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, Uint32 numActiveGroups) const
+{
+    Uint32 numOccludedRays = 0;
+
+    for (Uint32 i = 0; i < node.numLeaves; ++i)
+    {
+        const ObjectReference& reference = mObjectReferences[node.childIndex + i];
+        if (!reference.ContainsTime(context.context.time))
         {
-            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
-            rayGroup.rays[1].origin = invTransform.TransformPoint(rayGroup.rays[0].origin);
-            rayGroup.rays[1].dir = invTransform.TransformVector(rayGroup.rays[0].dir);
-            rayGroup.rays[1].invDir = Vector3x8::FastReciprocal(rayGroup.rays[1].dir);
+            continue;
         }
 
-        object->Traverse_Packet(context, objectIndex, numActiveGroups);
+        const ISceneObject* object = mObjects[reference.objectIndex].get();
+
+        // transform ray to local-space
+        TransformRays(context, reference.objectIndex, numActiveGroups);
+
+        numOccludedRays += object->Traverse_Shadow_Packet(context, numActiveGroups);
     }
+
+    return numOccludedRays;
 }
 
 void Scene::Traverse_Single(const SingleTraversalContext& context) const
 {
     const Uint32 numObjects = mObjects.Size();
 
-    if (numObjects == 0) // scene is empty
-    {
-        return;
-    }
-    else if (numObjects == 1) // bypass BVH
+    if (numObjects == 1) // bypass BVH
     {
         Traverse_Object_Single(context, 0);
     }
-    else // full BVH traversal
+    else if (numObjects > 1) // full BVH traversal
     {
+#ifdef RT_ENABLE_WIDE_BVH
+        GenericTraverse_Wide_Single(context, 0, this);
+#else
         GenericTraverse_Single(context, 0, this);
+#endif // RT_ENABLE_WIDE_BVH
     }
+
+    mInstances.Traverse_Single(context);
 }
 
 bool Scene::Traverse_Shadow_Single(const SingleTraversalContext& context) const
 {
     const Uint32 numObjects = mObjects.Size();
 
-    if (numObjects == 0) // scene is empty
+    const ShadowRaysCountersScope countersScope(context.context.localCounters, context.context.counters, 1);
+
+    if (numObjects == 1) // bypass BVH
     {
-        return false;
+        if (Traverse_Object_Shadow_Single(context, 0))
+        {
+            return true;
+        }
+    }
+    else if (numObjects > 1) // full BVH traversal
+    {
+#ifdef RT_ENABLE_WIDE_BVH
+        if (GenericTraverse_Wide_Shadow_Single(context, this))
+#else
+        if (GenericTraverse_Shadow_Single(context, this))
+#endif // RT_ENABLE_WIDE_BVH
+        {
+            return true;
+        }
+    }
+
+    return mInstances.Traverse_Shadow_Single(context);
+}
+
+void Scene::Traverse_Simd8(const SimdTraversalContext& context) const
+{
+    const Uint32 numObjects = mObjects.Size();
+
+    if (numObjects == 1) // bypass BVH
+    {
+        Traverse_Object_Simd8(context, 0);
+    }
+    else if (numObjects > 1) // full BVH traversal
+    {
+        GenericTraverse_Simd8(context, 0, this);
+    }
+
+    mInstances.Traverse_Simd8(context);
+}
+
+Uint32 Scene::Traverse_Shadow_Simd8(const SimdTraversalContext& context) const
+{
+    const Uint32 numObjects = mObjects.Size();
+
+    const VectorBool8 activeMask = context.hitPoint.distance > Vector8::Zero();
+    if (activeMask.None())
+    {
+        return 0;
+    }
+
+    const ShadowRaysCountersScope countersScope(context.context.localCounters, context.context.counters, PopCount(activeMask.GetMask()));
+
+    bool allOccluded = false;
+    if (numObjects == 1) // bypass BVH
+    {
+        Traverse_Object_Shadow_Simd8(context, 0);
+        allOccluded = (context.hitPoint.distance > Vector8::Zero()).None();
     }
-    else if (numObjects == 1) // bypass BVH
+    else if (numObjects > 1) // full BVH traversal
     {
-        return Traverse_Object_Shadow_Single(context, 0);
+        allOccluded = GenericTraverse_Shadow_Simd8(context, this);
     }
-    else // full BVH traversal
+
+    if (!allOccluded)
     {
-        return GenericTraverse_Shadow_Single(context, this);
+        mInstances.Traverse_Shadow_Simd8(context);
     }
+
+    // occluded rays have negative distance (see SimdTraversalContext::StoreOcclusion)
+    return (activeMask & (context.hitPoint.distance < Vector8::Zero())).GetMask();
 }
 
 void Scene::Traverse_Packet(const PacketTraversalContext& context) const
 {
     const Uint32 numObjects = mObjects.Size();
 
-    const Uint32 numRayGroups = context.ray.GetNumGroups();
+    RayPacket& packet = context.ray;
+    const Uint32 numRayGroups = packet.GetNumGroups();
     for (Uint32 i = 0; i < numRayGroups; ++i)
     {
-        context.ray.groups[i].maxDistances = VECTOR8_MAX;
-        context.context.activeGroupsIndices[i] = (Uint16)i;
+        packet.groups[i].maxDistances = VECTOR8_MAX;
     }
 
-    for (Uint32 i = 0; i < context.ray.numRays; ++i)
+    // fill unused rays of the last group with copies of a valid ray, so they don't pollute traversal
+    // Note: they must not report any intersection, hence zero max distance
+    for (Uint32 i = packet.numRays; i < numRayGroups * RayPacket::RaysPerGroup; ++i)
+    {
+        RayGroup& group = packet.groups[i / RayPacket::RaysPerGroup];
+        const Uint32 lane = i % RayPacket::RaysPerGroup;
+        group.rays[0].dir.x[lane] = group.rays[0].dir.x[0];
+        group.rays[0].dir.y[lane] = group.rays[0].dir.y[0];
+        group.rays[0].dir.z[lane] = group.rays[0].dir.z[0];
+        group.rays[0].origin.x[lane] = group.rays[0].origin.x[0];
+        group.rays[0].origin.y[lane] = group.rays[0].origin.y[0];
+        group.rays[0].origin.z[lane] = group.rays[0].origin.z[0];
+        group.rays[0].invDir.x[lane] = group.rays[0].invDir.x[0];
+        group.rays[0].invDir.y[lane] = group.rays[0].invDir.y[0];
+        group.rays[0].invDir.z[lane] = group.rays[0].invDir.z[0];
+        group.maxDistances[lane] = 0.0f;
+        group.rayOffsets[lane] = static_cast<Int32>(i);
+    }
+
+    for (Uint32 i = 0; i < numRayGroups * RayPacket::RaysPerGroup; ++i)
     {
         context.context.hitPoints[i].distance = FLT_MAX;
         context.context.hitPoints[i].objectId = UINT32_MAX;
     }
 
-    if (numObjects == 0) // scene is empty
+    if (numObjects == 0 && mInstances.IsEmpty()) // scene is empty
     {
         return;
     }
-    else if (numObjects == 1) // bypass BVH
+
+    // traverse runs of groups with the same direction octant separately
+    // If the packet is not octant-sorted (too many runs) traverse it as a whole.
+    Uint32 numOctantRuns = 1;
+    for (Uint32 i = 1; i < numRayGroups; ++i)
+    {
+        if (packet.GetGroupOctant(i) != packet.GetGroupOctant(i - 1))
+        {
+            numOctantRuns++;
+        }
+    }
+    const bool traverseOctantRuns = numOctantRuns <= 8;
+
+    for (Uint32 firstGroup = 0; firstGroup < numRayGroups; )
     {
-        const ISceneObject* object = mObjects.Front().get();
-        const Matrix4 invTransform = object->ComputeInverseTransform(context.context.time);
+        Uint32 numGroups = numRayGroups - firstGroup;
+        if (traverseOctantRuns)
+        {
+            const Uint32 octant = packet.GetGroupOctant(firstGroup);
+            numGroups = 1;
+            while (firstGroup + numGroups < numRayGroups && packet.GetGroupOctant(firstGroup + numGroups) == octant)
+            {
+                numGroups++;
+            }
+        }
 
-        for (Uint32 j = 0; j < numRayGroups; ++j)
+        for (Uint32 i = 0; i < numGroups; ++i)
         {
-            RayGroup& rayGroup = context.ray.groups[context.context.activeGroupsIndices[j]];
-            rayGroup.rays[1].origin = invTransform.TransformPoint(rayGroup.rays[0].origin);
-            rayGroup.rays[1].dir = invTransform.TransformVector(rayGroup.rays[0].dir);
-            rayGroup.rays[1].invDir = Vector3x8::FastReciprocal(rayGroup.rays[1].dir);
+            context.context.activeGroupsIndices[i] = (Uint16)(firstGroup + i);
+        }
+
+        if (numObjects == 1) // bypass BVH
+        {
+            TransformRays(context, 0, numGroups);
+
+            mObjects.Front()->Traverse_Packet(context, 0, numGroups);
+        }
+        else if (numObjects > 1) // full BVH traversal
+        {
+            GenericTraverse_Packet<Scene, 0>(context, 0, this, numGroups);
+        }
+
+        if (!mInstances.IsEmpty())
+        {
+            // active groups list could be modified by the objects traversal
+            for (Uint32 i = 0; i < numGroups; ++i)
+            {
+                context.context.activeGroupsIndices[i] = (Uint16)(firstGroup + i);
+            }
+
+            GenericTraverse_Packet<MeshInstanceSet, 0>(context, 0, &mInstances, numGroups);
         }
 
-        mObjects.Front()->Traverse_Packet(context, 0, numRayGroups);
+        firstGroup += numGroups;
     }
-    else // full BVH traversal
+
+    // rays may have been reordered during traversal
+    RestoreRaysOrder(packet);
+}
+
+Uint32 Scene::Traverse_Shadow_Packet(const PacketTraversalContext& context) const
+{
+    const Uint32 numObjects = mObjects.Size();
+
+    RayPacket& packet = context.ray;
+    const Uint32 numRayGroups = packet.GetNumGroups();
+
+    // disable unused rays of the last group (copies of a valid ray that are treated as already occluded)
+    for (Uint32 i = packet.numRays; i < numRayGroups * RayPacket::RaysPerGroup; ++i)
+    {
+        RayGroup& group = packet.groups[i / RayPacket::RaysPerGroup];
+        const Uint32 lane = i % RayPacket::RaysPerGroup;
+        group.rays[0].dir.x[lane] = group.rays[0].dir.x[0];
+        group.rays[0].dir.y[lane] = group.rays[0].dir.y[0];
+        group.rays[0].dir.z[lane] = group.rays[0].dir.z[0];
+        group.rays[0].origin.x[lane] = group.rays[0].origin.x[0];
+        group.rays[0].origin.y[lane] = group.rays[0].origin.y[0];
+        group.rays[0].origin.z[lane] = group.rays[0].origin.z[0];
+        group.rays[0].invDir.x[lane] = group.rays[0].invDir.x[0];
+        group.rays[0].invDir.y[lane] = group.rays[0].invDir.y[0];
+        group.rays[0].invDir.z[lane] = group.rays[0].invDir.z[0];
+        group.maxDistances[lane] = -std::numeric_limits<float>::infinity();
+        group.rayOffsets[lane] = static_cast<Int32>(i);
+    }
+
+    memset(context.context.occludedRaysMask, 0, sizeof(Uint8) * numRayGroups);
+
+    if (numObjects == 0 && mInstances.IsEmpty()) // scene is empty
+    {
+        return 0;
+    }
+
+    for (Uint32 i = 0; i < numRayGroups; ++i)
+    {
+        context.context.activeGroupsIndices[i] = (Uint16)i;
+    }
+
+    const ShadowRaysCountersScope countersScope(context.context.localCounters, context.context.counters, packet.numRays);
+
+    Uint32 numOccludedRays = 0;
+
+    if (numObjects == 1) // bypass BVH
+    {
+        TransformRays(context, 0, numRayGroups);
+
+        numOccludedRays = mObjects.Front()->Traverse_Shadow_Packet(context, numRayGroups);
+    }
+    else if (numObjects > 1) // full BVH traversal
+    {
+        numOccludedRays = GenericTraverse_Shadow_Packet<Scene, 0>(context, this, numRayGroups);
+    }
+
+    // occluded rays are masked out, so they don't take part in the instances traversal
+    if (!mInstances.IsEmpty() && numOccludedRays < packet.numRays)
     {
-        GenericTraverse_Packet<Scene, 0>(context, 0, this, numRayGroups);
+        for (Uint32 i = 0; i < numRayGroups; ++i)
+        {
+            context.context.activeGroupsIndices[i] = (Uint16)i;
+        }
+
+        numOccludedRays += GenericTraverse_Shadow_Packet<MeshInstanceSet, 0>(context, &mInstances, numRayGroups);
     }
+
+    // rays may have been reordered during traversal
+    RestoreRaysOrder(packet);
+
+    return numOccludedRays;
 }
 
 void Scene::ExtractShadingData(const math::Ray& ray, const HitPoint& hitPoint, const float time, ShadingData& outShadingData) const
 {
     RT_ASSERT(hitPoint.distance < FLT_MAX);
 
-    const ISceneObject* object = mObjects[hitPoint.objectId].get();
+    const bool isInstance = (hitPoint.objectId & RT_INSTANCE_OBJECT_FLAG) != 0;
+    const ISceneObject* object = isInstance ? nullptr : mObjects[hitPoint.objectId].get();
 
-    const Matrix4 transform = object->ComputeTransform(time);
+    const Matrix4 transform = isInstance ? mInstances.GetTransform(hitPoint) : object->ComputeTransform(time);
     const Matrix4 invTransform = transform.FastInverseNoScale();
 
     const Vector4 worldPosition = ray.GetAtDistance(hitPoint.distance);
     outShadingData.frame[3] = invTransform.TransformPoint(worldPosition);
 
     // calculate normal, tangent, tex coord, etc. from intersection data
-    object->EvaluateShadingData_Single(hitPoint, outShadingData);
+    if (isInstance)
+    {
+        mInstances.EvaluateShadingData_Single(hitPoint, outShadingData);
+    }
+    else
+    {
+        object->EvaluateShadingData_Single(hitPoint, outShadingData);
+    }
 
     Matrix4 localSpaceFrame = outShadingData.frame;
 
@@ -5,7 +5,11 @@
 #include "../Color/RayColor.h"
 #include "../Traversal/HitPoint.h"
 #include "../BVH/BVH.h"
+#include "../BVH/WideBVH.h"
 #include "../Containers/DynArray.h"
+#include "../Math/Float3.h"
+#include "MeshInstanceSet.h"
+#include "Object/SceneObject.h"
 
 namespace rt {
 
@@ -13,11 +17,13 @@ class ISceneObject;
 class ILight;
 class Bitmap;
 class Camera;
+class ThreadPool;
 struct RenderingContext;
 struct HitPoint;
 struct ShadingData;
 struct SingleTraversalContext;
 struct PacketTraversalContext;
+struct SimdTraversalContext;
 
 using SceneObjectPtr = std::unique_ptr<ISceneObject>;
 using LightPtr = std::unique_ptr<ILight>;
@@ -43,28 +49,68 @@ public:
     RAYLIB_API void AddLight(LightPtr object);
     RAYLIB_API void AddObject(SceneObjectPtr object);
 
-    RAYLIB_API bool BuildBVH();
+    // register mesh to be placed on the scene multiple times, returns index of the mesh
+    RAYLIB_API Uint32 AddInstancedMesh(const MeshPtr& mesh);
+
+    // register material that can be used to override instance's mesh materials, returns index of the material
+    RAYLIB_API Uint32 AddInstanceMaterial(const MaterialPtr& material);
+
+    // place instance of a mesh registered with AddInstancedMesh
+    // Instances are much lighter than scene objects (see MeshInstance), so they are preferred for massive scenes (e.g. foliage)
+    // Note: the transform must be rigid (rotation and translation only), scaled or sheared instances are rejected
+    RAYLIB_API bool AddMeshInstance(const math::Matrix4& transform, Uint32 meshIndex, Uint32 materialIndex = MeshInstance::NoMaterialOverride);
+
+    // set max number of time segments a fast moving object can be split into when building the BVH
+    // Each segment is a separate BVH leaf bounding the object's motion within the segment only,
+    // so fast objects do not inflate the whole tree. Setting 1 disables the splitting.
+    RAYLIB_API void SetMaxTimeSegments(Uint32 maxTimeSegments);
+
+    // build BVH over scene objects and the top-level BVH over mesh instances
+    // Optional thread pool is used to build the instances BVH in parallel
+    RAYLIB_API bool BuildBVH(ThreadPool* threadPool = nullptr);
+
+    // Copy read-only traversal data (scene and instances BVH nodes, meshes' BVH nodes and triangles) to local memory
+    // of every NUMA node of the thread pool (see RenderingParams::replicateSceneData). Does nothing if the copies are
+    // up to date, so it can be called before every frame. Rebuilding the BVH or updating a mesh drops its copies.
+    // Note: the copies don't change the scene, so they can be made for a const scene (e.g. the one referenced by a renderer)
+    RAYLIB_API bool ReplicateData(ThreadPool& threadPool) const;
 
     RT_FORCE_INLINE const BVH& GetBVH() const { return mBVH; }
+    RT_FORCE_INLINE const DefaultWideBVH& GetWideBVH() const { return mWideBVH; }
     RT_FORCE_INLINE const DynArray<SceneObjectPtr>& GetObjects() const { return mObjects; }
+    RT_FORCE_INLINE const MeshInstanceSet& GetInstances() const { return mInstances; }
     RT_FORCE_INLINE const DynArray<LightPtr>& GetLights() const { return mLights; }
     RT_FORCE_INLINE const DynArray<const ILight*>& GetGlobalLights() const { return mGlobalLights; }
 
     // traverse the scene, returns hit points
     RAYLIB_API void Traverse_Single(const SingleTraversalContext& context) const;
-    void Traverse_Packet(const PacketTraversalContext& context) const;
+    // Note: the packet should be octant-sorted (see RayPacket::SortByOctant)
+    RAYLIB_API void Traverse_Packet(const PacketTraversalContext& context) const;
 
     // cast shadow ray
     bool Traverse_Shadow_Single(const SingleTraversalContext& context) const;
 
+    // cast packet of shadow rays (max distances are taken from the packet, see RayPacket::PushRay)
+    // Occlusion of each ray is written to RenderingContext::occludedRaysMask. Returns number of occluded rays.
+    RAYLIB_API Uint32 Traverse_Shadow_Packet(const PacketTraversalContext& context) const;
+
     RAYLIB_API void ExtractShadingData(const math::Ray& ray, const HitPoint& hitPoint, const float time, ShadingData& outShadingData) const;
 
-    void TraceRay_Simd8(const math::Ray_Simd8& ray, RenderingContext& context, RayColor* outColors) const;
+    // traverse 8 rays at a time (e.g. 4x2 pixels group)
+    // Note: lanes with negative infinite max distance (see HitPoint_Simd8::distance) are inactive
+    RAYLIB_API void Traverse_Simd8(const SimdTraversalContext& context) const;
+
+    // cast 8 shadow rays at a time (max distances are taken from the hit point, negative infinite distance disables a lane)
+    // Returns bit mask of occluded rays
+    RAYLIB_API Uint32 Traverse_Shadow_Simd8(const SimdTraversalContext& context) const;
 
     void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
     void Traverse_Leaf_Packet(const PacketTraversalContext& context, const Uint32 objectID, const BVH::Node& node, Uint32 numActiveGroups) const;
+    void Traverse_Leaf_Simd8(const SimdTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const;
 
     bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const;
+    Uint32 Traverse_Leaf_Shadow_Packet(const PacketTraversalContext& context, const BVH::Node& node, Uint32 numActiveGroups) const;
+    void Traverse_Leaf_Shadow_Simd8(const SimdTraversalContext& context, const BVH::Node& node) const;
 
     RAYLIB_API const ILight& GetLightByObjectId(Uint32 id) const;
 
@@ -75,13 +121,71 @@ private:
     RT_FORCE_NOINLINE void Traverse_Object_Single(const SingleTraversalContext& context, const Uint32 objectID) const;
     RT_FORCE_NOINLINE bool Traverse_Object_Shadow_Single(const SingleTraversalContext& context, const Uint32 objectID) const;
 
+    void Traverse_Object_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const;
+    void Traverse_Object_Shadow_Simd8(const SimdTraversalContext& context, const Uint32 objectID) const;
+
+    // call object's traversal function without going through the vtable
+    RT_FORCE_INLINE void Dispatch_Single(const SingleTraversalContext& context, const Uint32 objectID) const;
+    RT_FORCE_INLINE bool Dispatch_Shadow_Single(const SingleTraversalContext& context, const Uint32 objectID) const;
+
+    // transform world-space rays of active groups to object's local space
+    void TransformRays(const PacketTraversalContext& context, const Uint32 objectID, Uint32 numActiveGroups) const;
+
+    // get world->local transform of an object at given time point
+    RT_FORCE_INLINE const math::Matrix4 GetObjectInverseTransform(const Uint32 objectID, const float time) const;
+
+    // build per-object traversal records (see ObjectTraversalData)
+    bool BuildObjectTraversalData();
+
+    // reference to a scene object stored in the BVH leaves
+    // Objects split in time are referenced once per time segment
+    struct ObjectReference
+    {
+        Uint32 objectIndex;
+        float timeBegin;
+        float timeEnd;
+
+        RT_FORCE_INLINE bool ContainsTime(const float time) const
+        {
+            return time >= timeBegin && time < timeEnd;
+        }
+    };
+
     DynArray<LightPtr> mLights;
     DynArray<const ILight*> mGlobalLights;
 
     DynArray<SceneObjectPtr> mObjects;
 
+    enum ObjectTraversalFlags : Uint8
+    {
+        ObjectTraversalFlag_Identity    = 1 << 0,   // object's transform is identity, rays don't need to be transformed
+        ObjectTraversalFlag_Moving      = 1 << 1,   // object's transform depends on time and must be computed on the fly
+    };
+
+    // per-object data used by the top-level traversal (structure of arrays indexed by object index)
+    // Allows for skipping the objects' memory (and vtable) until the object is actually traversed
+    struct ObjectTraversalData
+    {
+        DynArray<math::Float3> inverseTransforms; // world->local affine transform (4 rows per object, the last column is implicit)
+        DynArray<Uint8> flags;
+        DynArray<ISceneObject::Type> types;
+    };
+
+    ObjectTraversalData mObjectTraversalData;
+
+    // object references in the BVH leaves order
+    DynArray<ObjectReference> mObjectReferences;
+
+    Uint32 mMaxTimeSegments;
+
+    // mesh instances with their own top-level BVH
+    MeshInstanceSet mInstances;
+
     // bounding volume hierarchy for scene object
     BVH mBVH;
+
+    // the same hierarchy collapsed to multi-way tree
+    DefaultWideBVH mWideBVH;
 };
 
 } // namespace rt
@@ -8,6 +8,9 @@
 constexpr Uint32 RT_INVALID_OBJECT = UINT32_MAX;
 constexpr Uint32 RT_LIGHT_OBJECT = 0xFFFFFFFE;
 
+// object IDs of mesh instances have the highest bit set (lower bits store the instance index, see MeshInstanceSet)
+constexpr Uint32 RT_INSTANCE_OBJECT_FLAG = 0x80000000u;
+
 namespace rt {
 
 // Ray-scene intersection data (non-SIMD)
@@ -1,6 +1,92 @@
 #include "PCH.h"
+#include "RayPacket.h"
 
 namespace rt {
 
+using namespace math;
+
+void RayGroup::SwapRays(RayGroup& groupA, Uint32 a, RayGroup& groupB, Uint32 b)
+{
+    for (Uint32 i = 0; i < 2; ++i)
+    {
+        Ray_Simd8& raysA = groupA.rays[i];
+        Ray_Simd8& raysB = groupB.rays[i];
+
+        std::swap(raysA.dir.x[a], raysB.dir.x[b]);
+        std::swap(raysA.dir.y[a], raysB.dir.y[b]);
+        std::swap(raysA.dir.z[a], raysB.dir.z[b]);
+
+        std::swap(raysA.origin.x[a], raysB.origin.x[b]);
+        std::swap(raysA.origin.y[a], raysB.origin.y[b]);
+        std::swap(raysA.origin.z[a], raysB.origin.z[b]);
+
+        std::swap(raysA.invDir.x[a], raysB.invDir.x[b]);
+        std::swap(raysA.invDir.y[a], raysB.invDir.y[b]);
+        std::swap(raysA.invDir.z[a], raysB.invDir.z[b]);
+    }
+
+    std::swap(groupA.maxDistances[a], groupB.maxDistances[b]);
+    std::swap(groupA.rayOffsets[a], groupB.rayOffsets[b]);
+}
+
+void RayPacket::SwapRays(Uint32 a, Uint32 b)
+{
+    const Uint32 groupA = a / RaysPerGroup;
+    const Uint32 groupB = b / RaysPerGroup;
+    const Uint32 rayA = a % RaysPerGroup;
+    const Uint32 rayB = b % RaysPerGroup;
+
+    RayGroup::SwapRays(groups[groupA], rayA, groups[groupB], rayB);
+
+    std::swap(rayWeights[groupA].x[rayA], rayWeights[groupB].x[rayB]);
+    std::swap(rayWeights[groupA].y[rayA], rayWeights[groupB].y[rayB]);
+    std::swap(rayWeights[groupA].z[rayA], rayWeights[groupB].z[rayB]);
+
+    std::swap(imageLocations[a], imageLocations[b]);
+}
+
+void RayPacket::SortByOctant()
+{
+    // counting sort: calculate target location of every ray
+    Uint32 octantOffsets[8] = { 0 };
+    Uint8 octants[MaxRayPacketSize];
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        octants[i] = static_cast<Uint8>(GetRayOctant(i));
+        octantOffsets[octants[i]]++;
+    }
+
+    Uint32 offset = 0;
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        const Uint32 count = octantOffsets[i];
+        octantOffsets[i] = offset;
+        offset += count;
+    }
+
+    Uint16 targets[MaxRayPacketSize];
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        targets[i] = static_cast<Uint16>(octantOffsets[octants[i]]++);
+    }
+
+    // apply the permutation in-place by following its cycles
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        while (targets[i] != i)
+        {
+            const Uint32 target = targets[i];
+            SwapRays(i, target);
+            std::swap(targets[i], targets[target]);
+        }
+    }
+
+    // rays are stored in their final locations now
+    const Uint32 numGroups = GetNumGroups();
+    for (Uint32 i = 0; i < numGroups; ++i)
+    {
+        groups[i].rayOffsets = VectorInt8(i * RaysPerGroup) + VectorInt8(0, 1, 2, 3, 4, 5, 6, 7);
+    }
+}
 
 } // namespace rt
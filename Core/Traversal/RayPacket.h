@@ -29,6 +29,9 @@ struct RT_ALIGN(32) RayGroup
     math::Ray_Simd8 rays[2];
     math::Vector8 maxDistances;
     math::VectorInt8 rayOffsets;
+
+    // swap traversal data (rays at all depths, max distances and ray offsets) of two rays
+    static void SwapRays(RayGroup& groupA, Uint32 rayA, RayGroup& groupB, Uint32 rayB);
 };
 
 // packet of coherent rays (8-SIMD version)
@@ -57,7 +60,8 @@ struct RT_ALIGN(32) RayPacket
         return (numRays + RaysPerGroup - 1) / RaysPerGroup;
     }
 
-    RT_FORCE_INLINE void PushRay(const math::Ray& ray, const math::Vector4& weight, const ImageLocationInfo& location)
+    // Note: max distance is only used by shadow rays traversal (closest-hit traversal resets it)
+    RT_FORCE_INLINE void PushRay(const math::Ray& ray, const math::Vector4& weight, const ImageLocationInfo& location, float maxDistance = FLT_MAX)
     {
         RT_ASSERT(numRays < MaxRayPacketSize);
 
@@ -74,7 +78,7 @@ struct RT_ALIGN(32) RayPacket
         group.rays[0].invDir.x[rayIndex] = ray.invDir.x;
         group.rays[0].invDir.y[rayIndex] = ray.invDir.y;
         group.rays[0].invDir.z[rayIndex] = ray.invDir.z;
-        group.maxDistances[rayIndex] = FLT_MAX;
+        group.maxDistances[rayIndex] = maxDistance;
         group.rayOffsets[rayIndex] = numRays;
 
         rayWeights[groupIndex].x[rayIndex] = weight.x;
@@ -108,30 +112,33 @@ struct RT_ALIGN(32) RayPacket
     {
         numRays = 0;
     }
-};
 
-/*
-struct RT_ALIGN(64) RayStream
-{
-    float rayOriginX[MaxRayPacketSize];
-    float rayOriginY[MaxRayPacketSize];
-    float rayOriginZ[MaxRayPacketSize];
+    // get direction octant of a ray (bits are set for negative direction components)
+    RT_FORCE_INLINE Uint32 GetRayOctant(Uint32 rayIndex) const
+    {
+        const math::Vector3x8& dir = groups[rayIndex / RaysPerGroup].rays[0].dir;
+        const Uint32 laneBit = 1u << (rayIndex % RaysPerGroup);
+
+        Uint32 octant = (dir.x.GetSignMask() & laneBit) ? 1u : 0u;
+        octant |= (dir.y.GetSignMask() & laneBit) ? 2u : 0u;
+        octant |= (dir.z.GetSignMask() & laneBit) ? 4u : 0u;
+        return octant;
+    }
 
-    float rayDirX[MaxRayPacketSize];
-    float rayDirY[MaxRayPacketSize];
-    float rayDirZ[MaxRayPacketSize];
+    // direction octant of the first ray in a group
+    RT_FORCE_INLINE Uint32 GetGroupOctant(Uint32 groupIndex) const
+    {
+        return GetRayOctant(groupIndex * RaysPerGroup);
+    }
 
-    float distance[MaxRayPacketSize];
-};
+    // Reorder rays so the ones with the same direction octant are stored in consecutive groups
+    // (only groups on octants boundaries contain mixed rays). Rays order within an octant is preserved.
+    // Should be called after all the rays are pushed, before the packet is traversed.
+    RAYLIB_API void SortByOctant();
 
-struct RT_ALIGN(64) RayStreamHitData
-{
-    float distance[MaxRayPacketSize];
-    float u[MaxRayPacketSize];
-    float v[MaxRayPacketSize];
-    Uint32 subObjectId[MaxRayPacketSize];
-    Uint32 objectId[MaxRayPacketSize];
+private:
+    // swap all the data (including weights and image locations) of two rays
+    void SwapRays(Uint32 a, Uint32 b);
 };
-*/
 
 } // namespace rt
@@ -1,48 +1,189 @@
 #include "PCH.h"
 #include "RayStream.h"
+#include "../Math/Box.h"
+#include "../Utils/Logger.h"
 
 namespace rt {
 
+using namespace math;
+
+namespace {
+
+// insert two zero bits between each of lower 8 bits
+RT_FORCE_INLINE Uint32 SpreadBits(Uint32 x)
+{
+    x = (x | (x << 8)) & 0x0300F00Fu;
+    x = (x | (x << 4)) & 0x030C30C3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+} // namespace
+
 RayStream::RayStream()
     : mNumRays(0)
+    , mNumPoppedRays(0)
 {
 }
 
 RayStream::~RayStream() = default;
 
-void RayStream::PushRay(const math::Ray& ray, const math::Vector4& weight, const ImageLocationInfo& imageLocation)
+bool RayStream::Reserve(Uint32 maxRays)
 {
-    RT_ASSERT(mNumRays < MaxRays);
+    if (maxRays > MaxRays)
+    {
+        RT_LOG_ERROR("Too many rays requested for ray stream: %u (max is %u)", maxRays, MaxRays);
+        return false;
+    }
+
+    Clear();
+
+    if (!mRays.Resize(maxRays) || !mSortedRays.Resize(maxRays) || !mSortKeys.Resize(maxRays) || !mTempSortKeys.Resize(maxRays))
+    {
+        RT_LOG_ERROR("Failed to allocate ray stream");
+        return false;
+    }
 
-    PendingRay& pendingRay = mRays[mNumRays];
-    pendingRay.rayWeight = weight;
-    pendingRay.rayDir = ray.dir.ToFloat3();
-    pendingRay.rayOrigin = ray.origin.ToFloat3();
+    return true;
+}
+
+void RayStream::Clear()
+{
+    mNumRays = 0;
+    mNumPoppedRays = 0;
+}
+
+bool RayStream::PushRay(const Ray& ray, const ImageLocationInfo& imageLocation, Uint32 userData)
+{
+    const Uint32 index = mNumRays++;
+    if (index >= mRays.Size())
+    {
+        return false;
+    }
+
+    PendingRay& pendingRay = mRays[index];
+    pendingRay.origin = ray.origin.ToFloat3();
+    pendingRay.userData = userData;
+    pendingRay.dir = ray.dir.ToFloat3();
     pendingRay.imageLocation = imageLocation;
 
-    mNumRays++;
+    return true;
+}
+
+Uint32 RayStream::CalculateSortKey(const PendingRay& ray, const Vector4& boundsMin, const Vector4& gridScale)
+{
+    const Vector4 dir(ray.dir);
+
+    // the same octant definition as in RayPacket::GetRayOctant
+    Uint32 octant = (dir.x < 0.0f) ? 1u : 0u;
+    octant |= (dir.y < 0.0f) ? 2u : 0u;
+    octant |= (dir.z < 0.0f) ? 4u : 0u;
+
+    // 4x4 grid over (unit) direction components within the octant
+    const Uint32 cellX = Min(3u, static_cast<Uint32>(4.0f * Abs(dir.x)));
+    const Uint32 cellY = Min(3u, static_cast<Uint32>(4.0f * Abs(dir.y)));
+    const Uint32 directionKey = (octant << 4) | (cellY << 2) | cellX;
+
+    // 256^3 grid over origins
+    const Vector4 cellCoords = Vector4::Min(Vector4(255.0f), (Vector4(ray.origin) - boundsMin) * gridScale);
+    const VectorInt4 originCell = VectorInt4::Convert(Vector4::Max(Vector4::Zero(), cellCoords));
+    const Uint32 originKey = SpreadBits(originCell.x) | (SpreadBits(originCell.y) << 1) | (SpreadBits(originCell.z) << 2);
+
+    return (directionKey << 24) | originKey;
 }
 
 void RayStream::Sort()
 {
-    // TODO sort rays by position (median axis split partitioning) - O(N log N) or can be better?
-    // TODO sort rays by direction (map ray direction to cube-map grids) - O(N)
+    const Uint32 numRays = GetNumRays();
+
+    mNumPoppedRays = 0;
+
+    if (numRays < 2)
+    {
+        return;
+    }
+
+    Box bounds = Box::Empty();
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        bounds.AddPoint(Vector4(mRays[i].origin));
+    }
+
+    const Vector4 extent = Vector4::Max(bounds.max - bounds.min, Vector4(FLT_EPSILON));
+    const Vector4 gridScale = Vector4(256.0f) / extent;
+
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        const Uint64 key = CalculateSortKey(mRays[i], bounds.min, gridScale);
+        mSortKeys[i] = (key << 32) | i;
+    }
+
+    // LSD radix sort of 31-bit keys (ray indices are stored in lower 32 bits)
+    constexpr Uint32 BitsPerPass = 11;
+    constexpr Uint32 NumBuckets = 1u << BitsPerPass;
+
+    Uint32 offsets[NumBuckets];
+
+    for (Uint32 shift = 32; shift < 64; shift += BitsPerPass)
+    {
+        memset(offsets, 0, sizeof(offsets));
+        for (Uint32 i = 0; i < numRays; ++i)
+        {
+            offsets[(mSortKeys[i] >> shift) & (NumBuckets - 1)]++;
+        }
+
+        // skip pass if all the keys have the same digit
+        if (offsets[(mSortKeys[0] >> shift) & (NumBuckets - 1)] == numRays)
+        {
+            continue;
+        }
+
+        Uint32 offset = 0;
+        for (Uint32 i = 0; i < NumBuckets; ++i)
+        {
+            const Uint32 count = offsets[i];
+            offsets[i] = offset;
+            offset += count;
+        }
+
+        for (Uint32 i = 0; i < numRays; ++i)
+        {
+            const Uint64 key = mSortKeys[i];
+            mTempSortKeys[offsets[(key >> shift) & (NumBuckets - 1)]++] = key;
+        }
+
+        mSortKeys.Swap(mTempSortKeys);
+    }
+
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        mSortedRays[i] = mRays[static_cast<Uint32>(mSortKeys[i])];
+    }
+
+    mRays.Swap(mSortedRays);
 }
 
-bool RayStream::PopPacket(RayPacket& outPacket)
+bool RayStream::PopPacket(RayPacket& outPacket, Uint32* outUserData, Uint32 maxRaysInPacket)
 {
-    if (mNumRays == 0)
+    RT_ASSERT(maxRaysInPacket > 0 && maxRaysInPacket <= MaxRayPacketSize);
+
+    const Uint32 numRays = GetNumRays();
+
+    const Uint32 firstRay = mNumPoppedRays.fetch_add(maxRaysInPacket);
+    if (firstRay >= numRays)
     {
         return false;
     }
 
-    Uint32 numRaysInPacket = math::Min(mNumRays, MaxRayPacketSize);
-    Uint32 numRayGroups = math::RoundUp(numRaysInPacket, RayPacket::RaysPerGroup) / RayPacket::RaysPerGroup;
+    const Uint32 numRaysInPacket = Min(numRays - firstRay, maxRaysInPacket);
 
-    // TODO
-    (void)outPacket;
-    (void)numRaysInPacket;
-    (void)numRayGroups;
+    outPacket.Clear();
+    for (Uint32 i = 0; i < numRaysInPacket; ++i)
+    {
+        const PendingRay& pendingRay = mRays[firstRay + i];
+        outPacket.PushRay(Ray(Vector4(pendingRay.origin), Vector4(pendingRay.dir)), VECTOR_ONE, pendingRay.imageLocation);
+        outUserData[i] = pendingRay.userData;
+    }
 
     return true;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "RayPacket.h"
+#include "../Containers/DynArray.h"
+
+#include <atomic>
 
 
 namespace rt {
@@ -8,38 +11,69 @@ namespace rt {
 
 // Ray stream - generator of ray packets
 // Push incoherent rays, pops coherent ray packets
+// Note: pushing and popping rays is thread-safe, sorting is not
 class RayStream
 {
 public:
     static constexpr Uint32 MaxRays = 1024 * 1024;
 
-    RayStream();
-    ~RayStream();
+    RAYLIB_API RayStream();
+    RAYLIB_API ~RayStream();
+
+    // allocate storage for given number of rays (at most MaxRays)
+    // Note: this will remove all the pushed rays
+    RAYLIB_API bool Reserve(Uint32 maxRays);
+
+    // remove all the rays
+    RAYLIB_API void Clear();
 
     // push a new ray to the stream
-    void PushRay(const math::Ray& ray, const math::Vector4& weight, const ImageLocationInfo& imageLocation);
+    // The user data is passed along with the ray when a packet is popped (e.g. index of a path)
+    // Returns false if the stream is full
+    RAYLIB_API bool PushRay(const math::Ray& ray, const ImageLocationInfo& imageLocation, Uint32 userData);
 
-    // Convert collected rays into ray packets.
-    // This will flush all the pushed rays and generate list of fresh ray packets
-    void Sort();
+    // Sort collected rays, so consecutive rays have similar directions and origins.
+    // Rays are ordered by direction octant, then by direction cell within the octant and finally
+    // by origin cell (Morton order of a grid spanning all the ray origins).
+    // This will also rewind the stream, so the packets are popped from the beginning.
+    RAYLIB_API void Sort();
 
-    // Pop generated packet
+    // Pop generated packet consisting of at most 'maxRaysInPacket' consecutive rays
+    // User data of the packet rays are written to 'outUserData' (in the packet rays order).
     // If there's no packets pending the function returns false
-    // Note: ray stream keeps the packet ownership
-    bool PopPacket(RayPacket& outPacket);
+    RAYLIB_API bool PopPacket(RayPacket& outPacket, Uint32* outUserData, Uint32 maxRaysInPacket = MaxRayPacketSize);
+
+    RT_FORCE_INLINE Uint32 GetNumRays() const
+    {
+        return math::Min<Uint32>(mNumRays, mRays.Size());
+    }
+
+    RT_FORCE_INLINE Uint32 GetUserData(Uint32 rayIndex) const
+    {
+        RT_ASSERT(rayIndex < GetNumRays());
+        return mRays[rayIndex].userData;
+    }
 
 private:
 
     struct PendingRay
     {
-        math::Vector4 rayWeight;
-        math::Float3 rayOrigin;
-        math::Float3 rayDir;
+        math::Float3 origin;
+        Uint32 userData;
+        math::Float3 dir;
         ImageLocationInfo imageLocation;
     };
 
-    Uint32 mNumRays;
-    PendingRay mRays[MaxRays];
+    // calculate sorting key: 3 bits of direction octant, 4 bits of direction cell, 24 bits of origin cell
+    static Uint32 CalculateSortKey(const PendingRay& ray, const math::Vector4& boundsMin, const math::Vector4& gridScale);
+
+    DynArray<PendingRay> mRays;
+    DynArray<PendingRay> mSortedRays;
+    DynArray<Uint64> mSortKeys;
+    DynArray<Uint64> mTempSortKeys;
+
+    std::atomic<Uint32> mNumRays;
+    std::atomic<Uint32> mNumPoppedRays;
 };
 
 
@@ -33,4 +33,46 @@ void PacketTraversalContext::StoreIntersection(RayGroup& rayGroup, const Vector8
     }
 }
 
+void SimdTraversalContext::StoreIntersection(const Vector8& t, const Vector8& u, const Vector8& v, const VectorBool8& mask, Uint32 objectID, Uint32 subObjectID) const
+{
+    if (mask.None())
+    {
+        return;
+    }
+
+    hitPoint.distance = Vector8::Select(hitPoint.distance, t, mask);
+    hitPoint.u = Vector8::Select(hitPoint.u, u, mask);
+    hitPoint.v = Vector8::Select(hitPoint.v, v, mask);
+
+    // Note: blending integers as floats (bit patterns are preserved)
+    hitPoint.objectId = VectorInt8::Cast(Vector8::Select(hitPoint.objectId.CastToFloat(), VectorInt8(objectID).CastToFloat(), mask));
+    hitPoint.subObjectId = VectorInt8::Cast(Vector8::Select(hitPoint.subObjectId.CastToFloat(), VectorInt8(subObjectID).CastToFloat(), mask));
+}
+
+void SimdTraversalContext::StoreOcclusion(const VectorBool8& mask) const
+{
+    hitPoint.distance = Vector8::Select(hitPoint.distance, Vector8(-std::numeric_limits<float>::infinity()), mask);
+}
+
+Uint32 PacketTraversalContext::StoreOcclusion(RayGroup& rayGroup, const VectorBool8& mask) const
+{
+    const int intMask = mask.GetMask();
+
+    if (intMask)
+    {
+        rayGroup.maxDistances = Vector8::Select(rayGroup.maxDistances, Vector8(-std::numeric_limits<float>::infinity()), mask);
+
+        for (Uint32 k = 0; k < 8; ++k)
+        {
+            if ((intMask >> k) & 1)
+            {
+                const Uint32 rayIndex = rayGroup.rayOffsets[k];
+                context.occludedRaysMask[rayIndex / RayPacket::RaysPerGroup] |= (Uint8)(1u << (rayIndex % RayPacket::RaysPerGroup));
+            }
+        }
+    }
+
+    return PopCount(intMask);
+}
+
 } // namespace rt
@@ -23,6 +23,13 @@ struct SimdTraversalContext
     const math::Ray_Simd8& ray;
     HitPoint_Simd8& hitPoint;
     RenderingContext& context;
+
+    // update hit points of the lanes selected by the mask
+    void StoreIntersection(const math::Vector8& t, const math::Vector8& u, const math::Vector8& v, const math::VectorBool8& mask, Uint32 objectID, Uint32 subObjectID = 0) const;
+
+    // mark lanes as occluded (shadow rays traversal)
+    // Occluded lanes get negative infinite distance, so they don't pass any further box or primitive test.
+    void StoreOcclusion(const math::VectorBool8& mask) const;
 };
 
 struct PacketTraversalContext
@@ -31,6 +38,11 @@ struct PacketTraversalContext
     RenderingContext& context;
 
     void StoreIntersection(RayGroup& rayGroup, const math::Vector8& t, const math::Vector8& u, const math::Vector8& v, const math::VectorBool8& mask, Uint32 objectID, Uint32 subObjectID = 0) const;
+
+    // mark rays as occluded (shadow rays traversal)
+    // Occluded rays get negative infinite max distance, so they don't pass any further box or primitive test.
+    // Returns number of newly occluded rays
+    Uint32 StoreOcclusion(RayGroup& rayGroup, const math::VectorBool8& mask) const;
 };
 
 } // namespace rt
@@ -55,27 +55,13 @@ Uint32 RemoveMissedGroups(RenderingContext& context, Uint32 numGroups)
     }
 }
 
-// TODO this is ugly AF, but actually works
-static void SwapRays(RenderingContext& context, Uint32 a, Uint32 b, Uint32 traversalDepth)
+static void SwapRays(RayPacket& packet, const RenderingContext& context, Uint32 a, Uint32 b)
 {
-    RayGroup& groupA = context.rayPacket.groups[context.activeGroupsIndices[a / RayPacket::RaysPerGroup]];
-    RayGroup& groupB = context.rayPacket.groups[context.activeGroupsIndices[b / RayPacket::RaysPerGroup]];
+    RayGroup& groupA = packet.groups[context.activeGroupsIndices[a / RayPacket::RaysPerGroup]];
+    RayGroup& groupB = packet.groups[context.activeGroupsIndices[b / RayPacket::RaysPerGroup]];
 
-    std::swap(groupA.rays[traversalDepth].dir.x[a % 8], groupB.rays[traversalDepth].dir.x[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].dir.y[a % 8], groupB.rays[traversalDepth].dir.y[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].dir.z[a % 8], groupB.rays[traversalDepth].dir.z[b % RayPacket::RaysPerGroup]);
-
-    std::swap(groupA.rays[traversalDepth].origin.x[a % 8], groupB.rays[traversalDepth].origin.x[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].origin.y[a % 8], groupB.rays[traversalDepth].origin.y[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].origin.z[a % 8], groupB.rays[traversalDepth].origin.z[b % RayPacket::RaysPerGroup]);
-
-    std::swap(groupA.rays[traversalDepth].invDir.x[a % 8], groupB.rays[traversalDepth].invDir.x[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].invDir.y[a % 8], groupB.rays[traversalDepth].invDir.y[b % RayPacket::RaysPerGroup]);
-    std::swap(groupA.rays[traversalDepth].invDir.z[a % 8], groupB.rays[traversalDepth].invDir.z[b % RayPacket::RaysPerGroup]);
-
-    std::swap(groupA.maxDistances[a % 8], groupB.maxDistances[b % 8]);
-
-    std::swap(groupA.rayOffsets[a % 8], groupB.rayOffsets[b % 8]);
+    // Note: rays at all depths must be moved, so they stay consistent when returning to upper traversal level
+    RayGroup::SwapRays(groupA, a % RayPacket::RaysPerGroup, groupB, b % RayPacket::RaysPerGroup);
 }
 
 static void SwapBits(Uint8& a, Uint8& b, Uint32 indexA, Uint32 indexB)
@@ -86,7 +72,7 @@ static void SwapBits(Uint8& a, Uint8& b, Uint32 indexA, Uint32 indexB)
     b ^= (-bitA ^ b) & (1UL << indexB);
 }
 
-void ReorderRays(RenderingContext& context, Uint32 numGroups, Uint32 traversalDepth)
+void ReorderRays(RayPacket& packet, RenderingContext& context, Uint32 numGroups)
 {
     Uint32 numRays = numGroups * RayPacket::RaysPerGroup;
     Uint32 i = 0;
@@ -102,12 +88,56 @@ void ReorderRays(RenderingContext& context, Uint32 numGroups, Uint32 traversalDe
         else
         {
             numRays--;
-            SwapRays(context, i, numRays, traversalDepth);
+            SwapRays(packet, context, i, numRays);
             SwapBits(context.activeRaysMask[i / 8], context.activeRaysMask[numRays / 8], i % 8, numRays % 8);
         }
     }
 }
 
+void RestoreRaysOrder(RayPacket& packet)
+{
+    // every ray carries its original offset, so the permutation can be undone by following its cycles
+    const Uint32 numRays = packet.GetNumGroups() * RayPacket::RaysPerGroup;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        for (;;)
+        {
+            const Uint32 target = static_cast<Uint32>(packet.groups[i / RayPacket::RaysPerGroup].rayOffsets[i % RayPacket::RaysPerGroup]);
+            if (target == i)
+            {
+                break;
+            }
+
+            RT_ASSERT(target < numRays);
+            RayGroup::SwapRays(packet.groups[i / RayPacket::RaysPerGroup], i % RayPacket::RaysPerGroup,
+                               packet.groups[target / RayPacket::RaysPerGroup], target % RayPacket::RaysPerGroup);
+        }
+    }
+}
+
+Uint32 CalculateRayPacketOctant(const RayPacket& packet, Uint32 numGroups, const RenderingContext& context, Uint32 traversalDepth)
+{
+    // count rays with negative direction in each axis
+    Uint32 numNegativeX = 0;
+    Uint32 numNegativeY = 0;
+    Uint32 numNegativeZ = 0;
+
+    for (Uint32 i = 0; i < numGroups; ++i)
+    {
+        const Vector3x8& dir = packet.groups[context.activeGroupsIndices[i]].rays[traversalDepth].dir;
+        numNegativeX += PopCount(dir.x.GetSignMask());
+        numNegativeY += PopCount(dir.y.GetSignMask());
+        numNegativeZ += PopCount(dir.z.GetSignMask());
+    }
+
+    const Uint32 halfRays = numGroups * RayPacket::RaysPerGroup / 2;
+
+    Uint32 rayOctant = numNegativeX > halfRays ? 1 : 0;
+    rayOctant |= numNegativeY > halfRays ? 2 : 0;
+    rayOctant |= numNegativeZ > halfRays ? 4 : 0;
+    return rayOctant;
+}
+
 Uint32 TestRayPacket(RayPacket& packet, Uint32 numGroups, const BVH::Node& node, RenderingContext& context, Uint32 traversalDepth)
 {
     Vector8 distance;
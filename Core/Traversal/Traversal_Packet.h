@@ -11,17 +11,26 @@
 #include "Rendering/Counters.h"
 #include "Rendering/Context.h"
 
-#define RT_NO_RAY_REORDERING
-
 namespace rt {
 
 struct RenderingContext;
 
+// rays are compacted when SIMD lanes utilization of the active groups drops to this level
+// Note: reordering is not free (rays are moved one by one), so it pays off only for sparse packets
+static constexpr float RayReorderingUtilizationThreshold = 0.5f;
+
 // remove groups where all rays missed a bounding box
 RT_FORCE_NOINLINE Uint32 RemoveMissedGroups(RenderingContext& context, Uint32 numGroups);
 
-// reorder rays to restore coherency
-RT_FORCE_NOINLINE void ReorderRays(RenderingContext& context, Uint32 numRays, Uint32 traversalDepth);
+// reorder rays to restore coherency - move active rays to the front of the active groups list
+// Note: ray offsets are moved along with the rays, so hit points are not affected
+RT_FORCE_NOINLINE void ReorderRays(RayPacket& packet, RenderingContext& context, Uint32 numGroups);
+
+// restore the original order of rays in the packet (undo ReorderRays)
+RT_FORCE_NOINLINE void RestoreRaysOrder(RayPacket& packet);
+
+// determine dominant direction octant of the active rays
+RT_FORCE_NOINLINE Uint32 CalculateRayPacketOctant(const RayPacket& packet, Uint32 numGroups, const RenderingContext& context, Uint32 traversalDepth);
 
 // test all alive groups in a packet agains a BVH node
 RT_FORCE_NOINLINE Uint32 TestRayPacket(RayPacket& packet, Uint32 numGroups, const BVH::Node& node, RenderingContext& context, Uint32 traversalDepth);
@@ -30,7 +39,7 @@ template <typename ObjectType, Uint32 traversalDepth>
 void GenericTraverse_Packet(const PacketTraversalContext& context, const Uint32 objectID, const ObjectType* object, Uint32 numActiveGroups)
 {
     // all nodes
-    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes();
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
 
     struct StackFrame
     {
@@ -47,11 +56,8 @@ void GenericTraverse_Packet(const PacketTraversalContext& context, const Uint32
     stack[0].numActiveGroups = numActiveGroups;
     stack[0].numActiveRays = context.ray.numRays; // all rays are active at the beginning
 
-    // TODO packets should be octant-sorted
-    Uint32 rayOctant = 0;
-    rayOctant = context.ray.groups[0].rays[traversalDepth].dir.x[0] < 0.0f ? 1 : 0;
-    rayOctant |= context.ray.groups[0].rays[traversalDepth].dir.y[0] < 0.0f ? 2 : 0;
-    rayOctant |= context.ray.groups[0].rays[traversalDepth].dir.z[0] < 0.0f ? 4 : 0;
+    // Note: packets are expected to be octant-sorted (see RayPacket::SortByOctant)
+    const Uint32 rayOctant = CalculateRayPacketOctant(context.ray, numActiveGroups, context.context, traversalDepth);
 
     // BVH traversal
     while (stackSize > 0)
@@ -62,8 +68,9 @@ void GenericTraverse_Packet(const PacketTraversalContext& context, const Uint32
         Uint32 numGroups = frame.numActiveGroups;
         Uint32 raysHit = TestRayPacket(context.ray, numGroups, *frame.node, context.context, traversalDepth);
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        context.context.localCounters.numTraversalSteps += 8 * numGroups;
         context.context.localCounters.numRayBoxTests += 8 * numGroups;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
         context.context.localCounters.numPassedRayBoxTests += raysHit;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
@@ -80,10 +87,10 @@ void GenericTraverse_Packet(const PacketTraversalContext& context, const Uint32
 
 #ifndef RT_NO_RAY_REORDERING
             // reorder rays to restore coherency
-            if ((numGroups > 1) && ((4 * numGroups) >= raysHit)) // 50% utilization
+            if ((numGroups > 1) && (RayReorderingUtilizationThreshold * numGroups * RayPacket::RaysPerGroup >= raysHit))
             {
-                ReorderRays(context.context, numGroups);
-                numGroups = (raysHit + 7) / 8;
+                ReorderRays(context.ray, context.context, numGroups);
+                numGroups = (raysHit + RayPacket::RaysPerGroup - 1) / RayPacket::RaysPerGroup;
             }
 #endif // RT_NO_RAY_REORDERING
         }
@@ -116,4 +123,109 @@ void GenericTraverse_Packet(const PacketTraversalContext& context, const Uint32
     }
 }
 
+// shadow rays (occlusion) traversal - looks for any hit instead of the closest one
+// Occluded rays are masked out (see PacketTraversalContext::StoreOcclusion), so they stop taking part in box tests,
+// and the traversal terminates as soon as all the rays entering the object are occluded.
+// Returns number of rays occluded during the traversal
+template <typename ObjectType, Uint32 traversalDepth>
+Uint32 GenericTraverse_Shadow_Packet(const PacketTraversalContext& context, const ObjectType* object, Uint32 numActiveGroups)
+{
+    // all nodes
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
+
+    struct StackFrame
+    {
+        const BVH::Node* node;
+        Uint32 numActiveGroups;
+        Uint32 numActiveRays;
+    };
+
+    StackFrame stack[BVH::MaxDepth];
+
+    // push root
+    Uint32 stackSize = 1;
+    stack[0].node = nodes;
+    stack[0].numActiveGroups = numActiveGroups;
+    stack[0].numActiveRays = numActiveGroups * RayPacket::RaysPerGroup;
+
+    const Uint32 rayOctant = CalculateRayPacketOctant(context.ray, numActiveGroups, context.context, traversalDepth);
+
+    Uint32 numOccludedRays = 0;
+    Uint32 numRaysToOcclude = 0;
+
+    // BVH traversal
+    while (stackSize > 0)
+    {
+        // pop element from stack
+        const StackFrame& frame = stack[--stackSize];
+
+        Uint32 numGroups = frame.numActiveGroups;
+        Uint32 raysHit = TestRayPacket(context.ray, numGroups, *frame.node, context.context, traversalDepth);
+
+        context.context.localCounters.numTraversalSteps += 8 * numGroups;
+        context.context.localCounters.numRayBoxTests += 8 * numGroups;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        context.context.localCounters.numPassedRayBoxTests += raysHit;
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+        // only the rays hitting the root can be occluded
+        if (frame.node == nodes)
+        {
+            numRaysToOcclude = raysHit;
+        }
+
+        if (raysHit == 0)
+        {
+            // all rays missed the node (or are already occluded) - skip it
+            continue;
+        }
+
+        // remove missed groups from the list
+        if (raysHit < frame.numActiveRays)
+        {
+            numGroups = RemoveMissedGroups(context.context, numGroups);
+
+#ifndef RT_NO_RAY_REORDERING
+            // reorder rays to restore coherency
+            if ((numGroups > 1) && (RayReorderingUtilizationThreshold * numGroups * RayPacket::RaysPerGroup >= raysHit))
+            {
+                ReorderRays(context.ray, context.context, numGroups);
+                numGroups = (raysHit + RayPacket::RaysPerGroup - 1) / RayPacket::RaysPerGroup;
+            }
+#endif // RT_NO_RAY_REORDERING
+        }
+
+        if (frame.node->IsLeaf())
+        {
+            numOccludedRays += object->Traverse_Leaf_Shadow_Packet(context, *frame.node, numGroups);
+
+            // early out - all the rays are occluded
+            if (numOccludedRays >= numRaysToOcclude)
+            {
+                break;
+            }
+        }
+        else
+        {
+            const BVH::Node* __restrict children = nodes + frame.node->childIndex;
+            RT_PREFETCH_L1(children);
+
+            const Uint32 firstIndex = (rayOctant >> frame.node->GetSplitAxis()) & 1u;
+            const Uint32 secondIndex = firstIndex ^ 1u;
+
+            stack[stackSize].node = children + secondIndex;
+            stack[stackSize].numActiveGroups = numGroups;
+            stack[stackSize].numActiveRays = raysHit;
+            stackSize++;
+
+            stack[stackSize].node = children + firstIndex;
+            stack[stackSize].numActiveGroups = numGroups;
+            stack[stackSize].numActiveRays = raysHit;
+            stackSize++;
+        }
+    }
+
+    return numOccludedRays;
+}
+
 } // namespace rt
@@ -7,6 +7,8 @@
 #include "Math/Simd8Geometry.h"
 #include "Utils/iacaMarks.h"
 #include "Rendering/Counters.h"
+#include "Rendering/Context.h"
+#include "TraversalContext.h"
 
 
 namespace rt {
@@ -20,12 +22,15 @@ static void GenericTraverse_Simd8(const SimdTraversalContext& context, const Uin
     const math::Vector3x8 rayOriginDivDir = context.ray.origin * context.ray.invDir;
 
     // all nodes
-    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes();
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
 
     // "nodes to visit" stack
     Uint32 stackSize = 0;
     const BVH::Node* __restrict nodesStack[BVH::MaxDepth];
 
+    // traversal steps are counted for the active lanes only (hit distances stay positive, so the set never changes)
+    const Uint32 numActiveRays = math::PopCount((context.hitPoint.distance > math::Vector8::Zero()).GetMask());
+
     // BVH traversal
     for (const BVH::Node* __restrict currentNode = nodes;;)
     {
@@ -51,17 +56,20 @@ static void GenericTraverse_Simd8(const SimdTraversalContext& context, const Uin
             const math::Vector8 maskB = Intersect_BoxRay_Simd8(rayInvDir, rayOriginDivDir, childB->GetBox_Simd8(), context.hitPoint.distance, distanceB);
             const Int32 intMaskB = maskB.GetSignMask();
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numTraversalSteps += numActiveRays;
             context.context.localCounters.numRayBoxTests += 2 * 8;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
             context.context.localCounters.numPassedRayBoxTests += math::PopCount(intMaskA);
             context.context.localCounters.numPassedRayBoxTests += math::PopCount(intMaskB);
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
-            if (const Int32 intMaskAB = intMaskA & intMaskB)
+            // Note: both children must be visited even if no single ray hits both of them
+            if (intMaskA && intMaskB)
             {
+                const Int32 intMaskAB = intMaskA & intMaskB;
                 const Int32 intOrderMask = (distanceA < distanceB).GetMask();
-                const Int32 orderMaskA = intOrderMask & intMaskAB;
-                const Int32 orderMaskB = (~intOrderMask) & intMaskAB;
+                const Int32 orderMaskA = (intOrderMask & intMaskAB) | (intMaskA & ~intMaskB);
+                const Int32 orderMaskB = ((~intOrderMask) & intMaskAB) | (intMaskB & ~intMaskA);
 
                 // traverse to child node A if majority rays hit it before the child B
                 if (math::PopCount(orderMaskB) > math::PopCount(orderMaskA))
@@ -99,4 +107,89 @@ static void GenericTraverse_Simd8(const SimdTraversalContext& context, const Uin
     }
 }
 
+// traverse 8 shadow rays at a time
+// Max distances are taken from the hit point. Occluded rays get the distance set to -infinity and rays with
+// non-positive distance are treated as inactive, so the traversal is terminated when all the lanes are done.
+// Returns true if all the lanes are done
+template <typename ObjectType>
+static bool GenericTraverse_Shadow_Simd8(const SimdTraversalContext& context, const ObjectType* object)
+{
+    const math::Vector3x8 rayInvDir = context.ray.invDir;
+    const math::Vector3x8 rayOriginDivDir = context.ray.origin * context.ray.invDir;
+
+    // all nodes
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
+
+    // "nodes to visit" stack
+    Uint32 stackSize = 0;
+    const BVH::Node* __restrict nodesStack[BVH::MaxDepth];
+
+    // traversal steps are counted for the active lanes only
+    Uint32 numActiveRays = math::PopCount((context.hitPoint.distance > math::Vector8::Zero()).GetMask());
+
+    // BVH traversal
+    for (const BVH::Node* __restrict currentNode = nodes;;)
+    {
+        if (currentNode->IsLeaf())
+        {
+            object->Traverse_Leaf_Shadow_Simd8(context, *currentNode);
+
+            // per-lane termination: stop if all the rays are occluded (or inactive)
+            const Int32 activeMask = (context.hitPoint.distance > math::Vector8::Zero()).GetMask();
+            if (activeMask == 0)
+            {
+                return true;
+            }
+
+            numActiveRays = math::PopCount(activeMask);
+        }
+        else
+        {
+            const BVH::Node* __restrict childA = nodes + currentNode->childIndex;
+            const BVH::Node* __restrict childB = childA + 1;
+
+            math::Vector8 distanceA, distanceB;
+            const Int32 intMaskA = Intersect_BoxRay_Simd8(rayInvDir, rayOriginDivDir, childA->GetBox_Simd8(), context.hitPoint.distance, distanceA).GetSignMask();
+            const Int32 intMaskB = Intersect_BoxRay_Simd8(rayInvDir, rayOriginDivDir, childB->GetBox_Simd8(), context.hitPoint.distance, distanceB).GetSignMask();
+
+            context.context.localCounters.numTraversalSteps += numActiveRays;
+            context.context.localCounters.numRayBoxTests += 2 * 8;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numPassedRayBoxTests += math::PopCount(intMaskA);
+            context.context.localCounters.numPassedRayBoxTests += math::PopCount(intMaskB);
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+            // Note: the order does not matter for shadow rays
+            if (intMaskA && intMaskB)
+            {
+                currentNode = childA;
+                nodesStack[stackSize++] = childB;
+                continue;
+            }
+
+            if (intMaskA)
+            {
+                currentNode = childA;
+                continue;
+            }
+
+            if (intMaskB)
+            {
+                currentNode = childB;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        // pop a node
+        currentNode = nodesStack[--stackSize];
+    }
+
+    return false;
+}
+
 } // namespace rt
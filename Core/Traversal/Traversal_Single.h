@@ -7,10 +7,210 @@
 #include "Math/Geometry.h"
 #include "Utils/iacaMarks.h"
 #include "Rendering/Counters.h"
+#include "Rendering/Context.h"
 
 
 namespace rt {
 
+// single-ray traversal of BVH with quantized nodes
+// Decoded boxes of the nodes to visit are kept on the stack, as they are needed to decode children's boxes
+template <typename ObjectType>
+void GenericTraverse_Quantized_Single(const SingleTraversalContext& context, const Uint32 objectID, const ObjectType* object)
+{
+    float distanceA, distanceB;
+
+    const BVH& bvh = object->GetBVH();
+    RT_ASSERT(bvh.GetNodeFormat() == BVH::NodeFormat::Quantized);
+
+    // all nodes
+    const BVH::QuantizedNode* __restrict nodes = bvh.GetQuantizedNodes(context.context.numaNode);
+
+    struct StackEntry
+    {
+        math::Box box;
+        const BVH::QuantizedNode* node;
+    };
+
+    // "nodes to visit" stack
+    Uint32 stackSize = 0;
+    StackEntry nodesStack[BVH::MaxDepth];
+
+    // BVH traversal
+    math::Box currentBox = nodes->DecodeBox(bvh.GetRootBox());
+    for (const BVH::QuantizedNode* __restrict currentNode = nodes;;)
+    {
+        if (currentNode->IsLeaf())
+        {
+            BVH::Node leaf;
+            leaf.childIndex = currentNode->childIndex;
+            leaf.numLeaves = currentNode->numLeaves;
+            object->Traverse_Leaf_Single(context, objectID, leaf);
+        }
+        else
+        {
+            const BVH::QuantizedNode* __restrict childA = nodes + currentNode->childIndex;
+            const BVH::QuantizedNode* __restrict childB = childA + 1;
+
+            // prefetch grand-children
+            RT_PREFETCH_L1(nodes + childA->childIndex);
+
+            math::Box boxA = childA->DecodeBox(currentBox);
+            math::Box boxB = childB->DecodeBox(currentBox);
+
+            // Note: according to Intel manuals, prefetch instructions should not be grouped together
+            RT_PREFETCH_L1(nodes + childB->childIndex);
+
+            bool hitA = Intersect_BoxRay(context.ray, boxA, distanceA);
+            bool hitB = Intersect_BoxRay(context.ray, boxB, distanceB);
+
+            // box occlusion
+            hitA &= (distanceA < context.hitPoint.distance);
+            hitB &= (distanceB < context.hitPoint.distance);
+
+            context.context.localCounters.numTraversalSteps++;
+            context.context.localCounters.numRayBoxTests += 2;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numPassedRayBoxTests += hitA ? 1 : 0;
+            context.context.localCounters.numPassedRayBoxTests += hitB ? 1 : 0;
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+            if (hitA && hitB)
+            {
+                // will push [childA, childB] or [childB, childA] depending on distances
+                if (distanceB < distanceA)
+                {
+                    std::swap(childA, childB);
+                    std::swap(boxA, boxB);
+                }
+                currentNode = childA;
+                currentBox = boxA;
+                nodesStack[stackSize++] = { boxB, childB };
+                continue;
+            }
+            if (hitA)
+            {
+                currentNode = childA;
+                currentBox = boxA;
+                continue;
+            }
+            if (hitB)
+            {
+                currentNode = childB;
+                currentBox = boxB;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        // pop a node
+        --stackSize;
+        currentNode = nodesStack[stackSize].node;
+        currentBox = nodesStack[stackSize].box;
+    }
+}
+
+template <typename ObjectType>
+bool GenericTraverse_Quantized_Shadow_Single(const SingleTraversalContext& context, const ObjectType* object)
+{
+    float distanceA, distanceB;
+
+    const BVH& bvh = object->GetBVH();
+    RT_ASSERT(bvh.GetNodeFormat() == BVH::NodeFormat::Quantized);
+
+    // all nodes
+    const BVH::QuantizedNode* __restrict nodes = bvh.GetQuantizedNodes(context.context.numaNode);
+
+    struct StackEntry
+    {
+        math::Box box;
+        const BVH::QuantizedNode* node;
+    };
+
+    // "nodes to visit" stack
+    Uint32 stackSize = 0;
+    StackEntry nodesStack[BVH::MaxDepth];
+
+    // BVH traversal
+    math::Box currentBox = nodes->DecodeBox(bvh.GetRootBox());
+    for (const BVH::QuantizedNode* __restrict currentNode = nodes;;)
+    {
+        if (currentNode->IsLeaf())
+        {
+            BVH::Node leaf;
+            leaf.childIndex = currentNode->childIndex;
+            leaf.numLeaves = currentNode->numLeaves;
+            if (object->Traverse_Leaf_Shadow_Single(context, leaf))
+            {
+                return true;
+            }
+        }
+        else
+        {
+            const BVH::QuantizedNode* __restrict childA = nodes + currentNode->childIndex;
+            const BVH::QuantizedNode* __restrict childB = childA + 1;
+
+            // prefetch grand-children
+            RT_PREFETCH_L1(nodes + childA->childIndex);
+
+            const math::Box boxA = childA->DecodeBox(currentBox);
+            const math::Box boxB = childB->DecodeBox(currentBox);
+
+            // Note: according to Intel manuals, prefetch instructions should not be grouped together
+            RT_PREFETCH_L1(nodes + childB->childIndex);
+
+            bool hitA = Intersect_BoxRay(context.ray, boxA, distanceA);
+            bool hitB = Intersect_BoxRay(context.ray, boxB, distanceB);
+
+            // box occlusion
+            hitA &= (distanceA < context.hitPoint.distance);
+            hitB &= (distanceB < context.hitPoint.distance);
+
+            context.context.localCounters.numTraversalSteps++;
+            context.context.localCounters.numRayBoxTests += 2;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numPassedRayBoxTests += hitA ? 1 : 0;
+            context.context.localCounters.numPassedRayBoxTests += hitB ? 1 : 0;
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+            if (hitA && hitB)
+            {
+                currentNode = childA;
+                currentBox = boxA;
+                nodesStack[stackSize++] = { boxB, childB };
+                continue;
+            }
+            if (hitA)
+            {
+                currentNode = childA;
+                currentBox = boxA;
+                continue;
+            }
+            if (hitB)
+            {
+                currentNode = childB;
+                currentBox = boxB;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        // pop a node
+        --stackSize;
+        currentNode = nodesStack[stackSize].node;
+        currentBox = nodesStack[stackSize].box;
+    }
+
+    return false;
+}
+
 // simple single-ray traversal
 template <typename ObjectType>
 void GenericTraverse_Single(const SingleTraversalContext& context, const Uint32 objectID, const ObjectType* object)
@@ -23,8 +223,14 @@ void GenericTraverse_Single(const SingleTraversalContext& context, const Uint32
         return;
     }
 
+    if (object->GetBVH().GetNodeFormat() == BVH::NodeFormat::Quantized)
+    {
+        GenericTraverse_Quantized_Single(context, objectID, object);
+        return;
+    }
+
     // all nodes
-    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes();
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
 
     // "nodes to visit" stack
     Uint32 stackSize = 0;
@@ -56,8 +262,9 @@ void GenericTraverse_Single(const SingleTraversalContext& context, const Uint32
             hitA &= (distanceA < context.hitPoint.distance);
             hitB &= (distanceB < context.hitPoint.distance);
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numTraversalSteps++;
             context.context.localCounters.numRayBoxTests += 2;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
             context.context.localCounters.numPassedRayBoxTests += hitA ? 1 : 0;
             context.context.localCounters.numPassedRayBoxTests += hitB ? 1 : 0;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
@@ -106,8 +313,13 @@ bool GenericTraverse_Shadow_Single(const SingleTraversalContext& context, const
         return false;
     }
 
+    if (object->GetBVH().GetNodeFormat() == BVH::NodeFormat::Quantized)
+    {
+        return GenericTraverse_Quantized_Shadow_Single(context, object);
+    }
+
     // all nodes
-    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes();
+    const BVH::Node* __restrict nodes = object->GetBVH().GetNodes(context.context.numaNode);
 
     // "nodes to visit" stack
     Uint32 stackSize = 0;
@@ -142,8 +354,9 @@ bool GenericTraverse_Shadow_Single(const SingleTraversalContext& context, const
             hitA &= (distanceA < context.hitPoint.distance);
             hitB &= (distanceB < context.hitPoint.distance);
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numTraversalSteps++;
             context.context.localCounters.numRayBoxTests += 2;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
             context.context.localCounters.numPassedRayBoxTests += hitA ? 1 : 0;
             context.context.localCounters.numPassedRayBoxTests += hitB ? 1 : 0;
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "HitPoint.h"
+#include "TraversalContext.h"
+#include "Math/Ray.h"
+#include "BVH/BVH.h"
+#include "BVH/WideBVH.h"
+#include "Rendering/Counters.h"
+#include "Rendering/Context.h"
+
+#include <type_traits>
+
+
+namespace rt {
+
+// ray data splatted for testing against all wide BVH node's children at once
+template<typename VectorType>
+struct RT_ALIGN(32) WideRay
+{
+    VectorType invDirX, invDirY, invDirZ;
+    VectorType originDivDirX, originDivDirY, originDivDirZ;
+
+    RT_FORCE_INLINE explicit WideRay(const math::Ray& ray)
+        : invDirX(ray.invDir.x), invDirY(ray.invDir.y), invDirZ(ray.invDir.z)
+        , originDivDirX(ray.originDivDir.x), originDivDirY(ray.originDivDir.y), originDivDirZ(ray.originDivDir.z)
+    { }
+};
+
+// intersect ray with all children of a wide BVH node
+// returns bit mask of hit children, outputs entry distances
+template<typename VectorType, typename NodeType>
+RT_FORCE_INLINE Uint32 Intersect_WideNodeRay(const WideRay<VectorType>& ray, const NodeType& node, const float maxDistance, VectorType& outDistances)
+{
+    // see Intersect_BoxRay
+    const VectorType t1x = VectorType::MulAndSub(VectorType(node.minX), ray.invDirX, ray.originDivDirX);
+    const VectorType t2x = VectorType::MulAndSub(VectorType(node.maxX), ray.invDirX, ray.originDivDirX);
+    const VectorType t1y = VectorType::MulAndSub(VectorType(node.minY), ray.invDirY, ray.originDivDirY);
+    const VectorType t2y = VectorType::MulAndSub(VectorType(node.maxY), ray.invDirY, ray.originDivDirY);
+    const VectorType t1z = VectorType::MulAndSub(VectorType(node.minZ), ray.invDirZ, ray.originDivDirZ);
+    const VectorType t2z = VectorType::MulAndSub(VectorType(node.maxZ), ray.invDirZ, ray.originDivDirZ);
+
+    const VectorType tNear = VectorType::Max(
+        VectorType::Max(VectorType::Min(t1x, t2x), VectorType::Min(t1y, t2y)),
+        VectorType::Max(VectorType::Min(t1z, t2z), VectorType::Zero()));
+
+    const VectorType tFar = VectorType::Min(
+        VectorType::Min(VectorType::Max(t1x, t2x), VectorType::Max(t1y, t2y)),
+        VectorType::Min(VectorType::Max(t1z, t2z), VectorType(maxDistance)));
+
+    // Note: unused child slots must be masked out explicitly, because the slab test of a box at infinity
+    // gives NaNs for axis-aligned rays (zero times infinity) and the NaNs may pass the distances comparison
+    const auto usedSlots = VectorType(node.minX) < VectorType(std::numeric_limits<float>::infinity());
+
+    outDistances = tNear;
+    return static_cast<Uint32>((usedSlots & (tNear <= tFar)).GetMask());
+}
+
+// single-ray traversal of multi-way BVH (children are visited in front-to-back order)
+template <typename ObjectType>
+void GenericTraverse_Wide_Single(const SingleTraversalContext& context, const Uint32 objectID, const ObjectType* object)
+{
+    using BVHType = typename std::decay<decltype(object->GetWideBVH())>::type;
+    using VectorType = typename BVHType::VectorType;
+    using NodeType = typename BVHType::Node;
+
+    const BVHType& bvh = object->GetWideBVH();
+    if (bvh.GetNumNodes() == 0)
+    {
+        // tree is empty
+        return;
+    }
+
+    struct StackEntry
+    {
+        Uint32 childIndex;
+        Uint32 numLeaves;
+        float distance;
+    };
+
+    const NodeType* __restrict nodes = bvh.GetNodes(context.context.numaNode);
+    const WideRay<VectorType> ray(context.ray);
+
+    // "nodes to visit" stack
+    Uint32 stackSize = 0;
+    StackEntry nodesStack[BVHType::StackSize];
+
+    VectorType distances;
+
+    // BVH traversal
+    for (StackEntry current = { 0, 0, 0.0f };;)
+    {
+        if (current.numLeaves)
+        {
+            BVH::Node leaf;
+            leaf.childIndex = current.childIndex;
+            leaf.numLeaves = current.numLeaves;
+            object->Traverse_Leaf_Single(context, objectID, leaf);
+        }
+        else
+        {
+            const NodeType& node = nodes[current.childIndex];
+            Uint32 hitMask = Intersect_WideNodeRay(ray, node, context.hitPoint.distance, distances);
+
+            context.context.localCounters.numTraversalSteps++;
+            context.context.localCounters.numRayBoxTests += BVHType::NumChildren;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+            context.context.localCounters.numPassedRayBoxTests += math::PopCount(hitMask);
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+            if (hitMask)
+            {
+                // push hit children and keep them sorted, so the closest one is on top
+                const Uint32 firstHit = stackSize;
+                while (hitMask)
+                {
+                    const Uint32 slot = math::FirstBitSet(hitMask);
+                    hitMask &= hitMask - 1;
+
+                    if (!node.IsChildLeaf(slot))
+                    {
+                        RT_PREFETCH_L1(nodes + node.childIndex[slot]);
+                    }
+
+                    const StackEntry entry = { node.childIndex[slot], node.numLeaves[slot], distances[slot] };
+
+                    Uint32 i = stackSize++;
+                    for (; i > firstHit && nodesStack[i - 1].distance < entry.distance; --i)
+                    {
+                        nodesStack[i] = nodesStack[i - 1];
+                    }
+                    nodesStack[i] = entry;
+                }
+
+                current = nodesStack[--stackSize];
+                continue;
+            }
+        }
+
+        // pop a node (skip the ones that are behind the closest hit found so far)
+        do
+        {
+            if (stackSize == 0)
+            {
+                return;
+            }
+
+            current = nodesStack[--stackSize];
+        }
+        while (current.distance > context.hitPoint.distance);
+    }
+}
+
+template <typename ObjectType>
+bool GenericTraverse_Wide_Shadow_Single(const SingleTraversalContext& context, const ObjectType* object)
+{
+    using BVHType = typename std::decay<decltype(object->GetWideBVH())>::type;
+    using VectorType = typename BVHType::VectorType;
+    using NodeType = typename BVHType::Node;
+
+    const BVHType& bvh = object->GetWideBVH();
+    if (bvh.GetNumNodes() == 0)
+    {
+        // tree is empty
+        return false;
+    }
+
+    const NodeType* __restrict nodes = bvh.GetNodes(context.context.numaNode);
+    const WideRay<VectorType> ray(context.ray);
+
+    // "nodes to visit" stack
+    Uint32 stackSize = 1;
+    Uint32 nodesStack[BVHType::StackSize];
+    nodesStack[0] = 0;
+
+    VectorType distances;
+
+    // BVH traversal
+    // Note: any hit is sufficient, so there is no need for ordering children
+    while (stackSize > 0)
+    {
+        const NodeType& node = nodes[nodesStack[--stackSize]];
+        Uint32 hitMask = Intersect_WideNodeRay(ray, node, context.hitPoint.distance, distances);
+
+        context.context.localCounters.numTraversalSteps++;
+        context.context.localCounters.numRayBoxTests += BVHType::NumChildren;
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
+        context.context.localCounters.numPassedRayBoxTests += math::PopCount(hitMask);
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
+
+        while (hitMask)
+        {
+            const Uint32 slot = math::FirstBitSet(hitMask);
+            hitMask &= hitMask - 1;
+
+            if (node.IsChildLeaf(slot))
+            {
+                BVH::Node leaf;
+                leaf.childIndex = node.childIndex[slot];
+                leaf.numLeaves = node.numLeaves[slot];
+                if (object->Traverse_Leaf_Shadow_Single(context, leaf))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                nodesStack[stackSize++] = node.childIndex[slot];
+            }
+        }
+    }
+
+    return false;
+}
+
+} // namespace rt
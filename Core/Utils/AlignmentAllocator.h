@@ -10,6 +10,12 @@ RT_INLINE void* AlignedMalloc(size_t size, size_t alignment)
 #if defined(WIN32)
     return _aligned_malloc(size, alignment);
 #elif defined(__LINUX__) | defined(__linux__)
+    // posix_memalign requires alignment to be a multiple of pointer size
+    if (alignment < sizeof(void*))
+    {
+        alignment = sizeof(void*);
+    }
+
     void* ptr = nullptr;
     posix_memalign(&ptr, alignment, size);
     return ptr;
@@ -0,0 +1,245 @@
+#include "PCH.h"
+#include "CpuTopology.h"
+#include "Logger.h"
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__LINUX__) | defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#endif // defined(WIN32)
+
+namespace rt {
+
+namespace {
+
+#if defined(__LINUX__) | defined(__linux__)
+
+const Uint32 MaxNumaNodes = 64;
+
+// parse list of CPUs in "0-3,8,10-11" format
+bool ParseCpuList(const char* str, DynArray<Uint32>& outCpus)
+{
+    while (*str)
+    {
+        char* end = nullptr;
+        const unsigned long first = strtoul(str, &end, 10);
+        if (end == str)
+        {
+            return false;
+        }
+
+        unsigned long last = first;
+        str = end;
+        if (*str == '-')
+        {
+            last = strtoul(str + 1, &end, 10);
+            if (end == str + 1 || last < first)
+            {
+                return false;
+            }
+            str = end;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+        {
+            outCpus.PushBack(static_cast<Uint32>(cpu));
+        }
+
+        while (*str == ',' || *str == '\n' || *str == ' ')
+        {
+            str++;
+        }
+    }
+
+    return true;
+}
+
+#endif // defined(__LINUX__) | defined(__linux__)
+
+} // namespace
+
+CpuTopology::CpuTopology()
+    : mNumCpus(0)
+{
+    if (!Init())
+    {
+        mNodes.Clear();
+    }
+
+    if (mNodes.Empty())
+    {
+        // fallback - single node
+        const Uint32 numCpus = std::max(1u, std::thread::hardware_concurrency());
+
+        DynArray<Uint32> cpus;
+        for (Uint32 i = 0; i < numCpus; ++i)
+        {
+            cpus.PushBack(i);
+        }
+        mNodes.PushBack(std::move(cpus));
+    }
+
+    mNumCpus = 0;
+    for (const DynArray<Uint32>& node : mNodes)
+    {
+        mNumCpus += node.Size();
+    }
+
+    RT_LOG_INFO("CPU topology: %u logical CPUs, %u NUMA nodes", mNumCpus, mNodes.Size());
+}
+
+bool CpuTopology::Init()
+{
+#if defined(WIN32)
+
+    ULONG highestNodeNumber = 0;
+    if (!::GetNumaHighestNodeNumber(&highestNodeNumber))
+    {
+        return false;
+    }
+
+    for (ULONG node = 0; node <= highestNodeNumber; ++node)
+    {
+        // Note: only the first processor group is supported
+        ULONGLONG mask = 0;
+        if (!::GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask) || mask == 0)
+        {
+            continue;
+        }
+
+        DynArray<Uint32> cpus;
+        for (Uint32 cpu = 0; cpu < 64; ++cpu)
+        {
+            if (mask & (1ull << cpu))
+            {
+                cpus.PushBack(cpu);
+            }
+        }
+        mNodes.PushBack(std::move(cpus));
+    }
+
+    return true;
+
+#elif defined(__LINUX__) | defined(__linux__)
+
+    for (Uint32 node = 0; node < MaxNumaNodes; ++node)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+
+        FILE* file = fopen(path, "r");
+        if (!file)
+        {
+            // Note: node IDs can be sparse
+            continue;
+        }
+
+        char buffer[4096];
+        const bool readSuccessfully = fgets(buffer, sizeof(buffer), file) != nullptr;
+        fclose(file);
+
+        DynArray<Uint32> cpus;
+        if (!readSuccessfully || !ParseCpuList(buffer, cpus))
+        {
+            RT_LOG_WARNING("Failed to parse '%s'", path);
+            return false;
+        }
+
+        // memory-only nodes have no CPUs
+        if (!cpus.Empty())
+        {
+            mNodes.PushBack(std::move(cpus));
+        }
+    }
+
+    return true;
+
+#else
+
+    return false;
+
+#endif // defined(WIN32)
+}
+
+const CpuTopology& CpuTopology::Get()
+{
+    static const CpuTopology topology;
+    return topology;
+}
+
+Uint32 CpuTopology::GetWorkerNode(Uint32 workerIndex, Uint32 numWorkers) const
+{
+    RT_ASSERT(workerIndex < numWorkers);
+
+    // with fewer workers than nodes, only the first 'numWorkers' nodes are used, so every used node gets a worker
+    const Uint32 numNodes = std::min(numWorkers, mNodes.Size());
+    return static_cast<Uint32>(static_cast<Uint64>(workerIndex) * numNodes / numWorkers);
+}
+
+Uint32 CpuTopology::GetWorkerCpu(Uint32 workerIndex, Uint32 numWorkers) const
+{
+    const Uint32 node = GetWorkerNode(workerIndex, numWorkers);
+
+    // index of the worker within its node
+    Uint32 firstNodeWorker = workerIndex;
+    while (firstNodeWorker > 0 && GetWorkerNode(firstNodeWorker - 1, numWorkers) == node)
+    {
+        firstNodeWorker--;
+    }
+
+    const DynArray<Uint32>& cpus = mNodes[node];
+    return cpus[(workerIndex - firstNodeWorker) % cpus.Size()];
+}
+
+bool CpuTopology::SetCurrentThreadAffinity(Uint32 cpu)
+{
+#if defined(WIN32)
+
+    if (cpu >= 64)
+    {
+        RT_LOG_WARNING("Setting thread affinity for CPU %u is not supported", cpu);
+        return false;
+    }
+
+    if (::SetThreadAffinityMask(::GetCurrentThread(), 1ull << cpu) == 0)
+    {
+        RT_LOG_WARNING("Failed to set thread affinity. Error code: %u", ::GetLastError());
+        return false;
+    }
+
+    return true;
+
+#elif defined(__LINUX__) | defined(__linux__)
+
+    if (cpu >= CPU_SETSIZE)
+    {
+        RT_LOG_WARNING("Setting thread affinity for CPU %u is not supported", cpu);
+        return false;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+
+    const int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+    if (result != 0)
+    {
+        RT_LOG_WARNING("Failed to set thread affinity. Error code: %i", result);
+        return false;
+    }
+
+    return true;
+
+#else
+
+    RT_UNUSED(cpu);
+    return false;
+
+#endif // defined(WIN32)
+}
+
+} // namespace rt
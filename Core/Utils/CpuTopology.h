@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../RayLib.h"
+#include "../Common.h"
+#include "../Containers/DynArray.h"
+
+namespace rt {
+
+/**
+ * NUMA topology of the machine: logical CPUs grouped by memory nodes.
+ * Falls back to a single node with all the logical CPUs if the topology can't be queried.
+ */
+class CpuTopology
+{
+public:
+    // get cached topology of the current machine
+    RAYLIB_API static const CpuTopology& Get();
+
+    RT_FORCE_INLINE Uint32 GetNumNodes() const { return mNodes.Size(); }
+    RT_FORCE_INLINE Uint32 GetNumCpus() const { return mNumCpus; }
+
+    // logical CPUs indices of a given node
+    RT_FORCE_INLINE const DynArray<Uint32>& GetNodeCpus(Uint32 node) const { return mNodes[node]; }
+
+    // Assign a logical CPU and a node to a worker thread. Workers are spread evenly across the nodes in
+    // contiguous ranges, i.e. for 4 workers on 2 nodes the workers 0, 1 go to node 0 and 2, 3 to node 1.
+    // If there are fewer workers than nodes, the workers occupy nodes 0 to numWorkers - 1 (one worker per node).
+    RAYLIB_API Uint32 GetWorkerNode(Uint32 workerIndex, Uint32 numWorkers) const;
+    RAYLIB_API Uint32 GetWorkerCpu(Uint32 workerIndex, Uint32 numWorkers) const;
+
+    // pin the calling thread to a logical CPU
+    RAYLIB_API static bool SetCurrentThreadAffinity(Uint32 cpu);
+
+private:
+    CpuTopology();
+
+    bool Init();
+
+    DynArray<DynArray<Uint32>> mNodes;
+    Uint32 mNumCpus;
+};
+
+} // namespace rt
@@ -0,0 +1,128 @@
+#include "PCH.h"
+#include "MemoryMappedFile.h"
+#include "Logger.h"
+
+#if defined(__LINUX__) | defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // defined(__LINUX__) | defined(__linux__)
+
+namespace rt {
+
+MemoryMappedFile::MemoryMappedFile()
+    : mData(nullptr)
+    , mSize(0)
+#if defined(WIN32)
+    , mFileHandle(INVALID_HANDLE_VALUE)
+    , mMappingHandle(NULL)
+#endif // defined(WIN32)
+{ }
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    Close();
+}
+
+bool MemoryMappedFile::Open(const std::string& filePath)
+{
+    Close();
+
+#if defined(WIN32)
+    mFileHandle = ::CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFileHandle == INVALID_HANDLE_VALUE)
+    {
+        RT_LOG_ERROR("Failed to open file '%s' for mapping. Error code: %u", filePath.c_str(), ::GetLastError());
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(mFileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        RT_LOG_ERROR("Failed to map file '%s': file is empty", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    mMappingHandle = ::CreateFileMappingA(mFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mMappingHandle == NULL)
+    {
+        RT_LOG_ERROR("Failed to create mapping of file '%s'. Error code: %u", filePath.c_str(), ::GetLastError());
+        Close();
+        return false;
+    }
+
+    mData = ::MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!mData)
+    {
+        RT_LOG_ERROR("Failed to map file '%s'. Error code: %u", filePath.c_str(), ::GetLastError());
+        Close();
+        return false;
+    }
+
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(__LINUX__) | defined(__linux__)
+    const int fileDescriptor = open(filePath.c_str(), O_RDONLY);
+    if (fileDescriptor == -1)
+    {
+        RT_LOG_ERROR("Failed to open file '%s' for mapping. Error code: %i", filePath.c_str(), errno);
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        RT_LOG_ERROR("Failed to map file '%s': file is empty", filePath.c_str());
+        close(fileDescriptor);
+        return false;
+    }
+
+    // Note: the mapping stays valid after closing the file descriptor
+    void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+
+    if (data == MAP_FAILED)
+    {
+        RT_LOG_ERROR("Failed to map file '%s'. Error code: %i", filePath.c_str(), errno);
+        return false;
+    }
+
+    mData = data;
+    mSize = static_cast<size_t>(fileStat.st_size);
+#endif // defined(WIN32)
+
+    return true;
+}
+
+void MemoryMappedFile::Close()
+{
+#if defined(WIN32)
+    if (mData)
+    {
+        ::UnmapViewOfFile(mData);
+    }
+
+    if (mMappingHandle != NULL)
+    {
+        ::CloseHandle(mMappingHandle);
+        mMappingHandle = NULL;
+    }
+
+    if (mFileHandle != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(mFileHandle);
+        mFileHandle = INVALID_HANDLE_VALUE;
+    }
+#elif defined(__LINUX__) | defined(__linux__)
+    if (mData)
+    {
+        munmap(const_cast<void*>(mData), mSize);
+    }
+#endif // defined(WIN32)
+
+    mData = nullptr;
+    mSize = 0;
+}
+
+} // namespace rt
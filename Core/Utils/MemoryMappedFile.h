@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../RayLib.h"
+
+#include <string>
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+namespace rt {
+
+/**
+ * Read-only memory mapped file.
+ */
+class RAYLIB_API MemoryMappedFile
+{
+public:
+    MemoryMappedFile();
+    ~MemoryMappedFile();
+
+    // map whole file into memory
+    bool Open(const std::string& filePath);
+
+    // unmap the file
+    void Close();
+
+    RT_FORCE_INLINE const void* GetData() const { return mData; }
+    RT_FORCE_INLINE size_t GetSize() const { return mSize; }
+
+private:
+    MemoryMappedFile(const MemoryMappedFile&) = delete;
+    MemoryMappedFile& operator = (const MemoryMappedFile&) = delete;
+
+    const void* mData;
+    size_t mSize;
+
+#if defined(WIN32)
+    HANDLE mFileHandle;
+    HANDLE mMappingHandle;
+#endif // defined(WIN32)
+};
+
+} // namespace rt
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../RayLib.h"
+#include "../Common.h"
+#include "../Containers/DynArray.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <algorithm>
+
+namespace rt {
+
+/**
+ * Copies of a read-only array, one per NUMA node of a thread pool (see RenderingParams::replicateSceneData).
+ * Each copy is allocated and filled by a worker of its node, so its pages are placed in the node's local memory (first touch).
+ * Note: the copies are not updated automatically, the owner must clear them whenever the source array changes.
+ */
+template<typename ElementType>
+class NumaReplicas
+{
+public:
+    // make a copy of 'num' elements for every node the thread pool spans
+    // Does nothing if the copies were already made for the same number of nodes.
+    // Note: can't be called from inside of a task (see ThreadPool::RunPerThreadTask)
+    bool Build(const ElementType* source, Uint32 num, ThreadPool& threadPool)
+    {
+        const Uint32 numNodes = threadPool.GetNumNodes();
+        if (num == 0 || mCopies.Size() == numNodes)
+        {
+            return true;
+        }
+
+        mCopies.Clear();
+        if (!mCopies.Resize(numNodes))
+        {
+            return false;
+        }
+
+        std::atomic<bool> success(true);
+        const auto copyCallback = [&](Uint32, Uint32 threadID)
+        {
+            // first worker of each node makes the node's copy
+            const Uint32 node = threadPool.GetThreadNode(threadID);
+            if (threadID > 0 && threadPool.GetThreadNode(threadID - 1) == node)
+            {
+                return;
+            }
+
+            DynArray<ElementType>& copy = mCopies[node];
+            if (!copy.Resize(num))
+            {
+                success = false;
+                return;
+            }
+            std::copy(source, source + num, copy.Data());
+        };
+        threadPool.RunPerThreadTask(copyCallback);
+
+        if (!success)
+        {
+            mCopies.Clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Clear()
+    {
+        mCopies.Clear(true);
+    }
+
+    // get the copy placed on a given node, falls back to the source array if there is no such copy
+    RT_FORCE_INLINE const ElementType* Get(Uint32 node, const ElementType* source) const
+    {
+        return node < mCopies.Size() ? mCopies[node].Data() : source;
+    }
+
+private:
+    DynArray<DynArray<ElementType>> mCopies;
+};
+
+} // namespace rt
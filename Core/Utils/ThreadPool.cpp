@@ -1,16 +1,154 @@
 #include "PCH.h"
 #include "ThreadPool.h"
+#include "AlignmentAllocator.h"
+#include "CpuTopology.h"
 
 
 namespace rt {
 
+namespace {
+
+// worker thread identity, used to detect nested RunParallelTask calls
+thread_local const void* tCurrentThreadPool = nullptr;
+thread_local Uint32 tCurrentWorkerIndex = 0;
+
+// number of unsuccessful attempts to find work before an idle worker goes to sleep
+const Uint32 MaxIdleSpins = 64;
+
+// number of ranges per worker a job is split into
+const Uint32 RangesPerWorker = 8;
+
+} // namespace
+
+// Chase-Lev work-stealing deque of a fixed capacity
+// The owner thread pushes and pops at the bottom, other threads steal from the top.
+// See "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al., 2013).
+class ThreadPool::TaskQueue
+{
+public:
+    static const Int64 Capacity = 256;
+
+    TaskQueue()
+        : mTop(0)
+        , mBottom(0)
+    {}
+
+    // owner only, returns false if the queue is full
+    bool Push(const TaskRange& range)
+    {
+        const Int64 bottom = mBottom.load(std::memory_order_relaxed);
+        const Int64 top = mTop.load(std::memory_order_acquire);
+        if (bottom - top >= Capacity)
+        {
+            return false;
+        }
+
+        Entry& entry = mEntries[bottom % Capacity];
+        entry.job.store(range.job, std::memory_order_relaxed);
+        entry.begin.store(range.begin, std::memory_order_relaxed);
+        entry.end.store(range.end, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // owner only
+    bool Pop(TaskRange& outRange)
+    {
+        const Int64 bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Int64 top = mTop.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            // empty
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        Load(bottom, outRange);
+
+        if (top == bottom)
+        {
+            // last entry - race with thieves
+            const bool success = mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return success;
+        }
+
+        return true;
+    }
+
+    // any thread
+    bool Steal(TaskRange& outRange)
+    {
+        Int64 top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const Int64 bottom = mBottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+        {
+            return false;
+        }
+
+        // Note: the entry can't be overwritten by the owner unless some other thread advances the top first
+        Load(top, outRange);
+        return mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<Job*> job;
+        std::atomic<Uint32> begin;
+        std::atomic<Uint32> end;
+    };
+
+    RT_FORCE_INLINE void Load(const Int64 index, TaskRange& outRange) const
+    {
+        const Entry& entry = mEntries[index % Capacity];
+        outRange.job = entry.job.load(std::memory_order_relaxed);
+        outRange.begin = entry.begin.load(std::memory_order_relaxed);
+        outRange.end = entry.end.load(std::memory_order_relaxed);
+    }
+
+    // Note: top is modified by thieves, bottom only by the owner - keep them in separate cache lines
+    RT_ALIGN(64) std::atomic<Int64> mTop;
+    RT_ALIGN(64) std::atomic<Int64> mBottom;
+    RT_ALIGN(64) Entry mEntries[Capacity];
+};
+
+struct RT_ALIGN(64) ThreadPool::Worker : public Aligned<64>
+{
+    TaskQueue queue;
+
+    // pending RunPerThreadTask call
+    std::atomic<Job*> perThreadJob;
+
+    // NUMA node and logical CPU the worker is pinned to
+    Uint32 node = 0;
+    Uint32 cpu = UINT32_MAX;
+
+    // for picking steal victims
+    Uint32 randomState = 0;
+
+    Worker()
+        : perThreadJob(nullptr)
+    {}
+};
+
 ThreadPool::ThreadPool()
-    : mNumTasks(0)
-    , mCurrentTask(0)
-    , mTasksLeft(0)
+    : mNumWorkers(0)
+    , mNumNodes(1)
+    , mPinThreads(false)
+    , mSharedQueueSize(0)
+    , mWakeUpEpoch(0)
+    , mNumSleepingWorkers(0)
     , mFinishThreads(true)
 {
-    StartWorkerThreads(std::thread::hardware_concurrency());
+    StartWorkerThreads(std::thread::hardware_concurrency(), false);
 }
 
 ThreadPool::~ThreadPool()
@@ -18,32 +156,66 @@ ThreadPool::~ThreadPool()
     StopWorkerThreads();
 }
 
-void ThreadPool::StartWorkerThreads(Uint32 num)
+void ThreadPool::StartWorkerThreads(Uint32 num, bool pinThreads)
 {
-    const Uint32 maxThreads = 256;
+    if (num > MaxNumThreads)
+    {
+        num = MaxNumThreads;
+    }
 
-    if (num > maxThreads)
+    if (num == 0)
     {
-        num = maxThreads;
+        num = 1;
     }
 
     RT_ASSERT(mFinishThreads == true);
     mFinishThreads = false;
 
+    mWorkers.reset(new Worker[num]);
+    mNumWorkers = num;
+    mNumNodes = 1;
+    mPinThreads = pinThreads;
+
+    const CpuTopology& topology = CpuTopology::Get();
+    if (pinThreads)
+    {
+        // Note: must match the nodes assigned by CpuTopology::GetWorkerNode, so every node has workers
+        mNumNodes = std::min(num, topology.GetNumNodes());
+    }
+
+    for (Uint32 i = 0; i < num; ++i)
+    {
+        Worker& worker = mWorkers[i];
+        worker.randomState = 2u * i + 1u;
+
+        if (pinThreads)
+        {
+            worker.node = topology.GetWorkerNode(i, num);
+            worker.cpu = topology.GetWorkerCpu(i, num);
+        }
+    }
+
     for (Uint32 i = 0; i < num; ++i)
     {
         mThreads.EmplaceBack(&ThreadPool::ThreadCallback, this, i);
     }
 }
 
+Uint32 ThreadPool::GetThreadNode(Uint32 threadID) const
+{
+    RT_ASSERT(threadID < mNumWorkers);
+    return mWorkers[threadID].node;
+}
+
 void ThreadPool::StopWorkerThreads()
 {
     RT_ASSERT(mFinishThreads == false);
-    mFinishThreads = true;
 
     {
         Lock lock(mMutex);
-        mNewTaskCV.notify_all();
+        mFinishThreads = true;
+        mWakeUpEpoch++;
+        mWakeUpCV.notify_all();
     }
 
     for (auto& thread : mThreads)
@@ -52,68 +224,291 @@ void ThreadPool::StopWorkerThreads()
     }
 
     mThreads.Clear();
+    mWorkers.reset();
+    mNumWorkers = 0;
+    mNumNodes = 1;
 }
 
-void ThreadPool::ThreadCallback(Uint32 threadID)
+void ThreadPool::WakeUpWorkers()
 {
-    for (;;)
+    // Note: sequentially consistent operations guarantee that either the notification is sent
+    // or a worker going to sleep sees the new epoch (see ThreadCallback)
+    mWakeUpEpoch++;
+
+    if (mNumSleepingWorkers > 0)
     {
-        Uint32 taskID;
+        Lock lock(mMutex);
+        mWakeUpCV.notify_all();
+    }
+}
 
+Uint32 ThreadPool::CalculateGrainSize(Uint32 numTasks) const
+{
+    return std::max(1u, numTasks / (RangesPerWorker * mNumWorkers));
+}
+
+bool ThreadPool::FindWork(Uint32 workerIndex, TaskRange& outRange)
+{
+    Worker& worker = mWorkers[workerIndex];
+
+    if (worker.perThreadJob.load(std::memory_order_relaxed) != nullptr)
+    {
+        Job* job = worker.perThreadJob.exchange(nullptr, std::memory_order_acquire);
+        if (job)
         {
-            Lock lock(mMutex);
-            while (!mFinishThreads && (mNumTasks == 0))
-            {
-                mNewTaskCV.wait(lock);
-            }
+            outRange = { job, workerIndex, workerIndex + 1 };
+            return true;
+        }
+    }
 
-            if (mFinishThreads)
-            {
-                break;
-            }
+    if (worker.queue.Pop(outRange))
+    {
+        return true;
+    }
+
+    if (PopSharedRange(worker.node, false, outRange))
+    {
+        return true;
+    }
 
-            taskID = mCurrentTask++;
+    if (StealRange(workerIndex, true, outRange))
+    {
+        return true;
+    }
 
-            // last task
-            if (mCurrentTask >= mNumTasks)
-            {
-                mNumTasks = 0;
-            }
+    // nothing to do on own node - help other nodes
+    if (mNumNodes > 1)
+    {
+        return PopSharedRange(worker.node, true, outRange) || StealRange(workerIndex, false, outRange);
+    }
+
+    return false;
+}
+
+bool ThreadPool::PopSharedRange(Uint32 node, bool anyNode, TaskRange& outRange)
+{
+    if (mSharedQueueSize.load(std::memory_order_relaxed) == 0)
+    {
+        return false;
+    }
+
+    Lock lock(mMutex);
+
+    for (Uint32 i = mSharedQueue.Size(); i-- > 0; )
+    {
+        if (anyNode || mSharedQueue[i].node == node)
+        {
+            outRange = mSharedQueue[i].range;
+            mSharedQueue[i] = mSharedQueue.Back();
+            mSharedQueue.PopBack();
+            mSharedQueueSize--;
+            return true;
         }
+    }
+
+    return false;
+}
+
+bool ThreadPool::StealRange(Uint32 workerIndex, bool sameNode, TaskRange& outRange)
+{
+    Worker& worker = mWorkers[workerIndex];
+
+    // start from a random victim, so the thieves don't fight over the same queue
+    const Uint32 numWorkers = GetNumThreads();
+    worker.randomState ^= worker.randomState << 13;
+    worker.randomState ^= worker.randomState >> 17;
+    worker.randomState ^= worker.randomState << 5;
+    const Uint32 firstVictim = worker.randomState % numWorkers;
+
+    for (Uint32 i = 0; i < numWorkers; ++i)
+    {
+        const Uint32 victim = (firstVictim + i) % numWorkers;
+        if (victim == workerIndex || (sameNode && mNumNodes > 1 && mWorkers[victim].node != worker.node))
+        {
+            continue;
+        }
+
+        if (mWorkers[victim].queue.Steal(outRange))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::ExecuteRange(Uint32 workerIndex, TaskRange range)
+{
+    Worker& worker = mWorkers[workerIndex];
+    Job* job = range.job;
+
+    // split the range lazily, the upper halves can be stolen by idle workers
+    while (range.end - range.begin > job->grainSize)
+    {
+        const Uint32 middle = range.begin + (range.end - range.begin) / 2;
+        if (!worker.queue.Push({ job, middle, range.end }))
+        {
+            // queue is full - execute the whole range
+            break;
+        }
+
+        range.end = middle;
+
+        if (mNumSleepingWorkers.load(std::memory_order_relaxed) > 0)
+        {
+            WakeUpWorkers();
+        }
+    }
+
+    for (Uint32 i = range.begin; i < range.end; ++i)
+    {
+        job->task(i, workerIndex);
+    }
+
+    // Note: the job must not be accessed after the last tasks are accounted (waiting thread may destroy it)
+    const bool external = job->external;
+    const Uint32 numTasks = range.end - range.begin;
+    if (job->numTasksLeft.fetch_sub(numTasks, std::memory_order_acq_rel) == numTasks && external)
+    {
+        Lock lock(mMutex);
+        mJobFinishedCV.notify_all();
+    }
+}
+
+void ThreadPool::ThreadCallback(Uint32 workerIndex)
+{
+    tCurrentThreadPool = this;
+    tCurrentWorkerIndex = workerIndex;
+
+    if (mWorkers[workerIndex].cpu != UINT32_MAX)
+    {
+        CpuTopology::SetCurrentThreadAffinity(mWorkers[workerIndex].cpu);
+    }
+
+    Uint32 numIdleSpins = 0;
 
-        mTask(taskID, threadID);
+    while (!mFinishThreads)
+    {
+        const Uint64 epoch = mWakeUpEpoch;
+
+        TaskRange range;
+        if (FindWork(workerIndex, range))
+        {
+            ExecuteRange(workerIndex, range);
+            numIdleSpins = 0;
+            continue;
+        }
 
-        if (--mTasksLeft == 0)
+        if (++numIdleSpins < MaxIdleSpins)
         {
-            mTileFinishedCV.notify_all();
+            std::this_thread::yield();
+            continue;
         }
+
+        numIdleSpins = 0;
+
+        Lock lock(mMutex);
+        mNumSleepingWorkers++;
+        mWakeUpCV.wait(lock, [this, epoch] { return mFinishThreads || mWakeUpEpoch != epoch; });
+        mNumSleepingWorkers--;
     }
+
+    tCurrentThreadPool = nullptr;
 }
 
-void ThreadPool::SetNumThreads(const Uint32 numThreads)
+void ThreadPool::SetNumThreads(const Uint32 numThreads, const bool pinThreads)
 {
-    if (numThreads != GetNumThreads())
+    if (numThreads != GetNumThreads() || pinThreads != mPinThreads)
     {
         StopWorkerThreads();
-        StartWorkerThreads(numThreads);
+        StartWorkerThreads(numThreads, pinThreads);
     }
 }
 
 void ThreadPool::RunParallelTask(const ParallelTask& task, Uint32 num)
 {
-    if (num > 0u)
+    if (num == 0u)
+    {
+        return;
+    }
+
+    if (tCurrentThreadPool == this)
+    {
+        // nested call from a worker thread - push the job to own queue and help executing tasks until it's done
+        const Uint32 workerIndex = tCurrentWorkerIndex;
+
+        Job job(task, num, CalculateGrainSize(num), false);
+        if (!mWorkers[workerIndex].queue.Push({ &job, 0, num }))
+        {
+            for (Uint32 i = 0; i < num; ++i)
+            {
+                task(i, workerIndex);
+            }
+            return;
+        }
+
+        WakeUpWorkers();
+
+        while (job.numTasksLeft.load(std::memory_order_acquire) > 0)
+        {
+            TaskRange range;
+            if (FindWork(workerIndex, range))
+            {
+                ExecuteRange(workerIndex, range);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        return;
+    }
+
+    Job job(task, num, CalculateGrainSize(num), true);
+
     {
         Lock lock(mMutex);
 
-        mTask = task;
-        mCurrentTask = 0;
-        mNumTasks = num;
-        mTasksLeft = num;
+        // each node gets a contiguous part of the range, so e.g. neighbouring image tiles are rendered on the same node
+        const Uint32 numParts = std::min(num, mNumNodes);
+        for (Uint32 i = 0; i < numParts; ++i)
+        {
+            const Uint32 begin = static_cast<Uint32>(static_cast<Uint64>(num) * i / numParts);
+            const Uint32 end = static_cast<Uint32>(static_cast<Uint64>(num) * (i + 1) / numParts);
+            mSharedQueue.PushBack({ { &job, begin, end }, i });
+        }
+        mSharedQueueSize += numParts;
+    }
+
+    WakeUpWorkers();
+
+    Lock lock(mMutex);
+    mJobFinishedCV.wait(lock, [&job] { return job.numTasksLeft.load(std::memory_order_acquire) == 0; });
+}
+
+void ThreadPool::RunPerThreadTask(const ParallelTask& task)
+{
+    RT_ASSERT(tCurrentThreadPool != this, "RunPerThreadTask can't be called from a worker thread");
 
-        mNewTaskCV.notify_all();
+    const Uint32 numWorkers = GetNumThreads();
+    Job job(task, numWorkers, 1, true);
 
-        mTileFinishedCV.wait(lock);
+    for (Uint32 i = 0; i < numWorkers; ++i)
+    {
+        // wait for other RunPerThreadTask call to be picked up by the worker
+        Job* expected = nullptr;
+        while (!mWorkers[i].perThreadJob.compare_exchange_weak(expected, &job, std::memory_order_release, std::memory_order_relaxed))
+        {
+            expected = nullptr;
+            std::this_thread::yield();
+        }
     }
+
+    WakeUpWorkers();
+
+    Lock lock(mMutex);
+    mJobFinishedCV.wait(lock, [&job] { return job.numTasksLeft.load(std::memory_order_acquire) == 0; });
 }
 
 } // namespace rt
@@ -1,9 +1,9 @@
 #pragma once
 
+#include "../RayLib.h"
 #include "../Common.h"
 #include "../Containers/DynArray.h"
 
-#include <functional>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
@@ -11,50 +11,149 @@
 
 namespace rt {
 
-using ParallelTask = std::function<void(Uint32 taskID, Uint32 threadID)>;
-
-class ThreadPool
+// Non-owning reference to a callable object with "void(Uint32 taskID, Uint32 threadID)" signature
+// Note: nothing is copied nor allocated, the callable must outlive the ThreadPool::RunParallelTask call
+class ParallelTask
 {
 public:
-    struct TaskCoords
+    template<typename CallableType>
+    RT_FORCE_INLINE ParallelTask(const CallableType& callable)
+        : mCallable(&callable)
+        , mInvoke(&Invoke<CallableType>)
+    {}
+
+    RT_FORCE_INLINE void operator()(Uint32 taskID, Uint32 threadID) const
     {
-        Uint32 x;
-        Uint32 y;
-    };
+        mInvoke(mCallable, taskID, threadID);
+    }
+
+private:
+    template<typename CallableType>
+    static void Invoke(const void* callable, Uint32 taskID, Uint32 threadID)
+    {
+        (*static_cast<const CallableType*>(callable))(taskID, threadID);
+    }
+
+    const void* mCallable;
+    void (*mInvoke)(const void*, Uint32, Uint32);
+};
+
+// Work-stealing task scheduler
+// Each worker thread owns a deque of task ranges. A range is split lazily: the upper half is pushed to the deque
+// (where it can be stolen by idle workers) and the lower half is executed. Tasks are claimed with atomic operations only,
+// the mutex is taken once per RunParallelTask call (and when putting idle workers to sleep).
+// Optionally, the workers can be pinned to logical CPUs (spread evenly across NUMA nodes). Each node then gets
+// a contiguous part of the tasks range of every job and workers steal tasks from their own node first.
+class RAYLIB_API ThreadPool
+{
+public:
+    // upper limit for number of worker threads, larger requests are clamped
+    constexpr static Uint32 MaxNumThreads = 256;
 
     ThreadPool();
     ~ThreadPool();
 
-    void SetNumThreads(const Uint32 numThreads);
+    void SetNumThreads(const Uint32 numThreads, const bool pinThreads = false);
 
+    // execute 'num' tasks in parallel and wait for all of them to finish
+    // Can be called from inside of a task (nested parallelism, e.g. parallel BVH build) - the calling worker
+    // thread executes pending tasks while waiting, so the pool never deadlocks.
+    // Note: for that reason per-thread data (indexed by thread ID) must not be kept across nested calls.
     void RunParallelTask(const ParallelTask& task, Uint32 num);
 
+    // execute the task exactly once on every worker thread (task ID is equal to thread ID) and wait for it
+    // Useful for initializing per-thread data on the thread's NUMA node (first-touch allocation).
+    // Note: can't be called from inside of a task
+    void RunPerThreadTask(const ParallelTask& task);
+
     RT_FORCE_INLINE Uint32 GetNumThreads() const
     {
-        return mThreads.Size();
+        return mNumWorkers;
     }
 
+    // number of NUMA nodes the workers are spread across (1 if the threads are not pinned)
+    RT_FORCE_INLINE Uint32 GetNumNodes() const
+    {
+        return mNumNodes;
+    }
+
+    // NUMA node of a worker thread (always 0 if the threads are not pinned)
+    // Note: workers of a node have contiguous thread IDs, nodes go in increasing order
+    Uint32 GetThreadNode(Uint32 threadID) const;
+
 private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
 
-    void StartWorkerThreads(Uint32 num);
-    void StopWorkerThreads();
+    // single RunParallelTask call
+    struct Job
+    {
+        ParallelTask task;
+        std::atomic<Uint32> numTasksLeft;
+        Uint32 grainSize; // ranges are not split below this size
+        bool external; // submitted by non-worker thread, which waits for mJobFinishedCV
+
+        Job(const ParallelTask& task, Uint32 numTasks, Uint32 grainSize, bool external)
+            : task(task), numTasksLeft(numTasks), grainSize(grainSize), external(external)
+        {}
+    };
+
+    // range of tasks [begin, end) of a job
+    struct TaskRange
+    {
+        Job* job;
+        Uint32 begin;
+        Uint32 end;
+    };
+
+    // part of a job submitted by external thread, preferably executed by the workers of a given node
+    struct SharedTaskRange
+    {
+        TaskRange range;
+        Uint32 node;
+    };
+
+    class TaskQueue;
+    struct Worker;
 
     using Lock = std::unique_lock<std::mutex>;
 
+    void StartWorkerThreads(Uint32 num, bool pinThreads);
+    void StopWorkerThreads();
+
+    void ThreadCallback(Uint32 workerIndex);
+
+    // get a range from own deque, shared queue or steal it from other worker (workers of the same node first)
+    bool FindWork(Uint32 workerIndex, TaskRange& outRange);
+    bool PopSharedRange(Uint32 node, bool anyNode, TaskRange& outRange);
+    bool StealRange(Uint32 workerIndex, bool sameNode, TaskRange& outRange);
+
+    void ExecuteRange(Uint32 workerIndex, TaskRange range);
+
+    void WakeUpWorkers();
+
+    // a few ranges per worker are enough for load balancing, further splitting adds only overhead
+    Uint32 CalculateGrainSize(Uint32 numTasks) const;
+
     DynArray<std::thread> mThreads;
-    std::condition_variable mNewTaskCV;
-    std::condition_variable mTileFinishedCV;
-    std::mutex mMutex;
+    std::unique_ptr<Worker[]> mWorkers;
+    Uint32 mNumWorkers;
+    Uint32 mNumNodes;
+    bool mPinThreads;
 
-    ParallelTask mTask;
-    Uint32 mNumTasks;
-    Uint32 mCurrentTask;
+    std::mutex mMutex;
+    std::condition_variable mWakeUpCV;
+    std::condition_variable mJobFinishedCV;
 
-    std::atomic<Uint32> mTasksLeft;
+    // ranges submitted by external (non-worker) threads (guarded by mMutex)
+    DynArray<SharedTaskRange> mSharedQueue;
+    std::atomic<Uint32> mSharedQueueSize;
 
-    bool mFinishThreads;
+    // incremented when new work is submitted, so idle workers don't miss it while going to sleep
+    std::atomic<Uint64> mWakeUpEpoch;
+    std::atomic<Uint32> mNumSleepingWorkers;
 
-    void ThreadCallback(Uint32 id);
+    std::atomic<bool> mFinishThreads;
 };
 
 } // namespace rt
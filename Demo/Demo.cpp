@@ -294,7 +294,8 @@ void DemoWindow::OnMouseDown(MouseButton button, int x, int y)
                 mScene->ExtractShadingData(ray, hitPoint, renderingContext->time, shadingData);
 
                 mSelectedMaterial = const_cast<Material*>(shadingData.material);
-                mSelectedObject = const_cast<ISceneObject*>(mScene->GetObjects()[hitPoint.objectId].get());
+                // Note: mesh instances are not selectable as scene objects
+                mSelectedObject = (hitPoint.objectId & RT_INSTANCE_OBJECT_FLAG) ? nullptr : const_cast<ISceneObject*>(mScene->GetObjects()[hitPoint.objectId].get());
                 mSelectedLight = nullptr;
             }
         }
@@ -45,22 +45,60 @@ void DemoWindow::RenderUI_Stats()
     ImGui::Text("Delta time"); ImGui::NextColumn();
     ImGui::Text("%.2f ms", 1000.0 * mDeltaTime); ImGui::NextColumn();
 
-#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     const RayTracingCounters& counters = mViewport->GetCounters();
     ImGui::Separator();
+    ImGui::Text("Rays"); ImGui::NextColumn();
+    ImGui::Text("%.2fM", (float)counters.numRays / 1000000.0f); ImGui::NextColumn();
+
+    ImGui::Text("Shadow rays"); ImGui::NextColumn();
+    ImGui::Text("%.2fM", (float)counters.numShadowRays / 1000000.0f); ImGui::NextColumn();
+
+    ImGui::Text("Traversal steps per ray"); ImGui::NextColumn();
+    ImGui::Text("%.2f", (float)counters.numTraversalSteps / (float)std::max<Uint64>(1, counters.numRays + counters.numShadowRays)); ImGui::NextColumn();
+
     ImGui::Text("Ray-box tests (total)"); ImGui::NextColumn();
     ImGui::Text("%.2fM", (float)counters.numRayBoxTests / 1000000.0f); ImGui::NextColumn();
 
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     ImGui::Text("Ray-box tests (passed)"); ImGui::NextColumn();
     ImGui::Text("%.2fM", (float)counters.numPassedRayBoxTests / 1000000.0f); ImGui::NextColumn();
+#endif // RT_ENABLE_INTERSECTION_COUNTERS
 
     ImGui::Text("Ray-tri tests (total)"); ImGui::NextColumn();
     ImGui::Text("%.2fM", (float)counters.numRayTriangleTests / 1000000.0f); ImGui::NextColumn();
 
+#ifdef RT_ENABLE_INTERSECTION_COUNTERS
     ImGui::Text("Ray-tri tests (passed)"); ImGui::NextColumn();
     ImGui::Text("%.2fM", (float)counters.numPassedRayTriangleTests / 1000000.0f); ImGui::NextColumn();
 #endif // RT_ENABLE_INTERSECTION_COUNTERS
 
+    const FrameStats& frameStats = mViewport->GetFrameStats();
+    const char* stageNames[NumRenderingStages] = { "Pre-render", "Pre-render global", "Render", "Post-process" };
+    ImGui::Separator();
+    for (Uint32 i = 0; i < NumRenderingStages; ++i)
+    {
+        const RenderingStageStats& stageStats = frameStats.stages[i];
+        if (stageStats.wallTime > 0.0)
+        {
+            const double totalTime = stageStats.wallTime * std::max(1u, frameStats.numThreads);
+            ImGui::Text("%s (idle)", stageNames[i]); ImGui::NextColumn();
+            ImGui::Text("%.2f ms (%.1f%%)", 1000.0 * stageStats.wallTime, 100.0 * stageStats.idleTime / totalTime); ImGui::NextColumn();
+        }
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Pass time (std. dev.)"); ImGui::NextColumn();
+    ImGui::Text("%.2f ms (%.2f ms)", 1000.0 * frameStats.passTime.average, 1000.0 * std::sqrt(frameStats.passTime.variance)); ImGui::NextColumn();
+
+    ImGui::Text("Pass time (95th, max)"); ImGui::NextColumn();
+    ImGui::Text("%.2f ms, %.2f ms", 1000.0 * frameStats.passTime.percentile95, 1000.0 * frameStats.passTime.max); ImGui::NextColumn();
+
+    if (frameStats.tileTime.numSamples > 0)
+    {
+        ImGui::Text("Tile time (95th, max)"); ImGui::NextColumn();
+        ImGui::Text("%.2f ms, %.2f ms", 1000.0 * frameStats.tileTime.percentile95, 1000.0 * frameStats.tileTime.max); ImGui::NextColumn();
+    }
+
     ImGui::Columns(1);
 }
 
@@ -300,6 +338,8 @@ bool DemoWindow::RenderUI_Settings_Rendering()
     {
         Uint32 maxThreads = std::thread::hardware_concurrency();
         ImGui::SliderInt("Threads", (int*)&mRenderingParams.numThreads, 1, 2 * maxThreads);
+        ImGui::Checkbox("Pin threads to CPUs", &mRenderingParams.pinThreads);
+        ImGui::Checkbox("Replicate scene per NUMA node", &mRenderingParams.replicateSceneData);
     }
 
     // renderer selection
@@ -384,7 +424,7 @@ bool DemoWindow::RenderUI_Settings_Rendering()
     int traversalModeIndex = static_cast<int>(mRenderingParams.traversalMode);
     int tileOrder = static_cast<int>(mRenderingParams.tileSize);
 
-    const char* traversalModeItems[] = { "Single", "Packet" };
+    const char* traversalModeItems[] = { "Single", "Packet", "Stream", "SIMD-8" };
     resetFrame |= ImGui::Combo("Traversal mode", &traversalModeIndex, traversalModeItems, IM_ARRAYSIZE(traversalModeItems));
 
     ImGui::SliderInt("Tile size", (int*)&tileOrder, 1, 1024);
@@ -394,6 +434,7 @@ bool DemoWindow::RenderUI_Settings_Rendering()
     resetFrame |= ImGui::SliderInt("Russian roulette depth", (int*)&mRenderingParams.minRussianRouletteDepth, 1, 64);
     resetFrame |= ImGui::SliderFloat("Antialiasing spread", &mRenderingParams.antiAliasingSpread, 0.0f, 3.0f);
     resetFrame |= ImGui::SliderFloat("Motion blur strength", &mRenderingParams.motionBlurStrength, 0.0f, 1.0f);
+    ImGui::Checkbox("Collect ray statistics", &mRenderingParams.collectRayStats);
 
     mRenderingParams.traversalMode = static_cast<TraversalMode>(traversalModeIndex);
     mRenderingParams.tileSize = static_cast<Uint16>(tileOrder);
@@ -4,8 +4,12 @@
 #include "../Core/Utils/Logger.h"
 #include "../Core/Utils/Bitmap.h"
 #include "../Core/Utils/Timer.h"
+#include "../Core/Utils/ThreadPool.h"
+#include "../Core/Mesh/MeshCache.h"
 #include "../Core/Math/Geometry.h"
 
+#include <sys/stat.h>
+
 namespace helpers {
 
 using namespace rt;
@@ -76,6 +80,119 @@ MaterialPtr LoadMaterial(const std::string& baseDir, const tinyobj::material_t&
     return material;
 }
 
+// calculate key identifying source mesh file and loading parameters
+// Note: the content is not hashed (reading the whole file would defeat much of the cache speedup),
+// file size and modification time are assumed to change whenever the content does
+// returns zero if the file can't be accessed
+Uint64 CalculateMeshSourceKey(const std::string& filePath, const float scale)
+{
+#if defined(WIN32)
+    struct _stat64 fileStat;
+    if (_stat64(filePath.c_str(), &fileStat) != 0)
+#elif defined(__LINUX__) | defined(__linux__)
+    struct stat fileStat;
+    if (stat(filePath.c_str(), &fileStat) != 0)
+#endif // defined(WIN32)
+    {
+        return 0;
+    }
+
+    Uint32 scaleBits;
+    memcpy(&scaleBits, &scale, sizeof(scaleBits));
+
+    Uint64 key = Hash(static_cast<Uint64>(std::hash<std::string>()(filePath)));
+    key = Hash(key ^ static_cast<Uint64>(fileStat.st_mtime));
+    key = Hash(key ^ static_cast<Uint64>(fileStat.st_size));
+    key = Hash(key ^ static_cast<Uint64>(scaleBits));
+    return key;
+}
+
+// materials description stored in the mesh cache file (only the properties used by LoadMaterial)
+class MaterialsSerializer
+{
+public:
+    static void Write(const std::vector<tinyobj::material_t>& materials, std::vector<Uint8>& outData)
+    {
+        WriteValue(static_cast<Uint32>(materials.size()), outData);
+        for (const tinyobj::material_t& material : materials)
+        {
+            WriteString(material.name, outData);
+            WriteValue(material.diffuse, outData);
+            WriteValue(material.emission, outData);
+            WriteString(material.diffuse_texname, outData);
+            WriteString(material.normal_texname, outData);
+            WriteString(material.alpha_texname, outData);
+        }
+    }
+
+    static bool Read(const ArrayView<const Uint8>& data, std::vector<tinyobj::material_t>& outMaterials)
+    {
+        size_t offset = 0;
+
+        Uint32 numMaterials = 0;
+        if (!ReadValue(data, offset, numMaterials))
+        {
+            return false;
+        }
+
+        outMaterials.resize(numMaterials);
+        for (tinyobj::material_t& material : outMaterials)
+        {
+            if (!ReadString(data, offset, material.name) ||
+                !ReadValue(data, offset, material.diffuse) ||
+                !ReadValue(data, offset, material.emission) ||
+                !ReadString(data, offset, material.diffuse_texname) ||
+                !ReadString(data, offset, material.normal_texname) ||
+                !ReadString(data, offset, material.alpha_texname))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    template<typename T>
+    static void WriteValue(const T& value, std::vector<Uint8>& outData)
+    {
+        const Uint8* bytes = reinterpret_cast<const Uint8*>(&value);
+        outData.insert(outData.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void WriteString(const std::string& str, std::vector<Uint8>& outData)
+    {
+        WriteValue(static_cast<Uint32>(str.size()), outData);
+        outData.insert(outData.end(), str.begin(), str.end());
+    }
+
+    template<typename T>
+    static bool ReadValue(const ArrayView<const Uint8>& data, size_t& offset, T& outValue)
+    {
+        if (offset + sizeof(T) > data.Size())
+        {
+            return false;
+        }
+
+        memcpy(&outValue, data.Data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    static bool ReadString(const ArrayView<const Uint8>& data, size_t& offset, std::string& outStr)
+    {
+        Uint32 length = 0;
+        if (!ReadValue(data, offset, length) || offset + length > data.Size())
+        {
+            return false;
+        }
+
+        outStr.assign(reinterpret_cast<const char*>(data.Data() + offset), length);
+        offset += length;
+        return true;
+    }
+};
+
 MaterialPtr CreateDefaultMaterial(MaterialsMap& outMaterials)
 {
     auto material = MaterialPtr(new Material);
@@ -100,6 +217,57 @@ public:
     {
     }
 
+    static std::string GetCacheFilePath(const std::string& filePath)
+    {
+        return filePath + ".cache";
+    }
+
+    // try to load mesh from the cache file
+    // returns nullptr if there is no valid cache
+    MeshPtr LoadFromCache(const std::string& filePath, MaterialsMap& outMaterials, const float scale)
+    {
+        Timer timer;
+
+        mFilePath = filePath;
+        mSourceKey = CalculateMeshSourceKey(filePath, scale);
+        if (mSourceKey == 0)
+        {
+            return nullptr;
+        }
+
+        MeshDesc meshDesc;
+        meshDesc.path = filePath;
+
+        auto cache = std::make_shared<MeshCache>();
+        if (!cache->Open(GetCacheFilePath(filePath), meshDesc, mSourceKey))
+        {
+            return nullptr;
+        }
+
+        if (!MaterialsSerializer::Read(cache->GetUserData(), mSourceMaterials))
+        {
+            RT_LOG_ERROR("Corrupted materials description in mesh cache file '%s'", GetCacheFilePath(filePath).c_str());
+            mSourceMaterials.clear();
+            return nullptr;
+        }
+
+        LoadMaterials(filePath, outMaterials);
+
+        meshDesc.vertexBufferDesc.numMaterials = static_cast<Uint32>(mMaterialPointers.size());
+        meshDesc.vertexBufferDesc.materials = mMaterialPointers.data();
+
+        MeshPtr mesh = MeshPtr(new Mesh);
+        if (!mesh->InitializeFromCache(cache, meshDesc))
+        {
+            mSourceMaterials.clear();
+            mMaterialPointers.clear();
+            return nullptr;
+        }
+
+        RT_LOG_INFO("Mesh file '%s' loaded from cache in %.3f ms", filePath.c_str(), 1000.0 * timer.Stop());
+        return mesh;
+    }
+
     bool LoadMesh(const std::string& filePath, MaterialsMap& outMaterials, const float scale)
     {
         RT_LOG_DEBUG("Loading mesh file: '%s'...", filePath.c_str());
@@ -237,22 +405,12 @@ public:
 
         ComputeTangentVectors();
 
-        // load materials
-        mMaterialPointers.reserve(materials.size());
-        for (size_t i = 0; i < materials.size(); i++)
-        {
-            auto material = LoadMaterial(meshBaseDir, materials[i]);
-            mMaterialPointers.push_back(material);
-            outMaterials[material->debugName] = material;
-        }
+        mSourceMaterials = std::move(materials);
+        LoadMaterials(filePath, outMaterials);
 
         // fallback to default material
-        if (materials.empty())
+        if (mSourceMaterials.empty())
         {
-            RT_LOG_WARNING("No materials found in mesh '%s'. Falling back to the default material.", filePath.c_str());
-
-            mMaterialPointers.push_back(CreateDefaultMaterial(outMaterials));
-
             for (Uint32& index : mMaterialIndices)
             {
                 index = 0;
@@ -265,6 +423,27 @@ public:
         return true;
     }
 
+    void LoadMaterials(const std::string& filePath, MaterialsMap& outMaterials)
+    {
+        const std::string meshBaseDir = filePath.substr(0, filePath.find_last_of("\\/")) + "/";
+
+        mMaterialPointers.reserve(mSourceMaterials.size());
+        for (size_t i = 0; i < mSourceMaterials.size(); i++)
+        {
+            auto material = LoadMaterial(meshBaseDir, mSourceMaterials[i]);
+            mMaterialPointers.push_back(material);
+            outMaterials[material->debugName] = material;
+        }
+
+        // fallback to default material
+        if (mSourceMaterials.empty())
+        {
+            RT_LOG_WARNING("No materials found in mesh '%s'. Falling back to the default material.", filePath.c_str());
+
+            mMaterialPointers.push_back(CreateDefaultMaterial(outMaterials));
+        }
+    }
+
     void ComputeTangentVectors()
     {
         mVertexTangents.resize(mVertexNormals.size());
@@ -373,18 +552,32 @@ public:
         meshDesc.vertexBufferDesc.tangents = mVertexTangents.data();
         meshDesc.vertexBufferDesc.texCoords = mVertexTexCoords.data();
 
+        ThreadPool threadPool;
+
         MeshPtr mesh = MeshPtr(new Mesh);
-        bool result = mesh->Initialize(meshDesc);
+        bool result = mesh->Initialize(meshDesc, &threadPool);
         if (!result)
         {
             return nullptr;
         }
 
+        // store processed mesh, so next time it can be loaded instantly
+        if (mSourceKey != 0)
+        {
+            std::vector<Uint8> materialsData;
+            MaterialsSerializer::Write(mSourceMaterials, materialsData);
+
+            const ArrayView<const Uint8> userData(materialsData.data(), static_cast<Uint32>(materialsData.size()));
+            MeshCache::Save(GetCacheFilePath(mFilePath), *mesh, meshDesc, mSourceKey, userData);
+        }
+
         return mesh;
     }
 
 private:
     std::string mFilePath;
+    Uint64 mSourceKey = 0;
+    std::vector<tinyobj::material_t> mSourceMaterials;
 
     std::vector<Uint32> mVertexIndices;
     std::vector<Uint32> mMaterialIndices;
@@ -399,6 +592,12 @@ private:
 rt::MeshPtr LoadMesh(const std::string& filePath, MaterialsMap& outMaterials, const float scale)
 {
     MeshLoader loader;
+
+    if (MeshPtr mesh = loader.LoadFromCache(filePath, outMaterials, scale))
+    {
+        return mesh;
+    }
+
     if (!loader.LoadMesh(filePath, outMaterials, scale))
     {
         return nullptr;
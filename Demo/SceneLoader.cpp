@@ -3,6 +3,7 @@
 #include "MeshLoader.h"
 
 #include "../Core/Utils/Logger.h"
+#include "../Core/Math/Random.h"
 #include "../Core/Scene/Light/PointLight.h"
 #include "../Core/Scene/Light/AreaLight.h"
 #include "../Core/Scene/Light/BackgroundLight.h"
@@ -10,6 +11,7 @@
 #include "../Core/Scene/Light/SphereLight.h"
 #include "../Core/Scene/Object/SceneObject_Mesh.h"
 #include "../Core/Scene/Object/SceneObject_Sphere.h"
+#include "../Core/Scene/Object/SceneObject_SphereCloud.h"
 #include "../Core/Scene/Object/SceneObject_Box.h"
 #include "../Core/Scene/Object/SceneObject_Plane.h"
 
@@ -376,6 +378,70 @@ static bool ParseLight(const rapidjson::Value& value, Scene& scene)
     return true;
 }
 
+// Sphere cloud is described either by explicit list of spheres ("spheres": [[x, y, z, radius], ...])
+// or randomly scattered spheres ("count", "size" of the box they're placed in and "radius" range)
+static bool ParseSphereCloud(const rapidjson::Value& value, DynArray<Float3>& outCenters, DynArray<float>& outRadii)
+{
+    if (value.HasMember("spheres"))
+    {
+        const rapidjson::Value& spheres = value["spheres"];
+        if (!spheres.IsArray())
+        {
+            RT_LOG_ERROR("Property 'spheres' must be an array");
+            return false;
+        }
+
+        for (rapidjson::SizeType i = 0; i < spheres.Size(); ++i)
+        {
+            const rapidjson::Value& sphere = spheres[i];
+            if (!sphere.IsArray() || sphere.Size() != 4)
+            {
+                RT_LOG_ERROR("Sphere description must be an array of 4 floats (center and radius)");
+                return false;
+            }
+
+            outCenters.PushBack(Float3(sphere[0].GetFloat(), sphere[1].GetFloat(), sphere[2].GetFloat()));
+            outRadii.PushBack(sphere[3].GetFloat());
+        }
+
+        return true;
+    }
+
+    if (!value.HasMember("count") || !value["count"].IsUint())
+    {
+        RT_LOG_ERROR("Sphere cloud requires 'spheres' array or 'count' of random spheres");
+        return false;
+    }
+
+    Vector4 size(1.0f);
+    if (!TryParseVector3(value, "size", true, size))
+    {
+        return false;
+    }
+
+    Vector4 radius(0.01f, 0.01f, 0.0f, 0.0f);
+    if (!TryParseVector2(value, "radius", true, radius))
+    {
+        return false;
+    }
+
+    const Uint32 count = value["count"].GetUint();
+    if (!outCenters.Reserve(count) || !outRadii.Reserve(count))
+    {
+        RT_LOG_ERROR("Memory allocation failed");
+        return false;
+    }
+
+    Random random;
+    for (Uint32 i = 0; i < count; ++i)
+    {
+        outCenters.PushBack((size * (random.GetVector4() - Vector4(0.5f))).ToFloat3());
+        outRadii.PushBack(Lerp(radius.x, radius.y, random.GetFloat()));
+    }
+
+    return true;
+}
+
 static bool ParseObject(const rapidjson::Value& value, Scene& scene, MaterialsMap& materials)
 {
     if (!value.IsObject())
@@ -404,6 +470,23 @@ static bool ParseObject(const rapidjson::Value& value, Scene& scene, MaterialsMa
 
         sceneObject = std::make_unique<SphereSceneObject>(radius);
     }
+    else if (typeStr == "sphereCloud")
+    {
+        DynArray<Float3> centers;
+        DynArray<float> radii;
+        if (!ParseSphereCloud(value, centers, radii))
+        {
+            return false;
+        }
+
+        auto sphereCloud = std::make_unique<SphereCloudSceneObject>();
+        if (!sphereCloud->Initialize(centers.Data(), radii.Data(), centers.Size()))
+        {
+            return false;
+        }
+
+        sceneObject = std::move(sphereCloud);
+    }
     else if (typeStr == "box")
     {
         Vector4 size;
@@ -452,8 +535,6 @@ static bool ParseObject(const rapidjson::Value& value, Scene& scene, MaterialsMa
         return false;
     }
 
-    // TODO velocity
-
     MaterialPtr material;
     if (!TryParseMaterialName(materials, value, "material", material))
         return false;
@@ -464,6 +545,17 @@ static bool ParseObject(const rapidjson::Value& value, Scene& scene, MaterialsMa
         return false;
     sceneObject->SetTransform(transform.ToMatrix4());
 
+    Vector4 linearVelocity = Vector4::Zero();
+    if (!TryParseVector3(value, "linearVelocity", true, linearVelocity))
+        return false;
+    sceneObject->SetLinearVelocity(linearVelocity);
+
+    // angular velocity is given as Euler angles of rotation over the frame time
+    Vector4 angularVelocity = Vector4::Zero();
+    if (!TryParseVector3(value, "angularVelocity", true, angularVelocity))
+        return false;
+    sceneObject->SetAngularVelocity(Quaternion::FromEulerAngles(angularVelocity.ToFloat3()));
+
     scene.AddObject(std::move(sceneObject));
     return true;
 }
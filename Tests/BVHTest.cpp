@@ -0,0 +1,942 @@
+#include "PCH.h"
+#include "../Core/BVH/BVHBuilder.h"
+#include "../Core/BVH/BVHOptimizer.h"
+#include "../Core/BVH/WideBVH.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Traversal/Traversal_Single.h"
+#include "../Core/Traversal/Traversal_Wide.h"
+#include "../Core/Math/Random.h"
+#include "../Core/Math/Triangle.h"
+#include "../Core/Utils/ThreadPool.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+DynArray<Box> GenerateRandomBoxes(Uint32 num)
+{
+    Random random;
+
+    // BVH nodes store only XYZ coordinates
+    const Vector4 mask = Vector4::MakeMask<1,1,1,0>();
+
+    DynArray<Box> boxes;
+    boxes.Reserve(num);
+    for (Uint32 i = 0; i < num; ++i)
+    {
+        const Vector4 center = (random.GetVector4() * 100.0f) & mask;
+        const Vector4 size = (random.GetVector4() * 2.0f) & mask;
+        boxes.PushBack(Box(center - size, center + size));
+    }
+
+    return boxes;
+}
+
+bool BoxContains(const Box& outer, const Box& inner)
+{
+    return (outer.min <= inner.min).All() && (outer.max >= inner.max).All();
+}
+
+// check if every leaf is referenced exactly once and all the boxes are properly nested
+void ValidateBVH(const BVH& bvh, const DynArray<Box>& boxes, const BVHBuilder::Indices& leavesOrder, Uint32 maxLeafNodeSize)
+{
+    ASSERT_EQ(boxes.Size(), leavesOrder.Size());
+
+    DynArray<Uint32> leafReferences(boxes.Size(), 0u);
+    for (const Uint32 leafIndex : leavesOrder)
+    {
+        ASSERT_LT(leafIndex, boxes.Size());
+        leafReferences[leafIndex]++;
+    }
+
+    for (const Uint32 numReferences : leafReferences)
+    {
+        EXPECT_EQ(1u, numReferences);
+    }
+
+    Uint32 numVisitedLeaves = 0;
+
+    DynArray<Uint32> nodesStack;
+    nodesStack.PushBack(0);
+    while (!nodesStack.Empty())
+    {
+        const BVH::Node& node = bvh.GetNodes()[nodesStack.Back()];
+        nodesStack.PopBack();
+
+        const Box nodeBox = node.GetBox();
+
+        if (node.IsLeaf())
+        {
+            EXPECT_LE(node.numLeaves, maxLeafNodeSize);
+            ASSERT_LE(node.childIndex + node.numLeaves, leavesOrder.Size());
+
+            for (Uint32 i = 0; i < node.numLeaves; ++i)
+            {
+                EXPECT_TRUE(BoxContains(nodeBox, boxes[leavesOrder[node.childIndex + i]]));
+            }
+
+            numVisitedLeaves += node.numLeaves;
+        }
+        else
+        {
+            ASSERT_LT(node.childIndex + 1, bvh.GetNumNodes());
+            EXPECT_EQ(0u, node.childIndex % 2);
+            EXPECT_TRUE(BoxContains(nodeBox, bvh.GetNodes()[node.childIndex].GetBox()));
+            EXPECT_TRUE(BoxContains(nodeBox, bvh.GetNodes()[node.childIndex + 1].GetBox()));
+
+            nodesStack.PushBack(node.childIndex);
+            nodesStack.PushBack(node.childIndex + 1);
+        }
+    }
+
+    EXPECT_EQ(boxes.Size(), numVisitedLeaves);
+}
+
+// minimal traversable object: set of boxes
+template<Uint32 Width>
+class BoxesObject
+{
+public:
+    BoxesObject(Uint32 numBoxes)
+        : mBoxes(GenerateRandomBoxes(numBoxes))
+    {
+        BVHBuilder::Indices leavesOrder;
+        BVHBuilder builder(mBVH);
+        builder.Build(mBoxes.Data(), mBoxes.Size(), BVHBuilder::BuildingParams(), leavesOrder);
+        mWideBVH.Build(mBVH);
+
+        DynArray<Box> sortedBoxes;
+        for (const Uint32 index : leavesOrder)
+        {
+            sortedBoxes.PushBack(mBoxes[index]);
+        }
+        mBoxes = std::move(sortedBoxes);
+    }
+
+    const BVH& GetBVH() const { return mBVH; }
+    BVH& GetBVH() { return mBVH; }
+    const WideBVH<Width>& GetWideBVH() const { return mWideBVH; }
+    const DynArray<Box>& GetBoxes() const { return mBoxes; }
+
+    // Note: boxes containing the ray origin are ignored, so the result does not depend on traversal order
+    void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+    {
+        float distance;
+        for (Uint32 i = 0; i < node.numLeaves; ++i)
+        {
+            if (Intersect_BoxRay(context.ray, mBoxes[node.childIndex + i], distance) && distance > 0.0f && distance < context.hitPoint.distance)
+            {
+                context.hitPoint.Set(distance, objectID, node.childIndex + i);
+            }
+        }
+    }
+
+    bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const
+    {
+        float distance;
+        for (Uint32 i = 0; i < node.numLeaves; ++i)
+        {
+            if (Intersect_BoxRay(context.ray, mBoxes[node.childIndex + i], distance) && distance > 0.0f && distance < context.hitPoint.distance)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    DynArray<Box> mBoxes;
+    BVH mBVH;
+    WideBVH<Width> mWideBVH;
+};
+
+template<Uint32 Width>
+void ValidateWideBVH(const WideBVH<Width>& wideBvh, Uint32 numLeaves)
+{
+    using NodeType = typename WideBVH<Width>::Node;
+
+    DynArray<Uint32> leafReferences(numLeaves, 0u);
+    DynArray<Uint32> nodeReferences(wideBvh.GetNumNodes(), 0u);
+    nodeReferences[0] = 1;
+
+    for (Uint32 nodeIndex = 0; nodeIndex < wideBvh.GetNumNodes(); ++nodeIndex)
+    {
+        const NodeType& node = wideBvh.GetNodes()[nodeIndex];
+        for (Uint32 i = 0; i < Width; ++i)
+        {
+            if (node.minX[i] == std::numeric_limits<float>::infinity())
+            {
+                continue; // unused slot
+            }
+
+            EXPECT_LE(node.minX[i], node.maxX[i]);
+            EXPECT_LE(node.minY[i], node.maxY[i]);
+            EXPECT_LE(node.minZ[i], node.maxZ[i]);
+
+            if (node.IsChildLeaf(i))
+            {
+                for (Uint32 j = 0; j < node.numLeaves[i]; ++j)
+                {
+                    ASSERT_LT(node.childIndex[i] + j, numLeaves);
+                    leafReferences[node.childIndex[i] + j]++;
+                }
+            }
+            else
+            {
+                ASSERT_LT(node.childIndex[i], wideBvh.GetNumNodes());
+                EXPECT_GT(node.childIndex[i], nodeIndex);
+                nodeReferences[node.childIndex[i]]++;
+
+                // child node's boxes must be contained in the parent's slot
+                const NodeType& child = wideBvh.GetNodes()[node.childIndex[i]];
+                for (Uint32 j = 0; j < Width; ++j)
+                {
+                    if (child.minX[j] != std::numeric_limits<float>::infinity())
+                    {
+                        EXPECT_LE(node.minX[i], child.minX[j]);
+                        EXPECT_GE(node.maxZ[i], child.maxZ[j]);
+                    }
+                }
+            }
+        }
+    }
+
+    for (const Uint32 numReferences : leafReferences)
+    {
+        EXPECT_EQ(1u, numReferences);
+    }
+
+    for (const Uint32 numReferences : nodeReferences)
+    {
+        EXPECT_EQ(1u, numReferences);
+    }
+}
+
+template<Uint32 Width>
+void TestWideBVHTraversal()
+{
+    const BoxesObject<Width> object(5000);
+    ValidateWideBVH(object.GetWideBVH(), object.GetBoxes().Size());
+
+    // wide tree should be much shallower
+    EXPECT_LT(object.GetWideBVH().GetNumNodes(), object.GetBVH().GetNumNodes() / (Width - 1));
+
+    RenderingContext renderingContext;
+    Random random;
+    Uint32 numHits = 0;
+
+    for (Uint32 i = 0; i < 2000; ++i)
+    {
+        Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + (random.GetVector4() * 200.0f & Vector4::MakeMask<1,1,1,0>());
+        const Vector4 target = (random.GetVector4() * 100.0f) & Vector4::MakeMask<1,1,1,0>();
+        Vector4 dir = target - origin;
+
+        // axis-aligned rays produce NaNs in the slab test (zero times infinity)
+        if (i % 8 == 0)
+        {
+            origin = Vector4(-50.0f, origin.y, origin.z, 0.0f);
+            dir = Vector4(1.0f, 0.0f, 0.0f, 0.0f);
+        }
+
+        const Ray ray(origin, dir);
+
+        HitPoint binaryHitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ ray, binaryHitPoint, renderingContext }, 0, &object);
+
+        HitPoint wideHitPoint;
+        GenericTraverse_Wide_Single(SingleTraversalContext{ ray, wideHitPoint, renderingContext }, 0, &object);
+
+        ASSERT_EQ(binaryHitPoint.objectId, wideHitPoint.objectId);
+        ASSERT_EQ(binaryHitPoint.distance, wideHitPoint.distance);
+        if (binaryHitPoint.objectId != RT_INVALID_OBJECT)
+        {
+            ASSERT_EQ(binaryHitPoint.subObjectId, wideHitPoint.subObjectId);
+        }
+        numHits += binaryHitPoint.objectId != RT_INVALID_OBJECT ? 1 : 0;
+
+        HitPoint binaryShadowHitPoint;
+        binaryShadowHitPoint.distance = 50.0f;
+        HitPoint wideShadowHitPoint;
+        wideShadowHitPoint.distance = 50.0f;
+
+        const bool binaryShadow = GenericTraverse_Shadow_Single(SingleTraversalContext{ ray, binaryShadowHitPoint, renderingContext }, &object);
+        const bool wideShadow = GenericTraverse_Wide_Shadow_Single(SingleTraversalContext{ ray, wideShadowHitPoint, renderingContext }, &object);
+        ASSERT_EQ(binaryShadow, wideShadow);
+    }
+
+    EXPECT_GT(numHits, 1000u);
+}
+
+// random triangles, every 10th one is long and thin (good case for spatial splits)
+DynArray<Triangle> GenerateRandomTriangles(Uint32 num)
+{
+    Random random;
+
+    const Vector4 mask = Vector4::MakeMask<1,1,1,0>();
+
+    DynArray<Triangle> triangles;
+    triangles.Reserve(num);
+    for (Uint32 i = 0; i < num; ++i)
+    {
+        const float size = i % 10 == 0 ? 50.0f : 2.0f;
+        const Vector4 v0 = (random.GetVector4() * 100.0f) & mask;
+        const Vector4 v1 = v0 + ((random.GetVector4() * size) & mask);
+        const Vector4 v2 = v0 + ((random.GetVector4() * 2.0f) & mask);
+        triangles.PushBack(Triangle(v0, v1, v2));
+    }
+
+    return triangles;
+}
+
+// minimal traversable object: triangle soup
+class TrianglesObject
+{
+public:
+    TrianglesObject(const DynArray<Triangle>& triangles, const BVHBuilder::BuildingParams& params)
+    {
+        DynArray<Box> boxes;
+        for (const Triangle& tri : triangles)
+        {
+            boxes.PushBack(Box(tri.v0, tri.v1, tri.v2));
+        }
+
+        BVHBuilder builder(mBVH);
+        builder.Build(boxes.Data(), boxes.Size(), params, mLeavesOrder);
+
+        for (const Uint32 index : mLeavesOrder)
+        {
+            mTriangles.PushBack(triangles[index]);
+        }
+    }
+
+    const BVH& GetBVH() const { return mBVH; }
+    const BVHBuilder::Indices& GetLeavesOrder() const { return mLeavesOrder; }
+
+    void Traverse_Leaf_Single(const SingleTraversalContext& context, const Uint32 objectID, const BVH::Node& node) const
+    {
+        float distance, u, v;
+        for (Uint32 i = 0; i < node.numLeaves; ++i)
+        {
+            const Triangle& tri = mTriangles[node.childIndex + i];
+            if (Intersect_TriangleRay(context.ray, tri.v0, tri.v1 - tri.v0, tri.v2 - tri.v0, u, v, distance) && distance < context.hitPoint.distance)
+            {
+                context.hitPoint.Set(distance, objectID, mLeavesOrder[node.childIndex + i]);
+            }
+        }
+    }
+
+    bool Traverse_Leaf_Shadow_Single(const SingleTraversalContext& context, const BVH::Node& node) const
+    {
+        float distance, u, v;
+        for (Uint32 i = 0; i < node.numLeaves; ++i)
+        {
+            const Triangle& tri = mTriangles[node.childIndex + i];
+            if (Intersect_TriangleRay(context.ray, tri.v0, tri.v1 - tri.v0, tri.v2 - tri.v0, u, v, distance) && distance < context.hitPoint.distance)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    DynArray<Triangle> mTriangles;
+    BVHBuilder::Indices mLeavesOrder;
+    BVH mBVH;
+};
+
+} // namespace
+
+TEST(BVH, Build_Empty)
+{
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(nullptr, 0, BVHBuilder::BuildingParams(), leavesOrder));
+
+    EXPECT_EQ(0u, bvh.GetNumNodes());
+    EXPECT_TRUE(leavesOrder.Empty());
+}
+
+TEST(BVH, Build_SingleLeaf)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(1);
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+
+    ASSERT_EQ(2u, bvh.GetNumNodes());
+    EXPECT_TRUE(bvh.GetNodes()[0].IsLeaf());
+    ValidateBVH(bvh, boxes, leavesOrder, 1);
+}
+
+TEST(BVH, Build_Sweep)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(2000);
+
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Sweep;
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, leavesOrder));
+
+    ValidateBVH(bvh, boxes, leavesOrder, params.maxLeafNodeSize);
+}
+
+TEST(BVH, Build_Binned)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(2000);
+
+    for (const Uint32 numBins : { 2u, 16u, 32u })
+    {
+        SCOPED_TRACE("numBins=" + std::to_string(numBins));
+
+        BVHBuilder::BuildingParams params;
+        params.splitMode = BVHBuilder::SplitMode::Binned;
+        params.numBins = numBins;
+
+        BVH bvh;
+        BVHBuilder::Indices leavesOrder;
+
+        BVHBuilder builder(bvh);
+        ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, leavesOrder));
+
+        ValidateBVH(bvh, boxes, leavesOrder, params.maxLeafNodeSize);
+    }
+}
+
+TEST(BVH, Build_Binned_DegenerateInput)
+{
+    // all the boxes in the same place - binning can't find any split
+    DynArray<Box> boxes;
+    for (Uint32 i = 0; i < 100; ++i)
+    {
+        boxes.PushBack(Box(Vector4(-1.0f, -1.0f, -1.0f, 0.0f), Vector4(1.0f, 1.0f, 1.0f, 0.0f)));
+    }
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+
+    ValidateBVH(bvh, boxes, leavesOrder, 2);
+
+    BVH::Stats stats;
+    bvh.CalculateStats(stats);
+    EXPECT_LE(stats.maxDepth, 8u);
+}
+
+TEST(BVH, Build_Parallel)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(50000);
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    for (const BVHBuilder::SplitMode splitMode : { BVHBuilder::SplitMode::Sweep, BVHBuilder::SplitMode::Binned })
+    {
+        BVHBuilder::BuildingParams params;
+        params.splitMode = splitMode;
+
+        BVH referenceBvh;
+        BVHBuilder::Indices referenceLeavesOrder;
+        {
+            // no thread pool, input size below threshold - single task
+            params.threadPool = nullptr;
+            BVHBuilder builder(referenceBvh);
+            ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, referenceLeavesOrder));
+        }
+
+        BVH bvh;
+        BVHBuilder::Indices leavesOrder;
+        {
+            params.threadPool = &threadPool;
+            BVHBuilder builder(bvh);
+            ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, leavesOrder));
+        }
+
+        ValidateBVH(bvh, boxes, leavesOrder, params.maxLeafNodeSize);
+
+        // parallel build must not affect tree quality
+        EXPECT_NEAR(referenceBvh.CalculateSAHCost(), bvh.CalculateSAHCost(), 0.001f * referenceBvh.CalculateSAHCost());
+    }
+}
+
+TEST(BVH, WideBVH_SingleLeaf)
+{
+    const BoxesObject<4> object(1);
+    ASSERT_EQ(1u, object.GetWideBVH().GetNumNodes());
+    ValidateWideBVH(object.GetWideBVH(), 1);
+}
+
+TEST(BVH, WideBVH4_Traversal)
+{
+    TestWideBVHTraversal<4>();
+}
+
+TEST(BVH, WideBVH8_Traversal)
+{
+    TestWideBVHTraversal<8>();
+}
+
+TEST(BVH, Quantized_Conservative)
+{
+    BoxesObject<4> object(5000);
+    BVH& bvh = object.GetBVH();
+    ASSERT_TRUE(bvh.SetNodeFormat(BVH::NodeFormat::Quantized));
+    ASSERT_EQ(BVH::NodeFormat::Quantized, bvh.GetNodeFormat());
+
+    // decode all the boxes top-down and compare with full precision ones
+    struct Entry
+    {
+        Uint32 nodeIndex;
+        Box parentBox;
+    };
+
+    DynArray<Entry> stack;
+    stack.PushBack({ 0, bvh.GetRootBox() });
+
+    Uint32 numVisitedNodes = 0;
+    double fullArea = 0.0, quantizedArea = 0.0;
+
+    while (!stack.Empty())
+    {
+        const Entry entry = stack.Back();
+        stack.PopBack();
+
+        const BVH::Node& node = bvh.GetNodes()[entry.nodeIndex];
+        const BVH::QuantizedNode& quantizedNode = bvh.GetQuantizedNodes()[entry.nodeIndex];
+        const Box decodedBox = quantizedNode.DecodeBox(entry.parentBox);
+
+        EXPECT_TRUE(BoxContains(decodedBox, node.GetBox()));
+        EXPECT_EQ(node.childIndex, quantizedNode.childIndex);
+        EXPECT_EQ(node.numLeaves, quantizedNode.numLeaves);
+
+        fullArea += node.GetBox().SurfaceArea();
+        quantizedArea += decodedBox.SurfaceArea();
+        numVisitedNodes++;
+
+        if (!node.IsLeaf())
+        {
+            stack.PushBack({ node.childIndex, decodedBox });
+            stack.PushBack({ node.childIndex + 1, decodedBox });
+        }
+    }
+
+    EXPECT_EQ(bvh.GetNumNodes() - 1, numVisitedNodes);
+
+    // quantization should not loosen the boxes too much
+    EXPECT_LT(quantizedArea, 1.1 * fullArea);
+}
+
+TEST(BVH, Quantized_Traversal)
+{
+    BoxesObject<4> object(5000);
+
+    RenderingContext renderingContext;
+    Random random;
+
+    DynArray<Ray> rays;
+    DynArray<HitPoint> referenceHitPoints;
+    for (Uint32 i = 0; i < 2000; ++i)
+    {
+        const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + (random.GetVector4() * 200.0f & Vector4::MakeMask<1,1,1,0>());
+        const Vector4 target = (random.GetVector4() * 100.0f) & Vector4::MakeMask<1,1,1,0>();
+        rays.PushBack(Ray(origin, target - origin));
+
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ rays.Back(), hitPoint, renderingContext }, 0, &object);
+        referenceHitPoints.PushBack(hitPoint);
+    }
+
+    ASSERT_TRUE(object.GetBVH().SetNodeFormat(BVH::NodeFormat::Quantized));
+
+    for (Uint32 i = 0; i < rays.Size(); ++i)
+    {
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ rays[i], hitPoint, renderingContext }, 0, &object);
+
+        ASSERT_EQ(referenceHitPoints[i].objectId, hitPoint.objectId);
+        ASSERT_EQ(referenceHitPoints[i].distance, hitPoint.distance);
+        if (hitPoint.objectId != RT_INVALID_OBJECT)
+        {
+            ASSERT_EQ(referenceHitPoints[i].subObjectId, hitPoint.subObjectId);
+        }
+
+        HitPoint shadowHitPoint;
+        shadowHitPoint.distance = referenceHitPoints[i].distance + 1.0f;
+        const bool shadowHit = GenericTraverse_Shadow_Single(SingleTraversalContext{ rays[i], shadowHitPoint, renderingContext }, &object);
+        ASSERT_EQ(referenceHitPoints[i].objectId != RT_INVALID_OBJECT, shadowHit);
+    }
+}
+
+TEST(BVH, Quantized_SaveLoad)
+{
+    BoxesObject<4> object(1000);
+    const BVH& bvh = object.GetBVH();
+    ASSERT_TRUE(object.GetBVH().SetNodeFormat(BVH::NodeFormat::Quantized));
+
+    const std::string filePath = "bvh_test.bvh";
+    ASSERT_TRUE(bvh.SaveToFile(filePath));
+
+    BVH loadedBvh;
+    ASSERT_TRUE(loadedBvh.LoadFromFile(filePath));
+    std::remove(filePath.c_str());
+
+    ASSERT_EQ(bvh.GetNumNodes(), loadedBvh.GetNumNodes());
+    ASSERT_EQ(BVH::NodeFormat::Quantized, loadedBvh.GetNodeFormat());
+    EXPECT_EQ(0, memcmp(bvh.GetNodes(), loadedBvh.GetNodes(), sizeof(BVH::Node) * bvh.GetNumNodes()));
+    EXPECT_EQ(0, memcmp(bvh.GetQuantizedNodes(), loadedBvh.GetQuantizedNodes(), sizeof(BVH::QuantizedNode) * bvh.GetNumNodes()));
+}
+
+TEST(BVH, Build_Spatial)
+{
+    const DynArray<Triangle> triangles = GenerateRandomTriangles(2000);
+
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Spatial;
+    params.triangles = triangles.Data();
+    params.maxDuplicationRatio = 0.3f;
+
+    const TrianglesObject object(triangles, params);
+    const BVH& bvh = object.GetBVH();
+    const BVHBuilder::Indices& leavesOrder = object.GetLeavesOrder();
+
+    // every triangle must be referenced at least once, duplicates must fit in the budget
+    EXPECT_GT(leavesOrder.Size(), triangles.Size());
+    EXPECT_LE(leavesOrder.Size(), triangles.Size() + static_cast<Uint32>(0.3f * triangles.Size()));
+
+    DynArray<Uint32> leafReferences(triangles.Size(), 0u);
+    for (const Uint32 leafIndex : leavesOrder)
+    {
+        ASSERT_LT(leafIndex, triangles.Size());
+        leafReferences[leafIndex]++;
+    }
+
+    for (const Uint32 numReferences : leafReferences)
+    {
+        EXPECT_LE(1u, numReferences);
+    }
+
+    Uint32 numVisitedLeaves = 0;
+
+    DynArray<Uint32> nodesStack;
+    nodesStack.PushBack(0);
+    while (!nodesStack.Empty())
+    {
+        const BVH::Node& node = bvh.GetNodes()[nodesStack.Back()];
+        nodesStack.PopBack();
+
+        const Box nodeBox = node.GetBox();
+
+        if (node.IsLeaf())
+        {
+            ASSERT_LE(node.childIndex + node.numLeaves, leavesOrder.Size());
+
+            // leaf box may contain only a clipped part of the triangle
+            for (Uint32 i = 0; i < node.numLeaves; ++i)
+            {
+                const Triangle& tri = triangles[leavesOrder[node.childIndex + i]];
+                EXPECT_TRUE(Box::Intersection(nodeBox, Box(tri.v0, tri.v1, tri.v2)).IsValid());
+            }
+
+            numVisitedLeaves += node.numLeaves;
+        }
+        else
+        {
+            ASSERT_LT(node.childIndex + 1, bvh.GetNumNodes());
+            EXPECT_EQ(0u, node.childIndex % 2);
+            EXPECT_TRUE(BoxContains(nodeBox, bvh.GetNodes()[node.childIndex].GetBox()));
+            EXPECT_TRUE(BoxContains(nodeBox, bvh.GetNodes()[node.childIndex + 1].GetBox()));
+
+            nodesStack.PushBack(node.childIndex);
+            nodesStack.PushBack(node.childIndex + 1);
+        }
+    }
+
+    EXPECT_EQ(leavesOrder.Size(), numVisitedLeaves);
+
+    // spatial splits should produce tighter tree than plain object splits
+    BVHBuilder::BuildingParams binnedParams;
+    binnedParams.splitMode = BVHBuilder::SplitMode::Binned;
+    const TrianglesObject binnedObject(triangles, binnedParams);
+    EXPECT_LT(bvh.CalculateSAHCost(), binnedObject.GetBVH().CalculateSAHCost());
+}
+
+TEST(BVH, Build_Spatial_NoDuplicationBudget)
+{
+    const DynArray<Triangle> triangles = GenerateRandomTriangles(1000);
+
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Spatial;
+    params.triangles = triangles.Data();
+    params.maxDuplicationRatio = 0.0f;
+
+    const TrianglesObject object(triangles, params);
+    EXPECT_EQ(triangles.Size(), object.GetLeavesOrder().Size());
+}
+
+TEST(BVH, Build_Spatial_Traversal)
+{
+    const DynArray<Triangle> triangles = GenerateRandomTriangles(2000);
+
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Spatial;
+    params.triangles = triangles.Data();
+
+    const TrianglesObject object(triangles, params);
+
+    RenderingContext renderingContext;
+    Random random;
+    Uint32 numHits = 0;
+
+    for (Uint32 i = 0; i < 2000; ++i)
+    {
+        const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + (random.GetVector4() * 200.0f & Vector4::MakeMask<1,1,1,0>());
+        const Vector4 target = (random.GetVector4() * 100.0f) & Vector4::MakeMask<1,1,1,0>();
+        const Ray ray(origin, target - origin);
+
+        // brute force reference
+        float referenceDistance = FLT_MAX;
+        Uint32 referenceTriangle = UINT32_MAX;
+        for (Uint32 j = 0; j < triangles.Size(); ++j)
+        {
+            const Triangle& tri = triangles[j];
+            float distance, u, v;
+            if (Intersect_TriangleRay(ray, tri.v0, tri.v1 - tri.v0, tri.v2 - tri.v0, u, v, distance) && distance < referenceDistance)
+            {
+                referenceDistance = distance;
+                referenceTriangle = j;
+            }
+        }
+
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, renderingContext }, 0, &object);
+
+        if (referenceTriangle == UINT32_MAX)
+        {
+            ASSERT_EQ(RT_INVALID_OBJECT, hitPoint.objectId);
+            continue;
+        }
+
+        ASSERT_EQ(0u, hitPoint.objectId);
+        ASSERT_EQ(referenceDistance, hitPoint.distance);
+        ASSERT_EQ(referenceTriangle, hitPoint.subObjectId);
+        numHits++;
+
+        HitPoint shadowHitPoint;
+        shadowHitPoint.distance = referenceDistance + 1.0f;
+        ASSERT_TRUE(GenericTraverse_Shadow_Single(SingleTraversalContext{ ray, shadowHitPoint, renderingContext }, &object));
+    }
+
+    EXPECT_GT(numHits, 100u);
+}
+
+TEST(BVH, Build_Spatial_NoTriangles)
+{
+    // spatial mode without geometry falls back to object splits
+    const DynArray<Box> boxes = GenerateRandomBoxes(1000);
+
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Spatial;
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, leavesOrder));
+
+    ValidateBVH(bvh, boxes, leavesOrder, params.maxLeafNodeSize);
+}
+
+TEST(BVH, Optimize)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(5000);
+
+    // low quality initial tree
+    BVHBuilder::BuildingParams params;
+    params.splitMode = BVHBuilder::SplitMode::Binned;
+    params.numBins = 2;
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), params, leavesOrder));
+
+    BVH::Stats initialStats;
+    bvh.CalculateStats(initialStats);
+    EXPECT_EQ(bvh.CalculateSAHCost(), initialStats.sahCost);
+
+    BVHOptimizer optimizer(bvh);
+    ASSERT_TRUE(optimizer.Optimize(BVHOptimizer::OptimizationParams()));
+
+    ValidateBVH(bvh, boxes, leavesOrder, params.maxLeafNodeSize);
+
+    BVH::Stats stats;
+    bvh.CalculateStats(stats);
+    EXPECT_LT(stats.sahCost, initialStats.sahCost);
+}
+
+TEST(BVH, Optimize_Parallel)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(20000);
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    BVH referenceBvh;
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+    {
+        BVHBuilder builder(referenceBvh);
+        ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+    }
+    {
+        BVHBuilder builder(bvh);
+        ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+    }
+
+    BVHOptimizer::OptimizationParams optimizationParams;
+    {
+        BVHOptimizer optimizer(referenceBvh);
+        ASSERT_TRUE(optimizer.Optimize(optimizationParams));
+    }
+    {
+        optimizationParams.threadPool = &threadPool;
+        BVHOptimizer optimizer(bvh);
+        ASSERT_TRUE(optimizer.Optimize(optimizationParams));
+    }
+
+    ValidateBVH(bvh, boxes, leavesOrder, 2);
+
+    // treelets are always processed bottom-up, so the result must not depend on threads scheduling
+    // Note: node 1 is never used
+    ASSERT_EQ(referenceBvh.GetNumNodes(), bvh.GetNumNodes());
+    for (Uint32 i = 2; i < bvh.GetNumNodes(); ++i)
+    {
+        const BVH::Node& referenceNode = referenceBvh.GetNodes()[i];
+        const BVH::Node& node = bvh.GetNodes()[i];
+        ASSERT_EQ(referenceNode.childIndex, node.childIndex);
+        ASSERT_EQ(referenceNode.numLeaves, node.numLeaves);
+        ASSERT_TRUE((referenceNode.GetBox().min == node.GetBox().min).All());
+        ASSERT_TRUE((referenceNode.GetBox().max == node.GetBox().max).All());
+    }
+}
+
+TEST(BVH, Optimize_TimeBudget)
+{
+    const DynArray<Box> boxes = GenerateRandomBoxes(5000);
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+
+    const float initialCost = bvh.CalculateSAHCost();
+
+    // the pass is interrupted almost immediately, but the tree must stay valid
+    BVHOptimizer::OptimizationParams optimizationParams;
+    optimizationParams.maxIterations = 100;
+    optimizationParams.timeBudget = 1.0e-6f;
+
+    BVHOptimizer optimizer(bvh);
+    ASSERT_TRUE(optimizer.Optimize(optimizationParams));
+
+    ValidateBVH(bvh, boxes, leavesOrder, 2);
+    EXPECT_LE(bvh.CalculateSAHCost(), initialCost);
+}
+
+TEST(BVH, Optimize_Traversal)
+{
+    BoxesObject<4> object(5000);
+
+    RenderingContext renderingContext;
+    Random random;
+
+    DynArray<Ray> rays;
+    DynArray<HitPoint> referenceHitPoints;
+    for (Uint32 i = 0; i < 2000; ++i)
+    {
+        const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + (random.GetVector4() * 200.0f & Vector4::MakeMask<1,1,1,0>());
+        const Vector4 target = (random.GetVector4() * 100.0f) & Vector4::MakeMask<1,1,1,0>();
+        rays.PushBack(Ray(origin, target - origin));
+
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ rays.Back(), hitPoint, renderingContext }, 0, &object);
+        referenceHitPoints.PushBack(hitPoint);
+    }
+
+    // node format must be preserved
+    ASSERT_TRUE(object.GetBVH().SetNodeFormat(BVH::NodeFormat::Quantized));
+
+    BVHOptimizer optimizer(object.GetBVH());
+    ASSERT_TRUE(optimizer.Optimize(BVHOptimizer::OptimizationParams()));
+    ASSERT_EQ(BVH::NodeFormat::Quantized, object.GetBVH().GetNodeFormat());
+
+    for (Uint32 i = 0; i < rays.Size(); ++i)
+    {
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ rays[i], hitPoint, renderingContext }, 0, &object);
+
+        ASSERT_EQ(referenceHitPoints[i].objectId, hitPoint.objectId);
+        ASSERT_EQ(referenceHitPoints[i].distance, hitPoint.distance);
+    }
+}
+
+TEST(BVH, Refit)
+{
+    DynArray<Box> boxes = GenerateRandomBoxes(20000);
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    BVH bvh;
+    BVHBuilder::Indices leavesOrder;
+    BVHBuilder builder(bvh);
+    ASSERT_TRUE(builder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), leavesOrder));
+
+    Random random;
+    for (Box& box : boxes)
+    {
+        const Vector4 offset = (random.GetVector4() * 10.0f) & Vector4::MakeMask<1,1,1,0>();
+        box = box + offset;
+    }
+
+    DynArray<Box> sortedBoxes;
+    Box overallBox = Box::Empty();
+    for (const Uint32 index : leavesOrder)
+    {
+        sortedBoxes.PushBack(boxes[index]);
+        overallBox = Box(overallBox, boxes[index]);
+    }
+
+    BVH referenceBvh;
+    {
+        BVHBuilder referenceBuilder(referenceBvh);
+        BVHBuilder::Indices referenceLeavesOrder;
+        ASSERT_TRUE(referenceBuilder.Build(boxes.Data(), boxes.Size(), BVHBuilder::BuildingParams(), referenceLeavesOrder));
+    }
+
+    ASSERT_TRUE(bvh.Refit(sortedBoxes.Data(), &threadPool));
+
+    ValidateBVH(bvh, boxes, leavesOrder, 2);
+
+    // boxes must be tight
+    EXPECT_TRUE((bvh.GetNodes()[0].GetBox().min == overallBox.min).All());
+    EXPECT_TRUE((bvh.GetNodes()[0].GetBox().max == overallBox.max).All());
+
+    // refitted tree is worse than a fresh one
+    EXPECT_GT(bvh.CalculateSAHCost(), referenceBvh.CalculateSAHCost());
+}
@@ -0,0 +1,205 @@
+#include "PCH.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Object/SceneObject_SphereCloud.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/Counters.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Traversal/TraversalContext.h"
+#include "../Core/Math/Random.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+TEST(Counters, TraversalStepsBucket)
+{
+    EXPECT_EQ(0u, RayTracingCounters::GetTraversalStepsBucket(0));
+    EXPECT_EQ(1u, RayTracingCounters::GetTraversalStepsBucket(1));
+    EXPECT_EQ(2u, RayTracingCounters::GetTraversalStepsBucket(2));
+    EXPECT_EQ(2u, RayTracingCounters::GetTraversalStepsBucket(3));
+    EXPECT_EQ(3u, RayTracingCounters::GetTraversalStepsBucket(4));
+    EXPECT_EQ(8u, RayTracingCounters::GetTraversalStepsBucket(255));
+    EXPECT_EQ(9u, RayTracingCounters::GetTraversalStepsBucket(256));
+    EXPECT_EQ(NumTraversalStepsBuckets - 1u, RayTracingCounters::GetTraversalStepsBucket(UINT32_MAX));
+}
+
+TEST(Counters, Append)
+{
+    LocalCounters localCounters;
+    localCounters.numTraversalSteps = 40;
+    localCounters.numRayBoxTests = 80;
+    localCounters.numRayTriangleTests = 16;
+
+    RayTracingCounters counters;
+    counters.Append(localCounters, 0);
+    counters.Append(localCounters, 2, 4); // 10 steps per ray on average
+    counters.Append(localCounters, 100);
+
+    EXPECT_EQ(6u, counters.numRays);
+    EXPECT_EQ(120u, counters.numTraversalSteps);
+    EXPECT_EQ(240u, counters.numRayBoxTests);
+    EXPECT_EQ(48u, counters.numRayTriangleTests);
+
+    EXPECT_EQ(1u, counters.numRaysPerDepth[0]);
+    EXPECT_EQ(4u, counters.numRaysPerDepth[2]);
+    EXPECT_EQ(1u, counters.numRaysPerDepth[MaxCountedRayDepth - 1]);
+
+    EXPECT_EQ(2u, counters.traversalStepsHistogram[RayTracingCounters::GetTraversalStepsBucket(40)]);
+    EXPECT_EQ(4u, counters.traversalStepsHistogram[RayTracingCounters::GetTraversalStepsBucket(10)]);
+
+    // per-ray statistics disabled, totals are still collected
+    RayTracingCounters disabledCounters;
+    disabledCounters.collectRayStats = false;
+    disabledCounters.Append(localCounters, 1);
+    EXPECT_EQ(1u, disabledCounters.numRays);
+    EXPECT_EQ(40u, disabledCounters.numTraversalSteps);
+    EXPECT_EQ(0u, disabledCounters.numRaysPerDepth[1]);
+    EXPECT_EQ(0u, disabledCounters.traversalStepsHistogram[RayTracingCounters::GetTraversalStepsBucket(40)]);
+
+    // per-thread counters aggregation
+    RayTracingCounters total;
+    total.Append(counters);
+    total.Append(disabledCounters);
+    EXPECT_EQ(7u, total.numRays);
+    EXPECT_EQ(160u, total.numTraversalSteps);
+    EXPECT_EQ(4u, total.numRaysPerDepth[2]);
+}
+
+TEST(Counters, ShadowRaysScope)
+{
+    for (const bool collectRayStats : { true, false })
+    {
+        SCOPED_TRACE(collectRayStats ? "Enabled" : "Disabled");
+
+        RayTracingCounters counters;
+        counters.collectRayStats = collectRayStats;
+
+        LocalCounters localCounters;
+        localCounters.numTraversalSteps = 10;
+        {
+            const ShadowRaysCountersScope scope(localCounters, counters, 2);
+            EXPECT_EQ(0u, localCounters.numTraversalSteps);
+            localCounters.numTraversalSteps = 5;
+            localCounters.numRayTriangleTests = 3;
+        }
+
+        // counters of the shaded ray are restored, shadow rays tests are accounted regardless of the flag
+        EXPECT_EQ(10u, localCounters.numTraversalSteps);
+        EXPECT_EQ(0u, localCounters.numRayTriangleTests);
+        EXPECT_EQ(5u, counters.numTraversalSteps);
+        EXPECT_EQ(3u, counters.numRayTriangleTests);
+        EXPECT_EQ(collectRayStats ? 2u : 0u, counters.numShadowRays);
+    }
+}
+
+TEST(Counters, Traversal)
+{
+    Random random;
+    DynArray<Float3> centers;
+    DynArray<float> radii;
+    for (Uint32 i = 0; i < 1000; ++i)
+    {
+        centers.PushBack((random.GetVector4() * 100.0f).ToFloat3());
+        radii.PushBack(1.0f);
+    }
+
+    auto object = std::make_unique<SphereCloudSceneObject>();
+    ASSERT_TRUE(object->Initialize(centers.Data(), radii.Data(), centers.Size()));
+
+    Scene scene;
+    scene.AddObject(std::move(object));
+    ASSERT_TRUE(scene.BuildBVH());
+
+    auto ctx = std::make_unique<RenderingContext>();
+
+    const Ray ray(Vector4(-10.0f, 40.0f, 45.0f, 0.0f), Vector4(1.0f, 0.1f, 0.05f, 0.0f).Normalized3());
+
+    // closest hit traversal is counted without special builds
+    HitPoint hitPoint;
+    ctx->localCounters.Reset();
+    scene.Traverse_Single({ ray, hitPoint, *ctx });
+    EXPECT_GT(ctx->localCounters.numTraversalSteps, 0u);
+    EXPECT_GT(ctx->localCounters.numRayBoxTests, ctx->localCounters.numTraversalSteps);
+    ctx->counters.Append(ctx->localCounters);
+
+    // shadow ray is accounted separately and doesn't affect local counters of the shaded ray
+    const LocalCounters localCounters = ctx->localCounters;
+    const Uint64 numTraversalSteps = ctx->counters.numTraversalSteps;
+    HitPoint shadowHitPoint;
+    shadowHitPoint.distance = 200.0f;
+    scene.Traverse_Shadow_Single({ ray, shadowHitPoint, *ctx });
+
+    EXPECT_EQ(localCounters.numTraversalSteps, ctx->localCounters.numTraversalSteps);
+    EXPECT_EQ(localCounters.numRayBoxTests, ctx->localCounters.numRayBoxTests);
+    EXPECT_EQ(1u, ctx->counters.numRays);
+    EXPECT_EQ(1u, ctx->counters.numShadowRays);
+    EXPECT_GT(ctx->counters.numTraversalSteps, numTraversalSteps);
+
+    // SIMD-8 traversal counts steps of the active lanes only
+    const Ray_Simd8 simdRay(ray, ray, ray, ray, ray, ray, ray, ray);
+    HitPoint_Simd8 allLanesHitPoints;
+    ctx->localCounters.Reset();
+    scene.Traverse_Simd8({ simdRay, allLanesHitPoints, *ctx });
+    const Uint32 allLanesSteps = ctx->localCounters.numTraversalSteps;
+
+    HitPoint_Simd8 singleLaneHitPoints;
+    singleLaneHitPoints.distance = Vector8(-std::numeric_limits<float>::infinity());
+    singleLaneHitPoints.distance[0] = FLT_MAX;
+    ctx->localCounters.Reset();
+    scene.Traverse_Simd8({ simdRay, singleLaneHitPoints, *ctx });
+    EXPECT_GT(ctx->localCounters.numTraversalSteps, 0u);
+    EXPECT_EQ(allLanesSteps, 8u * ctx->localCounters.numTraversalSteps);
+}
+
+TEST(Counters, FrameStatsJSON)
+{
+    FrameStats stats;
+    stats.frameIndex = 3;
+    stats.numThreads = 2;
+    stats.counters.numRays = 1234;
+    stats.counters.traversalStepsHistogram[5] = 42;
+    stats.stages[static_cast<Uint32>(RenderingStage::Render)].idleTime = 0.5;
+    stats.passTime.numSamples = 7;
+
+    const std::string json = stats.ToJSON();
+    EXPECT_EQ('{', json.front());
+    EXPECT_NE(std::string::npos, json.find("\"frameIndex\": 3,"));
+    EXPECT_NE(std::string::npos, json.find("\"numThreads\": 2,"));
+    EXPECT_NE(std::string::npos, json.find("\"numRays\": 1234,"));
+    EXPECT_NE(std::string::npos, json.find("\"render\": { \"wallTime\": 0, \"idleTime\": 0.5 }"));
+    EXPECT_NE(std::string::npos, json.find("\"passTime\": { \"numSamples\": 7, \"average\": 0,"));
+    EXPECT_NE(std::string::npos, json.find("\"tileTime\": { \"numSamples\": 0,"));
+    EXPECT_NE(std::string::npos, json.find("\"traversalStepsHistogram\": [0, 0, 0, 0, 0, 42, 0"));
+    EXPECT_EQ(std::count(json.begin(), json.end(), '{'), std::count(json.begin(), json.end(), '}'));
+    EXPECT_EQ(std::count(json.begin(), json.end(), '['), std::count(json.begin(), json.end(), ']'));
+}
+
+TEST(Counters, TimeDistribution)
+{
+    TimeDistribution distribution;
+    distribution.Compute(nullptr, 0);
+    EXPECT_EQ(0u, distribution.numSamples);
+    EXPECT_EQ(0.0, distribution.max);
+
+    // 1, 2, ..., 100 shuffled
+    std::vector<double> samples;
+    for (Uint32 i = 0; i < 100; ++i)
+    {
+        samples.push_back(static_cast<double>((i * 37u) % 100u + 1u));
+    }
+
+    distribution.Compute(samples.data(), static_cast<Uint32>(samples.size()));
+    EXPECT_EQ(100u, distribution.numSamples);
+    EXPECT_DOUBLE_EQ(50.5, distribution.average);
+    EXPECT_DOUBLE_EQ(833.25, distribution.variance);
+    EXPECT_DOUBLE_EQ(95.0, distribution.percentile95);
+    EXPECT_DOUBLE_EQ(100.0, distribution.max);
+
+    double single = 0.25;
+    distribution.Compute(&single, 1);
+    EXPECT_EQ(1u, distribution.numSamples);
+    EXPECT_DOUBLE_EQ(0.25, distribution.average);
+    EXPECT_DOUBLE_EQ(0.0, distribution.variance);
+    EXPECT_DOUBLE_EQ(0.25, distribution.percentile95);
+}
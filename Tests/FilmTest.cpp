@@ -0,0 +1,89 @@
+#include "PCH.h"
+#include "../Core/Rendering/Film.h"
+#include "../Core/Utils/Bitmap.h"
+#include "../Core/Utils/ThreadPool.h"
+#include "../Core/Math/Random.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+const Uint32 FilmSize = 4;
+
+bool InitFloatBitmap(Bitmap& bitmap)
+{
+    if (!bitmap.Init(FilmSize, FilmSize, Bitmap::Format::R32G32B32_Float))
+    {
+        return false;
+    }
+
+    memset(bitmap.GetData(), 0, sizeof(Float3) * FilmSize * FilmSize);
+    return true;
+}
+
+Float3 GetTotal(const Bitmap& bitmap)
+{
+    Float3 total(0.0f, 0.0f, 0.0f);
+    for (Uint32 i = 0; i < FilmSize * FilmSize; ++i)
+    {
+        total += bitmap.GetDataAs<Float3>()[i];
+    }
+    return total;
+}
+
+} // namespace
+
+TEST(Film, AccumulatePixel)
+{
+    Bitmap sum, secondarySum;
+    ASSERT_TRUE(InitFloatBitmap(sum));
+    ASSERT_TRUE(InitFloatBitmap(secondarySum));
+
+    Film film(sum, &secondarySum);
+    film.AccumulateColor(1, 2, Vector4(1.0f, 2.0f, 3.0f));
+    film.AccumulateColor(1, 2, Vector4(1.0f, 2.0f, 3.0f));
+
+    const Float3& pixel = sum.GetDataAs<Float3>()[2 * FilmSize + 1];
+    EXPECT_EQ(2.0f, pixel.x);
+    EXPECT_EQ(4.0f, pixel.y);
+    EXPECT_EQ(6.0f, pixel.z);
+    EXPECT_EQ(6.0f, secondarySum.GetDataAs<Float3>()[2 * FilmSize + 1].z);
+}
+
+TEST(Film, ConcurrentSplats)
+{
+    Bitmap sum, splatSum;
+    ASSERT_TRUE(InitFloatBitmap(sum));
+    ASSERT_TRUE(InitFloatBitmap(splatSum));
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(8);
+
+    // all the threads splat onto few pixels, so the adds collide
+    const Uint32 numTasks = 64;
+    const Uint32 numSplatsPerTask = 10000;
+    const auto task = [&](Uint32, Uint32)
+    {
+        Film film(sum, nullptr, &splatSum);
+        Random random;
+
+        for (Uint32 i = 0; i < numSplatsPerTask; ++i)
+        {
+            film.AccumulateColor(Vector4(0.5f, 0.5f, 0.0f, 0.0f), Vector4(1.0f, 0.5f, 0.25f), random);
+        }
+    };
+
+    threadPool.RunParallelTask(task, numTasks);
+
+    // no samples can be lost (the sums are exactly representable)
+    const Float3 total = GetTotal(splatSum);
+    EXPECT_EQ(static_cast<float>(numTasks * numSplatsPerTask), total.x);
+    EXPECT_EQ(0.5f * static_cast<float>(numTasks * numSplatsPerTask), total.y);
+    EXPECT_EQ(0.25f * static_cast<float>(numTasks * numSplatsPerTask), total.z);
+
+    // splats don't touch the main accumulation buffer
+    EXPECT_EQ(0.0f, GetTotal(sum).x);
+}
@@ -1,5 +1,6 @@
 #include "PCH.h"
 #include "../Core/Math/Geometry.h"
+#include "../Core/Math/Simd8Geometry.h"
 #include "../Core/Math/Random.h"
 #include "../Core/Math/SamplingHelpers.h"
 
@@ -35,3 +36,75 @@ TEST(MathTest, Geometry_BuildOrthonormalBasis)
         EXPECT_NEAR(0.0f, Vector4::Dot3(x, v), 0.00001f);
     }
 }
+
+TEST(MathTest, Geometry_TriangleRay_Watertight_Simd8)
+{
+    Random random;
+
+    // must agree with the regular intersection test
+    for (Uint32 i = 0; i < 1000; ++i)
+    {
+        const Vector4 v0 = random.GetVector4() * 10.0f;
+        const Vector4 v1 = random.GetVector4() * 10.0f;
+        const Vector4 v2 = random.GetVector4() * 10.0f;
+        const Vector4 origin = ((random.GetVector4() - Vector4(0.5f)) * 40.0f) & Vector4::MakeMask<1,1,1,0>();
+        const Vector4 target = (v0 + v1 + v2) * (1.0f / 3.0f) + (random.GetVector4() - Vector4(0.5f)) * 8.0f;
+        const Ray ray(origin, (target - origin).Normalized3());
+
+        TriangleVertices_Simd8 tri;
+        tri.v0 = Vector3x8(v0);
+        tri.v1 = Vector3x8(v1);
+        tri.v2 = Vector3x8(v2);
+
+        float u, v, distance;
+        const bool hit = Intersect_TriangleRay(ray, v0, v1 - v0, v2 - v0, u, v, distance);
+
+        Vector8 u8, v8, distance8;
+        const Int32 mask = Intersect_TriangleRay_Watertight_Simd8(WatertightRay_Simd8(ray), tri, VECTOR8_MAX, u8, v8, distance8).GetMask();
+
+        EXPECT_EQ(hit ? 0xFF : 0, mask);
+        if (hit && mask)
+        {
+            EXPECT_NEAR(distance, distance8[0], 0.0001f * distance);
+            EXPECT_NEAR(u, u8[0], 0.001f);
+            EXPECT_NEAR(v, v8[0], 0.001f);
+        }
+    }
+
+    // fan of 8 triangles sharing the center vertex, rays aimed exactly at the shared edges must always hit
+    const Vector4 center = Vector4(0.3f, 0.7f, 0.1f, 0.0f);
+    Vector4 rim[8];
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        const float angle = 2.0f * RT_PI * static_cast<float>(i) / 8.0f;
+        rim[i] = center + Vector4(cosf(angle), sinf(angle), 0.2f * cosf(3.0f * angle), 0.0f) * 5.0f;
+    }
+
+    TriangleVertices_Simd8 fan;
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        const Vector4 v1 = rim[i];
+        const Vector4 v2 = rim[(i + 1) % 8];
+        fan.v0.x[i] = center.x;
+        fan.v0.y[i] = center.y;
+        fan.v0.z[i] = center.z;
+        fan.v1.x[i] = v1.x;
+        fan.v1.y[i] = v1.y;
+        fan.v1.z[i] = v1.z;
+        fan.v2.x[i] = v2.x;
+        fan.v2.y[i] = v2.y;
+        fan.v2.z[i] = v2.z;
+    }
+
+    for (Uint32 i = 0; i < 10000; ++i)
+    {
+        const Vector4 edgeEnd = rim[i % 8];
+        const Vector4 target = i % 100 == 0 ? center : Vector4::Lerp(center, edgeEnd, 0.9f * random.GetFloat());
+        const Vector4 origin = target + Vector4(random.GetFloat() - 0.5f, random.GetFloat() - 0.5f, 1.0f, 0.0f) * 20.0f;
+        const Ray ray(origin, (target - origin).Normalized3());
+
+        Vector8 u, v, distance;
+        const Int32 mask = Intersect_TriangleRay_Watertight_Simd8(WatertightRay_Simd8(ray), fan, VECTOR8_MAX, u, v, distance).GetMask();
+        ASSERT_NE(0, mask);
+    }
+}
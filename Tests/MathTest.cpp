@@ -1,5 +1,8 @@
 #include "PCH.h"
 #include "../Core/Math/Vector4.h"
+#include "../Core/Math/PackedUnitVector.h"
+#include "../Core/Math/Random.h"
+#include "../Core/Math/SamplingHelpers.h"
 
 #include "gtest/gtest.h"
 
@@ -227,4 +230,110 @@ TEST(Math, Denormal_Float)
     const float denormValue = value * value;
 
     EXPECT_EQ(0.0f, denormValue);
-}
\ No newline at end of file
+}
+
+TEST(Math, ConvertFloatToHalf)
+{
+    const float values[] = { 0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 0.25f, 1024.0f, 65504.0f, 6.103515625e-05f, 5.9604644775390625e-08f };
+    for (const float value : values)
+    {
+        EXPECT_EQ(value, ConvertHalfToFloat(ConvertFloatToHalf(value)));
+    }
+
+    // rounding to nearest
+    EXPECT_EQ(1.0f, ConvertHalfToFloat(ConvertFloatToHalf(1.0002f)));
+    EXPECT_EQ(1.0009765625f, ConvertHalfToFloat(ConvertFloatToHalf(1.0008f)));
+
+    EXPECT_TRUE(IsInfinity(ConvertHalfToFloat(ConvertFloatToHalf(1.0e+6f))));
+    EXPECT_TRUE(IsNaN(ConvertHalfToFloat(ConvertFloatToHalf(std::numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST(Math, PackUnitVector)
+{
+    // axes must be preserved exactly
+    const Vector4 axes[] = { VECTOR_X, VECTOR_Y, VECTOR_Z, -VECTOR_X, -VECTOR_Y, -VECTOR_Z };
+    for (const Vector4& axis : axes)
+    {
+        EXPECT_TRUE(Vector4::AlmostEqual(axis, UnpackUnitVector_32(PackUnitVector_32(axis)), 1.0e-6f));
+        EXPECT_TRUE(Vector4::AlmostEqual(axis, UnpackUnitVector_16(PackUnitVector_16(axis)), 1.0e-6f));
+    }
+
+    // max angular error: 0.005 degree for 32-bit and 1 degree for 16-bit packing
+    const float maxSinError32 = 8.8e-5f;
+    const float maxSinError16 = 1.75e-2f;
+
+    Random random;
+    for (Uint32 i = 0; i < 10000; ++i)
+    {
+        const Vector4 v = SamplingHelpers::GetSphere(random.GetFloat2());
+
+        const Vector4 unpacked32 = UnpackUnitVector_32(PackUnitVector_32(v));
+        EXPECT_NEAR(1.0f, unpacked32.Length3(), 1.0e-6f);
+        EXPECT_GT(Vector4::Dot3(v, unpacked32), 0.0f);
+        EXPECT_LT(Vector4::Cross3(v, unpacked32).Length3(), maxSinError32);
+
+        const Vector4 unpacked16 = UnpackUnitVector_16(PackUnitVector_16(v));
+        EXPECT_NEAR(1.0f, unpacked16.Length3(), 1.0e-6f);
+        EXPECT_GT(Vector4::Dot3(v, unpacked16), 0.0f);
+        EXPECT_LT(Vector4::Cross3(v, unpacked16).Length3(), maxSinError16);
+    }
+}
+
+TEST(Math, InterpolatePackedUnitVectors)
+{
+    Random random;
+    for (Uint32 i = 0; i < 1000; ++i)
+    {
+        Uint32 packed32[3];
+        Uint16 packed16[3];
+        Vector4 reference32 = Vector4::Zero();
+        Vector4 reference16 = Vector4::Zero();
+
+        const Float2 uv = random.GetFloat2();
+        const float weights[3] = { 1.0f - uv.x * 0.5f - uv.y * 0.5f, uv.x * 0.5f, uv.y * 0.5f };
+
+        for (Uint32 j = 0; j < 3; ++j)
+        {
+            const Vector4 v = SamplingHelpers::GetSphere(random.GetFloat2());
+            packed32[j] = PackUnitVector_32(v);
+            packed16[j] = PackUnitVector_16(v);
+            reference32 = Vector4::MulAndAdd(UnpackUnitVector_32(packed32[j]), weights[j], reference32);
+            reference16 = Vector4::MulAndAdd(UnpackUnitVector_16(packed16[j]), weights[j], reference16);
+        }
+
+        const Vector4 weightsVector(weights[0], weights[1], weights[2], 0.0f);
+        EXPECT_TRUE(Vector4::AlmostEqual(reference32, InterpolatePackedUnitVectors_32(packed32, weightsVector), 1.0e-5f));
+        EXPECT_TRUE(Vector4::AlmostEqual(reference16, InterpolatePackedUnitVectors_16(packed16, weightsVector), 1.0e-5f));
+    }
+}
+
+TEST(Math, HilbertCurveIndex)
+{
+    EXPECT_EQ(0u, HilbertCurveIndex(0, 0, 1));
+    EXPECT_EQ(1u, HilbertCurveIndex(0, 1, 1));
+    EXPECT_EQ(2u, HilbertCurveIndex(1, 1, 1));
+    EXPECT_EQ(3u, HilbertCurveIndex(1, 0, 1));
+
+    // the curve must visit every cell exactly once, moving to a neighbouring cell at each step
+    const Uint32 order = 5;
+    const Uint32 size = 1u << order;
+
+    std::vector<Int32> cellX(size * size, -1);
+    std::vector<Int32> cellY(size * size, -1);
+    for (Uint32 y = 0; y < size; ++y)
+    {
+        for (Uint32 x = 0; x < size; ++x)
+        {
+            const Uint32 index = HilbertCurveIndex(x, y, order);
+            ASSERT_LT(index, size * size);
+            ASSERT_EQ(-1, cellX[index]);
+            cellX[index] = static_cast<Int32>(x);
+            cellY[index] = static_cast<Int32>(y);
+        }
+    }
+
+    for (Uint32 i = 1; i < size * size; ++i)
+    {
+        EXPECT_EQ(1, Abs(cellX[i] - cellX[i - 1]) + Abs(cellY[i] - cellY[i - 1]));
+    }
+}
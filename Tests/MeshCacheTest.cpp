@@ -0,0 +1,136 @@
+#include "PCH.h"
+#include "../Core/Mesh/Mesh.h"
+#include "../Core/Mesh/MeshCache.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Traversal/Traversal_Single.h"
+#include "../Core/Math/Random.h"
+#include "TestMesh.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+const char* const CacheFilePath = "mesh_cache_test.cache";
+
+} // namespace
+
+TEST(MeshCache, Validation)
+{
+    const TestMeshData data(1000);
+    const MeshDesc desc = data.GetDesc();
+    const Uint64 key = 1234;
+
+    Mesh mesh;
+    ASSERT_TRUE(mesh.Initialize(desc));
+
+    const Uint8 userData[] = { 1, 2, 3, 4, 5 };
+    ASSERT_TRUE(MeshCache::Save(CacheFilePath, mesh, desc, key, ArrayView<const Uint8>(userData, 5)));
+
+    MeshCache cache;
+    ASSERT_TRUE(cache.Open(CacheFilePath, desc, key));
+    ASSERT_EQ(5u, cache.GetUserData().Size());
+    EXPECT_EQ(0, memcmp(userData, cache.GetUserData().Data(), 5));
+
+    // different source data
+    EXPECT_FALSE(cache.Open(CacheFilePath, desc, key + 1));
+
+    // different building parameters
+    MeshDesc quantizedDesc = desc;
+    quantizedDesc.bvhNodeFormat = BVH::NodeFormat::Quantized;
+    EXPECT_FALSE(cache.Open(CacheFilePath, quantizedDesc, key));
+
+    // missing file
+    EXPECT_FALSE(cache.Open("missing_mesh_cache_file.cache", desc, key));
+
+    // corrupted section sizes and offsets
+    cache.Close();
+    {
+        FILE* file = fopen(CacheFilePath, "r+b");
+        ASSERT_NE(nullptr, file);
+
+        MeshCacheHeader header;
+        ASSERT_EQ(1u, fread(&header, sizeof(header), 1, file));
+
+        MeshCacheHeader corruptedHeader = header;
+        corruptedHeader.numBVHNodes = 0xFFFFFFFF;
+        ASSERT_EQ(0, fseek(file, 0, SEEK_SET));
+        ASSERT_EQ(1u, fwrite(&corruptedHeader, sizeof(header), 1, file));
+        fflush(file);
+        EXPECT_FALSE(cache.Open(CacheFilePath, desc, key));
+        cache.Close();
+
+        corruptedHeader = header;
+        corruptedHeader.userDataOffset += 1;
+        ASSERT_EQ(0, fseek(file, 0, SEEK_SET));
+        ASSERT_EQ(1u, fwrite(&corruptedHeader, sizeof(header), 1, file));
+        fflush(file);
+        EXPECT_FALSE(cache.Open(CacheFilePath, desc, key));
+        cache.Close();
+
+        fclose(file);
+    }
+
+    cache.Close();
+    std::remove(CacheFilePath);
+}
+
+TEST(MeshCache, SaveLoad)
+{
+    const TestMeshData data(5000);
+
+    for (const BVH::NodeFormat nodeFormat : { BVH::NodeFormat::Full, BVH::NodeFormat::Quantized })
+    {
+        SCOPED_TRACE(nodeFormat == BVH::NodeFormat::Full ? "Full" : "Quantized");
+
+        MeshDesc desc = data.GetDesc();
+        desc.bvhNodeFormat = nodeFormat;
+
+        Mesh mesh;
+        ASSERT_TRUE(mesh.Initialize(desc));
+        ASSERT_TRUE(MeshCache::Save(CacheFilePath, mesh, desc, 1, ArrayView<const Uint8>()));
+
+        Mesh cachedMesh;
+        {
+            auto cache = std::make_shared<MeshCache>();
+            ASSERT_TRUE(cache->Open(CacheFilePath, desc, 1));
+            ASSERT_TRUE(cachedMesh.InitializeFromCache(cache, desc));
+        }
+
+        const BVH& bvh = mesh.GetBVH();
+        const BVH& cachedBvh = cachedMesh.GetBVH();
+        ASSERT_EQ(bvh.GetNumNodes(), cachedBvh.GetNumNodes());
+        ASSERT_EQ(bvh.GetNodeFormat(), cachedBvh.GetNodeFormat());
+        EXPECT_EQ(0, memcmp(bvh.GetNodes(), cachedBvh.GetNodes(), sizeof(BVH::Node) * bvh.GetNumNodes()));
+        ASSERT_EQ(mesh.GetWideBVH().GetNumNodes(), cachedMesh.GetWideBVH().GetNumNodes());
+        EXPECT_TRUE((mesh.GetBoundingBox().min == cachedMesh.GetBoundingBox().min).All());
+        EXPECT_TRUE((mesh.GetBoundingBox().max == cachedMesh.GetBoundingBox().max).All());
+
+        RenderingContext renderingContext;
+        Random random;
+        for (Uint32 i = 0; i < 1000; ++i)
+        {
+            const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + random.GetVector4() * 200.0f;
+            const Vector4 target = random.GetVector4() * 100.0f;
+            const Ray ray(origin, target - origin);
+
+            HitPoint hitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, renderingContext }, 0, &mesh);
+
+            HitPoint cachedHitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, cachedHitPoint, renderingContext }, 0, &cachedMesh);
+
+            ASSERT_EQ(hitPoint.objectId, cachedHitPoint.objectId);
+            ASSERT_EQ(hitPoint.distance, cachedHitPoint.distance);
+            if (hitPoint.objectId != RT_INVALID_OBJECT)
+            {
+                ASSERT_EQ(hitPoint.subObjectId, cachedHitPoint.subObjectId);
+            }
+        }
+
+        std::remove(CacheFilePath);
+    }
+}
@@ -0,0 +1,1013 @@
+﻿#include "PCH.h"
+#include "../Core/Mesh/Mesh.h"
+#include "../Core/Mesh/MeshCache.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Traversal/Traversal_Single.h"
+#include "../Core/Traversal/TraversalContext.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Object/SceneObject_Mesh.h"
+#include "../Core/Material/Material.h"
+#include "../Core/Rendering/ShadingData.h"
+#include "../Core/Utils/ThreadPool.h"
+#include "../Core/Utils/Bitmap.h"
+#include "../Core/Math/Random.h"
+#include "../Core/Math/SamplingHelpers.h"
+#include "TestMesh.h"
+#include "TestScene.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+// compare closest hits of two meshes representing the same geometry
+void CompareTraversal(const Mesh& mesh, const Mesh& referenceMesh)
+{
+    RenderingContext renderingContext;
+    Random random;
+    for (Uint32 i = 0; i < 1000; ++i)
+    {
+        const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + random.GetVector4() * 200.0f;
+        const Vector4 target = random.GetVector4() * 100.0f;
+        const Ray ray(origin, target - origin);
+
+        HitPoint hitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, renderingContext }, 0, &mesh);
+
+        HitPoint referenceHitPoint;
+        GenericTraverse_Single(SingleTraversalContext{ ray, referenceHitPoint, renderingContext }, 0, &referenceMesh);
+
+        ASSERT_EQ(referenceHitPoint.objectId, hitPoint.objectId);
+        ASSERT_EQ(referenceHitPoint.distance, hitPoint.distance);
+    }
+}
+
+} // namespace
+
+TEST(Mesh, UpdateVertexPositions_Refit)
+{
+    TestMeshData data(5000);
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    Mesh mesh;
+    ASSERT_TRUE(mesh.Initialize(data.GetDesc()));
+
+    // small deformation - refitting is enough
+    Random random;
+    for (Float3& position : data.positions)
+    {
+        position = (Vector4(position) + random.GetVector4() * 0.5f).ToFloat3();
+    }
+
+    const Uint32 numBVHNodes = mesh.GetBVH().GetNumNodes();
+    ASSERT_TRUE(mesh.UpdateVertexPositions(data.positions.data(), static_cast<Uint32>(data.positions.size()), &threadPool));
+    EXPECT_EQ(numBVHNodes, mesh.GetBVH().GetNumNodes());
+
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(data.GetDesc()));
+
+    EXPECT_TRUE((referenceMesh.GetBoundingBox().min == mesh.GetBoundingBox().min).All());
+    EXPECT_TRUE((referenceMesh.GetBoundingBox().max == mesh.GetBoundingBox().max).All());
+
+    CompareTraversal(mesh, referenceMesh);
+
+    // invalid number of vertices
+    EXPECT_FALSE(mesh.UpdateVertexPositions(data.positions.data(), 3));
+}
+
+TEST(Mesh, Initialize_Parallel)
+{
+    const TestMeshData data(5000);
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    MeshDesc desc = data.GetDesc();
+    desc.bvhOptimizationPasses = 2;
+
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(desc));
+
+    Mesh mesh;
+    ASSERT_TRUE(mesh.Initialize(desc, &threadPool));
+
+    EXPECT_EQ(referenceMesh.GetBVH().GetNumNodes(), mesh.GetBVH().GetNumNodes());
+    EXPECT_TRUE((referenceMesh.GetBoundingBox().min == mesh.GetBoundingBox().min).All());
+    EXPECT_TRUE((referenceMesh.GetBoundingBox().max == mesh.GetBoundingBox().max).All());
+
+    CompareTraversal(mesh, referenceMesh);
+}
+
+TEST(Mesh, UpdateVertexPositions_Rebuild)
+{
+    TestMeshData data(5000);
+
+    for (const BVH::NodeFormat nodeFormat : { BVH::NodeFormat::Full, BVH::NodeFormat::Quantized })
+    {
+        SCOPED_TRACE(nodeFormat == BVH::NodeFormat::Full ? "Full" : "Quantized");
+
+        MeshDesc desc = data.GetDesc();
+        desc.bvhNodeFormat = nodeFormat;
+
+        Mesh mesh;
+        ASSERT_TRUE(mesh.Initialize(desc));
+
+        // move triangles to random places - refitted tree is useless, so it must be rebuilt
+        TestMeshData movedData = data;
+        Random random;
+        for (Uint32 i = 0; i < movedData.positions.size(); i += 3)
+        {
+            const Vector4 offset = random.GetVector4() * 100.0f - Vector4(movedData.positions[i]);
+            for (Uint32 j = 0; j < 3; ++j)
+            {
+                movedData.positions[i + j] = (Vector4(movedData.positions[i + j]) + offset).ToFloat3();
+            }
+        }
+
+        ASSERT_TRUE(mesh.UpdateVertexPositions(movedData.positions.data(), static_cast<Uint32>(movedData.positions.size())));
+        EXPECT_EQ(nodeFormat, mesh.GetBVH().GetNodeFormat());
+
+        MeshDesc movedDesc = movedData.GetDesc();
+        movedDesc.bvhNodeFormat = nodeFormat;
+
+        Mesh referenceMesh;
+        ASSERT_TRUE(referenceMesh.Initialize(movedDesc));
+
+        // the rebuilt tree must be as good as a fresh one
+        EXPECT_NEAR(referenceMesh.GetBVH().CalculateSAHCost(), mesh.GetBVH().CalculateSAHCost(), 0.01f * referenceMesh.GetBVH().CalculateSAHCost());
+
+        CompareTraversal(mesh, referenceMesh);
+    }
+}
+
+TEST(Mesh, UpdateVertexPositions_FromCache)
+{
+    const char* const cacheFilePath = "mesh_update_test.cache";
+
+    TestMeshData data(2000);
+    const MeshDesc desc = data.GetDesc();
+
+    {
+        Mesh mesh;
+        ASSERT_TRUE(mesh.Initialize(desc));
+        ASSERT_TRUE(MeshCache::Save(cacheFilePath, mesh, desc, 1, ArrayView<const Uint8>()));
+    }
+
+    Mesh mesh;
+    {
+        auto cache = std::make_shared<MeshCache>();
+        ASSERT_TRUE(cache->Open(cacheFilePath, desc, 1));
+        ASSERT_TRUE(mesh.InitializeFromCache(cache, desc));
+    }
+
+    for (Float3& position : data.positions)
+    {
+        position = (Vector4(position) + Vector4(1.0f, 2.0f, 3.0f, 0.0f)).ToFloat3();
+    }
+
+    // the cache file stays intact, mesh makes a private copy of its data
+    ASSERT_TRUE(mesh.UpdateVertexPositions(data.positions.data(), static_cast<Uint32>(data.positions.size())));
+
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(data.GetDesc()));
+
+    CompareTraversal(mesh, referenceMesh);
+
+    std::remove(cacheFilePath);
+}
+
+TEST(Mesh, LeafSize)
+{
+    const TestMeshData data(5000);
+
+    MeshDesc desc = data.GetDesc();
+    desc.bvhMaxLeafSize = 2;
+
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(desc));
+
+    // leaves bigger than SIMD width are split into multiple triangle packs
+    for (const Uint32 leafSize : { 1u, 4u, 8u, 13u })
+    {
+        SCOPED_TRACE("leafSize=" + std::to_string(leafSize));
+
+        desc.bvhMaxLeafSize = leafSize;
+
+        Mesh mesh;
+        ASSERT_TRUE(mesh.Initialize(desc));
+
+        CompareTraversal(mesh, referenceMesh);
+    }
+
+    desc.bvhMaxLeafSize = 0;
+    Mesh invalidMesh;
+    EXPECT_FALSE(invalidMesh.Initialize(desc));
+}
+
+TEST(Mesh, Traverse_Packet)
+{
+    const TestMeshData data(5000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    for (const Uint32 numObjects : { 1u, 2u })
+    {
+        SCOPED_TRACE("numObjects=" + std::to_string(numObjects));
+
+        Scene scene;
+        for (Uint32 i = 0; i < numObjects; ++i)
+        {
+            AddTestObject(scene, mesh, Matrix4::MakeTranslation(Vector4(static_cast<float>(i) * 150.0f, 0.0f, 0.0f, 0.0f)));
+        }
+        ASSERT_TRUE(scene.BuildBVH());
+
+        auto renderingContext = std::make_unique<RenderingContext>();
+        RayPacket& packet = renderingContext->rayPacket;
+
+        // incoherent rays (e.g. secondary bounces), the last group is not full
+        Random random;
+        packet.Clear();
+        for (Uint32 i = 0; i < MaxRayPacketSize - 3; ++i)
+        {
+            const Ray ray = MakeRandomRay(random, Vector4::Zero(), Vector4(250.0f, 100.0f, 100.0f, 0.0f));
+            packet.PushRay(ray, Vector4(1.0f), ImageLocationInfo(i % 64, i / 64));
+        }
+
+        packet.SortByOctant();
+
+        // rays in the same octant are consecutive
+        for (Uint32 i = 1; i < packet.numRays; ++i)
+        {
+            ASSERT_LE(packet.GetRayOctant(i - 1), packet.GetRayOctant(i));
+        }
+
+        scene.Traverse_Packet({ packet, *renderingContext });
+
+        Uint32 numMismatches = 0;
+        for (Uint32 i = 0; i < packet.numRays; ++i)
+        {
+            const RayGroup& group = packet.groups[i / RayPacket::RaysPerGroup];
+            const Uint32 lane = i % RayPacket::RaysPerGroup;
+
+            // traversal must not change rays order
+            ASSERT_EQ(static_cast<Int32>(i), group.rayOffsets[lane]);
+
+            const Ray ray(Vector4(group.rays[0].origin.x[lane], group.rays[0].origin.y[lane], group.rays[0].origin.z[lane], 0.0f),
+                          Vector4(group.rays[0].dir.x[lane], group.rays[0].dir.y[lane], group.rays[0].dir.z[lane], 0.0f));
+
+            HitPoint referenceHitPoint;
+            scene.Traverse_Single({ ray, referenceHitPoint, *renderingContext });
+
+            numMismatches += HitPointsMatch(referenceHitPoint, renderingContext->hitPoints[i]) ? 0 : 1;
+        }
+
+        EXPECT_LE(numMismatches, packet.numRays / 200);
+    }
+}
+
+TEST(Mesh, Traverse_Shadow_Packet)
+{
+    const TestMeshData data(5000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    for (const Uint32 numObjects : { 1u, 2u })
+    {
+        SCOPED_TRACE("numObjects=" + std::to_string(numObjects));
+
+        Scene scene;
+        for (Uint32 i = 0; i < numObjects; ++i)
+        {
+            AddTestObject(scene, mesh, Matrix4::MakeTranslation(Vector4(static_cast<float>(i) * 150.0f, 0.0f, 0.0f, 0.0f)));
+        }
+        ASSERT_TRUE(scene.BuildBVH());
+
+        auto renderingContext = std::make_unique<RenderingContext>();
+        RayPacket& packet = renderingContext->shadowRayPacket;
+
+        // shadow rays of various lengths, the last group is not full
+        Random random;
+        std::vector<Ray> rays;
+        std::vector<float> maxDistances;
+        packet.Clear();
+        for (Uint32 i = 0; i < 1000; ++i)
+        {
+            rays.push_back(MakeRandomRay(random, Vector4::Zero(), Vector4(250.0f, 100.0f, 100.0f, 0.0f)));
+            maxDistances.push_back(random.GetFloat() * 50.0f);
+            packet.PushRay(rays.back(), Vector4(1.0f), ImageLocationInfo(), maxDistances.back());
+        }
+
+        const Uint32 numOccludedRays = scene.Traverse_Shadow_Packet({ packet, *renderingContext });
+
+        Uint32 numReferenceOccludedRays = 0;
+        Uint32 numMismatches = 0;
+        for (Uint32 i = 0; i < packet.numRays; ++i)
+        {
+            // traversal must not change rays order
+            ASSERT_EQ(static_cast<Int32>(i), packet.groups[i / RayPacket::RaysPerGroup].rayOffsets[i % RayPacket::RaysPerGroup]);
+
+            HitPoint referenceHitPoint;
+            referenceHitPoint.distance = maxDistances[i];
+            const bool referenceOccluded = scene.Traverse_Shadow_Single({ rays[i], referenceHitPoint, *renderingContext });
+            const bool occluded = (renderingContext->occludedRaysMask[i / RayPacket::RaysPerGroup] >> (i % RayPacket::RaysPerGroup)) & 1;
+
+            // Note: SIMD intersection routines are not bit-exact, so grazing hits may differ
+            if (referenceOccluded != occluded)
+            {
+                numMismatches++;
+            }
+
+            numReferenceOccludedRays += referenceOccluded ? 1 : 0;
+        }
+
+        // unused lanes of the last group must not be reported as occluded
+        for (Uint32 i = packet.numRays; i < packet.GetNumGroups() * RayPacket::RaysPerGroup; ++i)
+        {
+            EXPECT_FALSE((renderingContext->occludedRaysMask[i / RayPacket::RaysPerGroup] >> (i % RayPacket::RaysPerGroup)) & 1);
+        }
+
+        EXPECT_GT(numReferenceOccludedRays, 0u);
+        EXPECT_LT(numReferenceOccludedRays, packet.numRays);
+        EXPECT_LE(numMismatches, packet.numRays / 200);
+        EXPECT_LE(Abs(static_cast<Int32>(numOccludedRays) - static_cast<Int32>(numReferenceOccludedRays)), static_cast<Int32>(packet.numRays / 200));
+    }
+}
+
+TEST(Mesh, Traverse_Simd8)
+{
+    const TestMeshData data(3000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    // objects with identity and rotated transform, and a few instances
+    Scene scene;
+    AddTestObject(scene, mesh, Matrix4::Identity());
+    AddTestObject(scene, mesh, MakeRotationY(0.7f, Vector4(150.0f, 0.0f, 0.0f, 1.0f)));
+    const Uint32 meshIndex = scene.AddInstancedMesh(mesh);
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        ASSERT_TRUE(scene.AddMeshInstance(Matrix4::MakeTranslation(Vector4(static_cast<float>(i) * 150.0f, 0.0f, 150.0f, 0.0f)), meshIndex));
+    }
+    ASSERT_TRUE(scene.BuildBVH());
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+    Random random;
+
+    Uint32 numHits = 0;
+    Uint32 numMismatches = 0;
+    Uint32 numOccluded = 0;
+    Uint32 numShadowMismatches = 0;
+    const Uint32 numGroups = 250;
+
+    for (Uint32 group = 0; group < numGroups; ++group)
+    {
+        Ray rays[8];
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            rays[i] = MakeRandomRay(random, Vector4(-100.0f, -50.0f, -100.0f, 0.0f), Vector4(800.0f, 200.0f, 500.0f, 0.0f), Vector4(600.0f, 100.0f, 300.0f, 0.0f));
+        }
+        const Ray_Simd8 simdRay(rays[0], rays[1], rays[2], rays[3], rays[4], rays[5], rays[6], rays[7]);
+
+        // the last lane of every other group is disabled
+        const bool lastLaneActive = (group % 2) == 0;
+
+        HitPoint_Simd8 hitPoints;
+        if (!lastLaneActive)
+        {
+            hitPoints.distance[7] = -std::numeric_limits<float>::infinity();
+        }
+        scene.Traverse_Simd8({ simdRay, hitPoints, *renderingContext });
+
+        // shadow rays of random lengths
+        float maxDistances[8];
+        HitPoint_Simd8 shadowHitPoints;
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            maxDistances[i] = random.GetFloat() * 300.0f;
+            shadowHitPoints.distance[i] = maxDistances[i];
+        }
+        if (!lastLaneActive)
+        {
+            shadowHitPoints.distance[7] = -std::numeric_limits<float>::infinity();
+        }
+        const Uint32 occludedMask = scene.Traverse_Shadow_Simd8({ simdRay, shadowHitPoints, *renderingContext });
+
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            if (i == 7 && !lastLaneActive)
+            {
+                EXPECT_EQ(-std::numeric_limits<float>::infinity(), hitPoints.distance[i]);
+                EXPECT_EQ(0u, occludedMask & (1u << i));
+                continue;
+            }
+
+            HitPoint referenceHitPoint;
+            scene.Traverse_Single({ rays[i], referenceHitPoint, *renderingContext });
+
+            numHits += (referenceHitPoint.distance < FLT_MAX) ? 1 : 0;
+            numMismatches += HitPointsMatch(referenceHitPoint, hitPoints.Get(i)) ? 0 : 1;
+
+            HitPoint referenceShadowHitPoint;
+            referenceShadowHitPoint.distance = maxDistances[i];
+            const bool referenceOccluded = scene.Traverse_Shadow_Single({ rays[i], referenceShadowHitPoint, *renderingContext });
+            const bool occluded = (occludedMask & (1u << i)) != 0;
+            numShadowMismatches += (referenceOccluded != occluded) ? 1 : 0;
+            numOccluded += referenceOccluded ? 1 : 0;
+        }
+    }
+
+    const Uint32 numRays = numGroups * 8;
+    EXPECT_GT(numHits, numRays / 20);
+    EXPECT_GT(numOccluded, 0u);
+    EXPECT_LE(numMismatches, numRays / 200);
+    EXPECT_LE(numShadowMismatches, numRays / 200);
+}
+
+TEST(Mesh, Instancing)
+{
+    const TestMeshData data(2000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    // reference scene made of regular scene objects
+    Scene referenceScene;
+    Scene scene;
+
+    const Uint32 meshIndex = scene.AddInstancedMesh(mesh);
+    const MaterialPtr overrideMaterial = Material::Create();
+    const Uint32 materialIndex = scene.AddInstanceMaterial(overrideMaterial);
+
+    EXPECT_FALSE(scene.AddMeshInstance(Matrix4::Identity(), meshIndex + 1));
+    EXPECT_FALSE(scene.AddMeshInstance(Matrix4::Identity(), meshIndex, materialIndex + 1));
+    EXPECT_FALSE(scene.AddMeshInstance(Matrix4::MakeScaling(Vector4(2.0f, 2.0f, 2.0f, 0.0f)), meshIndex));
+    EXPECT_FALSE(scene.AddMeshInstance(Matrix4(Vector4(1.0f, 0.5f, 0.0f, 0.0f), Vector4(0.0f, 1.0f, 0.0f, 0.0f), Vector4(0.0f, 0.0f, 1.0f, 0.0f), VECTOR_W), meshIndex));
+
+    // grid of rotated instances
+    Random random;
+    for (Uint32 i = 0; i < 64; ++i)
+    {
+        const float angle = random.GetFloat() * 2.0f * RT_PI;
+        const Vector4 position(static_cast<float>(i % 8) * 150.0f, 0.0f, static_cast<float>(i / 8) * 150.0f, 1.0f);
+        const Matrix4 transform = MakeRotationY(angle, position);
+
+        AddTestObject(referenceScene, mesh, transform);
+
+        ASSERT_TRUE(scene.AddMeshInstance(transform, meshIndex, (i % 2) ? materialIndex : MeshInstance::NoMaterialOverride));
+    }
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    ASSERT_TRUE(referenceScene.BuildBVH());
+    ASSERT_TRUE(scene.BuildBVH(&threadPool));
+    EXPECT_EQ(64u, scene.GetInstances().GetInstances().Size());
+    EXPECT_TRUE(scene.GetObjects().Empty());
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+    RayPacket& packet = renderingContext->rayPacket;
+
+    std::vector<Ray> rays;
+    packet.Clear();
+    for (Uint32 i = 0; i < 1000; ++i)
+    {
+        rays.push_back(MakeRandomRay(random, Vector4(-100.0f, -50.0f, -100.0f, 0.0f), Vector4(1300.0f, 200.0f, 1300.0f, 0.0f), Vector4(1200.0f, 100.0f, 1200.0f, 0.0f)));
+        packet.PushRay(rays.back(), Vector4(1.0f), ImageLocationInfo());
+    }
+
+    scene.Traverse_Packet({ packet, *renderingContext });
+
+    Uint32 numHits = 0;
+    Uint32 numPacketMismatches = 0;
+    for (Uint32 i = 0; i < rays.size(); ++i)
+    {
+        HitPoint referenceHitPoint;
+        referenceScene.Traverse_Single({ rays[i], referenceHitPoint, *renderingContext });
+
+        HitPoint hitPoint;
+        scene.Traverse_Single({ rays[i], hitPoint, *renderingContext });
+
+        ASSERT_EQ(referenceHitPoint.distance == FLT_MAX, hitPoint.distance == FLT_MAX);
+        numPacketMismatches += HitPointsMatch(hitPoint, renderingContext->hitPoints[i]) ? 0 : 1;
+
+        if (hitPoint.distance == FLT_MAX)
+        {
+            continue;
+        }
+
+        numHits++;
+        EXPECT_NEAR(referenceHitPoint.distance, hitPoint.distance, 0.001f * hitPoint.distance);
+        EXPECT_EQ(referenceHitPoint.subObjectId, hitPoint.subObjectId);
+        ASSERT_TRUE(hitPoint.objectId & RT_INSTANCE_OBJECT_FLAG);
+
+        // shading data is evaluated in world space
+        ShadingData referenceShadingData;
+        referenceScene.ExtractShadingData(rays[i], referenceHitPoint, 0.0f, referenceShadingData);
+        ShadingData shadingData;
+        scene.ExtractShadingData(rays[i], hitPoint, 0.0f, shadingData);
+        EXPECT_TRUE(Vector4::AlmostEqual(referenceShadingData.frame[2], shadingData.frame[2], 0.001f));
+
+        const MeshInstance& instance = scene.GetInstances().GetInstances()[hitPoint.objectId & ~RT_INSTANCE_OBJECT_FLAG];
+        if (instance.materialIndex == materialIndex)
+        {
+            EXPECT_EQ(overrideMaterial.get(), shadingData.material);
+        }
+        else
+        {
+            EXPECT_EQ(referenceShadingData.material, shadingData.material);
+        }
+
+        // shadow rays
+        HitPoint shadowHitPoint;
+        shadowHitPoint.distance = hitPoint.distance * 1.001f;
+        EXPECT_TRUE(scene.Traverse_Shadow_Single({ rays[i], shadowHitPoint, *renderingContext }));
+    }
+
+    EXPECT_GT(numHits, 100u);
+    EXPECT_LE(numPacketMismatches, static_cast<Uint32>(rays.size() / 200));
+
+    // shadow rays packet - rays slightly longer than the hit distance must be occluded
+    RayPacket& shadowPacket = renderingContext->shadowRayPacket;
+    shadowPacket.Clear();
+    for (Uint32 i = 0; i < rays.size(); ++i)
+    {
+        const float distance = renderingContext->hitPoints[i].distance;
+        shadowPacket.PushRay(rays[i], Vector4(1.0f), ImageLocationInfo(), distance < FLT_MAX ? distance * 1.001f : 1.0e+6f);
+    }
+
+    const Uint32 numOccludedRays = scene.Traverse_Shadow_Packet({ shadowPacket, *renderingContext });
+    EXPECT_LE(Abs(static_cast<Int32>(numOccludedRays) - static_cast<Int32>(numHits)), static_cast<Int32>(rays.size() / 200));
+}
+
+TEST(Mesh, MotionBlur)
+{
+    const TestMeshData data(2000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    // row of objects, every other one is moving (the first one very fast, so it's split in time)
+    Scene scene;
+    std::vector<const ISceneObject*> objects;
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        MeshSceneObject* object = AddTestObject(scene, mesh, Matrix4::MakeTranslation(Vector4(static_cast<float>(i) * 150.0f, 0.0f, 0.0f, 0.0f)));
+        if (i % 2 == 0)
+        {
+            object->SetLinearVelocity(Vector4(0.0f, i == 0 ? 1000.0f : 20.0f, 10.0f, 0.0f));
+            object->SetAngularVelocity(Quaternion::RotationY(0.25f * RT_PI * static_cast<float>(i % 4 + 1)));
+        }
+
+        EXPECT_EQ(i % 2 == 0, object->IsMoving());
+        objects.push_back(object);
+    }
+
+    ASSERT_TRUE(scene.BuildBVH());
+
+    Random random;
+    auto renderingContext = std::make_unique<RenderingContext>();
+    RayPacket& packet = renderingContext->rayPacket;
+
+    for (const float time : { 0.0f, 0.3f, 0.7f, 1.0f })
+    {
+        // reference: static scene with objects frozen at the given time
+        Scene referenceScene;
+        for (const ISceneObject* object : objects)
+        {
+            const Matrix4 transform = object->ComputeTransform(time);
+
+            // motion bounds must enclose the object at any time point
+            const Box box = transform.TransformBox(mesh->GetBoundingBox());
+            const Box motionBox = object->GetBoundingBox();
+            EXPECT_EQ(0x7, (box.min >= motionBox.min).GetMask() & 0x7);
+            EXPECT_EQ(0x7, (box.max <= motionBox.max).GetMask() & 0x7);
+
+            AddTestObject(referenceScene, mesh, transform);
+        }
+        ASSERT_TRUE(referenceScene.BuildBVH());
+
+        renderingContext->time = time;
+
+        std::vector<Ray> rays;
+        packet.Clear();
+        for (Uint32 i = 0; i < 1000; ++i)
+        {
+            // aim at objects' centers
+            const Vector4 center = objects[i % objects.size()]->ComputeTransform(time).TransformPoint(Vector4(50.0f, 50.0f, 50.0f, 0.0f));
+            const Vector4 origin = center + Vector4(0.0f, 0.0f, -300.0f, 0.0f) + random.GetVector4() * 100.0f;
+            const Vector4 target = center + random.GetVector4() * 60.0f - Vector4(30.0f, 30.0f, 30.0f, 0.0f);
+            rays.push_back(Ray(origin, (target - origin).Normalized3()));
+            packet.PushRay(rays.back(), Vector4(1.0f), ImageLocationInfo());
+        }
+
+        scene.Traverse_Packet({ packet, *renderingContext });
+
+        Uint32 numHits = 0;
+        Uint32 numPacketMismatches = 0;
+        for (Uint32 i = 0; i < rays.size(); ++i)
+        {
+            HitPoint referenceHitPoint;
+            referenceScene.Traverse_Single({ rays[i], referenceHitPoint, *renderingContext });
+
+            HitPoint hitPoint;
+            scene.Traverse_Single({ rays[i], hitPoint, *renderingContext });
+
+            ASSERT_EQ(referenceHitPoint.distance == FLT_MAX, hitPoint.distance == FLT_MAX);
+            numPacketMismatches += HitPointsMatch(hitPoint, renderingContext->hitPoints[i]) ? 0 : 1;
+
+            if (hitPoint.distance == FLT_MAX)
+            {
+                continue;
+            }
+
+            numHits++;
+            EXPECT_NEAR(referenceHitPoint.distance, hitPoint.distance, 0.001f * hitPoint.distance);
+            EXPECT_EQ(referenceHitPoint.objectId, hitPoint.objectId);
+            EXPECT_EQ(referenceHitPoint.subObjectId, hitPoint.subObjectId);
+
+            // shading data is evaluated at the same time point
+            ShadingData referenceShadingData;
+            referenceScene.ExtractShadingData(rays[i], referenceHitPoint, time, referenceShadingData);
+            ShadingData shadingData;
+            scene.ExtractShadingData(rays[i], hitPoint, time, shadingData);
+            EXPECT_TRUE(Vector4::AlmostEqual(referenceShadingData.frame[2], shadingData.frame[2], 0.001f));
+
+            HitPoint shadowHitPoint;
+            shadowHitPoint.distance = hitPoint.distance * 1.001f;
+            EXPECT_TRUE(scene.Traverse_Shadow_Single({ rays[i], shadowHitPoint, *renderingContext }));
+        }
+
+        EXPECT_GT(numHits, 20u);
+        EXPECT_LE(numPacketMismatches, static_cast<Uint32>(rays.size() / 200));
+    }
+}
+
+TEST(Mesh, ReplicateData)
+{
+    const TestMeshData data(2000);
+    const MeshPtr mesh = CreateTestMesh(data);
+    ASSERT_TRUE(mesh);
+
+    Scene scene;
+    AddTestObject(scene, mesh, Matrix4::Identity());
+    AddTestObject(scene, mesh, Matrix4::MakeTranslation(Vector4(150.0f, 0.0f, 0.0f, 0.0f)));
+    const Uint32 meshIndex = scene.AddInstancedMesh(mesh);
+    ASSERT_TRUE(scene.AddMeshInstance(Matrix4::MakeTranslation(Vector4(0.0f, 0.0f, 150.0f, 0.0f)), meshIndex));
+    ASSERT_TRUE(scene.BuildBVH());
+
+    // Note: threads are not pinned, so the pool spans a single node and there is one copy
+    ThreadPool threadPool;
+    ASSERT_TRUE(scene.ReplicateData(threadPool));
+    EXPECT_NE(scene.GetBVH().GetNodes(), scene.GetBVH().GetNodes(0));
+    EXPECT_NE(scene.GetInstances().GetWideBVH().GetNodes(), scene.GetInstances().GetWideBVH().GetNodes(0));
+    EXPECT_NE(mesh->GetBVH().GetNodes(), mesh->GetBVH().GetNodes(0));
+    EXPECT_NE(mesh->GetWideBVH().GetNodes(), mesh->GetWideBVH().GetNodes(0));
+    EXPECT_EQ(mesh->GetBVH().GetNodes(), mesh->GetBVH().GetNodes(1));
+    EXPECT_TRUE(scene.ReplicateData(threadPool));
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+    Random random;
+
+    // the copies are exact, so the results must be identical
+    for (Uint32 group = 0; group < 100; ++group)
+    {
+        Ray rays[8];
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            rays[i] = MakeRandomRay(random, Vector4(-100.0f, -50.0f, -100.0f, 0.0f), Vector4(400.0f, 200.0f, 400.0f, 0.0f), Vector4(250.0f, 100.0f, 250.0f, 0.0f));
+        }
+        const Ray_Simd8 simdRay(rays[0], rays[1], rays[2], rays[3], rays[4], rays[5], rays[6], rays[7]);
+
+        HitPoint_Simd8 referenceHitPoints;
+        renderingContext->numaNode = UINT32_MAX;
+        scene.Traverse_Simd8({ simdRay, referenceHitPoints, *renderingContext });
+
+        HitPoint_Simd8 hitPoints;
+        renderingContext->numaNode = 0;
+        scene.Traverse_Simd8({ simdRay, hitPoints, *renderingContext });
+
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            HitPoint referenceHitPoint;
+            renderingContext->numaNode = UINT32_MAX;
+            scene.Traverse_Single({ rays[i], referenceHitPoint, *renderingContext });
+
+            HitPoint hitPoint;
+            renderingContext->numaNode = 0;
+            scene.Traverse_Single({ rays[i], hitPoint, *renderingContext });
+
+            EXPECT_EQ(referenceHitPoint.distance, hitPoint.distance);
+            EXPECT_EQ(referenceHitPoint.objectId, hitPoint.objectId);
+            EXPECT_EQ(referenceHitPoint.subObjectId, hitPoint.subObjectId);
+
+            EXPECT_EQ(referenceHitPoints.Get(i).distance, hitPoints.Get(i).distance);
+            EXPECT_EQ(referenceHitPoints.Get(i).objectId, hitPoints.Get(i).objectId);
+        }
+    }
+
+    // updating the mesh drops its copies, the scene's copies are kept until its BVH is rebuilt
+    ASSERT_TRUE(mesh->UpdateVertexPositions(data.positions.data(), static_cast<Uint32>(data.positions.size())));
+    EXPECT_EQ(mesh->GetBVH().GetNodes(), mesh->GetBVH().GetNodes(0));
+    EXPECT_EQ(mesh->GetWideBVH().GetNodes(), mesh->GetWideBVH().GetNodes(0));
+    EXPECT_NE(scene.GetBVH().GetNodes(), scene.GetBVH().GetNodes(0));
+
+    ASSERT_TRUE(scene.BuildBVH());
+    EXPECT_EQ(scene.GetBVH().GetNodes(), scene.GetBVH().GetNodes(0));
+}
+
+TEST(Mesh, AlphaMask)
+{
+    // two unit quads facing the rays: the front one (z = 0) is cut out for u < 0.5, the back one (z = 1) is opaque
+    const Float3 positions[] =
+    {
+        Float3(0.0f, 0.0f, 0.0f), Float3(1.0f, 0.0f, 0.0f), Float3(1.0f, 1.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f),
+        Float3(0.0f, 0.0f, 1.0f), Float3(1.0f, 0.0f, 1.0f), Float3(1.0f, 1.0f, 1.0f), Float3(0.0f, 1.0f, 1.0f),
+    };
+    const Float2 texCoords[] =
+    {
+        Float2(0.0f, 0.0f), Float2(1.0f, 0.0f), Float2(1.0f, 1.0f), Float2(0.0f, 1.0f),
+        Float2(0.0f, 0.0f), Float2(1.0f, 0.0f), Float2(1.0f, 1.0f), Float2(0.0f, 1.0f),
+    };
+    Float3 normals[8], tangents[8];
+    for (Uint32 i = 0; i < 8; ++i)
+    {
+        normals[i] = Float3(0.0f, 0.0f, -1.0f);
+        tangents[i] = Float3(1.0f, 0.0f, 0.0f);
+    }
+    const Uint32 indices[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+    const Uint32 materialIndices[] = { 0, 0, UINT32_MAX, UINT32_MAX };
+
+    const float maskTexels[] = { 0.0f, 1.0f };
+    auto maskBitmap = std::make_shared<Bitmap>("mask");
+    ASSERT_TRUE(maskBitmap->Init(2, 1, Bitmap::Format::R32_Float, maskTexels, true));
+
+    const MaterialPtr maskedMaterial = Material::Create();
+    maskedMaterial->maskMap = maskBitmap;
+    ASSERT_TRUE(maskedMaterial->HasAlphaMask());
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = 4;
+    desc.vertexBufferDesc.numVertices = 8;
+    desc.vertexBufferDesc.numMaterials = 1;
+    desc.vertexBufferDesc.positions = positions;
+    desc.vertexBufferDesc.normals = normals;
+    desc.vertexBufferDesc.tangents = tangents;
+    desc.vertexBufferDesc.texCoords = texCoords;
+    desc.vertexBufferDesc.vertexIndexBuffer = indices;
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices;
+    desc.vertexBufferDesc.materials = &maskedMaterial;
+    desc.bvhMaxLeafSize = 8;
+
+    auto mesh = std::make_shared<Mesh>();
+    ASSERT_TRUE(mesh->Initialize(desc));
+
+    Scene scene;
+    scene.AddObject(std::make_unique<MeshSceneObject>(mesh));
+    ASSERT_TRUE(scene.BuildBVH());
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+
+    // 8x8 grid of rays (one row per SIMD-8 group), the cut-out edge is avoided
+    for (Uint32 y = 0; y < 8; ++y)
+    {
+        Ray rays[8];
+        for (Uint32 x = 0; x < 8; ++x)
+        {
+            const Vector4 origin((static_cast<float>(x) + 0.5f) / 8.0f, (static_cast<float>(y) + 0.5f) / 8.0f, -1.0f, 0.0f);
+            rays[x] = Ray(origin, Vector4(0.001f, 0.002f, 1.0f, 0.0f).Normalized3());
+        }
+        const Ray_Simd8 simdRay(rays[0], rays[1], rays[2], rays[3], rays[4], rays[5], rays[6], rays[7]);
+
+        HitPoint_Simd8 hitPoints;
+        scene.Traverse_Simd8({ simdRay, hitPoints, *renderingContext });
+
+        // shadow rays end between the quads
+        HitPoint_Simd8 shadowHitPoints;
+        for (Uint32 x = 0; x < 8; ++x)
+        {
+            shadowHitPoints.distance[x] = 1.5f;
+        }
+        const Uint32 occludedMask = scene.Traverse_Shadow_Simd8({ simdRay, shadowHitPoints, *renderingContext });
+
+        for (Uint32 x = 0; x < 8; ++x)
+        {
+            const bool opaque = x >= 4;
+            const float expectedDistance = opaque ? 1.0f : 2.0f;
+
+            HitPoint hitPoint;
+            scene.Traverse_Single({ rays[x], hitPoint, *renderingContext });
+            EXPECT_NEAR(expectedDistance, hitPoint.distance, 1.0e-5f);
+            EXPECT_EQ(opaque, hitPoint.subObjectId < 2);
+
+            EXPECT_NEAR(expectedDistance, hitPoints.Get(x).distance, 1.0e-5f);
+
+            HitPoint shadowHitPoint;
+            shadowHitPoint.distance = 1.5f;
+            EXPECT_EQ(opaque, scene.Traverse_Shadow_Single({ rays[x], shadowHitPoint, *renderingContext }));
+            EXPECT_EQ(opaque, (occludedMask & (1u << x)) != 0);
+        }
+    }
+}
+
+TEST(Mesh, FlatShadingData)
+{
+    TestMeshData data(2000);
+
+    // random shading attributes
+    Random random;
+    std::vector<Float2> texCoords;
+    for (Uint32 i = 0; i < data.positions.size(); ++i)
+    {
+        const Vector4 normal = SamplingHelpers::GetSphere(random.GetFloat2());
+        const Vector4 tangent = Vector4::Cross3(normal, SamplingHelpers::GetSphere(random.GetFloat2())).Normalized3();
+        data.normals[i] = normal.ToFloat3();
+        data.tangents[i] = tangent.ToFloat3();
+        texCoords.push_back(random.GetFloat2());
+    }
+
+    MeshDesc desc = data.GetDesc();
+    desc.vertexBufferDesc.texCoords = texCoords.data();
+
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(desc));
+
+    desc.flatShadingData = true;
+    Mesh mesh;
+    ASSERT_TRUE(mesh.Initialize(desc));
+
+    const auto compareShadingData = [&](const Mesh& testedMesh)
+    {
+        RenderingContext renderingContext;
+        Uint32 numHits = 0;
+        for (Uint32 i = 0; i < 4000; ++i)
+        {
+            const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + random.GetVector4() * 200.0f;
+            const Vector4 target = random.GetVector4() * 100.0f;
+            const Ray ray(origin, target - origin);
+
+            HitPoint hitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, renderingContext }, 0, &testedMesh);
+            if (hitPoint.distance == FLT_MAX)
+            {
+                continue;
+            }
+
+            HitPoint referenceHitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, referenceHitPoint, renderingContext }, 0, &referenceMesh);
+            ASSERT_EQ(referenceHitPoint.distance, hitPoint.distance);
+
+            ShadingData shadingData, referenceShadingData;
+            testedMesh.EvaluateShadingData_Single(hitPoint, shadingData, nullptr);
+            referenceMesh.EvaluateShadingData_Single(referenceHitPoint, referenceShadingData, nullptr);
+            numHits++;
+
+            EXPECT_EQ(nullptr, shadingData.material);
+            EXPECT_NEAR(referenceShadingData.texCoord.x, shadingData.texCoord.x, 1.0e-3f);
+            EXPECT_NEAR(referenceShadingData.texCoord.y, shadingData.texCoord.y, 1.0e-3f);
+
+            // the error can be amplified by normalization of interpolated vectors, so only the direction is checked roughly
+            EXPECT_GT(Vector4::Dot3(referenceShadingData.frame[2], shadingData.frame[2]), 0.999f);
+            EXPECT_GT(Vector4::Dot3(referenceShadingData.frame[0], shadingData.frame[0]), 0.95f);
+        }
+        EXPECT_GT(numHits, 100u);
+    };
+
+    compareShadingData(mesh);
+
+    // flat shading data must follow triangles reordered by BVH rebuild
+    TestMeshData movedData = data;
+    for (Uint32 i = 0; i < movedData.positions.size(); i += 3)
+    {
+        const Vector4 offset = random.GetVector4() * 100.0f - Vector4(movedData.positions[i]);
+        for (Uint32 j = 0; j < 3; ++j)
+        {
+            movedData.positions[i + j] = (Vector4(movedData.positions[i + j]) + offset).ToFloat3();
+        }
+    }
+
+    ASSERT_TRUE(mesh.UpdateVertexPositions(movedData.positions.data(), static_cast<Uint32>(movedData.positions.size())));
+    ASSERT_TRUE(referenceMesh.UpdateVertexPositions(movedData.positions.data(), static_cast<Uint32>(movedData.positions.size())));
+    compareShadingData(mesh);
+}
+
+TEST(Mesh, ReorderVertices)
+{
+    // grid of shared vertices stored in random order
+    const Uint32 gridSize = 64;
+    const Uint32 numVertices = gridSize * gridSize;
+
+    Random random;
+    std::vector<Uint32> shuffledIndices(numVertices);
+    for (Uint32 i = 0; i < numVertices; ++i)
+    {
+        shuffledIndices[i] = i;
+    }
+    for (Uint32 i = numVertices - 1; i > 0; --i)
+    {
+        std::swap(shuffledIndices[i], shuffledIndices[random.GetInt() % (i + 1)]);
+    }
+
+    std::vector<Float3> positions(numVertices), normals(numVertices), tangents(numVertices);
+    std::vector<Float2> texCoords(numVertices);
+    for (Uint32 y = 0; y < gridSize; ++y)
+    {
+        for (Uint32 x = 0; x < gridSize; ++x)
+        {
+            const Uint32 index = shuffledIndices[y * gridSize + x];
+            positions[index] = Float3(static_cast<float>(x), static_cast<float>(y), random.GetFloat());
+            normals[index] = Float3(0.0f, 0.0f, 1.0f);
+            tangents[index] = Float3(1.0f, 0.0f, 0.0f);
+            texCoords[index] = Float2(static_cast<float>(x), static_cast<float>(y));
+        }
+    }
+
+    std::vector<Uint32> indices;
+    std::vector<Uint32> materialIndices;
+    for (Uint32 y = 0; y + 1 < gridSize; ++y)
+    {
+        for (Uint32 x = 0; x + 1 < gridSize; ++x)
+        {
+            const Uint32 i00 = shuffledIndices[y * gridSize + x];
+            const Uint32 i10 = shuffledIndices[y * gridSize + x + 1];
+            const Uint32 i01 = shuffledIndices[(y + 1) * gridSize + x];
+            const Uint32 i11 = shuffledIndices[(y + 1) * gridSize + x + 1];
+            indices.insert(indices.end(), { i00, i10, i11, i00, i11, i01 });
+            materialIndices.insert(materialIndices.end(), { UINT32_MAX, UINT32_MAX });
+        }
+    }
+
+    MeshDesc desc;
+    desc.vertexBufferDesc.numTriangles = static_cast<Uint32>(materialIndices.size());
+    desc.vertexBufferDesc.numVertices = numVertices;
+    desc.vertexBufferDesc.positions = positions.data();
+    desc.vertexBufferDesc.normals = normals.data();
+    desc.vertexBufferDesc.tangents = tangents.data();
+    desc.vertexBufferDesc.texCoords = texCoords.data();
+    desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+    desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+
+    desc.reorderVertices = false;
+    Mesh referenceMesh;
+    ASSERT_TRUE(referenceMesh.Initialize(desc));
+
+    desc.reorderVertices = true;
+    Mesh mesh;
+    ASSERT_TRUE(mesh.Initialize(desc));
+
+    // vertices must be numbered in order of the first use
+    {
+        const VertexBuffer& vertexBuffer = mesh.GetVertexBuffer();
+        Uint32 numUsedVertices = 0;
+        for (Uint32 i = 0; i < vertexBuffer.GetNumTriangles(); ++i)
+        {
+            VertexIndices triangleIndices;
+            vertexBuffer.GetVertexIndices(i, triangleIndices);
+            for (const Uint32 index : { triangleIndices.i0, triangleIndices.i1, triangleIndices.i2 })
+            {
+                ASSERT_LE(index, numUsedVertices);
+                numUsedVertices = Max(numUsedVertices, index + 1);
+            }
+        }
+        EXPECT_EQ(numVertices, numUsedVertices);
+    }
+
+    const auto compareMeshes = [&]()
+    {
+        RenderingContext renderingContext;
+        for (Uint32 i = 0; i < 1000; ++i)
+        {
+            const Vector4 origin(random.GetFloat() * gridSize, random.GetFloat() * gridSize, 10.0f, 0.0f);
+            const Ray ray(origin, Vector4(0.01f, 0.02f, -1.0f, 0.0f).Normalized3());
+
+            HitPoint hitPoint, referenceHitPoint;
+            GenericTraverse_Single(SingleTraversalContext{ ray, hitPoint, renderingContext }, 0, &mesh);
+            GenericTraverse_Single(SingleTraversalContext{ ray, referenceHitPoint, renderingContext }, 0, &referenceMesh);
+            ASSERT_EQ(referenceHitPoint.distance, hitPoint.distance);
+            if (hitPoint.distance == FLT_MAX)
+            {
+                continue;
+            }
+
+            ShadingData shadingData, referenceShadingData;
+            mesh.EvaluateShadingData_Single(hitPoint, shadingData, nullptr);
+            referenceMesh.EvaluateShadingData_Single(referenceHitPoint, referenceShadingData, nullptr);
+            EXPECT_NEAR(referenceShadingData.texCoord.x, shadingData.texCoord.x, 1.0e-4f);
+            EXPECT_NEAR(referenceShadingData.texCoord.y, shadingData.texCoord.y, 1.0e-4f);
+        }
+    };
+
+    compareMeshes();
+
+    // positions are updated in the original order
+    for (Float3& position : positions)
+    {
+        position.z += random.GetFloat();
+    }
+    ASSERT_TRUE(mesh.UpdateVertexPositions(positions.data(), numVertices));
+    ASSERT_TRUE(referenceMesh.UpdateVertexPositions(positions.data(), numVertices));
+
+    compareMeshes();
+}
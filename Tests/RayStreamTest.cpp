@@ -0,0 +1,105 @@
+#include "PCH.h"
+#include "../Core/Traversal/RayStream.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Math/Random.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+TEST(RayStream, Empty)
+{
+    RayStream stream;
+    ASSERT_TRUE(stream.Reserve(16));
+    stream.Sort();
+
+    auto context = std::make_unique<RenderingContext>();
+    Uint32 userData[MaxRayPacketSize];
+    EXPECT_FALSE(stream.PopPacket(context->rayPacket, userData));
+}
+
+TEST(RayStream, Capacity)
+{
+    RayStream stream;
+    EXPECT_FALSE(stream.Reserve(RayStream::MaxRays + 1));
+    ASSERT_TRUE(stream.Reserve(4));
+
+    const Ray ray(Vector4::Zero(), Vector4(1.0f, 0.0f, 0.0f, 0.0f));
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(stream.PushRay(ray, ImageLocationInfo(i, 0), i));
+    }
+    EXPECT_FALSE(stream.PushRay(ray, ImageLocationInfo(4, 0), 4));
+    EXPECT_EQ(4u, stream.GetNumRays());
+
+    stream.Clear();
+    EXPECT_EQ(0u, stream.GetNumRays());
+    EXPECT_TRUE(stream.PushRay(ray, ImageLocationInfo(0, 0), 0));
+}
+
+TEST(RayStream, SortAndPop)
+{
+    const Uint32 numRays = 10000;
+    const Uint32 maxRaysInPacket = 1000;
+
+    RayStream stream;
+    ASSERT_TRUE(stream.Reserve(numRays));
+
+    Random random;
+    std::vector<Ray> rays;
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        const Vector4 origin = random.GetVector4Bipolar() * 100.0f;
+        const Vector4 dir = random.GetVector4Bipolar();
+        rays.push_back(Ray(origin, dir));
+        ASSERT_TRUE(stream.PushRay(rays.back(), ImageLocationInfo(i % 100, i / 100), i));
+    }
+
+    stream.Sort();
+
+    // Note: packet must be 32-byte aligned
+    auto context = std::make_unique<RenderingContext>();
+    RayPacket* packet = &context->rayPacket;
+    Uint32 userData[MaxRayPacketSize];
+    std::vector<bool> popped(numRays, false);
+    Uint32 numPoppedRays = 0;
+    Uint32 prevOctant = 0;
+
+    while (stream.PopPacket(*packet, userData, maxRaysInPacket))
+    {
+        ASSERT_LE(packet->numRays, maxRaysInPacket);
+
+        for (Uint32 i = 0; i < packet->numRays; ++i)
+        {
+            const Uint32 index = userData[i];
+            ASSERT_LT(index, numRays);
+            ASSERT_FALSE(popped[index]);
+            popped[index] = true;
+
+            // every ray is popped once, with its data intact
+            const RayGroup& group = packet->groups[i / RayPacket::RaysPerGroup];
+            const Uint32 lane = i % RayPacket::RaysPerGroup;
+            EXPECT_EQ(rays[index].origin.x, group.rays[0].origin.x[lane]);
+            EXPECT_EQ(rays[index].origin.z, group.rays[0].origin.z[lane]);
+            EXPECT_FLOAT_EQ(rays[index].dir.y, group.rays[0].dir.y[lane]);
+            EXPECT_EQ(index % 100, packet->imageLocations[i].x);
+            EXPECT_EQ(index / 100, packet->imageLocations[i].y);
+
+            // rays are sorted by direction octant first
+            const Uint32 octant = packet->GetRayOctant(i);
+            EXPECT_GE(octant, prevOctant);
+            prevOctant = octant;
+        }
+
+        numPoppedRays += packet->numRays;
+    }
+
+    EXPECT_EQ(numRays, numPoppedRays);
+
+    // sorting rewinds the stream
+    stream.Sort();
+    EXPECT_TRUE(stream.PopPacket(*packet, userData));
+    EXPECT_EQ(MaxRayPacketSize, packet->numRays);
+}
@@ -0,0 +1,306 @@
+#include "PCH.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Object/SceneObject_SphereCloud.h"
+#include "../Core/Rendering/Context.h"
+#include "../Core/Rendering/RendererContext.h"
+#include "../Core/Rendering/ShadingData.h"
+#include "../Core/Traversal/TraversalContext.h"
+#include "../Core/Math/Random.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+struct TestSpheres
+{
+    DynArray<Float3> centers;
+    DynArray<float> radii;
+
+    explicit TestSpheres(const Uint32 numSpheres)
+    {
+        Random random;
+        for (Uint32 i = 0; i < numSpheres; ++i)
+        {
+            centers.PushBack((random.GetVector4() * 100.0f).ToFloat3());
+            radii.PushBack(0.2f + 1.5f * random.GetFloat());
+        }
+    }
+
+    // brute force closest hit (in double precision), returns sphere index or UINT32_MAX
+    Uint32 Intersect(const Ray& ray, const float maxDistance, float& outDistance) const
+    {
+        Uint32 result = UINT32_MAX;
+        double closest = maxDistance;
+        for (Uint32 i = 0; i < centers.Size(); ++i)
+        {
+            const double fx = (double)ray.origin.x - (double)centers[i].x;
+            const double fy = (double)ray.origin.y - (double)centers[i].y;
+            const double fz = (double)ray.origin.z - (double)centers[i].z;
+            const double b = fx * ray.dir.x + fy * ray.dir.y + fz * ray.dir.z;
+            const double c = fx * fx + fy * fy + fz * fz - (double)radii[i] * (double)radii[i];
+            const double det = b * b - c;
+            if (det < 0.0)
+            {
+                continue;
+            }
+
+            double t = -b - sqrt(det);
+            if (t <= 0.0)
+            {
+                t = -b + sqrt(det);
+            }
+
+            if (t > 0.0 && t < closest)
+            {
+                closest = t;
+                result = i;
+            }
+        }
+
+        outDistance = (float)closest;
+        return result;
+    }
+};
+
+const Ray GenerateRay(Random& random)
+{
+    const Vector4 origin = Vector4(-50.0f, -50.0f, -50.0f, 0.0f) + random.GetVector4() * 200.0f;
+    const Vector4 target = random.GetVector4() * 100.0f;
+    return Ray(origin, (target - origin).Normalized3());
+}
+
+} // namespace
+
+TEST(SphereCloud, Initialize)
+{
+    const TestSpheres spheres(100);
+
+    SphereCloudSceneObject sphereCloud;
+    EXPECT_FALSE(sphereCloud.Initialize(spheres.centers.Data(), spheres.radii.Data(), 0));
+
+    DynArray<float> invalidRadii = spheres.radii;
+    invalidRadii[50] = 0.0f;
+    EXPECT_FALSE(sphereCloud.Initialize(spheres.centers.Data(), invalidRadii.Data(), 100));
+
+    ASSERT_TRUE(sphereCloud.Initialize(spheres.centers.Data(), spheres.radii.Data(), 100));
+    EXPECT_EQ(100u, sphereCloud.GetNumSpheres());
+
+    // leaves must fit the SIMD-8 packs
+    const BVH::Node* nodes = sphereCloud.GetBVH().GetNodes();
+    Uint32 numSpheresInLeaves = 0;
+    DynArray<const BVH::Node*> nodesStack;
+    nodesStack.PushBack(nodes);
+    while (!nodesStack.Empty())
+    {
+        const BVH::Node* node = nodesStack.Back();
+        nodesStack.PopBack();
+        if (node->IsLeaf())
+        {
+            EXPECT_LE(node->numLeaves, 8u);
+            numSpheresInLeaves += node->numLeaves;
+        }
+        else
+        {
+            nodesStack.PushBack(nodes + node->childIndex);
+            nodesStack.PushBack(nodes + node->childIndex + 1);
+        }
+    }
+    EXPECT_EQ(100u, numSpheresInLeaves);
+}
+
+TEST(SphereCloud, Traverse_Single)
+{
+    const TestSpheres spheres(2000);
+
+    auto object = std::make_unique<SphereCloudSceneObject>();
+    ASSERT_TRUE(object->Initialize(spheres.centers.Data(), spheres.radii.Data(), spheres.centers.Size()));
+    object->SetDefaultMaterial(nullptr);
+    const SphereCloudSceneObject* sphereCloud = object.get();
+
+    Scene scene;
+    scene.AddObject(std::move(object));
+    ASSERT_TRUE(scene.BuildBVH());
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+    Random random;
+
+    Uint32 numHits = 0;
+    Uint32 numOccluded = 0;
+    Uint32 numMismatches = 0;
+    Uint32 numShadowMismatches = 0;
+    const Uint32 numRays = 2000;
+
+    for (Uint32 i = 0; i < numRays; ++i)
+    {
+        const Ray ray = GenerateRay(random);
+
+        float referenceDistance;
+        const Uint32 referenceSphere = spheres.Intersect(ray, FLT_MAX, referenceDistance);
+
+        HitPoint hitPoint;
+        scene.Traverse_Single({ ray, hitPoint, *renderingContext });
+
+        if (referenceSphere == UINT32_MAX)
+        {
+            numMismatches += (hitPoint.objectId == RT_INVALID_OBJECT) ? 0 : 1;
+            continue;
+        }
+
+        // Note: grazing hits are not precise in single precision
+        numHits++;
+        if (hitPoint.objectId != 0 ||
+            sphereCloud->GetSphereIndex(hitPoint.subObjectId) != referenceSphere ||
+            Abs(referenceDistance - hitPoint.distance) > 0.0001f * referenceDistance)
+        {
+            numMismatches++;
+            continue;
+        }
+
+        // shading normal points from the sphere center to the hit point
+        ShadingData shadingData;
+        scene.ExtractShadingData(ray, hitPoint, 0.0f, shadingData);
+        const Vector4 center(spheres.centers[referenceSphere]);
+        const Vector4 expectedNormal = ((ray.GetAtDistance(hitPoint.distance) - center) & Vector4::MakeMask<1,1,1,0>()).Normalized3();
+        EXPECT_TRUE(Vector4::AlmostEqual(expectedNormal, shadingData.frame[2], 0.001f));
+
+        // shadow rays of random lengths, some of them end before the closest hit
+        const float shadowDistance = random.GetFloat() * 2.0f * referenceDistance;
+        float referenceShadowDistance;
+        const bool referenceOccluded = spheres.Intersect(ray, shadowDistance, referenceShadowDistance) != UINT32_MAX;
+
+        HitPoint shadowHitPoint;
+        shadowHitPoint.distance = shadowDistance;
+        const bool occluded = scene.Traverse_Shadow_Single({ ray, shadowHitPoint, *renderingContext });
+        numShadowMismatches += (referenceOccluded != occluded) ? 1 : 0;
+        numOccluded += occluded ? 1 : 0;
+    }
+
+    EXPECT_GT(numHits, numRays / 4);
+    EXPECT_GT(numOccluded, numRays / 20);
+    EXPECT_LE(numMismatches, numRays / 200);
+    EXPECT_LE(numShadowMismatches, numRays / 200);
+}
+
+TEST(SphereCloud, Traverse_Simd8_Packet)
+{
+    const TestSpheres spheres(5000);
+
+    // one object in world space and one transformed
+    Scene scene;
+    for (Uint32 i = 0; i < 2; ++i)
+    {
+        auto object = std::make_unique<SphereCloudSceneObject>();
+        ASSERT_TRUE(object->Initialize(spheres.centers.Data(), spheres.radii.Data(), spheres.centers.Size()));
+        if (i > 0)
+        {
+            const float angle = 0.7f;
+            object->SetTransform(Matrix4(Vector4(cosf(angle), 0.0f, -sinf(angle), 0.0f),
+                                         Vector4(0.0f, 1.0f, 0.0f, 0.0f),
+                                         Vector4(sinf(angle), 0.0f, cosf(angle), 0.0f),
+                                         Vector4(150.0f, 0.0f, 0.0f, 1.0f)));
+        }
+        scene.AddObject(std::move(object));
+    }
+    ASSERT_TRUE(scene.BuildBVH());
+
+    auto renderingContext = std::make_unique<RenderingContext>();
+    Random random;
+
+    Uint32 numHits = 0;
+    Uint32 numMismatches = 0;
+    Uint32 numShadowMismatches = 0;
+    const Uint32 numGroups = 250;
+
+    for (Uint32 group = 0; group < numGroups; ++group)
+    {
+        Ray rays[8];
+        float maxDistances[8];
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            const Vector4 origin = Vector4(-100.0f, -50.0f, -100.0f, 0.0f) + random.GetVector4() * Vector4(400.0f, 200.0f, 300.0f, 0.0f);
+            const Vector4 target = random.GetVector4() * Vector4(250.0f, 100.0f, 200.0f, 0.0f);
+            rays[i] = Ray(origin, (target - origin).Normalized3());
+            maxDistances[i] = random.GetFloat() * 200.0f;
+        }
+        const Ray_Simd8 simdRay(rays[0], rays[1], rays[2], rays[3], rays[4], rays[5], rays[6], rays[7]);
+
+        HitPoint_Simd8 hitPoints;
+        scene.Traverse_Simd8({ simdRay, hitPoints, *renderingContext });
+
+        HitPoint_Simd8 shadowHitPoints;
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            shadowHitPoints.distance[i] = maxDistances[i];
+        }
+        const Uint32 occludedMask = scene.Traverse_Shadow_Simd8({ simdRay, shadowHitPoints, *renderingContext });
+
+        for (Uint32 i = 0; i < 8; ++i)
+        {
+            HitPoint referenceHitPoint;
+            scene.Traverse_Single({ rays[i], referenceHitPoint, *renderingContext });
+
+            const HitPoint hitPoint = hitPoints.Get(i);
+            if (referenceHitPoint.distance == FLT_MAX || hitPoint.distance == FLT_MAX)
+            {
+                numMismatches += (referenceHitPoint.distance == hitPoint.distance) ? 0 : 1;
+            }
+            else
+            {
+                numHits++;
+                if (Abs(referenceHitPoint.distance - hitPoint.distance) > 0.001f * referenceHitPoint.distance ||
+                    referenceHitPoint.combinedObjectId != hitPoint.combinedObjectId)
+                {
+                    numMismatches++;
+                }
+            }
+
+            HitPoint referenceShadowHitPoint;
+            referenceShadowHitPoint.distance = maxDistances[i];
+            const bool referenceOccluded = scene.Traverse_Shadow_Single({ rays[i], referenceShadowHitPoint, *renderingContext });
+            numShadowMismatches += (referenceOccluded != ((occludedMask & (1u << i)) != 0)) ? 1 : 0;
+        }
+    }
+
+    // the same rays traversed as a packet
+    RayPacket& packet = renderingContext->rayPacket;
+    packet.Clear();
+    for (Uint32 i = 0; i < MaxRayPacketSize; ++i)
+    {
+        packet.PushRay(GenerateRay(random), Vector4(1.0f), ImageLocationInfo(i % 64, i / 64));
+    }
+    packet.SortByOctant();
+    scene.Traverse_Packet({ packet, *renderingContext });
+
+    Uint32 numPacketMismatches = 0;
+    for (Uint32 i = 0; i < packet.numRays; ++i)
+    {
+        const RayGroup& group = packet.groups[i / RayPacket::RaysPerGroup];
+        const Uint32 lane = i % RayPacket::RaysPerGroup;
+
+        const Ray ray(Vector4(group.rays[0].origin.x[lane], group.rays[0].origin.y[lane], group.rays[0].origin.z[lane], 0.0f),
+                      Vector4(group.rays[0].dir.x[lane], group.rays[0].dir.y[lane], group.rays[0].dir.z[lane], 0.0f));
+
+        HitPoint referenceHitPoint;
+        scene.Traverse_Single({ ray, referenceHitPoint, *renderingContext });
+
+        const HitPoint& hitPoint = renderingContext->hitPoints[i];
+        if (referenceHitPoint.distance == FLT_MAX || hitPoint.distance == FLT_MAX)
+        {
+            numPacketMismatches += (referenceHitPoint.distance == hitPoint.distance) ? 0 : 1;
+        }
+        else if (referenceHitPoint.combinedObjectId != hitPoint.combinedObjectId ||
+                 Abs(referenceHitPoint.distance - hitPoint.distance) > 0.001f * referenceHitPoint.distance)
+        {
+            numPacketMismatches++;
+        }
+    }
+
+    const Uint32 numRays = numGroups * 8;
+    EXPECT_GT(numHits, numRays / 4);
+    EXPECT_LE(numMismatches, numRays / 200);
+    EXPECT_LE(numShadowMismatches, numRays / 200);
+    EXPECT_LE(numPacketMismatches, packet.numRays / 200);
+}
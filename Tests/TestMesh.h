@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../Core/Mesh/Mesh.h"
+#include "../Core/Math/Random.h"
+
+#include <vector>
+
+// random triangle soup (without materials)
+struct TestMeshData
+{
+    std::vector<rt::math::Float3> positions;
+    std::vector<rt::math::Float3> normals;
+    std::vector<rt::math::Float3> tangents;
+    std::vector<Uint32> indices;
+    std::vector<Uint32> materialIndices;
+
+    explicit TestMeshData(Uint32 numTriangles)
+    {
+        rt::math::Random random;
+        for (Uint32 i = 0; i < numTriangles; ++i)
+        {
+            const rt::math::Vector4 center = random.GetVector4() * 100.0f;
+            for (Uint32 j = 0; j < 3; ++j)
+            {
+                indices.push_back(static_cast<Uint32>(positions.size()));
+                positions.push_back((center + random.GetVector4() * 2.0f).ToFloat3());
+                normals.push_back(rt::math::Float3(0.0f, 0.0f, 1.0f));
+                tangents.push_back(rt::math::Float3(1.0f, 0.0f, 0.0f));
+            }
+            materialIndices.push_back(UINT32_MAX);
+        }
+    }
+
+    rt::MeshDesc GetDesc() const
+    {
+        rt::MeshDesc desc;
+        desc.vertexBufferDesc.numTriangles = static_cast<Uint32>(materialIndices.size());
+        desc.vertexBufferDesc.numVertices = static_cast<Uint32>(positions.size());
+        desc.vertexBufferDesc.positions = positions.data();
+        desc.vertexBufferDesc.normals = normals.data();
+        desc.vertexBufferDesc.tangents = tangents.data();
+        desc.vertexBufferDesc.vertexIndexBuffer = indices.data();
+        desc.vertexBufferDesc.materialIndexBuffer = materialIndices.data();
+        return desc;
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "TestMesh.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Object/SceneObject_Mesh.h"
+#include "../Core/Traversal/HitPoint.h"
+#include "../Core/Math/Matrix4.h"
+#include "../Core/Math/Ray.h"
+
+#include <memory>
+
+// create mesh from the test data, returns nullptr on failure
+inline rt::MeshPtr CreateTestMesh(const TestMeshData& data)
+{
+    auto mesh = std::make_shared<rt::Mesh>();
+    if (!mesh->Initialize(data.GetDesc()))
+    {
+        return nullptr;
+    }
+    return mesh;
+}
+
+// add mesh object to a scene, returns the object (owned by the scene)
+// Note: the object uses the default material, so shading data can be extracted
+inline rt::MeshSceneObject* AddTestObject(rt::Scene& scene, const rt::MeshPtr& mesh, const rt::math::Matrix4& transform)
+{
+    auto object = std::make_unique<rt::MeshSceneObject>(mesh);
+    object->SetTransform(transform);
+    object->SetDefaultMaterial(nullptr);
+
+    rt::MeshSceneObject* objectPtr = object.get();
+    scene.AddObject(std::move(object));
+    return objectPtr;
+}
+
+// rotation around Y axis followed by translation
+inline rt::math::Matrix4 MakeRotationY(const float angle, const rt::math::Vector4& position)
+{
+    return rt::math::Matrix4(rt::math::Vector4(cosf(angle), 0.0f, -sinf(angle), 0.0f),
+                             rt::math::Vector4(0.0f, 1.0f, 0.0f, 0.0f),
+                             rt::math::Vector4(sinf(angle), 0.0f, cosf(angle), 0.0f),
+                             rt::math::Vector4(position.x, position.y, position.z, 1.0f));
+}
+
+// ray starting within [originMin, originMin + originSize) box, in random direction
+inline rt::math::Ray MakeRandomRay(rt::math::Random& random, const rt::math::Vector4& originMin, const rt::math::Vector4& originSize)
+{
+    const rt::math::Vector4 origin = originMin + random.GetVector4() * originSize;
+    const rt::math::Vector4 dir = (random.GetVector4() - rt::math::Vector4(0.5f)) & rt::math::Vector4::MakeMask<1,1,1,0>();
+    return rt::math::Ray(origin, dir.Normalized3());
+}
+
+// ray starting within [originMin, originMin + originSize) box, aimed at a point within [0, targetSize) box
+inline rt::math::Ray MakeRandomRay(rt::math::Random& random, const rt::math::Vector4& originMin, const rt::math::Vector4& originSize, const rt::math::Vector4& targetSize)
+{
+    const rt::math::Vector4 origin = originMin + random.GetVector4() * originSize;
+    const rt::math::Vector4 target = random.GetVector4() * targetSize;
+    return rt::math::Ray(origin, (target - origin).Normalized3());
+}
+
+// compare hit point with the reference one (e.g. SIMD traversal result against single ray traversal)
+// Note: SIMD intersection routines are not bit-exact, so the distances are compared with a tolerance
+inline bool HitPointsMatch(const rt::HitPoint& referenceHitPoint, const rt::HitPoint& hitPoint)
+{
+    if (referenceHitPoint.distance == FLT_MAX || hitPoint.distance == FLT_MAX)
+    {
+        return referenceHitPoint.distance == hitPoint.distance;
+    }
+
+    return referenceHitPoint.objectId == hitPoint.objectId &&
+        rt::math::Abs(referenceHitPoint.distance - hitPoint.distance) <= 0.001f * referenceHitPoint.distance;
+}
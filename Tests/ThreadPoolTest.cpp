@@ -0,0 +1,196 @@
+#include "PCH.h"
+#include "../Core/Utils/ThreadPool.h"
+#include "../Core/Utils/CpuTopology.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+
+TEST(ThreadPool, AllTasksExecutedOnce)
+{
+    ThreadPool threadPool;
+
+    for (const Uint32 numTasks : { 0u, 1u, 7u, 1000u, 100000u })
+    {
+        std::unique_ptr<std::atomic<Uint32>[]> counters(new std::atomic<Uint32>[numTasks + 1]);
+        for (Uint32 i = 0; i < numTasks; ++i)
+        {
+            counters[i] = 0;
+        }
+
+        std::atomic<Uint32> invalidThreadIDs(0);
+        const auto task = [&](Uint32 taskID, Uint32 threadID)
+        {
+            counters[taskID]++;
+            if (threadID >= threadPool.GetNumThreads())
+            {
+                invalidThreadIDs++;
+            }
+        };
+
+        threadPool.RunParallelTask(task, numTasks);
+
+        for (Uint32 i = 0; i < numTasks; ++i)
+        {
+            ASSERT_EQ(1u, counters[i].load()) << "task " << i << " of " << numTasks;
+        }
+        EXPECT_EQ(0u, invalidThreadIDs.load());
+    }
+}
+
+TEST(ThreadPool, SetNumThreads)
+{
+    ThreadPool threadPool;
+
+    for (const Uint32 numThreads : { 1u, 3u, 8u })
+    {
+        threadPool.SetNumThreads(numThreads);
+        EXPECT_EQ(numThreads, threadPool.GetNumThreads());
+
+        std::atomic<Uint32> sum(0);
+        threadPool.RunParallelTask([&](Uint32 taskID, Uint32) { sum += taskID; }, 1000);
+        EXPECT_EQ(1000u * 999u / 2u, sum.load());
+    }
+}
+
+TEST(ThreadPool, ManySmallDispatches)
+{
+    ThreadPool threadPool;
+
+    std::atomic<Uint32> numExecuted(0);
+    for (Uint32 i = 0; i < 2000; ++i)
+    {
+        threadPool.RunParallelTask([&](Uint32, Uint32) { numExecuted++; }, i % 5);
+    }
+
+    EXPECT_EQ(2000u / 5u * (0u + 1u + 2u + 3u + 4u), numExecuted.load());
+}
+
+TEST(ThreadPool, NestedTasks)
+{
+    ThreadPool threadPool;
+
+    const Uint32 numOuterTasks = 64;
+    const Uint32 numInnerTasks = 100;
+
+    std::atomic<Uint32> counters[numOuterTasks];
+    for (Uint32 i = 0; i < numOuterTasks; ++i)
+    {
+        counters[i] = 0;
+    }
+
+    const auto outerTask = [&](Uint32 outerTaskID, Uint32)
+    {
+        // two levels of nesting, like recursive subtree building
+        const auto innerTask = [&](Uint32 innerTaskID, Uint32)
+        {
+            const auto innermostTask = [&](Uint32, Uint32) { counters[outerTaskID]++; };
+            threadPool.RunParallelTask(innermostTask, innerTaskID % 3);
+        };
+        threadPool.RunParallelTask(innerTask, numInnerTasks);
+    };
+
+    threadPool.RunParallelTask(outerTask, numOuterTasks);
+
+    // sum of (i % 3) for i in [0, 100)
+    const Uint32 expected = 33u * (0u + 1u + 2u);
+    for (Uint32 i = 0; i < numOuterTasks; ++i)
+    {
+        EXPECT_EQ(expected, counters[i].load());
+    }
+}
+
+TEST(ThreadPool, ConcurrentSubmitters)
+{
+    ThreadPool threadPool;
+
+    std::atomic<Uint32> numExecuted(0);
+    const auto submit = [&]()
+    {
+        for (Uint32 i = 0; i < 200; ++i)
+        {
+            threadPool.RunParallelTask([&](Uint32, Uint32) { numExecuted++; }, 50);
+        }
+    };
+
+    std::thread threadA(submit);
+    std::thread threadB(submit);
+    threadA.join();
+    threadB.join();
+
+    EXPECT_EQ(2u * 200u * 50u, numExecuted.load());
+}
+
+TEST(ThreadPool, RunPerThreadTask)
+{
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(4);
+
+    std::atomic<Uint32> counters[4];
+    std::thread::id threadIds[4];
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        counters[i] = 0;
+    }
+
+    threadPool.RunPerThreadTask([&](Uint32 taskID, Uint32 threadID)
+    {
+        EXPECT_EQ(taskID, threadID);
+        counters[threadID]++;
+        threadIds[threadID] = std::this_thread::get_id();
+    });
+
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(1u, counters[i].load());
+        for (Uint32 j = 0; j < i; ++j)
+        {
+            EXPECT_NE(threadIds[i], threadIds[j]);
+        }
+    }
+
+    // regular tasks report the same thread IDs
+    threadPool.RunParallelTask([&](Uint32, Uint32 threadID)
+    {
+        EXPECT_EQ(threadIds[threadID], std::this_thread::get_id());
+    }, 1000);
+}
+
+TEST(ThreadPool, PinnedThreads)
+{
+    const CpuTopology& topology = CpuTopology::Get();
+    ASSERT_GE(topology.GetNumNodes(), 1u);
+    ASSERT_GE(topology.GetNumCpus(), topology.GetNumNodes());
+
+    // workers are spread evenly across the nodes in contiguous ranges
+    const Uint32 maxNumThreads = ThreadPool::MaxNumThreads;
+    const Uint32 numWorkers = std::min(2 * topology.GetNumCpus(), maxNumThreads);
+    for (Uint32 i = 1; i < numWorkers; ++i)
+    {
+        EXPECT_LE(topology.GetWorkerNode(i - 1, numWorkers), topology.GetWorkerNode(i, numWorkers));
+    }
+    EXPECT_EQ(topology.GetNumNodes() - 1u, topology.GetWorkerNode(numWorkers - 1, numWorkers));
+
+    // fewer workers than nodes: one worker per node, starting from the first node
+    const Uint32 numFewWorkers = std::max(1u, topology.GetNumNodes() / 2u);
+    for (Uint32 i = 0; i < numFewWorkers; ++i)
+    {
+        EXPECT_EQ(i, topology.GetWorkerNode(i, numFewWorkers));
+    }
+
+    ThreadPool threadPool;
+    threadPool.SetNumThreads(numWorkers, true);
+    EXPECT_EQ(numWorkers, threadPool.GetNumThreads());
+    EXPECT_EQ(topology.GetNumNodes(), threadPool.GetNumNodes());
+    for (Uint32 i = 0; i < numWorkers; ++i)
+    {
+        EXPECT_EQ(topology.GetWorkerNode(i, numWorkers), threadPool.GetThreadNode(i));
+    }
+
+    std::atomic<Uint32> sum(0);
+    threadPool.RunParallelTask([&](Uint32 taskID, Uint32) { sum += taskID; }, 1000);
+    EXPECT_EQ(1000u * 999u / 2u, sum.load());
+
+    threadPool.SetNumThreads(numWorkers, false);
+    EXPECT_EQ(1u, threadPool.GetNumNodes());
+}
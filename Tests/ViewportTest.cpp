@@ -0,0 +1,173 @@
+#include "PCH.h"
+#include "../Core/Scene/Scene.h"
+#include "../Core/Scene/Camera.h"
+#include "../Core/Scene/Object/SceneObject_SphereCloud.h"
+#include "../Core/Scene/Light/BackgroundLight.h"
+#include "../Core/Material/Material.h"
+#include "../Core/Rendering/Viewport.h"
+#include "../Core/Rendering/Renderer.h"
+#include "../Core/Math/Random.h"
+
+#include "gtest/gtest.h"
+
+using namespace rt;
+using namespace rt::math;
+
+namespace {
+
+const Uint32 ImageSize = 64;
+
+class ViewportTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        Random random;
+        DynArray<Float3> centers;
+        DynArray<float> radii;
+        for (Uint32 i = 0; i < 100; ++i)
+        {
+            centers.PushBack((random.GetVector4Bipolar() * 4.0f + Vector4(0.0f, 0.0f, 10.0f, 0.0f)).ToFloat3());
+            radii.PushBack(0.5f);
+        }
+
+        auto object = std::make_unique<SphereCloudSceneObject>();
+        ASSERT_TRUE(object->Initialize(centers.Data(), radii.Data(), centers.Size()));
+        object->SetDefaultMaterial(Material::GetDefaultMaterial());
+
+        mScene.AddObject(std::move(object));
+        mScene.AddLight(std::make_unique<BackgroundLight>(Vector4(1.0f)));
+        ASSERT_TRUE(mScene.BuildBVH());
+
+        mCamera.SetPerspective(1.0f, RT_PI / 3.0f);
+
+        mViewport = std::make_unique<Viewport>();
+        ASSERT_TRUE(mViewport->Resize(ImageSize, ImageSize));
+    }
+
+    void SetRenderer(const char* name, TraversalMode traversalMode)
+    {
+        RenderingParams params;
+        params.traversalMode = traversalMode;
+        ASSERT_TRUE(mViewport->SetRenderingParams(params));
+        ASSERT_TRUE(mViewport->SetRenderer(CreateRenderer(name, mScene)));
+        mViewport->Reset();
+    }
+
+    // average of accumulated samples (all the pixels should see the background or a sphere lit by it)
+    float GetAverageSum() const
+    {
+        const Float3* pixels = mViewport->GetSumBuffer().GetDataAs<Float3>();
+
+        float sum = 0.0f;
+        for (Uint32 i = 0; i < ImageSize * ImageSize; ++i)
+        {
+            sum += pixels[i].y;
+        }
+        return sum / static_cast<float>(ImageSize * ImageSize);
+    }
+
+    Scene mScene;
+    Camera mCamera;
+    std::unique_ptr<Viewport> mViewport;
+};
+
+} // namespace
+
+TEST_F(ViewportTest, PipelinedPasses)
+{
+    SetRenderer("Path Tracer", TraversalMode::Single);
+
+    ASSERT_TRUE(mViewport->Render(mCamera, 4));
+
+    const FrameStats& stats = mViewport->GetFrameStats();
+    EXPECT_EQ(4u, mViewport->GetProgress().passesFinished);
+    EXPECT_EQ(4u, stats.frameIndex);
+    EXPECT_EQ(4u, stats.numPasses);
+    EXPECT_EQ(4u * ImageSize * ImageSize, stats.counters.numPrimaryRays);
+
+    // no pre-render pass for path tracer
+    EXPECT_EQ(0.0, stats.stages[static_cast<Uint32>(RenderingStage::PreRender)].wallTime);
+    EXPECT_EQ(0.0, stats.stages[static_cast<Uint32>(RenderingStage::PreRenderGlobal)].wallTime);
+    EXPECT_GT(stats.stages[static_cast<Uint32>(RenderingStage::Render)].wallTime, 0.0);
+    EXPECT_GE(stats.stages[static_cast<Uint32>(RenderingStage::Render)].idleTime, 0.0);
+
+    // pipelined passes are timed together
+    EXPECT_EQ(4u, stats.passTime.numSamples);
+    EXPECT_GT(stats.passTime.average, 0.0);
+    EXPECT_DOUBLE_EQ(stats.passTime.average, stats.passTime.max);
+
+    // 4x4 tiles of default size
+    EXPECT_EQ(16u, stats.tileTime.numSamples);
+    EXPECT_GT(stats.tileTime.average, 0.0);
+    EXPECT_LE(stats.tileTime.percentile95, stats.tileTime.max);
+
+    // every pass accumulated one sample per pixel
+    const float average = GetAverageSum();
+    EXPECT_GT(average, 0.0f);
+
+    ASSERT_TRUE(mViewport->Render(mCamera));
+    EXPECT_EQ(5u, mViewport->GetProgress().passesFinished);
+    EXPECT_EQ(1u, mViewport->GetFrameStats().numPasses);
+    EXPECT_EQ(5u, mViewport->GetFrameStats().passTime.numSamples);
+    EXPECT_GT(GetAverageSum(), average);
+
+    // full image post processing was done in the first frame, now the tiles are post processed while rendering
+    EXPECT_EQ(0.0, stats.stages[static_cast<Uint32>(RenderingStage::PostProcess)].wallTime);
+}
+
+TEST_F(ViewportTest, SynchronizedPasses)
+{
+    // light tracer splats samples onto the whole film, so the passes can't be pipelined
+    SetRenderer("Light Tracer", TraversalMode::Single);
+
+    ASSERT_TRUE(mViewport->Render(mCamera, 3));
+
+    const FrameStats& stats = mViewport->GetFrameStats();
+    EXPECT_EQ(3u, mViewport->GetProgress().passesFinished);
+    EXPECT_EQ(3u, stats.numPasses);
+    EXPECT_GT(stats.stages[static_cast<Uint32>(RenderingStage::Render)].wallTime, 0.0);
+    EXPECT_GT(stats.stages[static_cast<Uint32>(RenderingStage::PostProcess)].wallTime, 0.0);
+
+    // splatted samples are merged into the accumulation buffer after each pass
+    EXPECT_GT(GetAverageSum(), 0.0f);
+
+    EXPECT_EQ(3u, stats.passTime.numSamples);
+    EXPECT_LE(stats.passTime.percentile95, stats.passTime.max);
+    EXPECT_EQ(16u, stats.tileTime.numSamples);
+
+    // pass times are collected since the reset
+    mViewport->Reset();
+    ASSERT_TRUE(mViewport->Render(mCamera));
+    EXPECT_EQ(1u, mViewport->GetFrameStats().passTime.numSamples);
+}
+
+TEST_F(ViewportTest, TilesCoverImage)
+{
+    // every path escapes to the background, so each pass adds exactly one unit sample to every pixel
+    Scene emptyScene;
+    emptyScene.AddLight(std::make_unique<BackgroundLight>(Vector4(1.0f)));
+    ASSERT_TRUE(emptyScene.BuildBVH());
+
+    // tiles not aligned to the image size, rendered in Hilbert curve order
+    RenderingParams params;
+    params.traversalMode = TraversalMode::Single;
+    params.tileSize = 24;
+    ASSERT_TRUE(mViewport->SetRenderingParams(params));
+    ASSERT_TRUE(mViewport->SetRenderer(CreateRenderer("Path Tracer", emptyScene)));
+    mViewport->Reset();
+
+    const Uint32 numPasses = 3;
+    for (Uint32 i = 0; i < numPasses; ++i)
+    {
+        ASSERT_TRUE(mViewport->Render(mCamera));
+        EXPECT_EQ(9u, mViewport->GetFrameStats().tileTime.numSamples);
+    }
+
+    // every pixel has been rendered once per pass
+    const Float3* pixels = mViewport->GetSumBuffer().GetDataAs<Float3>();
+    for (Uint32 i = 0; i < ImageSize * ImageSize; ++i)
+    {
+        ASSERT_NEAR(static_cast<float>(numPasses), pixels[i].y, 0.01f) << "pixel " << i;
+    }
+}